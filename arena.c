@@ -0,0 +1,169 @@
+/*
+ * arena - bump pointer allocator for short lived objects
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+#define ARENA_PAD(len)	(((len) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+void arena_init(struct arena *a, size_t chunk_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+}
+
+static struct arena_chunk *arena_add_chunk(struct arena *a, size_t size, bool large)
+{
+	struct arena_chunk *c;
+
+	c = malloc(sizeof(*c) + size);
+	if (!c)
+		return NULL;
+
+	c->size = size;
+	c->used = 0;
+
+	/*
+	 * Oversized chunks go behind the current one, so that the remaining
+	 * space of the current chunk is still used for small objects.
+	 */
+	if (a->chunks && large) {
+		c->next = a->chunks->next;
+		a->chunks->next = c;
+	} else {
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+
+	return c;
+}
+
+void *arena_alloc(struct arena *a, size_t len)
+{
+	struct arena_chunk *c = a->chunks;
+	void *ptr;
+
+	len = ARENA_PAD(len);
+	if (!c || c->size - c->used < len) {
+		bool large = len > a->chunk_size / 2;
+
+		c = arena_add_chunk(a, large ? len : a->chunk_size, large);
+		if (!c)
+			return NULL;
+	}
+
+	ptr = c->data + c->used;
+	c->used += len;
+	a->last_chunk = c;
+	a->last = ptr;
+
+	return ptr;
+}
+
+void *arena_calloc(struct arena *a, size_t len)
+{
+	void *ptr = arena_alloc(a, len);
+
+	if (ptr)
+		memset(ptr, 0, len);
+
+	return ptr;
+}
+
+void *arena_realloc(struct arena *a, void *ptr, size_t old_len, size_t len)
+{
+	struct arena_chunk *c = a->last_chunk;
+	void *new;
+
+	if (!ptr)
+		return arena_alloc(a, len);
+
+	old_len = ARENA_PAD(old_len);
+	if (ptr == a->last && c->used - old_len + ARENA_PAD(len) <= c->size) {
+		c->used = c->used - old_len + ARENA_PAD(len);
+		return ptr;
+	}
+
+	new = arena_alloc(a, len);
+	if (!new)
+		return NULL;
+
+	memcpy(new, ptr, old_len < len ? old_len : len);
+
+	return new;
+}
+
+void *arena_memdup(struct arena *a, const void *data, size_t len)
+{
+	void *ptr = arena_alloc(a, len);
+
+	if (ptr)
+		memcpy(ptr, data, len);
+
+	return ptr;
+}
+
+char *arena_strdup(struct arena *a, const char *str)
+{
+	return arena_memdup(a, str, strlen(str) + 1);
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_chunk *c, *keep = NULL, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		if (!keep && c->size == a->chunk_size) {
+			keep = c;
+			continue;
+		}
+
+		free(c);
+	}
+
+	a->chunks = keep;
+	if (keep) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	a->last_chunk = NULL;
+	a->last = NULL;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	a->chunks = NULL;
+	a->last_chunk = NULL;
+	a->last = NULL;
+}
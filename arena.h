@@ -0,0 +1,59 @@
+/*
+ * arena - bump pointer allocator for short lived objects
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __LIBUBOX_ARENA_H
+#define __LIBUBOX_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN		8
+#define ARENA_CHUNK_SIZE	4096
+
+struct arena_chunk;
+
+/*
+ * Objects allocated from an arena are not freed individually, all of them
+ * are released at once by arena_reset or arena_free.
+ */
+struct arena {
+	struct arena_chunk *chunks;
+	size_t chunk_size;
+
+	/* most recent allocation, can be resized in place */
+	struct arena_chunk *last_chunk;
+	void *last;
+};
+
+void arena_init(struct arena *a, size_t chunk_size);
+
+/* arena_reset: release all objects, keeping one chunk for reuse */
+void arena_reset(struct arena *a);
+
+/* arena_free: release all objects and memory */
+void arena_free(struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t len);
+void *arena_calloc(struct arena *a, size_t len);
+
+/*
+ * arena_realloc: resize an allocation. The most recent allocation is
+ * extended in place if its chunk has room, others are copied.
+ */
+void *arena_realloc(struct arena *a, void *ptr, size_t old_len, size_t len);
+
+void *arena_memdup(struct arena *a, const void *data, size_t len);
+char *arena_strdup(struct arena *a, const char *str);
+
+#endif
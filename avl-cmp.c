@@ -28,6 +28,33 @@ avl_strcmp(const void *k1, const void *k2, void *ptr)
 	return strcmp(k1, k2);
 }
 
+int
+avl_intcmp(const void *k1, const void *k2, void *ptr)
+{
+	return avl_intcmp_inline(k1, k2, ptr);
+}
+
+/* the first four bytes in big endian order, zero padded after the end */
+uint32_t
+avl_strprefix(const void *key)
+{
+	const unsigned char *s = key;
+	uint32_t val = 0;
+	int i;
+
+	for (i = 0; i < 4 && s[i]; i++)
+		val |= (uint32_t)s[i] << (24 - 8 * i);
+
+	return val;
+}
+
+uint32_t
+avl_intprefix(const void *key)
+{
+	/* flip the sign bit so that unsigned order matches signed order */
+	return (uint32_t)*(const int *)key ^ 0x80000000;
+}
+
 int
 avl_blobcmp(const void *k1, const void *k2, void *ptr)
 {
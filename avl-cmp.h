@@ -16,7 +16,28 @@
 #ifndef __AVL_CMP_H
 #define __AVL_CMP_H
 
+#include <stdint.h>
+#include <string.h>
+
 int avl_strcmp(const void *k1, const void *k2, void *ptr);
 int avl_blobcmp(const void *k1, const void *k2, void *ptr);
+int avl_intcmp(const void *k1, const void *k2, void *ptr);
+
+/* prefix functions matching avl_strcmp and avl_intcmp, see avl_set_prefix */
+uint32_t avl_strprefix(const void *key);
+uint32_t avl_intprefix(const void *key);
+
+/* for use with avl_find_element_cmp */
+static inline int avl_strcmp_inline(const void *k1, const void *k2, void *ptr)
+{
+	return strcmp(k1, k2);
+}
+
+static inline int avl_intcmp_inline(const void *k1, const void *k2, void *ptr)
+{
+	int v1 = *(const int *)k1, v2 = *(const int *)k2;
+
+	return (v1 > v2) - (v1 < v2);
+}
 
 #endif
@@ -73,7 +73,7 @@ static inline int avl_min(int x, int y) {
 }
 
 static struct avl_node *
-avl_find_rec(struct avl_node *node, const void *key, avl_tree_comp comp, void *ptr, int *cmp_result);
+avl_find_rec(const struct avl_tree *tree, const void *key, uint32_t prefix, int *cmp_result);
 static void avl_insert_before(struct avl_tree *tree, struct avl_node *pos_node, struct avl_node *node);
 static void avl_insert_after(struct avl_tree *tree, struct avl_node *pos_node, struct avl_node *node);
 static void post_insert(struct avl_tree *tree, struct avl_node *node);
@@ -97,6 +97,32 @@ avl_init(struct avl_tree *tree, avl_tree_comp comp, bool allow_dups, void *ptr)
   tree->comp = comp;
   tree->allow_dups = allow_dups;
   tree->cmp_ptr = ptr;
+  tree->prefix = NULL;
+}
+
+/**
+ * Set (or clear) the key prefix function of a tree, see avl_tree_prefix.
+ * Can be called at any time, the prefixes of existing nodes are updated.
+ * @param tree pointer to avl-tree
+ * @param prefix prefix function matching the tree comparator, or NULL
+ */
+void
+avl_set_prefix(struct avl_tree *tree, avl_tree_prefix prefix)
+{
+  struct avl_node *node;
+
+  tree->prefix = prefix;
+  if (!prefix)
+    return;
+
+  list_for_each_entry(node, &tree->list_head, list)
+    node->key_prefix = prefix(node->key);
+}
+
+static inline uint32_t
+avl_key_prefix(const struct avl_tree *tree, const void *key)
+{
+  return tree->prefix ? tree->prefix(key) : 0;
 }
 
 static inline struct avl_node *avl_next(struct avl_node *node)
@@ -120,7 +146,7 @@ avl_find(const struct avl_tree *tree, const void *key)
   if (tree->root == NULL)
     return NULL;
 
-  node = avl_find_rec(tree->root, key, tree->comp, tree->cmp_ptr, &diff);
+  node = avl_find_rec(tree, key, avl_key_prefix(tree, key), &diff);
 
   return diff == 0 ? node : NULL;
 }
@@ -141,7 +167,7 @@ avl_find_lessequal(const struct avl_tree *tree, const void *key) {
   if (tree->root == NULL)
     return NULL;
 
-  node = avl_find_rec(tree->root, key, tree->comp, tree->cmp_ptr, &diff);
+  node = avl_find_rec(tree, key, avl_key_prefix(tree, key), &diff);
 
   /* go left as long as key<node.key */
   while (diff < 0) {
@@ -183,7 +209,7 @@ avl_find_greaterequal(const struct avl_tree *tree, const void *key) {
   if (tree->root == NULL)
     return NULL;
 
-  node = avl_find_rec(tree->root, key, tree->comp, tree->cmp_ptr, &diff);
+  node = avl_find_rec(tree, key, avl_key_prefix(tree, key), &diff);
 
   /* go right as long as key>node.key */
   while (diff > 0) {
@@ -229,6 +255,7 @@ avl_insert(struct avl_tree *tree, struct avl_node *new)
 
   new->balance = 0;
   new->leader = true;
+  new->key_prefix = avl_key_prefix(tree, new->key);
 
   if (tree->root == NULL) {
     list_add(&new->list, &tree->list_head);
@@ -237,7 +264,7 @@ avl_insert(struct avl_tree *tree, struct avl_node *new)
     return 0;
   }
 
-  node = avl_find_rec(tree->root, new->key, tree->comp, tree->cmp_ptr, &diff);
+  node = avl_find_rec(tree, new->key, new->key_prefix, &diff);
 
   last = node;
 
@@ -249,8 +276,6 @@ avl_insert(struct avl_tree *tree, struct avl_node *new)
     last = next;
   }
 
-  diff = (*tree->comp) (new->key, node->key, tree->cmp_ptr);
-
   if (diff == 0) {
     if (!tree->allow_dups)
       return -1;
@@ -298,6 +323,131 @@ avl_insert(struct avl_tree *tree, struct avl_node *new)
   return 0;
 }
 
+static struct avl_node *
+avl_build_rec(struct list_head **cursor, struct list_head *head,
+              struct avl_node *parent, size_t count, int *height)
+{
+  struct avl_node *node, *left, *right;
+  int lh, rh;
+
+  if (count == 0) {
+    *height = 0;
+    return NULL;
+  }
+
+  left = avl_build_rec(cursor, head, NULL, count / 2, &lh);
+
+  node = list_entry(*cursor, struct avl_node, list);
+  do {
+    *cursor = (*cursor)->next;
+  } while (*cursor != head && !list_entry(*cursor, struct avl_node, list)->leader);
+
+  right = avl_build_rec(cursor, head, node, count - count / 2 - 1, &rh);
+
+  node->parent = parent;
+  node->left = left;
+  node->right = right;
+  node->balance = rh - lh;
+  if (left != NULL)
+    left->parent = node;
+
+  *height = avl_max(lh, rh) + 1;
+  return node;
+}
+
+/**
+ * Fill an empty tree from an array of nodes sorted by the tree comparator.
+ * The resulting tree is perfectly balanced and built in linear time,
+ * without any comparisons beyond checking the order of the array.
+ * @param tree pointer to an empty tree
+ * @param nodes array of nodes with their keys set
+ * @param count number of nodes in the array
+ * @return 0 if the tree was built, -1 if it was not empty, the array
+ *   is not sorted or contains duplicate keys in a tree without allow_dups.
+ *   The tree is left unchanged in that case.
+ */
+int
+avl_build_from_sorted(struct avl_tree *tree, struct avl_node **nodes, size_t count)
+{
+  struct list_head *cursor;
+  size_t i, leaders = 0;
+  int diff, height;
+
+  if (tree->root != NULL)
+    return -1;
+
+  for (i = 1; i < count; i++) {
+    diff = tree->comp(nodes[i - 1]->key, nodes[i]->key, tree->cmp_ptr);
+    if (diff > 0 || (diff == 0 && !tree->allow_dups))
+      return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    nodes[i]->leader = !tree->allow_dups || i == 0 ||
+        tree->comp(nodes[i - 1]->key, nodes[i]->key, tree->cmp_ptr) != 0;
+    nodes[i]->key_prefix = avl_key_prefix(tree, nodes[i]->key);
+    if (nodes[i]->leader)
+      leaders++;
+    else
+      nodes[i]->parent = nodes[i]->left = nodes[i]->right = NULL;
+
+    list_add_tail(&nodes[i]->list, &tree->list_head);
+  }
+
+  cursor = tree->list_head.next;
+  tree->root = avl_build_rec(&cursor, &tree->list_head, NULL, leaders, &height);
+  tree->count = count;
+  return 0;
+}
+
+/**
+ * Remove all nodes from a tree at once, without rebalancing. The nodes
+ * themselves are not touched, use avl_remove_all_elements() to walk
+ * them while clearing the tree.
+ * @param tree pointer to tree
+ */
+void
+avl_clear(struct avl_tree *tree)
+{
+  INIT_LIST_HEAD(&tree->list_head);
+  tree->root = NULL;
+  tree->count = 0;
+}
+
+/**
+ * Put a node into the place of another one with an equal key, without
+ * searching or rebalancing
+ * @param tree pointer to tree
+ * @param old pointer to node in the tree
+ * @param new pointer to node replacing it, its key must compare equal
+ */
+void
+avl_replace(struct avl_tree *tree, struct avl_node *old, struct avl_node *new)
+{
+  new->parent = old->parent;
+  new->left = old->left;
+  new->right = old->right;
+  new->balance = old->balance;
+  new->leader = old->leader;
+  new->key_prefix = avl_key_prefix(tree, new->key);
+
+  if (old->leader) {
+    if (old->parent == NULL)
+      tree->root = new;
+    else if (old->parent->left == old)
+      old->parent->left = new;
+    else
+      old->parent->right = new;
+
+    if (old->left != NULL)
+      old->left->parent = new;
+    if (old->right != NULL)
+      old->right->parent = new;
+  }
+
+  _list_add(&new->list, old->list.prev, old->list.next);
+}
+
 /**
  * Remove a node from an avl tree
  * @param tree pointer to tree
@@ -350,28 +500,48 @@ avl_delete(struct avl_tree *tree, struct avl_node *node)
   avl_remove(tree, node);
 }
 
+static inline void
+avl_prefetch(const struct avl_node *node)
+{
+#if defined(__GNUC__)
+  /* prefetching NULL is harmless */
+  __builtin_prefetch(node);
+#endif
+}
+
 static struct avl_node *
-avl_find_rec(struct avl_node *node, const void *key, avl_tree_comp comp, void *cmp_ptr, int *cmp_result)
+avl_find_rec(const struct avl_tree *tree, const void *key, uint32_t prefix, int *cmp_result)
 {
+  struct avl_node *node = tree->root, *next;
   int diff;
 
-  diff = (*comp) (key, node->key, cmp_ptr);
-  *cmp_result = diff;
+  for (;;) {
+    /*
+     * Start loading both children while this node is compared, one of
+     * them is the next step unless the search ends here.
+     */
+    avl_prefetch(node->left);
+    avl_prefetch(node->right);
 
-  if (diff < 0) {
-    if (node->left != NULL)
-      return avl_find_rec(node->left, key, comp, cmp_ptr, cmp_result);
+    if (tree->prefix && prefix != node->key_prefix)
+      diff = prefix < node->key_prefix ? -1 : 1;
+    else
+      diff = (*tree->comp) (key, node->key, tree->cmp_ptr);
 
-    return node;
-  }
+    if (diff < 0)
+      next = node->left;
+    else if (diff > 0)
+      next = node->right;
+    else
+      break;
 
-  if (diff > 0) {
-    if (node->right != NULL)
-      return avl_find_rec(node->right, key, comp, cmp_ptr, cmp_result);
+    if (next == NULL)
+      break;
 
-    return node;
+    node = next;
   }
 
+  *cmp_result = diff;
   return node;
 }
 
@@ -43,6 +43,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "list.h"
 
@@ -92,6 +93,12 @@ struct avl_node {
    * true if first of a series of nodes with same key
    */
   bool leader;
+
+  /**
+   * cached key prefix, only valid if the tree has a prefix function.
+   * Fits into padding on 64 bit targets.
+   */
+  uint32_t key_prefix;
 };
 
 /**
@@ -103,6 +110,17 @@ struct avl_node {
  */
 typedef int (*avl_tree_comp) (const void *k1, const void *k2, void *ptr);
 
+/**
+ * Prototype for avl key prefix functions, see avl_set_prefix()
+ *
+ * Must be order preserving: prefix(k1) < prefix(k2) has to imply
+ * comp(k1, k2) < 0. Searches compare the prefixes cached in the nodes
+ * first and only dereference node keys (calling comp) when they are equal.
+ * @param key key to summarize
+ * @return prefix value
+ */
+typedef uint32_t (*avl_tree_prefix) (const void *key);
+
 /**
  * This struct is the central management part of an avl tree.
  * One of them is necessary for each avl_tree.
@@ -142,6 +160,11 @@ struct avl_tree {
    * custom pointer delivered to the tree comparator
    */
   void *cmp_ptr;
+
+  /**
+   * optional key prefix function, see avl_tree_prefix
+   */
+  avl_tree_prefix prefix;
 };
 
 /**
@@ -166,11 +189,15 @@ enum avl_find_mode {
 		AVL_TREE_INIT(_name, _comp, _allow_dups, _cmp_ptr)
 
 void EXPORT(avl_init)(struct avl_tree *, avl_tree_comp, bool, void *);
+void EXPORT(avl_set_prefix)(struct avl_tree *, avl_tree_prefix);
 struct avl_node *EXPORT(avl_find)(const struct avl_tree *, const void *);
 struct avl_node *EXPORT(avl_find_greaterequal)(const struct avl_tree *tree, const void *key);
 struct avl_node *EXPORT(avl_find_lessequal)(const struct avl_tree *tree, const void *key);
 int EXPORT(avl_insert)(struct avl_tree *, struct avl_node *);
 void EXPORT(avl_delete)(struct avl_tree *, struct avl_node *);
+void EXPORT(avl_replace)(struct avl_tree *, struct avl_node *old, struct avl_node *new);
+int EXPORT(avl_build_from_sorted)(struct avl_tree *, struct avl_node **nodes, size_t count);
+void EXPORT(avl_clear)(struct avl_tree *);
 
 /**
  * @param tree pointer to avl-tree
@@ -266,6 +293,57 @@ __avl_find_element(const struct avl_tree *tree, const void *key, size_t offset,
 #define avl_find_ge_element(tree, key, element, node_element) \
   ((__typeof__(*(element)) *)__avl_find_element(tree, key, offsetof(typeof(*(element)), node_element), AVL_FIND_GREATEREQUAL))
 
+/**
+ * Internal function for comparator-inlined lookups
+ * @param tree pointer to avl tree
+ * @param key pointer to key
+ * @param comp comparator, must order like the tree comparator
+ * @param offset offset of node inside the embedded struct
+ * @return pointer to element, NULL if no fitting one was found
+ */
+static inline __attribute__((always_inline)) void *
+__avl_find_element_cmp(const struct avl_tree *tree, const void *key,
+                       avl_tree_comp comp, size_t offset) {
+  struct avl_node *node = tree->root;
+  uint32_t prefix = tree->prefix ? tree->prefix(key) : 0;
+
+  while (node) {
+    int diff;
+
+    __builtin_prefetch(node->left);
+    __builtin_prefetch(node->right);
+
+    if (tree->prefix && prefix != node->key_prefix)
+      diff = prefix < node->key_prefix ? -1 : 1;
+    else
+      diff = comp(key, node->key, tree->cmp_ptr);
+
+    if (!diff)
+      return ((char *)node) - offset;
+
+    node = diff < 0 ? node->left : node->right;
+  }
+  return NULL;
+}
+
+/**
+ * Like avl_find_element, but with the comparator called directly, so that
+ * a static inline comparator gets inlined into the search loop. Cached key
+ * prefixes are used as well if the tree has them.
+ *
+ * @param tree pointer to avl-tree
+ * @param key pointer to key
+ * @param element pointer to a node element
+ *    (don't need to be initialized)
+ * @param node_element name of the avl_node element inside the
+ *    larger struct
+ * @param comp comparator function with the same ordering as the tree's
+ * @return pointer to tree element with the specified key,
+ *    NULL if no element was found
+ */
+#define avl_find_element_cmp(tree, key, element, node_element, comp) \
+  ((__typeof__(*(element)) *)__avl_find_element_cmp(tree, key, comp, offsetof(typeof(*(element)), node_element)))
+
 /**
  * This function must not be called for an empty tree
  *
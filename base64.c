@@ -62,10 +62,19 @@
 
 #include <sys/types.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B64_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define B64_NEON
+#include <arm_neon.h>
+#endif
+
 #include "assert.h"
 #include "utils.h"
 
@@ -73,6 +82,366 @@ static const char Base64[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char Pad64 = '=';
 
+/* reverse of Base64[], -1 for anything outside of the alphabet */
+static const signed char Base64_dec[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * Block kernels convert as many complete blocks as they can, never reading
+ * past src + len and never writing past dest + dest_len. They return the
+ * number of input bytes consumed; the decoders stop in front of the first
+ * block that contains anything but alphabet characters, leaving whitespace,
+ * padding and errors to the scalar code.
+ */
+typedef size_t (*b64_encode_fn)(const unsigned char *src, size_t len,
+				char *dest);
+typedef size_t (*b64_decode_fn)(const char *src, size_t len,
+				unsigned char *dest, size_t dest_len);
+
+static size_t b64_encode_scalar(const unsigned char *src, size_t len,
+				char *dest)
+{
+	size_t done = 0;
+
+	while (len - done > 2) {
+		uint32_t val = src[0] << 16 | src[1] << 8 | src[2];
+
+		dest[0] = Base64[val >> 18];
+		dest[1] = Base64[(val >> 12) & 0x3f];
+		dest[2] = Base64[(val >> 6) & 0x3f];
+		dest[3] = Base64[val & 0x3f];
+		src += 3;
+		dest += 4;
+		done += 3;
+	}
+
+	return done;
+}
+
+static size_t b64_decode_scalar(const char *src, size_t len,
+				unsigned char *dest, size_t dest_len)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	size_t done = 0;
+
+	while (len - done >= 4 && dest_len >= 3) {
+		int32_t a = Base64_dec[s[0]], b = Base64_dec[s[1]];
+		int32_t c = Base64_dec[s[2]], d = Base64_dec[s[3]];
+		uint32_t val;
+
+		if ((a | b | c | d) < 0)
+			break;
+
+		val = a << 18 | b << 12 | c << 6 | d;
+		dest[0] = val >> 16;
+		dest[1] = val >> 8;
+		dest[2] = val;
+		s += 4;
+		dest += 3;
+		dest_len -= 3;
+		done += 4;
+	}
+
+	return done;
+}
+
+#ifdef B64_X86
+
+/*
+ * SSSE3/AVX2 kernels after Wojciech Mula's pshufb based method: reshuffle
+ * 3 input bytes into each 32 bit lane, extract the 6 bit indices with two
+ * multiplies, and map indices to and from ASCII with small nibble LUTs.
+ */
+#define B64_X86_KERNELS(_attr, _w, _vec, _p)					\
+static inline _attr _vec b64_enc_vec##_w(_vec in)				\
+{										\
+	_vec t0, t1, t2, t3, idx, res;						\
+										\
+	in = _p##_shuffle_epi8(in, _p##_setr_epi8(B64_ENC_SHUF));		\
+	t0 = _p##_and_si##_w(in, _p##_set1_epi32(0x0fc0fc00));			\
+	t1 = _p##_mulhi_epu16(t0, _p##_set1_epi32(0x04000040));			\
+	t2 = _p##_and_si##_w(in, _p##_set1_epi32(0x003f03f0));			\
+	t3 = _p##_mullo_epi16(t2, _p##_set1_epi32(0x01000010));			\
+	idx = _p##_or_si##_w(t1, t3);						\
+										\
+	res = _p##_subs_epu8(idx, _p##_set1_epi8(51));				\
+	t0 = _p##_cmpgt_epi8(_p##_set1_epi8(26), idx);				\
+	res = _p##_or_si##_w(res, _p##_and_si##_w(t0, _p##_set1_epi8(13)));	\
+	res = _p##_shuffle_epi8(_p##_setr_epi8(B64_ENC_LUT), res);		\
+										\
+	return _p##_add_epi8(res, idx);						\
+}										\
+										\
+static inline _attr int b64_dec_vec##_w(_vec *str)				\
+{										\
+	_vec mask = _p##_set1_epi8(0x2f);					\
+	_vec hi = _p##_and_si##_w(_p##_srli_epi32(*str, 4), mask);		\
+	_vec lo = _p##_and_si##_w(*str, mask);					\
+	_vec roll, t0;								\
+										\
+	lo = _p##_shuffle_epi8(_p##_setr_epi8(B64_DEC_LUT_LO), lo);		\
+	t0 = _p##_shuffle_epi8(_p##_setr_epi8(B64_DEC_LUT_HI), hi);		\
+	t0 = _p##_and_si##_w(lo, t0);						\
+	if (_p##_movemask_epi8(_p##_cmpeq_epi8(t0, _p##_setzero_si##_w())) !=	\
+	    (int)(uint32_t)((1ULL << sizeof(_vec)) - 1))			\
+		return -1;							\
+										\
+	t0 = _p##_cmpeq_epi8(*str, mask);					\
+	roll = _p##_shuffle_epi8(_p##_setr_epi8(B64_DEC_LUT_ROLL),		\
+				 _p##_add_epi8(t0, hi));			\
+	t0 = _p##_add_epi8(*str, roll);						\
+										\
+	t0 = _p##_maddubs_epi16(t0, _p##_set1_epi32(0x01400140));		\
+	t0 = _p##_madd_epi16(t0, _p##_set1_epi32(0x00011000));			\
+	*str = _p##_shuffle_epi8(t0, _p##_setr_epi8(B64_DEC_SHUF));		\
+										\
+	return 0;								\
+}
+
+#define B64_ENC_SHUF_128 \
+	1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+#define B64_ENC_LUT_128 \
+	'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+	'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, \
+	'/' - 63, 'A', 0, 0
+#define B64_DEC_LUT_LO_128 \
+	0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+	0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+#define B64_DEC_LUT_HI_128 \
+	0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define B64_DEC_LUT_ROLL_128 \
+	0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+#define B64_DEC_SHUF_128 \
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/* the 256 bit shuffles work per 128 bit lane, so the tables repeat */
+#define B64_ENC_SHUF		B64_ENC_SHUF_128
+#define B64_ENC_LUT		B64_ENC_LUT_128
+#define B64_DEC_LUT_LO		B64_DEC_LUT_LO_128
+#define B64_DEC_LUT_HI		B64_DEC_LUT_HI_128
+#define B64_DEC_LUT_ROLL	B64_DEC_LUT_ROLL_128
+#define B64_DEC_SHUF		B64_DEC_SHUF_128
+B64_X86_KERNELS(__attribute__((target("ssse3"))), 128, __m128i, _mm)
+#undef B64_ENC_SHUF
+#undef B64_ENC_LUT
+#undef B64_DEC_LUT_LO
+#undef B64_DEC_LUT_HI
+#undef B64_DEC_LUT_ROLL
+#undef B64_DEC_SHUF
+
+#define B64_ENC_SHUF		B64_ENC_SHUF_128, B64_ENC_SHUF_128
+#define B64_ENC_LUT		B64_ENC_LUT_128, B64_ENC_LUT_128
+#define B64_DEC_LUT_LO		B64_DEC_LUT_LO_128, B64_DEC_LUT_LO_128
+#define B64_DEC_LUT_HI		B64_DEC_LUT_HI_128, B64_DEC_LUT_HI_128
+#define B64_DEC_LUT_ROLL	B64_DEC_LUT_ROLL_128, B64_DEC_LUT_ROLL_128
+#define B64_DEC_SHUF		B64_DEC_SHUF_128, B64_DEC_SHUF_128
+B64_X86_KERNELS(__attribute__((target("avx2"))), 256, __m256i, _mm256)
+
+static __attribute__((target("ssse3"))) size_t
+b64_encode_ssse3(const unsigned char *src, size_t len, char *dest)
+{
+	size_t done = 0;
+
+	/* 12 bytes are used, but 16 are loaded */
+	while (len - done >= 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(src + done));
+
+		_mm_storeu_si128((__m128i *)dest, b64_enc_vec128(in));
+		dest += 16;
+		done += 12;
+	}
+
+	return done;
+}
+
+static __attribute__((target("ssse3"))) size_t
+b64_decode_ssse3(const char *src, size_t len, unsigned char *dest,
+		 size_t dest_len)
+{
+	size_t done = 0;
+
+	/* 12 bytes are produced, but 16 are stored */
+	while (len - done >= 16 && dest_len >= 16) {
+		__m128i str = _mm_loadu_si128((const __m128i *)(src + done));
+
+		if (b64_dec_vec128(&str))
+			break;
+
+		_mm_storeu_si128((__m128i *)dest, str);
+		dest += 12;
+		dest_len -= 12;
+		done += 16;
+	}
+
+	return done;
+}
+
+static __attribute__((target("avx2"))) size_t
+b64_encode_avx2(const unsigned char *src, size_t len, char *dest)
+{
+	size_t done = 0;
+
+	/* 24 bytes are used, the upper lane load reaches up to 28 */
+	while (len - done >= 28) {
+		const __m128i *in = (const __m128i *)(src + done);
+		__m256i val;
+
+		val = _mm256_castsi128_si256(_mm_loadu_si128(in));
+		val = _mm256_inserti128_si256(val,
+			_mm_loadu_si128((const __m128i *)(src + done + 12)), 1);
+		_mm256_storeu_si256((__m256i *)dest, b64_enc_vec256(val));
+		dest += 32;
+		done += 24;
+	}
+
+	/* avoid SSE/AVX transition stalls in the code that follows */
+	_mm256_zeroupper();
+
+	return done + b64_encode_ssse3(src + done, len - done, dest);
+}
+
+static __attribute__((target("avx2"))) size_t
+b64_decode_avx2(const char *src, size_t len, unsigned char *dest,
+		size_t dest_len)
+{
+	size_t done = 0;
+
+	/* 24 bytes are produced, but 32 are stored */
+	while (len - done >= 32 && dest_len >= 32) {
+		__m256i str = _mm256_loadu_si256((const __m256i *)(src + done));
+
+		if (b64_dec_vec256(&str))
+			break;
+
+		str = _mm256_permutevar8x32_epi32(str,
+			_mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i *)dest, str);
+		dest += 24;
+		dest_len -= 24;
+		done += 32;
+	}
+
+	_mm256_zeroupper();
+
+	return done + b64_decode_ssse3(src + done, len - done, dest, dest_len);
+}
+
+#endif
+
+#ifdef B64_NEON
+
+static size_t b64_encode_neon(const unsigned char *src, size_t len, char *dest)
+{
+	const uint8_t *tbl = (const uint8_t *)Base64;
+	uint8x16x4_t lut = { { vld1q_u8(tbl), vld1q_u8(tbl + 16),
+			       vld1q_u8(tbl + 32), vld1q_u8(tbl + 48) } };
+	uint8x16_t mask = vdupq_n_u8(0x3f);
+	size_t done = 0;
+
+	while (len - done >= 48) {
+		uint8x16x3_t in = vld3q_u8(src + done);
+		uint8x16x4_t out;
+
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4),
+					       vshrq_n_u8(in.val[1], 4)), mask);
+		out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2),
+					       vshrq_n_u8(in.val[2], 6)), mask);
+		out.val[3] = vandq_u8(in.val[2], mask);
+		for (int i = 0; i < 4; i++)
+			out.val[i] = vqtbl4q_u8(lut, out.val[i]);
+
+		vst4q_u8((uint8_t *)dest, out);
+		dest += 64;
+		done += 48;
+	}
+
+	return done;
+}
+
+static size_t b64_decode_neon(const char *src, size_t len, unsigned char *dest,
+			      size_t dest_len)
+{
+	const uint8_t *dec = (const uint8_t *)Base64_dec;
+	uint8x16x4_t lut_lo = { { vld1q_u8(dec), vld1q_u8(dec + 16),
+				  vld1q_u8(dec + 32), vld1q_u8(dec + 48) } };
+	uint8x16x4_t lut_hi = { { vld1q_u8(dec + 64), vld1q_u8(dec + 80),
+				  vld1q_u8(dec + 96), vld1q_u8(dec + 112) } };
+	uint8x16_t off = vdupq_n_u8(64);
+	size_t done = 0;
+
+	while (len - done >= 64 && dest_len >= 48) {
+		uint8x16x4_t in = vld4q_u8((const uint8_t *)src + done);
+		uint8x16_t bad = vdupq_n_u8(0);
+		uint8x16x3_t out;
+
+		/* invalid characters map to 0xff, anything >= 128 to 0 */
+		for (int i = 0; i < 4; i++) {
+			uint8x16_t c = in.val[i];
+
+			bad = vorrq_u8(bad, c);
+			c = vqtbx4q_u8(vqtbl4q_u8(lut_lo, c), lut_hi,
+				       vsubq_u8(c, off));
+			bad = vorrq_u8(bad, c);
+			in.val[i] = c;
+		}
+
+		if (vmaxvq_u8(bad) & 0x80)
+			break;
+
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2),
+				      vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4),
+				      vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+		vst3q_u8(dest, out);
+		dest += 48;
+		dest_len -= 48;
+		done += 64;
+	}
+
+	return done;
+}
+
+#endif
+
+static b64_encode_fn b64_encode_blocks = b64_encode_scalar;
+static b64_decode_fn b64_decode_blocks = b64_decode_scalar;
+
+static void __constructor b64_init(void)
+{
+#ifdef B64_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		b64_encode_blocks = b64_encode_avx2;
+		b64_decode_blocks = b64_decode_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		b64_encode_blocks = b64_encode_ssse3;
+		b64_decode_blocks = b64_decode_ssse3;
+	}
+#elif defined(B64_NEON)
+	b64_encode_blocks = b64_encode_neon;
+	b64_decode_blocks = b64_decode_neon;
+#endif
+}
+
 /* (From RFC1521 and draft-ietf-dnssec-secext-03.txt)
    The following encoding technique is taken from RFC 1521 by Borenstein
    and Freed.  It is reproduced here in a slightly edited form for
@@ -141,31 +510,22 @@ int b64_encode(const void *_src, size_t srclength,
 {
 	const unsigned char *src = _src;
 	char *target = dest;
-	size_t datalength = 0;
+	size_t datalength;
 	u_char input[3] = {0};
 	u_char output[4];
-	size_t i;
+	size_t i, done;
 
 	assert(dest && targsize > 0);
 
-	while (2 < srclength) {
-		input[0] = *src++;
-		input[1] = *src++;
-		input[2] = *src++;
-		srclength -= 3;
+	if (B64_ENCODE_LEN(srclength) > targsize)
+		return (-1);
 
-		output[0] = input[0] >> 2;
-		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-		output[3] = input[2] & 0x3f;
-
-		if (datalength + 4 > targsize)
-			return (-1);
-		target[datalength++] = Base64[output[0]];
-		target[datalength++] = Base64[output[1]];
-		target[datalength++] = Base64[output[2]];
-		target[datalength++] = Base64[output[3]];
-	}
+	done = b64_encode_blocks(src, srclength, target);
+	done += b64_encode_scalar(src + done, srclength - done,
+				  target + done / 3 * 4);
+	datalength = done / 3 * 4;
+	src += done;
+	srclength -= done;
 
 	/* Now we worry about padding. */
 	if (0 != srclength) {
@@ -178,8 +538,6 @@ int b64_encode(const void *_src, size_t srclength,
 		output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
 		output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
 
-		if (datalength + 4 > targsize)
-			return (-1);
 		target[datalength++] = Base64[output[0]];
 		target[datalength++] = Base64[output[1]];
 		if (srclength == 1)
@@ -188,8 +546,6 @@ int b64_encode(const void *_src, size_t srclength,
 			target[datalength++] = Base64[output[2]];
 		target[datalength++] = Pad64;
 	}
-	if (datalength >= targsize)
-		return (-1);
 	target[datalength] = '\0';	/* Returned value doesn't count \0. */
 	return (datalength);
 }
@@ -203,26 +559,45 @@ int b64_encode(const void *_src, size_t srclength,
 int b64_decode(const void *_src, void *dest, size_t targsize)
 {
 	const char *src = _src;
+	const char *end = src + strlen(src);
 	unsigned char *target = dest;
-	int state, ch;
-	size_t tarindex;
+	int state, ch, val;
+	size_t tarindex, done;
 	u_char nextbyte;
-	char *pos;
+	bool blocks = !!target;
 
 	state = 0;
 	tarindex = 0;
 
 	assert(dest && targsize > 0);
 
-	while ((ch = (unsigned char)*src++) != '\0') {
-		if (isspace(ch))	/* Skip whitespace anywhere. */
+	for (;;) {
+		/* Whole quanta go through the block kernels. */
+		if (blocks && state == 0) {
+			done = b64_decode_blocks(src, end - src, target + tarindex,
+						 targsize - tarindex);
+			done += b64_decode_scalar(src + done, end - src - done,
+						  target + tarindex + done / 4 * 3,
+						  targsize - tarindex - done / 4 * 3);
+			tarindex += done / 4 * 3;
+			src += done;
+			blocks = false;
+		}
+
+		ch = (unsigned char)*src++;
+		if (ch == '\0')
+			break;
+
+		if (isspace(ch)) {	/* Skip whitespace anywhere. */
+			blocks = !!target;
 			continue;
+		}
 
 		if (ch == Pad64)
 			break;
 
-		pos = strchr(Base64, ch);
-		if (pos == 0)		/* A non-base64 character. */
+		val = Base64_dec[ch];
+		if (val < 0)		/* A non-base64 character. */
 			return (-1);
 
 		switch (state) {
@@ -230,7 +605,7 @@ int b64_decode(const void *_src, void *dest, size_t targsize)
 			if (target) {
 				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex] = (pos - Base64) << 2;
+				target[tarindex] = val << 2;
 			}
 			state = 1;
 			break;
@@ -238,8 +613,8 @@ int b64_decode(const void *_src, void *dest, size_t targsize)
 			if (target) {
 				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 4;
-				nextbyte = ((pos - Base64) & 0x0f) << 4;
+				target[tarindex]   |=  val >> 4;
+				nextbyte = (val & 0x0f) << 4;
 				if (tarindex + 1 < targsize)
 					target[tarindex+1] = nextbyte;
 				else if (nextbyte)
@@ -252,8 +627,8 @@ int b64_decode(const void *_src, void *dest, size_t targsize)
 			if (target) {
 				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex]   |=  (pos - Base64) >> 2;
-				nextbyte = ((pos - Base64) & 0x03) << 6;
+				target[tarindex]   |=  val >> 2;
+				nextbyte = (val & 0x03) << 6;
 				if (tarindex + 1 < targsize)
 					target[tarindex+1] = nextbyte;
 				else if (nextbyte)
@@ -266,7 +641,7 @@ int b64_decode(const void *_src, void *dest, size_t targsize)
 			if (target) {
 				if (tarindex >= targsize)
 					return (-1);
-				target[tarindex] |= (pos - Base64);
+				target[tarindex] |= val;
 			}
 			tarindex++;
 			state = 0;
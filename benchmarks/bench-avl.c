@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "avl-cmp.h"
+#include "utils.h"
+#include "bench.h"
+
+struct node {
+	struct avl_node avl;
+	char key[16];
+};
+
+struct avl_ctx {
+	struct avl_tree tree;
+	struct node *nodes;
+	struct avl_node **sorted;
+	int count;
+};
+
+static struct node *alloc_nodes(int count)
+{
+	struct node *nodes = calloc(count, sizeof(*nodes));
+
+	/* scatter the keys so that inserts don't arrive in sorted order */
+	for (int i = 0; i < count; i++) {
+		snprintf(nodes[i].key, sizeof(nodes[i].key), "%08x",
+			 (unsigned int) i * 2654435761U);
+		nodes[i].avl.key = nodes[i].key;
+	}
+
+	return nodes;
+}
+
+static void fill_tree(struct avl_tree *t, struct avl_ctx *ctx)
+{
+	avl_init(t, avl_strcmp, false, NULL);
+	for (int i = 0; i < ctx->count; i++)
+		avl_insert(t, &ctx->nodes[i].avl);
+}
+
+static uint64_t bench_insert(void *priv, uint64_t n)
+{
+	struct avl_ctx *ctx = priv;
+	struct avl_tree t;
+
+	/* start over with an empty tree once all nodes have been inserted */
+	for (uint64_t i = 0; i < n; i++) {
+		int idx = i % ctx->count;
+
+		if (!idx)
+			avl_init(&t, avl_strcmp, false, NULL);
+		avl_insert(&t, &ctx->nodes[idx].avl);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_build(void *priv, uint64_t n)
+{
+	struct avl_ctx *ctx = priv;
+	struct avl_tree t;
+
+	/* one op per node, the tree is rebuilt once all nodes are in */
+	for (uint64_t i = 0; i < n; i += ctx->count) {
+		uint64_t len = n - i < (uint64_t)ctx->count ? n - i : (uint64_t)ctx->count;
+
+		avl_init(&t, avl_strcmp, false, NULL);
+		avl_build_from_sorted(&t, ctx->sorted, len);
+		bench_use(t.root);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_find(void *priv, uint64_t n)
+{
+	struct avl_ctx *ctx = priv;
+
+	for (uint64_t i = 0; i < n; i++) {
+		struct avl_node *node;
+
+		node = avl_find(&ctx->tree, ctx->nodes[i % ctx->count].key);
+		bench_use(node);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_find_inline(void *priv, uint64_t n)
+{
+	struct avl_ctx *ctx = priv;
+
+	for (uint64_t i = 0; i < n; i++) {
+		struct node *node;
+
+		node = avl_find_element_cmp(&ctx->tree, ctx->nodes[i % ctx->count].key,
+					    node, avl, avl_strcmp_inline);
+		bench_use(node);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_replace(void *priv, uint64_t n)
+{
+	struct avl_ctx *ctx = priv;
+
+	/* delete and re-insert, keeping the tree size constant */
+	for (uint64_t i = 0; i < n; i++) {
+		struct avl_node *node = &ctx->nodes[i % ctx->count].avl;
+
+		avl_delete(&ctx->tree, node);
+		avl_insert(&ctx->tree, node);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 100, 10000, 1000000 };
+	char name[64];
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		struct avl_ctx ctx = {
+			.nodes = alloc_nodes(sizes[i]),
+			.count = sizes[i],
+		};
+		struct node *node;
+		int j = 0;
+
+		snprintf(name, sizeof(name), "avl_insert/nodes=%d", ctx.count);
+		bench_run(name, bench_insert, &ctx);
+
+		fill_tree(&ctx.tree, &ctx);
+		ctx.sorted = calloc(ctx.count, sizeof(*ctx.sorted));
+		avl_for_each_element(&ctx.tree, node, avl)
+			ctx.sorted[j++] = &node->avl;
+
+		snprintf(name, sizeof(name), "avl_build_from_sorted/nodes=%d", ctx.count);
+		bench_run(name, bench_build, &ctx);
+
+		/* building took the nodes over, link them in again */
+		fill_tree(&ctx.tree, &ctx);
+		snprintf(name, sizeof(name), "avl_find/nodes=%d", ctx.count);
+		bench_run(name, bench_find, &ctx);
+		snprintf(name, sizeof(name), "avl_find_inline/nodes=%d", ctx.count);
+		bench_run(name, bench_find_inline, &ctx);
+		snprintf(name, sizeof(name), "avl_delete_insert/nodes=%d", ctx.count);
+		bench_run(name, bench_replace, &ctx);
+
+		/* the same with cached key prefixes */
+		avl_set_prefix(&ctx.tree, avl_strprefix);
+		snprintf(name, sizeof(name), "avl_find_prefix/nodes=%d", ctx.count);
+		bench_run(name, bench_find, &ctx);
+		snprintf(name, sizeof(name), "avl_find_inline_prefix/nodes=%d", ctx.count);
+		bench_run(name, bench_find_inline, &ctx);
+		snprintf(name, sizeof(name), "avl_delete_insert_prefix/nodes=%d", ctx.count);
+		bench_run(name, bench_replace, &ctx);
+
+		free(ctx.sorted);
+		free(ctx.nodes);
+	}
+
+	return 0;
+}
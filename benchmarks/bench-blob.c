@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "blobmsg.h"
+#include "utils.h"
+#include "bench.h"
+
+#define MAX_POLICY	64
+
+static struct blobmsg_policy policy[MAX_POLICY];
+static char names[MAX_POLICY][16];
+static struct blob_buf b;
+
+struct parse_ctx {
+	int n_policy;
+	struct blob_attr *msg;
+};
+
+static void init_policy(void)
+{
+	for (int i = 0; i < MAX_POLICY; i++) {
+		snprintf(names[i], sizeof(names[i]), "attr%d", i);
+		policy[i].name = names[i];
+		policy[i].type = (i % 2) ? BLOBMSG_TYPE_INT32 : BLOBMSG_TYPE_STRING;
+	}
+}
+
+static void fill_msg(struct blob_buf *buf, int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (i % 2)
+			blobmsg_add_u32(buf, names[i], i);
+		else
+			blobmsg_add_string(buf, names[i], "value");
+	}
+}
+
+static uint64_t bench_parse(void *priv, uint64_t n)
+{
+	struct parse_ctx *ctx = priv;
+	struct blob_attr *tb[MAX_POLICY];
+
+	for (uint64_t i = 0; i < n; i++) {
+		blobmsg_parse(policy, ctx->n_policy, tb,
+			      blob_data(ctx->msg), blob_len(ctx->msg));
+		bench_use(tb[0]);
+	}
+
+	return n * blob_raw_len(ctx->msg);
+}
+
+static uint64_t bench_build(void *priv, uint64_t n)
+{
+	int entries = *(int *)priv;
+	uint64_t bytes = 0;
+
+	for (uint64_t i = 0; i < n; i++) {
+		blob_buf_init(&b, 0);
+		fill_msg(&b, entries);
+		bytes += blob_raw_len(b.head);
+	}
+
+	return bytes;
+}
+
+static uint64_t bench_build_nested(void *priv, uint64_t n)
+{
+	uint64_t bytes = 0;
+
+	for (uint64_t i = 0; i < n; i++) {
+		void *c, *a;
+
+		blob_buf_init(&b, 0);
+		c = blobmsg_open_table(&b, "table");
+		for (int j = 0; j < 8; j++) {
+			a = blobmsg_open_array(&b, names[j]);
+			fill_msg(&b, 4);
+			blobmsg_close_array(&b, a);
+		}
+		blobmsg_close_table(&b, c);
+		bytes += blob_raw_len(b.head);
+	}
+
+	return bytes;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 4, 16, 64 };
+	struct blob_buf msg = {};
+	char name[64];
+
+	init_policy();
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		struct parse_ctx ctx = { .n_policy = sizes[i] };
+
+		blob_buf_init(&msg, 0);
+		fill_msg(&msg, sizes[i]);
+		ctx.msg = msg.head;
+
+		snprintf(name, sizeof(name), "blobmsg_parse/policy=%d", sizes[i]);
+		bench_run(name, bench_parse, &ctx);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		int entries = sizes[i];
+
+		snprintf(name, sizeof(name), "blob_buf_build/attrs=%d", entries);
+		bench_run(name, bench_build, &entries);
+	}
+
+	bench_run("blob_buf_build/nested", bench_build_nested, NULL);
+
+	blob_buf_free(&msg);
+	blob_buf_free(&b);
+
+	return 0;
+}
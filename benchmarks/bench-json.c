@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobmsg_json.h"
+#include "utils.h"
+#include "bench.h"
+
+static struct blob_buf b;
+
+struct format_ctx {
+	bool indent;
+};
+
+static void fill_msg(struct blob_buf *buf)
+{
+	void *c, *a;
+
+	blobmsg_add_string(buf, "name", "benchmark \"quoted\"\tvalue");
+	blobmsg_add_u32(buf, "int32", 123456);
+	blobmsg_add_u64(buf, "int64", 1234567890123ULL);
+	blobmsg_add_u8(buf, "bool", 1);
+	blobmsg_add_double(buf, "double", 3.25);
+
+	c = blobmsg_open_table(buf, "table");
+	for (int i = 0; i < 16; i++) {
+		char key[16];
+
+		snprintf(key, sizeof(key), "key%d", i);
+		blobmsg_add_string(buf, key, "some string value");
+	}
+	blobmsg_close_table(buf, c);
+
+	a = blobmsg_open_array(buf, "array");
+	for (int i = 0; i < 32; i++)
+		blobmsg_add_u32(buf, NULL, i * 1000);
+	blobmsg_close_array(buf, a);
+}
+
+static uint64_t bench_format(void *priv, uint64_t n)
+{
+	struct format_ctx *ctx = priv;
+	uint64_t bytes = 0;
+
+	for (uint64_t i = 0; i < n; i++) {
+		char *str = blobmsg_format_json_indent(b.head, true,
+						       ctx->indent ? 0 : -1);
+
+		bytes += strlen(str);
+		free(str);
+	}
+
+	return bytes;
+}
+
+static uint64_t bench_parse(void *priv, uint64_t n)
+{
+	const char *str = priv;
+	struct blob_buf out = {};
+
+	for (uint64_t i = 0; i < n; i++) {
+		blob_buf_init(&out, 0);
+		blobmsg_add_json_from_string(&out, str);
+	}
+	blob_buf_free(&out);
+
+	return n * strlen(str);
+}
+
+int main(int argc, char **argv)
+{
+	struct format_ctx plain = { false }, indent = { true };
+	char *str;
+
+	blob_buf_init(&b, 0);
+	fill_msg(&b);
+
+	bench_run("blobmsg_format_json", bench_format, &plain);
+	bench_run("blobmsg_format_json/indent", bench_format, &indent);
+
+	str = blobmsg_format_json(b.head, true);
+	bench_run("blobmsg_add_json_from_string", bench_parse, str);
+	free(str);
+
+	blob_buf_free(&b);
+
+	return 0;
+}
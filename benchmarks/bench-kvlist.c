@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvlist.h"
+#include "utils.h"
+#include "bench.h"
+
+struct kv_ctx {
+	struct kvlist kv;
+	char (*keys)[16];
+	int count;
+};
+
+static uint64_t bench_get(void *priv, uint64_t n)
+{
+	struct kv_ctx *ctx = priv;
+
+	for (uint64_t i = 0; i < n; i++)
+		bench_use(kvlist_get(&ctx->kv, ctx->keys[(i * 7919) % ctx->count]));
+
+	return 0;
+}
+
+static uint64_t bench_set(void *priv, uint64_t n)
+{
+	struct kv_ctx *ctx = priv;
+
+	/* overwrites, so the size stays constant */
+	for (uint64_t i = 0; i < n; i++)
+		kvlist_set(&ctx->kv, ctx->keys[(i * 7919) % ctx->count], "value");
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 16, 1000, 100000 };
+	char name[64];
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (int hash = 0; hash < 2; hash++) {
+			struct kv_ctx ctx = {
+				.keys = calloc(sizes[i], sizeof(*ctx.keys)),
+				.count = sizes[i],
+			};
+			const char *type = hash ? "hash" : "avl";
+
+			if (hash)
+				kvlist_init_hash(&ctx.kv, kvlist_strlen);
+			else
+				kvlist_init(&ctx.kv, kvlist_strlen);
+
+			for (int j = 0; j < ctx.count; j++) {
+				snprintf(ctx.keys[j], sizeof(ctx.keys[j]),
+					 "key-%x", j * 2654435761U);
+				kvlist_set(&ctx.kv, ctx.keys[j], "value");
+			}
+
+			snprintf(name, sizeof(name), "kvlist_get/%s/entries=%d",
+				 type, ctx.count);
+			bench_run(name, bench_get, &ctx);
+			snprintf(name, sizeof(name), "kvlist_set/%s/entries=%d",
+				 type, ctx.count);
+			bench_run(name, bench_set, &ctx);
+
+			kvlist_free(&ctx.kv);
+			free(ctx.keys);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udebug.h"
+#include "utils.h"
+#include "bench.h"
+
+static uint64_t bench_entry_add(void *priv, uint64_t n)
+{
+	struct udebug_buf *buf = priv;
+	static const char data[64] = "benchmark entry payload";
+
+	for (uint64_t i = 0; i < n; i++) {
+		udebug_entry_init(buf);
+		udebug_entry_append(buf, data, sizeof(data));
+		udebug_entry_add(buf);
+	}
+
+	return n * sizeof(data);
+}
+
+static uint64_t bench_entry_printf(void *priv, uint64_t n)
+{
+	struct udebug_buf *buf = priv;
+
+	for (uint64_t i = 0; i < n; i++) {
+		udebug_entry_init(buf);
+		udebug_entry_printf(buf, "event %llu on %s: %d",
+				    (unsigned long long) i, "eth0", 42);
+		udebug_entry_add(buf);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_entry_deferred_printf(void *priv, uint64_t n)
+{
+	struct udebug_buf *buf = priv;
+
+	for (uint64_t i = 0; i < n; i++) {
+		udebug_entry_init(buf);
+		udebug_entry_deferred_printf(buf, "event %llu on %s: %d",
+					     (unsigned long long) i, "eth0", 42);
+		udebug_entry_add(buf);
+	}
+
+	return 0;
+}
+
+static uint64_t bench_read(void *priv, uint64_t n, bool incremental)
+{
+	struct udebug_buf *buf = priv;
+	struct udebug_remote_buf rb = {
+		.buf = {
+			.hdr = buf->hdr,
+			.data = buf->data,
+			.data_size = buf->data_size,
+			.ring_size = buf->ring_size,
+		},
+	};
+	static const char data[64] = "benchmark entry payload";
+	struct udebug_snapshot *s;
+	struct udebug_iter it;
+	uint64_t bytes = 0;
+
+	udebug_remote_buf_set_start_offset(&rb, 0);
+	for (uint64_t i = 0; i < n; i++) {
+		/* a poll that finds a few new entries */
+		for (int j = 0; j < 4; j++) {
+			udebug_entry_init(buf);
+			udebug_entry_append(buf, data, sizeof(data));
+			udebug_entry_add(buf);
+		}
+
+		if (incremental) {
+			while (udebug_remote_buf_read(&rb, &it))
+				bytes += it.len;
+			continue;
+		}
+
+		s = udebug_remote_buf_snapshot(&rb);
+		for (unsigned int j = 0; s && j < s->n_entries; j++)
+			if (udebug_snapshot_get_entry(s, &it, j))
+				bytes += it.len;
+		free(s);
+	}
+
+	return bytes;
+}
+
+static uint64_t bench_read_snapshot(void *priv, uint64_t n)
+{
+	return bench_read(priv, n, false);
+}
+
+static uint64_t bench_read_incremental(void *priv, uint64_t n)
+{
+	return bench_read(priv, n, true);
+}
+
+static uint64_t bench_mp_entry_add(void *priv, uint64_t n)
+{
+	struct udebug_buf *buf = priv;
+	static const char data[64] = "benchmark entry payload";
+
+	for (uint64_t i = 0; i < n; i++)
+		udebug_mp_entry_add(buf, i, data, sizeof(data));
+
+	return n * sizeof(data);
+}
+
+#define MERGE_RINGS	64
+
+struct merge_data {
+	struct udebug_buf bufs[MERGE_RINGS];
+	struct udebug_snapshot *s[MERGE_RINGS];
+};
+
+static uint64_t bench_iter_next(void *priv, uint64_t n)
+{
+	struct merge_data *m = priv;
+	struct udebug_iter it;
+	uint64_t i = 0;
+
+	while (i < n) {
+		udebug_iter_start(&it, m->s, MERGE_RINGS);
+		while (i < n && udebug_iter_next(&it))
+			i++;
+		udebug_iter_free(&it);
+	}
+
+	return 0;
+}
+
+static int merge_init(struct merge_data *m)
+{
+	for (int i = 0; i < MERGE_RINGS; i++) {
+		struct udebug_remote_buf rb = {};
+
+		if (udebug_buf_init(&m->bufs[i], 1024, 64 * 1024) < 0)
+			return -1;
+
+		/* interleaved timestamps across all rings */
+		for (int j = 0; j < 1000; j++) {
+			udebug_entry_init_ts(&m->bufs[i], j * MERGE_RINGS + (i * 7) % MERGE_RINGS);
+			udebug_entry_append(&m->bufs[i], "entry", 5);
+			udebug_entry_add(&m->bufs[i]);
+		}
+
+		rb.buf.hdr = m->bufs[i].hdr;
+		rb.buf.data = m->bufs[i].data;
+		rb.buf.data_size = m->bufs[i].data_size;
+		rb.buf.ring_size = m->bufs[i].ring_size;
+		m->s[i] = udebug_remote_buf_snapshot(&rb);
+		if (!m->s[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+static void merge_free(struct merge_data *m)
+{
+	for (int i = 0; i < MERGE_RINGS; i++) {
+		free(m->s[i]);
+		udebug_buf_free(&m->bufs[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct merge_data merge;
+	struct udebug_buf buf = {}, mp_buf = {};
+
+	if (udebug_buf_init(&buf, 1024, 256 * 1024) < 0) {
+		fprintf(stderr, "Failed to allocate udebug buffer\n");
+		return 1;
+	}
+
+	bench_run("udebug_entry_add/len=64", bench_entry_add, &buf);
+	bench_run("udebug_entry_printf", bench_entry_printf, &buf);
+	bench_run("udebug_entry_deferred_printf", bench_entry_deferred_printf, &buf);
+	bench_run("udebug_remote_buf_snapshot/4", bench_read_snapshot, &buf);
+	bench_run("udebug_remote_buf_read/4", bench_read_incremental, &buf);
+
+	udebug_buf_free(&buf);
+
+	uloop_init();
+	if (udebug_buf_init(&mp_buf, 1024, 256 * 1024) < 0 ||
+	    udebug_buf_mp_init(&mp_buf) < 0) {
+		fprintf(stderr, "Failed to allocate udebug buffer\n");
+		return 1;
+	}
+
+	bench_run("udebug_mp_entry_add/len=64", bench_mp_entry_add, &mp_buf);
+
+	udebug_buf_free(&mp_buf);
+	uloop_done();
+
+	if (merge_init(&merge) < 0) {
+		fprintf(stderr, "Failed to allocate udebug buffer\n");
+		return 1;
+	}
+
+	bench_run("udebug_iter_next/rings=64", bench_iter_next, &merge);
+
+	merge_free(&merge);
+
+	return 0;
+}
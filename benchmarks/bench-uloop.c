@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "uloop.h"
+#include "ustream.h"
+#include "utils.h"
+#include "bench.h"
+
+#define CHUNK_LEN	4096
+#define MAX_PENDING	(256 * 1024)
+
+struct timeout_ctx {
+	struct uloop_timeout *t;
+	int count;
+};
+
+static uint64_t bench_timeout_set(void *priv, uint64_t n)
+{
+	struct timeout_ctx *ctx = priv;
+
+	/* re-arm pending timers at spread deadlines, as a busy daemon would */
+	for (uint64_t i = 0; i < n; i++)
+		uloop_timeout_set(&ctx->t[i % ctx->count],
+				  1000000 + (i * 7919) % 100000);
+
+	return 0;
+}
+
+static struct ustream_fd writer, reader;
+static char chunk[CHUNK_LEN];
+static uint64_t total, queued, received;
+
+static void writer_fill(struct ustream *s)
+{
+	while (queued < total && ustream_pending_data(s, true) < MAX_PENDING) {
+		ustream_write(s, chunk, sizeof(chunk), false);
+		queued += sizeof(chunk);
+	}
+}
+
+static void writer_notify_write(struct ustream *s, int bytes)
+{
+	writer_fill(s);
+}
+
+static void reader_notify_read(struct ustream *s, int bytes)
+{
+	char *buf;
+	int len;
+
+	while ((buf = ustream_get_read_buf(s, &len)) != NULL) {
+		received += len;
+		ustream_consume(s, len);
+	}
+
+	if (received >= total)
+		uloop_end();
+}
+
+static uint64_t bench_ustream(void *priv, uint64_t n)
+{
+	/* one op is one chunk pushed through the socketpair */
+	total = n * CHUNK_LEN;
+	queued = received = 0;
+	writer_fill(&writer.stream);
+	uloop_run();
+
+	return received;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 16, 1000, 100000 };
+	char name[64];
+	int sv[2];
+
+	uloop_init();
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		struct timeout_ctx ctx = {
+			.t = calloc(sizes[i], sizeof(*ctx.t)),
+			.count = sizes[i],
+		};
+
+		for (int j = 0; j < ctx.count; j++)
+			uloop_timeout_set(&ctx.t[j], 1000000 + (j * 7919) % 100000);
+
+		snprintf(name, sizeof(name), "uloop_timeout_set/pending=%d", ctx.count);
+		bench_run(name, bench_timeout_set, &ctx);
+
+		for (int j = 0; j < ctx.count; j++)
+			uloop_timeout_cancel(&ctx.t[j]);
+		free(ctx.t);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return 1;
+
+	memset(chunk, 'x', sizeof(chunk));
+	writer.stream.notify_write = writer_notify_write;
+	reader.stream.notify_read = reader_notify_read;
+	ustream_fd_init(&writer, sv[0]);
+	ustream_fd_init(&reader, sv[1]);
+
+	bench_run("ustream_socketpair/chunk=4096", bench_ustream, NULL);
+
+	ustream_free(&writer.stream);
+	ustream_free(&reader.stream);
+	close(sv[0]);
+	close(sv[1]);
+	uloop_done();
+
+	return 0;
+}
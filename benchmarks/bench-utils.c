@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "utils.h"
+#include "bench.h"
+
+struct data_ctx {
+	char *src;
+	char *dest;
+	size_t len;
+	size_t src_len;
+	size_t dest_len;
+};
+
+static uint64_t bench_b64_encode(void *priv, uint64_t n)
+{
+	struct data_ctx *ctx = priv;
+
+	for (uint64_t i = 0; i < n; i++)
+		b64_encode(ctx->src, ctx->len, ctx->dest, ctx->dest_len);
+
+	return n * ctx->len;
+}
+
+static uint64_t bench_b64_decode(void *priv, uint64_t n)
+{
+	struct data_ctx *ctx = priv;
+
+	for (uint64_t i = 0; i < n; i++)
+		b64_decode(ctx->dest, ctx->src, ctx->src_len);
+
+	return n * ctx->len;
+}
+
+static uint64_t bench_md5(void *priv, uint64_t n)
+{
+	struct data_ctx *ctx = priv;
+	uint8_t sum[16];
+	md5_ctx_t md5;
+
+	for (uint64_t i = 0; i < n; i++) {
+		md5_begin(&md5);
+		md5_hash(ctx->src, ctx->len, &md5);
+		md5_end(sum, &md5);
+		bench_use(sum[0]);
+	}
+
+	return n * ctx->len;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 64, 4096, 1024 * 1024 };
+	char name[64];
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		struct data_ctx ctx = {
+			.len = sizes[i],
+			.dest_len = B64_ENCODE_LEN(sizes[i]),
+		};
+
+		/* large enough to decode back into */
+		ctx.src_len = B64_DECODE_LEN(ctx.dest_len);
+		ctx.src = malloc(ctx.src_len);
+		ctx.dest = malloc(ctx.dest_len);
+		for (size_t j = 0; j < ctx.len; j++)
+			ctx.src[j] = j * 7 + j / 251;
+		b64_encode(ctx.src, ctx.len, ctx.dest, ctx.dest_len);
+
+		snprintf(name, sizeof(name), "b64_encode/len=%zu", ctx.len);
+		bench_run(name, bench_b64_encode, &ctx);
+		snprintf(name, sizeof(name), "b64_decode/len=%zu", ctx.len);
+		bench_run(name, bench_b64_decode, &ctx);
+		snprintf(name, sizeof(name), "md5/len=%zu", ctx.len);
+		bench_run(name, bench_md5, &ctx);
+
+		free(ctx.src);
+		free(ctx.dest);
+	}
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Minimal microbenchmark harness.
+ *
+ * Every benchmark is run in growing batches until a batch takes
+ * at least BENCH_MIN_NS, and the result of that batch is printed as one
+ * JSON object per line on stdout, so that runs can be compared by script.
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef BENCH_MIN_NS
+#define BENCH_MIN_NS	200000000ULL
+#endif
+
+/*
+ * Called with the number of operations to perform, returns the number of
+ * bytes processed (0 if throughput is not meaningful for this benchmark).
+ */
+typedef uint64_t (*bench_fn)(void *priv, uint64_t n);
+
+static inline uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t bench_min_ns(void)
+{
+	const char *val = getenv("BENCH_MIN_MS");
+
+	if (val && *val)
+		return strtoull(val, NULL, 0) * 1000000ULL;
+
+	return BENCH_MIN_NS;
+}
+
+static inline void bench_run(const char *name, bench_fn fn, void *priv)
+{
+	uint64_t min_ns = bench_min_ns();
+	uint64_t n = 1, bytes, start, elapsed;
+
+	for (;;) {
+		start = bench_now();
+		bytes = fn(priv, n);
+		elapsed = bench_now() - start;
+		if (elapsed >= min_ns || n >= (1ULL << 40))
+			break;
+
+		/* aim a bit past the target so the last batch usually suffices */
+		if (elapsed < min_ns / 16)
+			n *= 16;
+		else
+			n = n * min_ns / elapsed * 5 / 4 + 1;
+	}
+
+	if (!elapsed)
+		elapsed = 1;
+
+	printf("{ \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f",
+	       name, (unsigned long long) n, (double) elapsed / n);
+	if (bytes)
+		printf(", \"mb_per_sec\": %.2f",
+		       (double) bytes * 1000.0 / elapsed);
+	printf(" }\n");
+	fflush(stdout);
+}
+
+/* keep the compiler from optimizing away otherwise unused results */
+#define bench_use(val) __asm__ __volatile__("" : : "g"(val) : "memory")
+
+#endif
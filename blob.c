@@ -17,12 +17,36 @@
  */
 
 #include "blob.h"
+#include "arena.h"
+#include "list.h"
+
+static int blob_grow_floor = 256;
+static int blob_grow_cap = 1024 * 1024;
+
+void
+blob_buf_set_growth(int floor, int cap)
+{
+	if (floor > 0)
+		blob_grow_floor = floor;
+	if (cap > 0)
+		blob_grow_cap = cap;
+}
 
 static bool
 blob_buffer_grow(struct blob_buf *buf, int minlen)
 {
 	struct blob_buf *new;
 	int delta = ((minlen / 256) + 1) * 256;
+	int geo = buf->buflen < blob_grow_cap ? buf->buflen : blob_grow_cap;
+
+	/* grow geometrically to keep the number of reallocs logarithmic */
+	if (delta < geo)
+		delta = geo;
+	if (delta < blob_grow_floor)
+		delta = blob_grow_floor;
+	if (buf->buflen + delta > BLOB_ATTR_LEN_MASK && minlen <= BLOB_ATTR_LEN_MASK - buf->buflen)
+		delta = BLOB_ATTR_LEN_MASK - buf->buflen;
+
 	new = realloc(buf->buf, buf->buflen + delta);
 	if (new) {
 		buf->buf = new;
@@ -67,6 +91,23 @@ blob_buf_grow(struct blob_buf *buf, int required)
 	return true;
 }
 
+bool
+blob_buf_reserve(struct blob_buf *buf, int len)
+{
+	int required = len - buf->buflen;
+
+	if (required <= 0)
+		return true;
+
+	if (!buf->grow)
+		buf->grow = blob_buffer_grow;
+
+	if (!buf->head)
+		return len <= BLOB_ATTR_LEN_MASK && buf->grow(buf, required);
+
+	return blob_buf_grow(buf, required);
+}
+
 static struct blob_attr *
 blob_add(struct blob_buf *buf, struct blob_attr *pos, int id, int payload)
 {
@@ -93,6 +134,8 @@ blob_buf_init(struct blob_buf *buf, int id)
 	if (!buf->grow)
 		buf->grow = blob_buffer_grow;
 
+	free(buf->names);
+	buf->names = NULL;
 	buf->head = buf->buf;
 	if (blob_add(buf, buf->buf, id, 0) == NULL)
 		return -ENOMEM;
@@ -100,13 +143,67 @@ blob_buf_init(struct blob_buf *buf, int id)
 	return 0;
 }
 
+static bool
+blob_arena_grow(struct blob_buf *buf, int minlen)
+{
+	struct blob_arena_buf *ab = container_of(buf, struct blob_arena_buf, buf);
+	int delta = ((minlen / 256) + 1) * 256;
+	void *new;
+
+	if (delta < buf->buflen)
+		delta = buf->buflen;
+	if (buf->buflen + delta > BLOB_ATTR_LEN_MASK && minlen <= BLOB_ATTR_LEN_MASK - buf->buflen)
+		delta = BLOB_ATTR_LEN_MASK - buf->buflen;
+
+	new = arena_realloc(ab->arena, buf->buf, buf->buflen, buf->buflen + delta);
+	if (!new)
+		return false;
+
+	buf->buf = new;
+	memset((char *) buf->buf + buf->buflen, 0, delta);
+	buf->buflen += delta;
+
+	return true;
+}
+
+int
+blob_arena_buf_init(struct blob_arena_buf *ab, struct arena *a, int id)
+{
+	struct blob_buf *buf = &ab->buf;
+
+	/* the previous buffer may have gone away with an arena_reset */
+	memset(buf, 0, sizeof(*buf));
+	buf->grow = blob_arena_grow;
+	ab->arena = a;
+
+	return blob_buf_init(buf, id);
+}
+
+int
+blob_buf_reset(struct blob_buf *buf, int id, int trim)
+{
+	void *new;
+
+	if (trim > 0 && buf->buflen > trim && buf->grow == blob_buffer_grow) {
+		new = realloc(buf->buf, trim);
+		if (new) {
+			buf->buf = new;
+			buf->buflen = trim;
+		}
+	}
+
+	return blob_buf_init(buf, id);
+}
+
 void
 blob_buf_free(struct blob_buf *buf)
 {
 	free(buf->buf);
+	free(buf->names);
 	buf->buf = NULL;
 	buf->head = NULL;
 	buf->buflen = 0;
+	buf->names = NULL;
 }
 
 void
@@ -335,3 +432,158 @@ blob_memdup(const struct blob_attr *attr)
 	memcpy(ret, attr, size);
 	return ret;
 }
+
+#define BLOB_HASH_P1	0x9e3779b185ebca87ULL
+#define BLOB_HASH_P2	0xc2b2ae3d27d4eb4fULL
+#define BLOB_HASH_P3	0x165667b19e3779f9ULL
+#define BLOB_HASH_P4	0x85ebca77c2b2ae63ULL
+#define BLOB_HASH_P5	0x27d4eb2f165667c5ULL
+
+static inline uint64_t blob_hash_rotl(uint64_t val, int bits)
+{
+	return (val << bits) | (val >> (64 - bits));
+}
+
+/* input words are little endian, as in the reference XXH64 */
+static inline uint64_t blob_hash_read64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le64_to_cpu(val);
+}
+
+static inline uint32_t blob_hash_read32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le32_to_cpu(val);
+}
+
+static inline uint64_t blob_hash_round(uint64_t acc, uint64_t val)
+{
+	acc += val * BLOB_HASH_P2;
+	acc = blob_hash_rotl(acc, 31);
+	return acc * BLOB_HASH_P1;
+}
+
+static inline uint64_t blob_hash_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= blob_hash_round(0, val);
+	return acc * BLOB_HASH_P1 + BLOB_HASH_P4;
+}
+
+uint64_t
+blob_hash_data(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		const uint8_t *limit = end - 32;
+		uint64_t v1 = BLOB_HASH_P1 + BLOB_HASH_P2;
+		uint64_t v2 = BLOB_HASH_P2;
+		uint64_t v3 = 0;
+		uint64_t v4 = -BLOB_HASH_P1;
+
+		do {
+			v1 = blob_hash_round(v1, blob_hash_read64(p));
+			v2 = blob_hash_round(v2, blob_hash_read64(p + 8));
+			v3 = blob_hash_round(v3, blob_hash_read64(p + 16));
+			v4 = blob_hash_round(v4, blob_hash_read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = blob_hash_rotl(v1, 1) + blob_hash_rotl(v2, 7) +
+		    blob_hash_rotl(v3, 12) + blob_hash_rotl(v4, 18);
+		h = blob_hash_merge(h, v1);
+		h = blob_hash_merge(h, v2);
+		h = blob_hash_merge(h, v3);
+		h = blob_hash_merge(h, v4);
+	} else {
+		h = BLOB_HASH_P5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= blob_hash_round(0, blob_hash_read64(p));
+		h = blob_hash_rotl(h, 27) * BLOB_HASH_P1 + BLOB_HASH_P4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t) blob_hash_read32(p) * BLOB_HASH_P1;
+		h = blob_hash_rotl(h, 23) * BLOB_HASH_P2 + BLOB_HASH_P3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= *p * BLOB_HASH_P5;
+		h = blob_hash_rotl(h, 11) * BLOB_HASH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= BLOB_HASH_P2;
+	h ^= h >> 29;
+	h *= BLOB_HASH_P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t
+blob_hash(const struct blob_attr *attr)
+{
+	return blob_hash_data(attr, blob_pad_len(attr));
+}
+
+struct blob_attr *
+blob_memdup_hash(const struct blob_attr *attr)
+{
+	struct blob_attr *ret;
+	int size = blob_pad_len(attr);
+	uint64_t hash = blob_hash(attr);
+
+	ret = malloc(size + sizeof(hash));
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, attr, size);
+	memcpy((char *) ret + size, &hash, sizeof(hash));
+	return ret;
+}
+
+uint64_t
+blob_cached_hash(const struct blob_attr *attr)
+{
+	uint64_t hash;
+
+	memcpy(&hash, (const char *) attr + blob_pad_len(attr), sizeof(hash));
+	return hash;
+}
+
+bool
+blob_hashed_equal(const struct blob_attr *a1, const struct blob_attr *a2)
+{
+	if (!a1 && !a2)
+		return true;
+
+	if (!a1 || !a2)
+		return false;
+
+	if (blob_pad_len(a1) != blob_pad_len(a2))
+		return false;
+
+	if (blob_cached_hash(a1) != blob_cached_hash(a2))
+		return false;
+
+	return !memcmp(a1, a2, blob_pad_len(a1));
+}
+
+struct blob_attr *
+blob_memdup_arena(struct arena *a, const struct blob_attr *attr)
+{
+	return arena_memdup(a, attr, blob_pad_len(attr));
+}
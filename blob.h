@@ -66,6 +66,17 @@ struct blob_buf {
 	bool (*grow)(struct blob_buf *buf, int minlen);
 	int buflen;
 	void *buf;
+
+	/* names of the open compact container, see blobmsg_open_compact */
+	struct blobmsg_names *names;
+};
+
+struct arena;
+
+/* blob_buf with its buffer allocated from an arena, see blob_arena_buf_init */
+struct blob_arena_buf {
+	struct blob_buf buf;
+	struct arena *arena;
 };
 
 /*
@@ -192,7 +203,36 @@ extern void blob_set_raw_len(struct blob_attr *attr, unsigned int len);
 extern bool blob_attr_equal(const struct blob_attr *a1, const struct blob_attr *a2);
 extern int blob_buf_init(struct blob_buf *buf, int id);
 extern void blob_buf_free(struct blob_buf *buf);
+
+/*
+ * blob_buf_reset: start a new message like blob_buf_init, keeping the
+ * allocated buffer for reuse. If trim is set and the buffer has grown beyond
+ * trim bytes, it is shrunk back to that size first, so that a single large
+ * message does not pin its memory.
+ */
+extern int blob_buf_reset(struct blob_buf *buf, int id, int trim);
+
+/*
+ * blob_arena_buf_init: initialize a blob_buf that allocates from an arena.
+ * Each call starts a new buffer; its memory is released with the arena and
+ * blob_buf_free must not be used.
+ */
+extern int blob_arena_buf_init(struct blob_arena_buf *ab, struct arena *a, int id);
 extern bool blob_buf_grow(struct blob_buf *buf, int required);
+
+/*
+ * blob_buf_reserve: make sure the buffer can hold len bytes without growing,
+ * e.g. using an expected size or blob_pad_len() of a previous message.
+ * Can be called before blob_buf_init.
+ */
+extern bool blob_buf_reserve(struct blob_buf *buf, int len);
+
+/*
+ * blob_buf_set_growth: set the minimum and maximum step by which the default
+ * grow function extends a buffer. Buffers grow by their current size in
+ * between, so building large messages needs a logarithmic number of reallocs.
+ */
+extern void blob_buf_set_growth(int floor, int cap);
 extern struct blob_attr *blob_new(struct blob_buf *buf, int id, int payload);
 extern void *blob_nest_start(struct blob_buf *buf, int id);
 extern void blob_nest_end(struct blob_buf *buf, void *cookie);
@@ -201,6 +241,26 @@ extern bool blob_check_type(const void *ptr, unsigned int len, int type);
 extern int blob_parse(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max);
 extern int blob_parse_untrusted(struct blob_attr *attr, size_t attr_len, struct blob_attr **data, const struct blob_attr_info *info, int max);
 extern struct blob_attr *blob_memdup(const struct blob_attr *attr);
+extern struct blob_attr *blob_memdup_arena(struct arena *a, const struct blob_attr *attr);
+
+/*
+ * blob_hash: fast non-cryptographic (XXH64) hash over an attribute including
+ * its header, so equal attributes always hash equal. The result is the same
+ * on little and big endian hosts.
+ */
+extern uint64_t blob_hash(const struct blob_attr *attr);
+
+/* blob_hash_data: XXH64 with seed 0 over len bytes of data */
+extern uint64_t blob_hash_data(const void *data, size_t len);
+
+/*
+ * blob_memdup_hash: like blob_memdup, but stores the hash of the copy right
+ * behind it. blob_cached_hash and blob_hashed_equal may only be used on such
+ * copies; blob_hashed_equal only compares the data if the hashes match.
+ */
+extern struct blob_attr *blob_memdup_hash(const struct blob_attr *attr);
+extern uint64_t blob_cached_hash(const struct blob_attr *attr);
+extern bool blob_hashed_equal(const struct blob_attr *a1, const struct blob_attr *a2);
 extern struct blob_attr *blob_put_raw(struct blob_buf *buf, const void *ptr, unsigned int len);
 
 static inline struct blob_attr *
@@ -0,0 +1,715 @@
+/*
+ * blobmsg-gen - generate specialized parse functions for blobmsg policies
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reads a C file and writes a header with two functions for every
+ * initialized array of struct blobmsg_policy <name>:
+ *
+ *   <name>_parse(tb, data, len)
+ *   <name>_parse_ext(tb, data, len, flags)
+ *
+ * They behave like blobmsg_parse and blobmsg_parse_ext with that policy,
+ * but dispatch on the name length and first byte instead of comparing
+ * every attribute against every policy entry. The header has to be
+ * included after the policy definition, at file scope.
+ */
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* blobmsg_parse compares against an 8 bit policy name length */
+#define MAX_NAMELEN	255
+
+enum token_type {
+	TOK_EOF,
+	TOK_IDENT,
+	TOK_NUMBER,
+	TOK_STRING,
+	TOK_PUNCT,
+};
+
+struct token {
+	enum token_type type;
+	char *text;
+	int len;
+	int line;
+};
+
+struct entry {
+	char *index;
+	bool has_name;
+	char *name;
+	int namelen;
+	char *type;
+	bool done;
+};
+
+struct policy {
+	char *name;
+	struct entry *entries;
+	int n_entries;
+};
+
+static const char *filename;
+static struct token *tokens;
+static int n_tokens, cur;
+
+static void __attribute__((noreturn, format(printf, 2, 3)))
+fail(int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s:%d: ", filename, line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void *xalloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static char *xstrndup(const char *str, int len)
+{
+	char *ret = xalloc(NULL, len + 1);
+
+	memcpy(ret, str, len);
+	ret[len] = 0;
+
+	return ret;
+}
+
+static void add_token(enum token_type type, char *text, int len, int line)
+{
+	struct token *t;
+
+	if (!(n_tokens % 256))
+		tokens = xalloc(tokens, (n_tokens + 256) * sizeof(*tokens));
+
+	t = &tokens[n_tokens++];
+	t->type = type;
+	t->text = text;
+	t->len = len;
+	t->line = line;
+}
+
+static int unescape(const char **src, int line)
+{
+	const char *s = *src;
+	int val = 0, i;
+
+	switch (*s) {
+	case 'n':
+		val = '\n';
+		break;
+	case 't':
+		val = '\t';
+		break;
+	case 'r':
+		val = '\r';
+		break;
+	case 'x':
+		for (i = 0; i < 2 && isxdigit((unsigned char) s[1]); i++, s++)
+			val = val * 16 + (isdigit((unsigned char) s[1]) ?
+					  s[1] - '0' : tolower((unsigned char) s[1]) - 'a' + 10);
+		if (!i)
+			fail(line, "invalid escape sequence");
+		break;
+	case '0' ... '7':
+		for (i = 0; i < 3 && s[0] >= '0' && s[0] <= '7'; i++, s++)
+			val = val * 8 + s[0] - '0';
+		s--;
+		break;
+	case '\\':
+	case '\'':
+	case '"':
+	case '?':
+		val = *s;
+		break;
+	default:
+		fail(line, "unsupported escape sequence '\\%c'", *s);
+	}
+
+	*src = s + 1;
+	return val;
+}
+
+static void tokenize(const char *s)
+{
+	bool line_start = true;
+	int line = 1;
+
+	while (*s) {
+		const char *start = s;
+
+		if (*s == '\n') {
+			line_start = true;
+			line++;
+			s++;
+			continue;
+		}
+
+		if (isspace((unsigned char) *s)) {
+			s++;
+			continue;
+		}
+
+		if (line_start && *s == '#') {
+			/* skip preprocessor lines, including continuations */
+			while (*s && (*s != '\n' || s[-1] == '\\')) {
+				if (*s == '\n')
+					line++;
+				s++;
+			}
+			continue;
+		}
+		line_start = false;
+
+		if (s[0] == '/' && s[1] == '*') {
+			for (s += 2; *s && !(s[0] == '*' && s[1] == '/'); s++)
+				if (*s == '\n')
+					line++;
+			if (!*s)
+				fail(line, "unterminated comment");
+			s += 2;
+			continue;
+		}
+
+		if (s[0] == '/' && s[1] == '/') {
+			while (*s && *s != '\n')
+				s++;
+			continue;
+		}
+
+		if (isalpha((unsigned char) *s) || *s == '_') {
+			while (isalnum((unsigned char) *s) || *s == '_')
+				s++;
+			add_token(TOK_IDENT, xstrndup(start, s - start), s - start, line);
+			continue;
+		}
+
+		if (isdigit((unsigned char) *s)) {
+			while (isalnum((unsigned char) *s) || *s == '_' || *s == '.')
+				s++;
+			add_token(TOK_NUMBER, xstrndup(start, s - start), s - start, line);
+			continue;
+		}
+
+		if (*s == '\'') {
+			for (s++; *s && *s != '\'' && *s != '\n'; s++)
+				if (*s == '\\' && s[1])
+					s++;
+			if (*s != '\'')
+				fail(line, "unterminated character constant");
+			s++;
+			add_token(TOK_NUMBER, xstrndup(start, s - start), s - start, line);
+			continue;
+		}
+
+		if (*s == '"') {
+			char *str = xalloc(NULL, strlen(s) + 1);
+			int len = 0;
+
+			for (s++; *s && *s != '"' && *s != '\n'; ) {
+				if (*s == '\\') {
+					s++;
+					str[len++] = unescape(&s, line);
+				} else {
+					str[len++] = *s++;
+				}
+			}
+			if (*s != '"')
+				fail(line, "unterminated string");
+			s++;
+			str[len] = 0;
+			add_token(TOK_STRING, str, len, line);
+			continue;
+		}
+
+		add_token(TOK_PUNCT, xstrndup(s, 1), 1, line);
+		s++;
+	}
+
+	add_token(TOK_EOF, "", 0, line);
+}
+
+static struct token *peek(int ofs)
+{
+	if (cur + ofs >= n_tokens)
+		return &tokens[n_tokens - 1];
+
+	return &tokens[cur + ofs];
+}
+
+static bool is_punct(const struct token *t, char c)
+{
+	return t->type == TOK_PUNCT && t->text[0] == c;
+}
+
+static bool is_ident(const struct token *t, const char *name)
+{
+	return t->type == TOK_IDENT && !strcmp(t->text, name);
+}
+
+static void expect(char c)
+{
+	if (!is_punct(peek(0), c))
+		fail(peek(0)->line, "expected '%c'", c);
+	cur++;
+}
+
+/* collect tokens up to a closing bracket or a top level ',' */
+static char *collect_expr(char end)
+{
+	char *expr = xalloc(NULL, 1);
+	int depth = 0, len = 0;
+
+	expr[0] = 0;
+	while (1) {
+		struct token *t = peek(0);
+
+		if (t->type == TOK_EOF)
+			fail(t->line, "unexpected end of file");
+		if (t->type == TOK_STRING)
+			fail(t->line, "unexpected string");
+
+		if (t->type == TOK_PUNCT && strchr("([{", t->text[0]))
+			depth++;
+		else if (t->type == TOK_PUNCT && strchr(")]}", t->text[0])) {
+			if (!depth && (t->text[0] == end || end == ','))
+				break;
+			depth--;
+		} else if (!depth && is_punct(t, end))
+			break;
+
+		expr = xalloc(expr, len + t->len + 2);
+		len += sprintf(expr + len, "%s%s", len ? " " : "", t->text);
+		cur++;
+	}
+
+	if (!len)
+		fail(peek(0)->line, "expected expression");
+
+	return expr;
+}
+
+static void parse_name(struct entry *e)
+{
+	struct token *t = peek(0);
+
+	if (is_ident(t, "NULL") || (t->type == TOK_NUMBER && !strcmp(t->text, "0"))) {
+		e->has_name = false;
+		cur++;
+		return;
+	}
+
+	if (t->type != TOK_STRING)
+		fail(t->line, "policy names need to be string literals");
+
+	e->has_name = true;
+	e->name = NULL;
+	e->namelen = 0;
+	for (; (t = peek(0))->type == TOK_STRING; cur++) {
+		e->name = xalloc(e->name, e->namelen + t->len + 1);
+		memcpy(e->name + e->namelen, t->text, t->len + 1);
+		e->namelen += t->len;
+	}
+}
+
+static void parse_entry(struct entry *e)
+{
+	int pos = 0;
+
+	expect('{');
+	while (!is_punct(peek(0), '}')) {
+		const char *field;
+
+		if (is_punct(peek(0), '.')) {
+			cur++;
+			if (peek(0)->type != TOK_IDENT)
+				fail(peek(0)->line, "expected field name");
+			field = peek(0)->text;
+			cur++;
+			expect('=');
+		} else {
+			field = pos == 0 ? "name" : pos == 1 ? "type" : NULL;
+			if (!field)
+				fail(peek(0)->line, "too many initializers");
+		}
+		pos++;
+
+		if (!strcmp(field, "name"))
+			parse_name(e);
+		else if (!strcmp(field, "type"))
+			e->type = collect_expr(',');
+		else
+			fail(peek(0)->line, "unknown field '%s'", field);
+
+		if (is_punct(peek(0), ','))
+			cur++;
+	}
+	expect('}');
+}
+
+static void parse_policy(struct policy *p)
+{
+	char *base = NULL;
+	int ofs = 0;
+
+	expect('{');
+	while (!is_punct(peek(0), '}')) {
+		struct entry *e;
+
+		if (is_punct(peek(0), '[')) {
+			cur++;
+			base = collect_expr(']');
+			expect(']');
+			expect('=');
+			ofs = 0;
+		}
+
+		p->entries = xalloc(p->entries, (p->n_entries + 1) * sizeof(*p->entries));
+		e = &p->entries[p->n_entries++];
+		memset(e, 0, sizeof(*e));
+
+		if (!base) {
+			e->index = xalloc(NULL, 16);
+			sprintf(e->index, "%d", ofs);
+		} else if (!ofs) {
+			e->index = base;
+		} else {
+			e->index = xalloc(NULL, strlen(base) + 16);
+			sprintf(e->index, "(%s) + %d", base, ofs);
+		}
+		ofs++;
+
+		parse_entry(e);
+		if (!e->type)
+			e->type = "BLOBMSG_TYPE_UNSPEC";
+
+		if (e->has_name && e->namelen > MAX_NAMELEN) {
+			fprintf(stderr, "%s: warning: name of %s[%s] is too long to ever match\n",
+				filename, p->name, e->index);
+			e->has_name = false;
+		}
+
+		if (is_punct(peek(0), ','))
+			cur++;
+	}
+	expect('}');
+}
+
+static struct policy *find_policies(int *n)
+{
+	struct policy *list = NULL;
+
+	*n = 0;
+	for (cur = 0; peek(0)->type != TOK_EOF; cur++) {
+		struct policy *p;
+
+		if (!is_ident(peek(0), "struct") || !is_ident(peek(1), "blobmsg_policy") ||
+		    peek(2)->type != TOK_IDENT || !is_punct(peek(3), '['))
+			continue;
+
+		list = xalloc(list, (*n + 1) * sizeof(*list));
+		p = &list[(*n)++];
+		memset(p, 0, sizeof(*p));
+		p->name = peek(2)->text;
+
+		cur += 4;
+		if (!is_punct(peek(0), ']'))
+			free(collect_expr(']'));
+		expect(']');
+		expect('=');
+		parse_policy(p);
+	}
+
+	return list;
+}
+
+static void print_string(FILE *out, const char *str, int len)
+{
+	fputc('"', out);
+	for (int i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c == '"' || c == '\\' || c == '?' || !isprint(c))
+			fprintf(out, "\\%03o", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void print_char(FILE *out, unsigned char c)
+{
+	if (isalnum(c) || c == '_' || c == '-' || c == '.')
+		fprintf(out, "'%c'", c);
+	else
+		fprintf(out, "0x%02x", c);
+}
+
+static void print_type_check(FILE *out, const char *type)
+{
+	if (!strcmp(type, "BLOBMSG_TYPE_UNSPEC") || !strcmp(type, "0"))
+		return;
+
+	if (!strcmp(type, "BLOBMSG_CAST_INT64"))
+		fprintf(out, "blob_id(attr) >= BLOBMSG_TYPE_INT64 &&\n\t\t\t\t    "
+			"blob_id(attr) <= BLOBMSG_TYPE_INT8 && ");
+	else
+		fprintf(out, "blob_id(attr) == %s && ", type);
+}
+
+/* fill all entries using the name, in policy order like blobmsg_parse */
+static void print_match(FILE *out, struct policy *p, struct entry *e,
+			const char *indent)
+{
+	for (struct entry *m = e; m < &p->entries[p->n_entries]; m++) {
+		if (!m->has_name || m->namelen != e->namelen ||
+		    memcmp(m->name, e->name, e->namelen) != 0)
+			continue;
+
+		fprintf(out, "%sif (", indent);
+		print_type_check(out, m->type);
+		fprintf(out, "!tb[%s])\n%s\ttb[%s] = attr;\n", m->index, indent, m->index);
+		m->done = true;
+	}
+}
+
+static void print_compare(FILE *out, struct entry *e, int skip,
+			  const char *indent, bool first)
+{
+	/* a one byte name is already matched by its first byte */
+	if (e->namelen == skip) {
+		fprintf(out, "%s%s{\n", indent, first ? "" : "} else ");
+		return;
+	}
+
+	fprintf(out, "%s%sif (!memcmp(name%s, ", indent, first ? "" : "} else ",
+		skip ? " + 1" : "");
+	print_string(out, e->name + skip, e->namelen - skip);
+	fprintf(out, ", %d)) {\n", e->namelen - skip);
+}
+
+static void print_length_case(FILE *out, struct policy *p, int len)
+{
+	struct entry *e;
+	int n = 0, n_first = 0;
+	bool seen[256] = {};
+
+	for (e = p->entries; e < &p->entries[p->n_entries]; e++) {
+		if (!e->has_name || e->namelen != len || e->done)
+			continue;
+
+		n++;
+		if (!seen[(unsigned char) e->name[0]]) {
+			seen[(unsigned char) e->name[0]] = true;
+			n_first++;
+		}
+	}
+
+	if (!n)
+		return;
+
+	fprintf(out, "\t\tcase %d:\n", len);
+
+	if (!len) {
+		for (e = p->entries; e < &p->entries[p->n_entries]; e++)
+			if (e->has_name && !e->namelen && !e->done)
+				print_match(out, p, e, "\t\t\t");
+		fprintf(out, "\t\t\tbreak;\n");
+		return;
+	}
+
+	/* a single name, or only one first byte: no inner switch */
+	if (n_first == 1) {
+		bool first = true;
+
+		for (e = p->entries; e < &p->entries[p->n_entries]; e++) {
+			if (!e->has_name || e->namelen != len || e->done)
+				continue;
+
+			print_compare(out, e, 0, "\t\t\t", first);
+			print_match(out, p, e, "\t\t\t\t");
+			first = false;
+		}
+		fprintf(out, "\t\t\t}\n\t\t\tbreak;\n");
+		return;
+	}
+
+	fprintf(out, "\t\t\tswitch ((uint8_t) name[0]) {\n");
+	for (int c = 0; c < 256; c++) {
+		bool first = true;
+
+		if (!seen[c])
+			continue;
+
+		fprintf(out, "\t\t\tcase ");
+		print_char(out, c);
+		fprintf(out, ":\n");
+		for (e = p->entries; e < &p->entries[p->n_entries]; e++) {
+			if (!e->has_name || e->namelen != len || e->done ||
+			    (unsigned char) e->name[0] != c)
+				continue;
+
+			print_compare(out, e, 1, "\t\t\t\t", first);
+			print_match(out, p, e, "\t\t\t\t\t");
+			first = false;
+		}
+		fprintf(out, "\t\t\t\t}\n\t\t\t\tbreak;\n");
+	}
+	fprintf(out, "\t\t\t}\n\t\t\tbreak;\n");
+}
+
+static void print_policy(FILE *out, struct policy *p)
+{
+	bool names = false;
+
+	for (int i = 0; i < p->n_entries; i++)
+		names |= p->entries[i].has_name;
+
+	fprintf(out,
+		"static inline int\n"
+		"%s_parse_ext(struct blob_attr **tb, void *data, unsigned int len,\n"
+		"\t\tunsigned int flags)\n"
+		"{\n", p->name);
+	if (names)
+		fprintf(out,
+			"\tconst struct blobmsg_hdr *hdr;\n"
+			"\tconst char *name;\n");
+	fprintf(out,
+		"\tstruct blob_attr *attr;\n"
+		"\n"
+		"\tmemset(tb, 0, ARRAY_SIZE(%s) * sizeof(*tb));\n"
+		"\tif (!data || !len)\n"
+		"\t\treturn -EINVAL;\n"
+		"\n"
+		"\tif (flags & BLOBMSG_PARSE_VALIDATE) {\n"
+		"\t\tif (!blobmsg_check_tree_len(data, len))\n"
+		"\t\t\treturn -1;\n"
+		"\n"
+		"\t\tflags |= BLOBMSG_PARSE_TRUSTED;\n"
+		"\t}\n"
+		"\n"
+		"\t__blob_for_each_attr(attr, data, len) {\n"
+		"\t\tif (!(flags & BLOBMSG_PARSE_TRUSTED) &&\n"
+		"\t\t    !blobmsg_check_attr_len(attr, false, len))\n"
+		"\t\t\treturn -1;\n", p->name);
+
+	if (names) {
+		fprintf(out,
+			"\n"
+			"\t\tif (!blob_is_extended(attr))\n"
+			"\t\t\tcontinue;\n"
+			"\n"
+			"\t\thdr = blobmsg_name_hdr(blob_data(attr));\n"
+			"\t\tname = (const char *) hdr->name;\n"
+			"\t\tswitch (blobmsg_namelen(hdr)) {\n");
+		for (int len = 0; len <= MAX_NAMELEN; len++)
+			print_length_case(out, p, len);
+		fprintf(out, "\t\t}\n");
+	}
+
+	fprintf(out,
+		"\t}\n"
+		"\n"
+		"\treturn 0;\n"
+		"}\n"
+		"\n"
+		"static inline int\n"
+		"%s_parse(struct blob_attr **tb, void *data, unsigned int len)\n"
+		"{\n"
+		"\treturn %s_parse_ext(tb, data, len, 0);\n"
+		"}\n", p->name, p->name);
+}
+
+static char *read_file(const char *name)
+{
+	char *buf = NULL;
+	size_t len = 0, ret;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+
+	do {
+		buf = xalloc(buf, len + 4097);
+		ret = fread(buf + len, 1, 4096, f);
+		len += ret;
+	} while (ret > 0);
+	buf[len] = 0;
+	fclose(f);
+
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	struct policy *policies;
+	FILE *out = stdout;
+	int n;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s <input> [<output>]\n", argv[0]);
+		return 1;
+	}
+
+	filename = argv[1];
+	tokenize(read_file(filename));
+	policies = find_policies(&n);
+	if (!n) {
+		fprintf(stderr, "%s: no blobmsg_policy arrays found\n", filename);
+		return 1;
+	}
+
+	if (argc > 2) {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			perror(argv[2]);
+			return 1;
+		}
+	}
+
+	fprintf(out, "/* generated by blobmsg-gen from %s, do not edit */\n", filename);
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "\n");
+		print_policy(out, &policies[i]);
+	}
+
+	if (out != stdout && fclose(out)) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -30,7 +30,71 @@ bool blobmsg_check_attr(const struct blob_attr *attr, bool name)
 	return blobmsg_check_attr_len(attr, name, blob_raw_len(attr));
 }
 
-static bool blobmsg_check_name(const struct blob_attr *attr, bool name)
+static const uint32_t *blobmsg_sorted_index(const struct blob_attr *attr)
+{
+	const struct blobmsg_hdr *hdr = blob_data(attr);
+
+	return (const uint32_t *) ((const char *) hdr + blobmsg_hdr_size(hdr));
+}
+
+static bool blobmsg_check_index(const struct blob_attr *attr, size_t hdrlen)
+{
+	const uint32_t *idx = blobmsg_sorted_index(attr);
+	size_t len = blob_len(attr) - hdrlen;
+	struct blob_attr *cur;
+	const char *data;
+	uint32_t i = 0, n;
+
+	if (blob_id(attr) != BLOBMSG_TYPE_TABLE || len < sizeof(uint32_t))
+		return false;
+
+	n = be32_to_cpu(idx[0]);
+	if (n > len / sizeof(uint32_t) - 1)
+		return false;
+
+	/* the index has to list exactly the member offsets */
+	data = blobmsg_data(attr);
+	len = blobmsg_data_len(attr);
+	__blob_for_each_attr(cur, data, len) {
+		if (i == n || be32_to_cpu(idx[i + 1]) != (uint32_t) ((char *) cur - data))
+			return false;
+
+		i++;
+	}
+
+	return i == n;
+}
+
+/*
+ * References are only valid inside of a compact container starting at start,
+ * the name they point to has to be complete before the referencing attribute.
+ */
+static bool blobmsg_check_ref(const struct blob_attr *attr, const char *start)
+{
+	const struct blobmsg_hdr *hdr = blob_data(attr);
+	const char *end = (const char *) attr;
+	uint16_t namelen;
+
+	if (!start || (hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_COMPACT)) ||
+	    blobmsg_ref_dist(hdr) > (size_t) ((const char *) hdr - start))
+		return false;
+
+	hdr = blobmsg_name_hdr(hdr);
+	if ((const char *) hdr + sizeof(struct blobmsg_hdr) > end)
+		return false;
+
+	if (hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_REF))
+		return false;
+
+	namelen = be16_to_cpu(hdr->namelen) & BLOBMSG_NAMELEN_MASK;
+	if ((const char *) hdr->name + namelen >= end)
+		return false;
+
+	return hdr->name[namelen] == 0;
+}
+
+static bool blobmsg_check_name(const struct blob_attr *attr, bool name,
+			       const char *start)
 {
 	const struct blobmsg_hdr *hdr;
 	uint16_t namelen;
@@ -42,20 +106,38 @@ static bool blobmsg_check_name(const struct blob_attr *attr, bool name)
 		return false;
 
 	hdr = (const struct blobmsg_hdr *)blob_data(attr);
-	if (name && !hdr->namelen)
+	if (blob_len(attr) < (size_t)blobmsg_hdr_size(hdr))
 		return false;
 
+	if (blobmsg_hdr_is_ref(hdr)) {
+		if (!blobmsg_check_ref(attr, start))
+			return false;
+	} else if (hdr->name[blobmsg_namelen(hdr)] != 0) {
+		return false;
+	}
+
 	namelen = blobmsg_namelen(hdr);
-	if (blob_len(attr) < (size_t)blobmsg_hdrlen(namelen))
+	if (name && !namelen)
 		return false;
 
-	if (hdr->name[namelen] != 0)
+	/* compact containers can not be sorted */
+	if (blobmsg_is_compact(attr) &&
+	    (blobmsg_is_sorted(attr) ||
+	     (blob_id(attr) != BLOBMSG_TYPE_TABLE &&
+	      blob_id(attr) != BLOBMSG_TYPE_ARRAY)))
 		return false;
 
+	if (blobmsg_is_sorted(attr))
+		return blobmsg_check_index(attr, blobmsg_hdr_size(hdr));
+
 	return true;
 }
 
-bool blobmsg_check_attr_len(const struct blob_attr *attr, bool name, size_t len)
+static bool blobmsg_check_list(const void *data, size_t len, bool name,
+			       const char *start, int depth);
+
+static bool __blobmsg_check_attr_len(const struct blob_attr *attr, bool name,
+				     size_t len, const char *start, int depth)
 {
 	const char *data;
 	size_t data_len;
@@ -68,22 +150,35 @@ bool blobmsg_check_attr_len(const struct blob_attr *attr, bool name, size_t len)
 	if (data_len < sizeof(struct blob_attr) || data_len > len)
 		return false;
 
-	if (!blobmsg_check_name(attr, name))
+	if (!blobmsg_check_name(attr, name, start))
 		return false;
 
 	id = blob_id(attr);
 	if (id > BLOBMSG_TYPE_LAST)
 		return false;
 
-	if (!blob_type[id])
-		return true;
-
 	data = blobmsg_data(attr);
 	data_len = blobmsg_data_len(attr);
 
+	/*
+	 * the references of the members can only be checked here, containers
+	 * inside of it are checked against the same start
+	 */
+	if (blobmsg_is_compact(attr) && !start)
+		return blobmsg_check_list(data, data_len, id == BLOBMSG_TYPE_TABLE,
+					  data, depth + 1);
+
+	if (!blob_type[id])
+		return true;
+
 	return blob_check_type(data, data_len, blob_type[id]);
 }
 
+bool blobmsg_check_attr_len(const struct blob_attr *attr, bool name, size_t len)
+{
+	return __blobmsg_check_attr_len(attr, name, len, NULL, 0);
+}
+
 int blobmsg_check_array(const struct blob_attr *attr, int type)
 {
 	return blobmsg_check_array_len(attr, type, blob_raw_len(attr));
@@ -93,6 +188,7 @@ int blobmsg_check_array_len(const struct blob_attr *attr, int type,
 			    size_t blob_len)
 {
 	struct blob_attr *cur;
+	const char *start;
 	size_t rem;
 	bool name;
 	int size = 0;
@@ -114,11 +210,12 @@ int blobmsg_check_array_len(const struct blob_attr *attr, int type,
 		return -1;
 	}
 
+	start = blobmsg_is_compact(attr) ? blobmsg_data(attr) : NULL;
 	blobmsg_for_each_attr(cur, attr, rem) {
 		if (type != BLOBMSG_TYPE_UNSPEC && blobmsg_type(cur) != type)
 			return -1;
 
-		if (!blobmsg_check_attr_len(cur, name, rem))
+		if (!__blobmsg_check_attr_len(cur, name, rem, start, 0))
 			return -1;
 
 		size++;
@@ -127,6 +224,41 @@ int blobmsg_check_array_len(const struct blob_attr *attr, int type,
 	return size;
 }
 
+#define BLOBMSG_MAX_DEPTH	64
+
+static bool blobmsg_check_list(const void *data, size_t len, bool name,
+			       const char *start, int depth)
+{
+	const struct blob_attr *attr;
+
+	if (depth > BLOBMSG_MAX_DEPTH)
+		return false;
+
+	__blob_for_each_attr(attr, data, len) {
+		if (!__blobmsg_check_attr_len(attr, name, len, start, depth))
+			return false;
+
+		if (blobmsg_is_compact(attr) && !start)
+			continue;
+
+		if (blob_id(attr) != BLOBMSG_TYPE_TABLE &&
+		    blob_id(attr) != BLOBMSG_TYPE_ARRAY)
+			continue;
+
+		if (!blobmsg_check_list(blobmsg_data(attr), blobmsg_data_len(attr),
+					blob_id(attr) == BLOBMSG_TYPE_TABLE, start,
+					depth + 1))
+			return false;
+	}
+
+	return true;
+}
+
+bool blobmsg_check_tree_len(const void *data, size_t len)
+{
+	return blobmsg_check_list(data, len, false, NULL, 0);
+}
+
 bool blobmsg_check_attr_list(const struct blob_attr *attr, int type)
 {
 	return blobmsg_check_array(attr, type) >= 0;
@@ -163,8 +295,30 @@ int blobmsg_parse_array(const struct blobmsg_policy *policy, int policy_len,
 	return 0;
 }
 
+static bool blobmsg_policy_match_type(const struct blobmsg_policy *policy,
+				      const struct blob_attr *attr)
+{
+	if (policy->type == BLOBMSG_TYPE_UNSPEC)
+		return true;
+
+	if (policy->type != BLOBMSG_CAST_INT64)
+		return blob_id(attr) == policy->type;
+
+	return blob_id(attr) == BLOBMSG_TYPE_INT64 ||
+	       blob_id(attr) == BLOBMSG_TYPE_INT32 ||
+	       blob_id(attr) == BLOBMSG_TYPE_INT16 ||
+	       blob_id(attr) == BLOBMSG_TYPE_INT8;
+}
+
 int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
                   struct blob_attr **tb, void *data, unsigned int len)
+{
+	return blobmsg_parse_ext(policy, policy_len, tb, data, len, 0);
+}
+
+int blobmsg_parse_ext(const struct blobmsg_policy *policy, int policy_len,
+		      struct blob_attr **tb, void *data, unsigned int len,
+		      unsigned int flags)
 {
 	const struct blobmsg_hdr *hdr;
 	struct blob_attr *attr;
@@ -174,6 +328,14 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 	memset(tb, 0, policy_len * sizeof(*tb));
 	if (!data || !len)
 		return -EINVAL;
+
+	if (flags & BLOBMSG_PARSE_VALIDATE) {
+		if (!blobmsg_check_tree_len(data, len))
+			return -1;
+
+		flags |= BLOBMSG_PARSE_TRUSTED;
+	}
+
 	pslen = alloca(policy_len);
 	for (i = 0; i < policy_len; i++) {
 		if (!policy[i].name)
@@ -183,27 +345,19 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 	}
 
 	__blob_for_each_attr(attr, data, len) {
-		if (!blobmsg_check_attr_len(attr, false, len))
+		if (!(flags & BLOBMSG_PARSE_TRUSTED) &&
+		    !blobmsg_check_attr_len(attr, false, len))
 			return -1;
 
 		if (!blob_is_extended(attr))
 			continue;
 
-		hdr = blob_data(attr);
+		hdr = blobmsg_name_hdr(blob_data(attr));
 		for (i = 0; i < policy_len; i++) {
 			if (!policy[i].name)
 				continue;
 
-			if (policy[i].type != BLOBMSG_TYPE_UNSPEC &&
-			    policy[i].type != BLOBMSG_CAST_INT64 &&
-			    blob_id(attr) != policy[i].type)
-				continue;
-
-			if (policy[i].type == BLOBMSG_CAST_INT64 &&
-			    (blob_id(attr) != BLOBMSG_TYPE_INT64 &&
-			     blob_id(attr) != BLOBMSG_TYPE_INT32 &&
-			     blob_id(attr) != BLOBMSG_TYPE_INT16 &&
-			     blob_id(attr) != BLOBMSG_TYPE_INT8))
+			if (!blobmsg_policy_match_type(&policy[i], attr))
 				continue;
 
 			if (blobmsg_namelen(hdr) != pslen[i])
@@ -222,27 +376,285 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 	return 0;
 }
 
+/* FNV-1a */
+static uint32_t blobmsg_name_hash(const char *name, unsigned int len)
+{
+	uint32_t hash = 2166136261u;
+
+	while (len--) {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+struct blobmsg_compiled_policy *
+blobmsg_policy_compile(const struct blobmsg_policy *policy, int policy_len)
+{
+	struct blobmsg_compiled_policy *cp;
+	struct blobmsg_policy_slot *slots;
+	unsigned int size = 4;
+	int i;
+
+	if (policy_len < 0 || policy_len > UINT16_MAX)
+		return NULL;
+
+	/* keep the table at most half full */
+	while (size < 2 * (unsigned int) policy_len)
+		size <<= 1;
+
+	cp = calloc_a(sizeof(*cp), &slots, size * sizeof(*slots));
+	if (!cp)
+		return NULL;
+
+	cp->policy = policy;
+	cp->policy_len = policy_len;
+	cp->mask = size - 1;
+	cp->slots = slots;
+
+	for (i = 0; i < policy_len; i++) {
+		struct blobmsg_policy_slot *slot;
+		size_t namelen;
+		uint32_t hash;
+		unsigned int n;
+
+		if (!policy[i].name)
+			continue;
+
+		namelen = strlen(policy[i].name);
+		if (namelen > UINT16_MAX)
+			continue;
+
+		/* entries sharing a name are kept in policy order along the probe */
+		hash = blobmsg_name_hash(policy[i].name, namelen);
+		for (n = hash & cp->mask; slots[n].index; n = (n + 1) & cp->mask);
+
+		slot = &slots[n];
+		slot->hash = hash;
+		slot->index = i + 1;
+		slot->namelen = namelen;
+	}
+
+	return cp;
+}
+
+void blobmsg_compiled_policy_free(struct blobmsg_compiled_policy *cp)
+{
+	free(cp);
+}
+
+int blobmsg_parse_compiled(const struct blobmsg_compiled_policy *cp,
+			   struct blob_attr **tb, void *data, unsigned int len)
+{
+	return blobmsg_parse_compiled_ext(cp, tb, data, len, 0);
+}
+
+int blobmsg_parse_compiled_ext(const struct blobmsg_compiled_policy *cp,
+			       struct blob_attr **tb, void *data, unsigned int len,
+			       unsigned int flags)
+{
+	const struct blobmsg_policy *policy = cp->policy;
+	const struct blobmsg_hdr *hdr;
+	struct blob_attr *attr;
+
+	memset(tb, 0, cp->policy_len * sizeof(*tb));
+	if (!data || !len)
+		return -EINVAL;
+
+	if (flags & BLOBMSG_PARSE_VALIDATE) {
+		if (!blobmsg_check_tree_len(data, len))
+			return -1;
+
+		flags |= BLOBMSG_PARSE_TRUSTED;
+	}
+
+	__blob_for_each_attr(attr, data, len) {
+		const struct blobmsg_policy_slot *slot;
+		unsigned int namelen, n;
+		uint32_t hash;
+
+		if (!(flags & BLOBMSG_PARSE_TRUSTED) &&
+		    !blobmsg_check_attr_len(attr, false, len))
+			return -1;
+
+		if (!blob_is_extended(attr))
+			continue;
+
+		hdr = blobmsg_name_hdr(blob_data(attr));
+		namelen = blobmsg_namelen(hdr);
+		hash = blobmsg_name_hash((const char *) hdr->name, namelen);
+		for (n = hash & cp->mask; (slot = &cp->slots[n])->index;
+		     n = (n + 1) & cp->mask) {
+			int i = slot->index - 1;
+
+			if (slot->hash != hash || slot->namelen != namelen)
+				continue;
+
+			if (tb[i])
+				continue;
+
+			if (!blobmsg_policy_match_type(&policy[i], attr))
+				continue;
+
+			if (memcmp(policy[i].name, hdr->name, namelen) != 0)
+				continue;
+
+			tb[i] = attr;
+		}
+	}
+
+	return 0;
+}
+
+
+struct blobmsg_name_slot {
+	uint32_t hash;
+	uint32_t offset;
+};
+
+/*
+ * first occurrences of names in the open compact container, as offsets of
+ * their headers in the buffer, starting at the offset of its data
+ */
+struct blobmsg_names {
+	uint32_t start;
+	unsigned int mask;
+	unsigned int count;
+	struct blobmsg_name_slot slots[];
+};
+
+static struct blobmsg_names *
+blobmsg_names_alloc(unsigned int size, const struct blobmsg_names *old)
+{
+	struct blobmsg_names *names;
+
+	names = calloc(1, sizeof(*names) + size * sizeof(names->slots[0]));
+	if (!names)
+		return NULL;
+
+	names->start = old ? old->start : 0;
+	names->mask = size - 1;
+	for (unsigned int i = 0; old && i <= old->mask; i++) {
+		const struct blobmsg_name_slot *slot = &old->slots[i];
+		unsigned int n;
+
+		if (!slot->offset)
+			continue;
+
+		for (n = slot->hash & names->mask; names->slots[n].offset;
+		     n = (n + 1) & names->mask);
+		names->slots[n] = *slot;
+		names->count++;
+	}
+
+	return names;
+}
+
+static struct blobmsg_name_slot *
+blobmsg_names_slot(struct blob_buf *buf, uint32_t hash)
+{
+	struct blobmsg_names *names = buf->names;
+	struct blobmsg_name_slot *slot;
+	unsigned int n;
+
+	/* keep the table at most half full */
+	if (2 * (names->count + 1) > names->mask + 1) {
+		names = blobmsg_names_alloc(2 * (names->mask + 1), buf->names);
+		if (!names)
+			return NULL;
+
+		free(buf->names);
+		buf->names = names;
+	}
+
+	for (n = hash & names->mask; (slot = &names->slots[n])->offset;
+	     n = (n + 1) & names->mask)
+		if (slot->hash == hash)
+			break;
+
+	return slot;
+}
+
+/*
+ * Names with the same hash share a slot, so check that the header at offset
+ * holds the name and lies inside the container, before the attribute at pos.
+ */
+static bool
+blobmsg_names_match(struct blob_buf *buf, uint32_t offset, const char *name,
+		    unsigned int namelen, uint32_t pos)
+{
+	const struct blobmsg_hdr *hdr;
+
+	if (offset < buf->names->start ||
+	    offset + sizeof(*hdr) + namelen + 1 > pos)
+		return false;
+
+	hdr = (const struct blobmsg_hdr *) ((char *) buf->buf + offset);
+	if (blobmsg_hdr_is_ref(hdr) ||
+	    (be16_to_cpu(hdr->namelen) & BLOBMSG_NAMELEN_MASK) != namelen)
+		return false;
+
+	return !memcmp(hdr->name, name, namelen) && !hdr->name[namelen];
+}
 
 static struct blob_attr *
 blobmsg_new(struct blob_buf *buf, int type, const char *name, int payload_len, void **data)
 {
+	struct blobmsg_name_slot *slot = NULL;
 	struct blob_attr *attr;
 	struct blobmsg_hdr *hdr;
 	int attrlen, namelen;
 	char *pad_start, *pad_end;
+	uint32_t hash = 0, pos = 0, dist = 0;
+	bool nested;
 
 	if (!name)
 		name = "";
 
 	namelen = strlen(name);
-	attrlen = blobmsg_hdrlen(namelen) + payload_len;
+	if (namelen > BLOBMSG_NAMELEN_MASK)
+		return NULL;
+
+	/*
+	 * containers inside of a compact one are marked as well, which needs
+	 * their full name, so that copies know to resolve their members
+	 */
+	nested = buf->names &&
+		 (type == BLOBMSG_TYPE_TABLE || type == BLOBMSG_TYPE_ARRAY);
+
+	/* a reference takes as much space as a one byte name */
+	if (buf->names && !nested && namelen > 1) {
+		pos = (char *) blob_next(buf->head) - (char *) buf->buf +
+		      sizeof(struct blob_attr);
+		hash = blobmsg_name_hash(name, namelen);
+		slot = blobmsg_names_slot(buf, hash);
+		if (slot && slot->offset &&
+		    blobmsg_names_match(buf, slot->offset, name, namelen, pos))
+			dist = (pos - slot->offset) / 4;
+	}
+
+	if (dist)
+		attrlen = sizeof(struct blobmsg_hdr) + 2 + payload_len;
+	else
+		attrlen = blobmsg_hdrlen(namelen) + payload_len;
 	attr = blob_new(buf, type, attrlen);
 	if (!attr)
 		return NULL;
 
 	attr->id_len |= be32_to_cpu(BLOB_ATTR_EXTENDED);
 	hdr = blob_data(attr);
+	if (dist) {
+		hdr->namelen = cpu_to_be16(BLOBMSG_NAMELEN_REF | (dist >> 16));
+		hdr->name[0] = dist >> 8;
+		hdr->name[1] = dist;
+		*data = blobmsg_data(attr);
+		return attr;
+	}
+
 	hdr->namelen = cpu_to_be16(namelen);
+	if (nested)
+		hdr->namelen |= cpu_to_be16(BLOBMSG_NAMELEN_COMPACT);
 
 	memcpy(hdr->name, name, namelen);
 	hdr->name[namelen] = '\0';
@@ -252,6 +664,13 @@ blobmsg_new(struct blob_buf *buf, int type, const char *name, int payload_len, v
 	if (pad_start < pad_end)
 		memset(pad_start, 0, pad_end - pad_start);
 
+	if (slot) {
+		if (!slot->offset)
+			buf->names->count++;
+		slot->hash = hash;
+		slot->offset = pos;
+	}
+
 	return attr;
 }
 
@@ -276,11 +695,183 @@ blobmsg_open_nested(struct blob_buf *buf, const char *name, bool array)
 	head = blobmsg_new(buf, type, name, 0, &data);
 	if (!head)
 		return NULL;
-	blob_set_raw_len(buf->head, blob_pad_len(buf->head) - blobmsg_hdrlen(strlen(name)));
+	blob_set_raw_len(buf->head, blob_pad_len(buf->head) - blob_len(head));
 	buf->head = head;
 	return (void *)offset;
 }
 
+void *
+blobmsg_open_compact(struct blob_buf *buf, const char *name, bool array)
+{
+	struct blobmsg_names *names;
+	struct blobmsg_hdr *hdr;
+	void *cookie;
+
+	if (buf->names)
+		return NULL;
+
+	names = blobmsg_names_alloc(64, NULL);
+	if (!names)
+		return NULL;
+
+	cookie = blobmsg_open_nested(buf, name, array);
+	if (!cookie) {
+		free(names);
+		return NULL;
+	}
+
+	hdr = blob_data(buf->head);
+	hdr->namelen |= cpu_to_be16(BLOBMSG_NAMELEN_COMPACT);
+	names->start = (char *) blobmsg_data(buf->head) - (char *) buf->buf;
+	buf->names = names;
+
+	return cookie;
+}
+
+void
+blobmsg_close_compact(struct blob_buf *buf, void *cookie)
+{
+	free(buf->names);
+	buf->names = NULL;
+	blob_nest_end(buf, cookie);
+}
+
+static int blobmsg_name_cmp(const void *k1, const void *k2)
+{
+	const struct blob_attr *a1 = *(const struct blob_attr **) k1;
+	const struct blob_attr *a2 = *(const struct blob_attr **) k2;
+	int ret;
+
+	ret = strcmp(blobmsg_name(a1), blobmsg_name(a2));
+	if (ret)
+		return ret;
+
+	/* keep duplicates in their original order */
+	return (a1 > a2) - (a1 < a2);
+}
+
+static int blobmsg_sort_members(struct blob_buf *buf)
+{
+	struct blob_attr *attr = buf->head, *cur, **members;
+	int offset = attr_to_offset(buf, attr) - BLOB_COOKIE;
+	struct blobmsg_hdr *hdr;
+	uint32_t *idx;
+	size_t len, rem, pos;
+	int required, n = 0, i;
+	char *data, *tmp;
+
+	if (blobmsg_type(attr) != BLOBMSG_TYPE_TABLE || !blob_is_extended(attr) ||
+	    blobmsg_is_sorted(attr) || buf->names)
+		return -EINVAL;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (!blob_is_extended(cur) || blobmsg_hdr_is_ref(blob_data(cur)))
+			return -EINVAL;
+
+		n++;
+	}
+
+	len = blobmsg_data_len(attr);
+	members = calloc_a(n * sizeof(*members), &tmp, len);
+	if (!members)
+		return -ENOMEM;
+
+	i = 0;
+	blobmsg_for_each_attr(cur, attr, rem)
+		members[i++] = cur;
+
+	qsort(members, n, sizeof(*members), blobmsg_name_cmp);
+	for (i = 0, pos = 0; i < n; pos += blob_pad_len(members[i]), i++)
+		memcpy(tmp + pos, members[i], blob_pad_len(members[i]));
+
+	required = offset + blob_pad_len(attr) + (n + 1) * sizeof(uint32_t) - buf->buflen;
+	if (required > 0 && !blob_buf_grow(buf, required)) {
+		free(members);
+		return -ENOMEM;
+	}
+
+	attr = buf->head;
+	hdr = blob_data(attr);
+	idx = blobmsg_data(attr);
+	data = (char *) &idx[n + 1];
+
+	/* members may have moved with the buffer, walk the sorted copy */
+	idx[0] = cpu_to_be32(n);
+	for (i = 0, pos = 0; i < n; pos += blob_pad_len((struct blob_attr *) (tmp + pos)), i++)
+		idx[i + 1] = cpu_to_be32(pos);
+	memcpy(data, tmp, len);
+	free(members);
+
+	hdr->namelen |= cpu_to_be16(BLOBMSG_NAMELEN_SORTED);
+	blob_set_raw_len(attr, blob_raw_len(attr) + (n + 1) * sizeof(uint32_t));
+
+	return 0;
+}
+
+int blobmsg_close_table_sorted(struct blob_buf *buf, void *cookie)
+{
+	int ret = blobmsg_sort_members(buf);
+
+	blob_nest_end(buf, cookie);
+	return ret;
+}
+
+struct blob_attr *blobmsg_find(const struct blob_attr *attr, const char *name)
+{
+	struct blob_attr *cur;
+	const uint32_t *idx;
+	unsigned int lo, hi;
+	char *data;
+	size_t rem;
+
+	if (!attr || blobmsg_type(attr) != BLOBMSG_TYPE_TABLE)
+		return NULL;
+
+	if (!blobmsg_is_sorted(attr)) {
+		blobmsg_for_each_attr(cur, attr, rem) {
+			if (blob_is_extended(cur) && !strcmp(blobmsg_name(cur), name))
+				return cur;
+		}
+
+		return NULL;
+	}
+
+	idx = blobmsg_sorted_index(attr);
+	data = blobmsg_data(attr);
+	lo = 0;
+	hi = be32_to_cpu(idx[0]);
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		cur = (struct blob_attr *) (data + be32_to_cpu(idx[mid + 1]));
+		if (strcmp(blobmsg_name(cur), name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == be32_to_cpu(idx[0]))
+		return NULL;
+
+	cur = (struct blob_attr *) (data + be32_to_cpu(idx[lo + 1]));
+	if (strcmp(blobmsg_name(cur), name) != 0)
+		return NULL;
+
+	return cur;
+}
+
+struct blob_attr *blobmsg_lookup_path(const struct blob_attr *attr,
+				      const char * const *path, int len)
+{
+	struct blob_attr *cur = (struct blob_attr *) attr;
+	int i;
+
+	for (i = 0; i < len && cur; i++)
+		cur = blobmsg_find(cur, path[i]);
+
+	return cur;
+}
+
 __attribute__((format(printf, 3, 0)))
 int blobmsg_vprintf(struct blob_buf *buf, const char *name, const char *format, va_list arg)
 {
@@ -389,3 +980,94 @@ blobmsg_add_field(struct blob_buf *buf, int type, const char *name,
 
 	return 0;
 }
+
+/* the header of attr has to fit into len, names are not checked */
+static bool blobmsg_check_hdr(const struct blob_attr *attr, size_t len)
+{
+	const struct blobmsg_hdr *hdr = blob_data(attr);
+
+	if (len < sizeof(struct blob_attr) ||
+	    blob_raw_len(attr) < sizeof(struct blob_attr) ||
+	    blob_raw_len(attr) > len)
+		return false;
+
+	if (!blob_is_extended(attr))
+		return true;
+
+	if (blob_len(attr) < sizeof(struct blobmsg_hdr) ||
+	    blob_len(attr) < (size_t) blobmsg_hdr_size(hdr))
+		return false;
+
+	return !blobmsg_is_sorted(attr) ||
+	       blobmsg_check_index(attr, blobmsg_hdr_size(hdr));
+}
+
+/* add the members of a compact container one by one, resolving their names */
+static int
+blobmsg_add_members(struct blob_buf *buf, const struct blob_attr *attr, int depth)
+{
+	const struct blob_attr *cur;
+	bool array = blob_id(attr) == BLOBMSG_TYPE_ARRAY;
+	bool root = !buf->names;
+	void *cookie;
+	size_t rem;
+	int ret = 0;
+
+	if (depth > BLOBMSG_MAX_DEPTH || !blobmsg_check_hdr(attr, blob_raw_len(attr)))
+		return -1;
+
+	if (root)
+		cookie = blobmsg_open_compact(buf, blobmsg_name(attr), array);
+	else
+		cookie = blobmsg_open_nested(buf, blobmsg_name(attr), array);
+	if (!cookie)
+		return -1;
+
+	rem = blobmsg_data_len(attr);
+	__blob_for_each_attr(cur, blobmsg_data(attr), rem) {
+		if (!blob_is_extended(cur)) {
+			if (!blob_put_raw(buf, cur, blob_pad_len(cur)))
+				ret = -1;
+		} else if (!blobmsg_check_hdr(cur, rem)) {
+			ret = -1;
+		} else if (blobmsg_is_compact(cur)) {
+			ret = blobmsg_add_members(buf, cur, depth + 1);
+		} else {
+			ret = blobmsg_add_field(buf, blobmsg_type(cur), blobmsg_name(cur),
+						blobmsg_data(cur), blobmsg_data_len(cur));
+		}
+		if (ret)
+			break;
+	}
+
+	if (root)
+		blobmsg_close_compact(buf, cookie);
+	else
+		blob_nest_end(buf, cookie);
+
+	return ret;
+}
+
+int
+blobmsg_add_blob(struct blob_buf *buf, struct blob_attr *attr)
+{
+	if (blobmsg_is_compact(attr))
+		return blobmsg_add_members(buf, attr, 0);
+
+	return blobmsg_add_field(buf, blobmsg_type(attr), blobmsg_name(attr),
+				 blobmsg_data(attr), blobmsg_data_len(attr));
+}
+
+struct blob_attr *
+blobmsg_expand(struct blob_buf *buf, const struct blob_attr *attr)
+{
+	if (!blob_is_extended(attr) ||
+	    (!blobmsg_is_compact(attr) && !blobmsg_hdr_is_ref(blob_data(attr))))
+		return (struct blob_attr *) attr;
+
+	if (blob_buf_init(buf, 0) ||
+	    blobmsg_add_blob(buf, (struct blob_attr *) attr))
+		return NULL;
+
+	return blob_data(buf->head);
+}
@@ -38,6 +38,32 @@ enum blobmsg_type {
 	BLOBMSG_CAST_INT64 = __BLOBMSG_TYPE_LAST,
 };
 
+/*
+ * A set top bit in namelen marks a table whose members are sorted by name.
+ * Its members are preceded by an index: the number of members followed by
+ * their offsets from the first member, all as big endian uint32_t.
+ *
+ * The next bit marks a name reference, written inside compact containers:
+ * instead of the name, namelen and the following two bytes hold a 29 bit
+ * distance in units of 4 bytes back to an earlier header with the same name.
+ *
+ * The third bit marks a compact container, see blobmsg_open_compact, and
+ * the containers inside of it. Name references only occur inside of one and
+ * point to headers within the outermost marked container.
+ *
+ * Wire format change: the three bits used to be part of the name length,
+ * so names are now limited to BLOBMSG_NAMELEN_MASK (8191) bytes and longer
+ * ones are rejected by blobmsg_add_field and friends. Readers built before
+ * the flags were introduced, including code still using an older inline
+ * blobmsg_data(), take a flagged header for a long name and mis-parse it.
+ * Messages without sorted or compact containers keep the old layout, so
+ * only send those to peers that are not known to understand the flags.
+ */
+#define BLOBMSG_NAMELEN_SORTED	0x8000
+#define BLOBMSG_NAMELEN_REF	0x4000
+#define BLOBMSG_NAMELEN_COMPACT	0x2000
+#define BLOBMSG_NAMELEN_MASK	0x1fff
+
 struct blobmsg_hdr {
 	uint16_t namelen;
 	uint8_t name[];
@@ -48,20 +74,82 @@ struct blobmsg_policy {
 	enum blobmsg_type type;
 };
 
+enum blobmsg_parse_flags {
+	/* validate the whole message tree, including nested containers */
+	BLOBMSG_PARSE_VALIDATE = (1 << 0),
+	/* data is part of an already validated tree, skip all checks */
+	BLOBMSG_PARSE_TRUSTED = (1 << 1),
+};
+
+struct blobmsg_policy_slot {
+	uint32_t hash;
+	uint16_t index;
+	uint16_t namelen;
+};
+
+struct blobmsg_compiled_policy {
+	const struct blobmsg_policy *policy;
+	int policy_len;
+
+	/* open addressing hash table of policy names, index 0 is unused */
+	unsigned int mask;
+	struct blobmsg_policy_slot *slots;
+};
+
 static inline int blobmsg_hdrlen(unsigned int namelen)
 {
 	return BLOBMSG_PADDING(sizeof(struct blobmsg_hdr) + namelen + 1);
 }
 
+static inline bool blobmsg_hdr_is_ref(const struct blobmsg_hdr *hdr)
+{
+	return !!(hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_REF));
+}
+
+/* size of the header itself, without the index of sorted tables */
+static inline int blobmsg_hdr_size(const struct blobmsg_hdr *hdr)
+{
+	if (blobmsg_hdr_is_ref(hdr))
+		return sizeof(struct blobmsg_hdr) + 2;
+
+	return blobmsg_hdrlen(be16_to_cpu(hdr->namelen) & BLOBMSG_NAMELEN_MASK);
+}
+
+/* distance in bytes from a name reference back to the name */
+static inline size_t blobmsg_ref_dist(const struct blobmsg_hdr *hdr)
+{
+	uint32_t dist;
+
+	dist = (be16_to_cpu(hdr->namelen) & BLOBMSG_NAMELEN_MASK) << 16;
+	dist |= (hdr->name[0] << 8) | hdr->name[1];
+
+	return 4 * (size_t) dist;
+}
+
+/* header holding the name, following a name reference */
+static inline const struct blobmsg_hdr *blobmsg_name_hdr(const struct blobmsg_hdr *hdr)
+{
+	if (!blobmsg_hdr_is_ref(hdr))
+		return hdr;
+
+	return (const struct blobmsg_hdr *) ((const char *) hdr - blobmsg_ref_dist(hdr));
+}
+
 static inline void blobmsg_clear_name(struct blob_attr *attr)
 {
 	struct blobmsg_hdr *hdr = (struct blobmsg_hdr *) blob_data(attr);
+
+	/* a reference has the size of an empty name */
+	if (blobmsg_hdr_is_ref(hdr)) {
+		hdr->namelen &= cpu_to_be16(BLOBMSG_NAMELEN_SORTED);
+		hdr->name[1] = 0;
+	}
 	hdr->name[0] = 0;
 }
 
 static inline const char *blobmsg_name(const struct blob_attr *attr)
 {
-	struct blobmsg_hdr *hdr = (struct blobmsg_hdr *) blob_data(attr);
+	const struct blobmsg_hdr *hdr = blobmsg_name_hdr(blob_data(attr));
 	return (const char *)(hdr + 1);
 }
 
@@ -70,9 +158,25 @@ static inline int blobmsg_type(const struct blob_attr *attr)
 	return blob_id(attr);
 }
 
-static uint16_t blobmsg_namelen(const struct blobmsg_hdr *hdr)
+static inline uint16_t blobmsg_namelen(const struct blobmsg_hdr *hdr)
+{
+	return be16_to_cpu(blobmsg_name_hdr(hdr)->namelen) & BLOBMSG_NAMELEN_MASK;
+}
+
+static inline bool blobmsg_is_sorted(const struct blob_attr *attr)
+{
+	const struct blobmsg_hdr *hdr = (const struct blobmsg_hdr *) blob_data(attr);
+
+	return blob_is_extended(attr) &&
+	       (hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_SORTED));
+}
+
+static inline bool blobmsg_is_compact(const struct blob_attr *attr)
 {
-	return be16_to_cpu(hdr->namelen);
+	const struct blobmsg_hdr *hdr = (const struct blobmsg_hdr *) blob_data(attr);
+
+	return blob_is_extended(attr) && !blobmsg_hdr_is_ref(hdr) &&
+	       (hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_COMPACT));
 }
 
 static inline void *blobmsg_data(const struct blob_attr *attr)
@@ -86,8 +190,11 @@ static inline void *blobmsg_data(const struct blob_attr *attr)
 	hdr = (struct blobmsg_hdr *) blob_data(attr);
 	data = (char *) blob_data(attr);
 
-	if (blob_is_extended(attr))
-		data += blobmsg_hdrlen(blobmsg_namelen(hdr));
+	if (blob_is_extended(attr)) {
+		data += blobmsg_hdr_size(hdr);
+		if (hdr->namelen & cpu_to_be16(BLOBMSG_NAMELEN_SORTED))
+			data += sizeof(uint32_t) * (be32_to_cpu(*(uint32_t *) data) + 1);
+	}
 
 	return data;
 }
@@ -170,11 +277,48 @@ int blobmsg_check_array(const struct blob_attr *attr, int type);
  */
 int blobmsg_check_array_len(const struct blob_attr *attr, int type, size_t len);
 
+/*
+ * blobmsg_check_tree_len: validate an untrusted list of attributes
+ *
+ * Like blobmsg_check_attr_len for each attribute, but also descends into
+ * tables and arrays, so that nested containers can be parsed or iterated
+ * afterwards without checking them again.
+ */
+bool blobmsg_check_tree_len(const void *data, size_t len);
+
 int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
                   struct blob_attr **tb, void *data, unsigned int len);
+
+/*
+ * blobmsg_parse_ext: blobmsg_parse with enum blobmsg_parse_flags
+ *
+ * Parse the top level message with BLOBMSG_PARSE_VALIDATE once, then use
+ * BLOBMSG_PARSE_TRUSTED for its nested tables.
+ */
+int blobmsg_parse_ext(const struct blobmsg_policy *policy, int policy_len,
+		      struct blob_attr **tb, void *data, unsigned int len,
+		      unsigned int flags);
 int blobmsg_parse_array(const struct blobmsg_policy *policy, int policy_len,
 			struct blob_attr **tb, void *data, unsigned int len);
 
+/*
+ * blobmsg_policy_compile: build a name index for a policy
+ *
+ * The policy array is referenced, not copied. Parsing with the result
+ * takes time proportional to the number of attributes only, which helps
+ * for large policies that are parsed often.
+ */
+struct blobmsg_compiled_policy *
+blobmsg_policy_compile(const struct blobmsg_policy *policy, int policy_len);
+void blobmsg_compiled_policy_free(struct blobmsg_compiled_policy *cp);
+
+/* blobmsg_parse_compiled: same as blobmsg_parse, using a compiled policy */
+int blobmsg_parse_compiled(const struct blobmsg_compiled_policy *cp,
+			   struct blob_attr **tb, void *data, unsigned int len);
+int blobmsg_parse_compiled_ext(const struct blobmsg_compiled_policy *cp,
+			       struct blob_attr **tb, void *data, unsigned int len,
+			       unsigned int flags);
+
 int blobmsg_add_field(struct blob_buf *buf, int type, const char *name,
                       const void *data, unsigned int len);
 
@@ -185,6 +329,13 @@ blobmsg_parse_attr(const struct blobmsg_policy *policy, int policy_len,
 	return blobmsg_parse(policy, policy_len, tb, blobmsg_data(data), blobmsg_len(data));
 }
 
+static inline int
+blobmsg_parse_attr_compiled(const struct blobmsg_compiled_policy *cp,
+			    struct blob_attr **tb, struct blob_attr *data)
+{
+	return blobmsg_parse_compiled(cp, tb, blobmsg_data(data), blobmsg_len(data));
+}
+
 static inline int
 blobmsg_parse_array_attr(const struct blobmsg_policy *policy, int policy_len,
 			 struct blob_attr **tb, struct blob_attr *data)
@@ -237,15 +388,45 @@ blobmsg_add_string(struct blob_buf *buf, const char *name, const char *string)
 	return blobmsg_add_field(buf, BLOBMSG_TYPE_STRING, name, string, strlen(string) + 1);
 }
 
-static inline int
-blobmsg_add_blob(struct blob_buf *buf, struct blob_attr *attr)
-{
-	return blobmsg_add_field(buf, blobmsg_type(attr), blobmsg_name(attr),
-				 blobmsg_data(attr), blobmsg_data_len(attr));
-}
+/*
+ * blobmsg_add_blob: add a copy of attr
+ *
+ * Members of compact containers get their full name. Compact containers,
+ * including the ones inside of them, are added member by member as a compact
+ * container of their own, or as part of the one open in buf.
+ */
+int blobmsg_add_blob(struct blob_buf *buf, struct blob_attr *attr);
+
+/*
+ * blobmsg_expand: get attr without name references to data outside of it
+ *
+ * Returns attr itself if it is no member of a compact container, otherwise
+ * a copy made with blobmsg_add_blob in buf, which is initialized for it, or
+ * NULL on failure.
+ */
+struct blob_attr *blobmsg_expand(struct blob_buf *buf, const struct blob_attr *attr);
 
 void *blobmsg_open_nested(struct blob_buf *buf, const char *name, bool array);
 
+/*
+ * blobmsg_open_compact: open a table or array with compact names
+ *
+ * Names used again inside of it are written as references to their first
+ * occurrence, which shrinks containers repeating the same keys, e.g.
+ * arrays of tables. Readers resolve references transparently.
+ * Members can not be checked on their own, as their names may be stored
+ * earlier in the container: blobmsg_check_attr and blobmsg_parse validate
+ * a compact container as a whole, after which its members may be parsed
+ * with BLOBMSG_PARSE_TRUSTED.
+ * Members have to be copied with blobmsg_add_blob or blobmsg_expand, which
+ * resolve their names; blobmsg_add_field and blob_memdup copy them as they
+ * are, with references pointing outside of the copy.
+ * Compact containers can not be nested, tables inside of them can not be
+ * sorted. Returns NULL on failure, must be closed with blobmsg_close_compact.
+ */
+void *blobmsg_open_compact(struct blob_buf *buf, const char *name, bool array);
+void blobmsg_close_compact(struct blob_buf *buf, void *cookie);
+
 static inline void *
 blobmsg_open_array(struct blob_buf *buf, const char *name)
 {
@@ -270,11 +451,48 @@ blobmsg_close_table(struct blob_buf *buf, void *cookie)
 	blob_nest_end(buf, cookie);
 }
 
+/*
+ * blobmsg_close_table_sorted: close a table, sorting its members by name
+ *
+ * The table is marked as sorted and gets a member index, so that
+ * blobmsg_find can use a binary search on it. Members with the same name
+ * keep their order. Returns 0 on success; on failure, or if the innermost
+ * open container is no named table, it is closed unchanged.
+ */
+int blobmsg_close_table_sorted(struct blob_buf *buf, void *cookie);
+
+/*
+ * blobmsg_find: look up a member of a table by name
+ *
+ * Uses a binary search on sorted tables and scans other tables. With
+ * duplicate names, the first one is returned.
+ * This method may be used with trusted data only.
+ */
+struct blob_attr *blobmsg_find(const struct blob_attr *attr, const char *name);
+
+/*
+ * blobmsg_lookup_path: look up a member of nested tables
+ *
+ * Descends through len names starting with attr, see blobmsg_find.
+ */
+struct blob_attr *blobmsg_lookup_path(const struct blob_attr *attr,
+				      const char * const *path, int len);
+
 static inline int blobmsg_buf_init(struct blob_buf *buf)
 {
 	return blob_buf_init(buf, BLOBMSG_TYPE_TABLE);
 }
 
+static inline int blobmsg_buf_reset(struct blob_buf *buf, int trim)
+{
+	return blob_buf_reset(buf, BLOBMSG_TYPE_TABLE, trim);
+}
+
+static inline int blobmsg_arena_buf_init(struct blob_arena_buf *ab, struct arena *a)
+{
+	return blob_arena_buf_init(ab, a, BLOBMSG_TYPE_TABLE);
+}
+
 static inline uint8_t blobmsg_get_u8(struct blob_attr *attr)
 {
 	return *(uint8_t *) blobmsg_data(attr);
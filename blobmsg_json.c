@@ -13,9 +13,24 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include "avl-cmp.h"
 #include "blobmsg.h"
 #include "blobmsg_json.h"
+#include "htable.h"
+#include "ustream.h"
+#include "utils.h"
 
 #ifdef JSONC
 	#include <json.h>
@@ -87,45 +102,885 @@ bool blobmsg_add_json_element(struct blob_buf *b, const char *name, json_object
 	return ret;
 }
 
-static bool __blobmsg_add_json(struct blob_buf *b, json_object *obj)
+enum {
+	P_VALUE,
+	P_KEY,
+	P_COLON,
+	P_SEP,
+	P_STRING,
+	P_ESCAPE,
+	P_UNICODE,
+	P_LITERAL,
+	P_COMMENT,
+	P_LINE_COMMENT,
+	P_BLOCK_COMMENT,
+	P_BLOCK_STAR,
+	P_DONE,
+	P_ERROR,
+};
+
+void blobmsg_json_parse_init(struct blobmsg_json_parser *p, struct blob_buf *b)
+{
+	memset(p, 0, sizeof(*p));
+	p->buf = b;
+	p->head = (char *) b->head - (char *) b->buf;
+	p->head_len = blob_raw_len(b->head);
+}
+
+static void blobmsg_json_parse_error(struct blobmsg_json_parser *p)
+{
+	struct blob_buf *b = p->buf;
+
+	/* drop everything added so far, like a failed json-c parse would */
+	b->head = (struct blob_attr *) ((char *) b->buf + p->head);
+	blob_set_raw_len(b->head, p->head_len);
+	p->state = P_ERROR;
+}
+
+static bool blobmsg_json_putc(struct blobmsg_json_parser *p, char c)
+{
+	char *tok;
+
+	if (p->tok_len + 1 >= p->tok_size) {
+		int size = p->tok_size ? p->tok_size * 2 : 64;
+
+		tok = realloc(p->tok, size);
+		if (!tok)
+			return false;
+
+		p->tok = tok;
+		p->tok_size = size;
+	}
+
+	p->tok[p->tok_len++] = c;
+	p->tok[p->tok_len] = 0;
+	return true;
+}
+
+static bool blobmsg_json_put_utf8(struct blobmsg_json_parser *p, uint32_t c)
 {
+	if (c < 0x80)
+		return blobmsg_json_putc(p, c);
+
+	if (c < 0x800)
+		return blobmsg_json_putc(p, 0xc0 | (c >> 6)) &&
+		       blobmsg_json_putc(p, 0x80 | (c & 0x3f));
+
+	if (c < 0x10000)
+		return blobmsg_json_putc(p, 0xe0 | (c >> 12)) &&
+		       blobmsg_json_putc(p, 0x80 | ((c >> 6) & 0x3f)) &&
+		       blobmsg_json_putc(p, 0x80 | (c & 0x3f));
+
+	return blobmsg_json_putc(p, 0xf0 | (c >> 18)) &&
+	       blobmsg_json_putc(p, 0x80 | ((c >> 12) & 0x3f)) &&
+	       blobmsg_json_putc(p, 0x80 | ((c >> 6) & 0x3f)) &&
+	       blobmsg_json_putc(p, 0x80 | (c & 0x3f));
+}
+
+static bool blobmsg_json_flush_surrogate(struct blobmsg_json_parser *p)
+{
+	if (!p->surrogate)
+		return true;
+
+	/* unpaired surrogate */
+	p->surrogate = 0;
+	return blobmsg_json_put_utf8(p, 0xfffd);
+}
+
+void blobmsg_json_parse_init_element(struct blobmsg_json_parser *p, struct blob_buf *b,
+				      const char *name)
+{
+	blobmsg_json_parse_init(p, b);
+	p->element = true;
+	p->name = name ? name : "";
+}
+
+static const char *blobmsg_json_name(struct blobmsg_json_parser *p)
+{
+	if (!p->depth)
+		return p->name;
+
+	if (p->array & (1ULL << (p->depth - 1)))
+		return NULL;
+
+	return p->key ? p->key : "";
+}
+
+static bool blobmsg_json_open(struct blobmsg_json_parser *p, bool array)
+{
+	if (!p->depth && !p->element) {
+		/* the top level object is merged into the buffer */
+		if (array)
+			return false;
+
+		p->array = 0;
+		p->depth++;
+		return true;
+	}
+
+	if (p->depth >= BLOBMSG_JSON_MAX_DEPTH)
+		return false;
+
+	p->cookie[p->depth] = blobmsg_open_nested(p->buf, blobmsg_json_name(p), array);
+	if (!p->cookie[p->depth])
+		return false;
+
+	if (array)
+		p->array |= 1ULL << p->depth;
+	else
+		p->array &= ~(1ULL << p->depth);
+	p->depth++;
+
+	return true;
+}
+
+struct blobmsg_json_member {
+	struct htable_node node;
+	struct blob_attr *attr;
+	bool dup;
+};
+
+/*
+ * Like json-c, a key that appears again keeps its first position and gets
+ * the last value. Done once when the object is closed, with a table of the
+ * names seen so far.
+ */
+static bool blobmsg_json_dedup(struct blobmsg_json_parser *p)
+{
+	struct blob_buf *b = p->buf;
+	struct blob_attr *head = b->head, *first, *cur, *end;
+	struct htable names = HTABLE_INIT(htable_strhash, avl_strcmp, NULL);
+	struct blobmsg_json_member *members, *m;
+	struct htable_node *node;
+	unsigned int n = 0, dups = 0, len = 0, i;
 	bool ret = false;
+	char *tmp;
 
-	if (!obj)
+	/* the top level object may be merged into a table with other data */
+	if (p->depth == 1 && !p->element)
+		first = (struct blob_attr *) ((char *) b->buf + p->head +
+			((p->head_len + BLOB_ATTR_ALIGN - 1) & ~(BLOB_ATTR_ALIGN - 1)));
+	else
+		first = blobmsg_data(head);
+
+	end = (struct blob_attr *) ((char *) head + blob_pad_len(head));
+	for (cur = first; cur < end; cur = blob_next(cur))
+		n++;
+
+	if (n < 2)
+		return true;
+
+	members = calloc(n, sizeof(*members));
+	if (!members)
 		return false;
 
-	if (json_object_get_type(obj) != json_type_object)
+	for (cur = first, i = 0; cur < end; cur = blob_next(cur), i++) {
+		members[i].node.key = blobmsg_name(cur);
+		members[i].attr = cur;
+
+		node = htable_find(&names, members[i].node.key);
+		if (node) {
+			m = container_of(node, struct blobmsg_json_member, node);
+			m->attr = cur;
+			members[i].dup = true;
+			dups++;
+		} else if (htable_insert(&names, &members[i].node)) {
+			goto out;
+		}
+	}
+
+	if (!dups) {
+		ret = true;
+		goto out;
+	}
+
+	tmp = malloc((char *) end - (char *) first);
+	if (!tmp)
 		goto out;
 
-	ret = blobmsg_add_object(b, obj);
+	for (i = 0; i < n; i++) {
+		if (members[i].dup)
+			continue;
+
+		memcpy(tmp + len, members[i].attr, blob_pad_len(members[i].attr));
+		len += blob_pad_len(members[i].attr);
+	}
+
+	memcpy(first, tmp, len);
+	blob_set_raw_len(head, blob_raw_len(head) -
+			 ((char *) end - (char *) first - len));
+	free(tmp);
+	ret = true;
 
 out:
-	json_object_put(obj);
+	htable_free(&names);
+	free(members);
+	return ret;
+}
+
+static bool blobmsg_json_close(struct blobmsg_json_parser *p, bool array)
+{
+	if (!!(p->array & (1ULL << (p->depth - 1))) != array)
+		return false;
+
+	if (!array && !blobmsg_json_dedup(p))
+		return false;
+
+	if (--p->depth || p->element)
+		blob_nest_end(p->buf, p->cookie[p->depth]);
+
+	p->state = p->depth ? P_SEP : P_DONE;
+
+	return true;
+}
+
+static bool blobmsg_json_literal(struct blobmsg_json_parser *p)
+{
+	struct blob_buf *b = p->buf;
+	const char *name = blobmsg_json_name(p);
+	char *tok = p->tok, *end;
+	int64_t i64;
+	double d;
+
+	if (!strcasecmp(tok, "true"))
+		return !blobmsg_add_u8(b, name, 1);
+
+	if (!strcasecmp(tok, "false"))
+		return !blobmsg_add_u8(b, name, 0);
+
+	if (!strcasecmp(tok, "null"))
+		return !blobmsg_add_field(b, BLOBMSG_TYPE_UNSPEC, name, NULL, 0);
+
+	errno = 0;
+	if (strpbrk(tok, ".eEiInN")) {
+		d = strtod(tok, &end);
+		if (*end)
+			return false;
+
+		return !blobmsg_add_double(b, name, d);
+	}
+
+	/* out of range values are clamped, as json-c does */
+	i64 = strtoll(tok, &end, 10);
+	if (*end || end == tok)
+		return false;
+
+	if (i64 >= INT32_MIN && i64 <= INT32_MAX)
+		return !blobmsg_add_u32(b, name, (uint32_t) i64);
+
+	return !blobmsg_add_u64(b, name, (uint64_t) i64);
+}
+
+static bool blobmsg_json_string_end(struct blobmsg_json_parser *p)
+{
+	char *tmp;
+	int size;
+
+	if (!p->tok && !blobmsg_json_putc(p, 0))
+		return false;
+
+	p->tok[p->tok_len] = 0;
+
+	if (!p->is_key) {
+		p->state = p->depth ? P_SEP : P_DONE;
+		return !blobmsg_add_string(p->buf, blobmsg_json_name(p), p->tok);
+	}
+
+	/* keep the key around, reuse its old buffer for the value */
+	tmp = p->key;
+	size = p->key_size;
+	p->key = p->tok;
+	p->key_size = p->tok_size;
+	p->tok = tmp;
+	p->tok_size = size;
+	p->state = P_COLON;
+
+	return true;
+}
+
+static bool blobmsg_json_is_literal(char c)
+{
+	return isalnum((unsigned char) c) || c == '-' || c == '+' || c == '.';
+}
+
+static bool blobmsg_json_space(struct blobmsg_json_parser *p, char c)
+{
+	if (c == '/') {
+		p->ret_state = p->state;
+		p->state = P_COMMENT;
+		return true;
+	}
+
+	return isspace((unsigned char) c);
+}
+
+/* returns false if c has to be processed again in the new state */
+static bool blobmsg_json_char(struct blobmsg_json_parser *p, char c)
+{
+	static const char escapes[256] = {
+		['b'] = '\b', ['f'] = '\f', ['n'] = '\n', ['r'] = '\r',
+		['t'] = '\t', ['/'] = '/', ['\\'] = '\\', ['"'] = '"',
+		['\''] = '\'',
+	};
+	bool array = p->depth && (p->array & (1ULL << (p->depth - 1)));
+
+	switch (p->state) {
+	case P_VALUE:
+		if (blobmsg_json_space(p, c))
+			break;
+
+		if (c == '{' || c == '[') {
+			if (!blobmsg_json_open(p, c == '['))
+				goto error;
+
+			p->state = c == '[' ? P_VALUE : P_KEY;
+			break;
+		}
+
+		if (!p->depth && !p->element)
+			goto error;
+
+		/* json-c accepts a trailing comma */
+		if (c == ']' && array) {
+			if (!blobmsg_json_close(p, true))
+				goto error;
+			break;
+		}
+
+		if (c == '"' || c == '\'') {
+			p->quote = c;
+			p->is_key = false;
+			p->tok_len = 0;
+			p->state = P_STRING;
+			break;
+		}
+
+		if (!isalnum((unsigned char) c) && c != '-')
+			goto error;
+
+		p->tok_len = 0;
+		p->state = P_LITERAL;
+		return false;
+	case P_KEY:
+		if (blobmsg_json_space(p, c))
+			break;
+
+		if (c == '}') {
+			if (!blobmsg_json_close(p, false))
+				goto error;
+			break;
+		}
+
+		if (c != '"' && c != '\'')
+			goto error;
+
+		p->quote = c;
+		p->is_key = true;
+		p->tok_len = 0;
+		p->state = P_STRING;
+		break;
+	case P_COLON:
+		if (blobmsg_json_space(p, c))
+			break;
+
+		if (c != ':')
+			goto error;
+
+		p->state = P_VALUE;
+		break;
+	case P_SEP:
+		if (blobmsg_json_space(p, c))
+			break;
+
+		if (c == ',') {
+			p->state = array ? P_VALUE : P_KEY;
+			break;
+		}
+
+		if ((c != ']' && c != '}') || !blobmsg_json_close(p, c == ']'))
+			goto error;
+		break;
+	case P_STRING:
+		if (c == '\\') {
+			p->state = P_ESCAPE;
+			break;
+		}
+
+		if (!blobmsg_json_flush_surrogate(p))
+			goto error;
+
+		if (c == p->quote) {
+			if (!blobmsg_json_string_end(p))
+				goto error;
+			break;
+		}
+
+		if (!blobmsg_json_putc(p, c))
+			goto error;
+		break;
+	case P_ESCAPE:
+		if (c == 'u') {
+			p->esc = 0;
+			p->esc_len = 0;
+			p->state = P_UNICODE;
+			break;
+		}
+
+		if (!escapes[(unsigned char) c] ||
+		    !blobmsg_json_flush_surrogate(p) ||
+		    !blobmsg_json_putc(p, escapes[(unsigned char) c]))
+			goto error;
+
+		p->state = P_STRING;
+		break;
+	case P_UNICODE:
+		if (!isxdigit((unsigned char) c))
+			goto error;
+
+		p->esc = (p->esc << 4) | (isdigit((unsigned char) c) ? c - '0' : (c | 0x20) - 'a' + 10);
+		if (++p->esc_len < 4)
+			break;
+
+		p->state = P_STRING;
+		if (p->surrogate && p->esc >= 0xdc00 && p->esc <= 0xdfff) {
+			p->esc = 0x10000 + ((p->surrogate - 0xd800) << 10) + (p->esc - 0xdc00);
+			p->surrogate = 0;
+		} else if (!blobmsg_json_flush_surrogate(p)) {
+			goto error;
+		} else if (p->esc >= 0xd800 && p->esc <= 0xdbff) {
+			p->surrogate = p->esc;
+			break;
+		}
+
+		if (!blobmsg_json_put_utf8(p, p->esc))
+			goto error;
+		break;
+	case P_LITERAL:
+		if (blobmsg_json_is_literal(c)) {
+			if (!blobmsg_json_putc(p, c))
+				goto error;
+			break;
+		}
+
+		if (!blobmsg_json_literal(p))
+			goto error;
+
+		p->state = p->depth ? P_SEP : P_DONE;
+		return false;
+	case P_COMMENT:
+		if (c == '*')
+			p->state = P_BLOCK_COMMENT;
+		else if (c == '/')
+			p->state = P_LINE_COMMENT;
+		else
+			goto error;
+		break;
+	case P_LINE_COMMENT:
+		if (c == '\n')
+			p->state = p->ret_state;
+		break;
+	case P_BLOCK_COMMENT:
+		if (c == '*')
+			p->state = P_BLOCK_STAR;
+		break;
+	case P_BLOCK_STAR:
+		if (c == '/')
+			p->state = p->ret_state;
+		else if (c != '*')
+			p->state = P_BLOCK_COMMENT;
+		break;
+	}
+
+	return true;
+
+error:
+	blobmsg_json_parse_error(p);
+	return true;
+}
+
+int blobmsg_json_parse_feed(struct blobmsg_json_parser *p, const char *data, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		if (p->state == P_DONE)
+			break;
+
+		if (p->state == P_ERROR)
+			return -1;
+
+		if (blobmsg_json_char(p, data[i]))
+			i++;
+	}
+
+	return p->state == P_ERROR ? -1 : (int) i;
+}
+
+bool blobmsg_json_parse_done(struct blobmsg_json_parser *p)
+{
+	return p->state == P_DONE;
+}
+
+bool blobmsg_json_parse_finish(struct blobmsg_json_parser *p)
+{
+	bool ret;
+
+	/* a top level literal is only terminated by the end of input */
+	if (p->state == P_LITERAL && !p->depth) {
+		if (blobmsg_json_literal(p))
+			p->state = P_DONE;
+		else
+			blobmsg_json_parse_error(p);
+	}
+
+	ret = p->state == P_DONE;
+	if (!ret && p->state != P_ERROR)
+		blobmsg_json_parse_error(p);
+
+	free(p->tok);
+	free(p->key);
+	p->tok = p->key = NULL;
+	p->tok_size = p->key_size = 0;
+
+	return ret;
+}
+
+int blobmsg_json_parse_ustream(struct blobmsg_json_parser *p, struct ustream *s)
+{
+	char *buf;
+	int len, ret;
+
+	while (!blobmsg_json_parse_done(p) &&
+	       (buf = ustream_get_read_buf(s, &len)) != NULL) {
+		ret = blobmsg_json_parse_feed(p, buf, len);
+		if (ret < 0)
+			return -1;
+
+		ustream_consume(s, ret);
+	}
+
+	return blobmsg_json_parse_done(p);
+}
+
+static char *blobmsg_json_cache_dir;
+
+void blobmsg_json_set_cache_dir(const char *dir)
+{
+	free(blobmsg_json_cache_dir);
+	blobmsg_json_cache_dir = dir ? strdup(dir) : NULL;
+}
+
+#define BLOBMSG_JSON_CACHE_MAGIC	0x424a4331 /* BJC1 */
+
+struct blobmsg_json_cache_hdr {
+	uint32_t magic;
+	uint32_t path_len;
+	uint32_t name_len;
+	uint32_t data_len;
+	uint64_t size;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	uint64_t ino;
+};
+
+static char *blobmsg_json_cache_path(const char *file)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const char *c;
+	char *path;
+
+	for (c = file; *c; c++)
+		hash = (hash ^ (unsigned char) *c) * 0x100000001b3ULL;
+
+	if (asprintf(&path, "%s/%016" PRIx64 ".blob", blobmsg_json_cache_dir, hash) < 0)
+		return NULL;
+
+	return path;
+}
+
+static void blobmsg_json_cache_hdr_init(struct blobmsg_json_cache_hdr *hdr, struct stat *st,
+					const char *file, const char *name, int data_len)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = BLOBMSG_JSON_CACHE_MAGIC;
+	hdr->path_len = strlen(file);
+	hdr->name_len = name ? strlen(name) + 1 : 0;
+	hdr->data_len = data_len;
+	hdr->size = st->st_size;
+	hdr->mtime = st->st_mtim.tv_sec;
+	hdr->mtime_nsec = st->st_mtim.tv_nsec;
+	hdr->ino = st->st_ino;
+}
+
+/*
+ * Accesses past the end of a mapped file that was truncated raise SIGBUS,
+ * so only files on read-only mounts, which cannot shrink, are mapped.
+ */
+static bool blobmsg_json_can_map(int fd)
+{
+	struct statvfs vfs;
+
+	return !fstatvfs(fd, &vfs) && (vfs.f_flag & ST_RDONLY);
+}
+
+static void *blobmsg_json_read_all(int fd, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+	char *buf;
+
+	buf = malloc(len);
+	if (!buf)
+		return NULL;
+
+	while (done < len) {
+		ret = read(fd, buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0) {
+			free(buf);
+			return NULL;
+		}
+
+		done += ret;
+	}
+
+	return buf;
+}
+
+static bool blobmsg_json_cache_load(struct blob_buf *b, struct stat *st,
+				    const char *file, const char *name)
+{
+	struct blobmsg_json_cache_hdr hdr, *cur;
+	struct stat cst;
+	bool ret = false, mapped;
+	char *path, *data;
+	void *map;
+	int fd;
+
+	path = blobmsg_json_cache_path(file);
+	if (!path)
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &cst) || (size_t) cst.st_size < sizeof(hdr))
+		goto out;
+
+	mapped = blobmsg_json_can_map(fd);
+	if (mapped)
+		map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	else
+		map = blobmsg_json_read_all(fd, cst.st_size);
+	if (!map || map == MAP_FAILED)
+		goto out;
+
+	cur = map;
+	data = (char *) (cur + 1);
+	blobmsg_json_cache_hdr_init(&hdr, st, file, name, cur->data_len);
+	if (memcmp(cur, &hdr, sizeof(hdr)) != 0 ||
+	    sizeof(hdr) + hdr.path_len + hdr.name_len + hdr.data_len != (size_t) cst.st_size ||
+	    memcmp(data, file, hdr.path_len) != 0 ||
+	    (name && memcmp(data + hdr.path_len, name, hdr.name_len) != 0))
+		goto unmap;
+
+	data += hdr.path_len + hdr.name_len;
+	if (!hdr.data_len) {
+		ret = true;
+		goto unmap;
+	}
+
+	/* the cache is not trusted any more than the JSON file itself */
+	if (!blobmsg_check_tree_len(data, hdr.data_len))
+		goto unmap;
+
+	ret = !!blob_put_raw(b, data, hdr.data_len);
+
+unmap:
+	if (mapped)
+		munmap(map, cst.st_size);
+	else
+		free(map);
+out:
+	close(fd);
+	return ret;
+}
+
+static void blobmsg_json_cache_store(struct stat *st, const char *file, const char *name,
+				     const void *data, int data_len)
+{
+	struct blobmsg_json_cache_hdr hdr;
+	struct iovec iov[4];
+	char *path, *tmp;
+	ssize_t len;
+	int fd;
+
+	path = blobmsg_json_cache_path(file);
+	if (!path)
+		return;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		goto out;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out_tmp;
+
+	blobmsg_json_cache_hdr_init(&hdr, st, file, name, data_len);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) file;
+	iov[1].iov_len = hdr.path_len;
+	iov[2].iov_base = (void *) (name ? name : "");
+	iov[2].iov_len = hdr.name_len;
+	iov[3].iov_base = (void *) data;
+	iov[3].iov_len = data_len;
+
+	/* replace atomically, so that readers never see a partial file */
+	len = writev(fd, iov, ARRAY_SIZE(iov));
+	close(fd);
+	if (len != (ssize_t) (sizeof(hdr) + hdr.path_len + hdr.name_len + data_len) ||
+	    rename(tmp, path) < 0)
+		unlink(tmp);
+
+out_tmp:
+	free(tmp);
+out:
+	free(path);
+}
+
+static bool blobmsg_json_parse_fd(struct blobmsg_json_parser *p, int fd, struct stat *st)
+{
+	char buf[4096];
+	ssize_t len;
+	void *map;
+
+	if (S_ISREG(st->st_mode) && st->st_size > 0 && blobmsg_json_can_map(fd)) {
+		map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st->st_size, MADV_SEQUENTIAL);
+			blobmsg_json_parse_feed(p, map, st->st_size);
+			munmap(map, st->st_size);
+			return blobmsg_json_parse_finish(p);
+		}
+	}
+
+	/* pipes, procfs and files that could be truncated while mapped */
+	while (!blobmsg_json_parse_done(p)) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+
+		if (len <= 0 || blobmsg_json_parse_feed(p, buf, len) < 0)
+			break;
+	}
+
+	return blobmsg_json_parse_finish(p);
+}
+
+static bool __blobmsg_add_json_file(struct blob_buf *b, const char *file,
+				    bool element, const char *name)
+{
+	struct blobmsg_json_parser p;
+	bool cache = false;
+	struct stat st;
+	unsigned int start;
+	bool ret;
+	int fd;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return false;
+	}
+
+	if (element && !name)
+		name = "";
+
+	if (blobmsg_json_cache_dir && S_ISREG(st.st_mode) && file[0] == '/') {
+		if (blobmsg_json_cache_load(b, &st, file, element ? name : NULL)) {
+			close(fd);
+			return true;
+		}
+		cache = true;
+	}
+
+	start = blob_raw_len(b->head);
+	if (element)
+		blobmsg_json_parse_init_element(&p, b, name);
+	else
+		blobmsg_json_parse_init(&p, b);
+	ret = blobmsg_json_parse_fd(&p, fd, &st);
+	close(fd);
+
+	if (ret && cache)
+		blobmsg_json_cache_store(&st, file, element ? name : NULL,
+					 (char *) b->head + start,
+					 blob_raw_len(b->head) - start);
+
 	return ret;
 }
 
 bool blobmsg_add_json_from_file(struct blob_buf *b, const char *file)
 {
-	return __blobmsg_add_json(b, json_object_from_file(file));
+	return __blobmsg_add_json_file(b, file, false, NULL);
 }
 
-bool blobmsg_add_json_from_string(struct blob_buf *b, const char *str)
+bool blobmsg_add_json_element_from_file(struct blob_buf *b, const char *name, const char *file)
 {
-	return __blobmsg_add_json(b, json_tokener_parse(str));
+	return __blobmsg_add_json_file(b, file, true, name);
 }
 
+bool blobmsg_add_json_from_string(struct blob_buf *b, const char *str)
+{
+	struct blobmsg_json_parser p;
+
+	blobmsg_json_parse_init(&p, b);
+	blobmsg_json_parse_feed(&p, str, strlen(str));
+
+	return blobmsg_json_parse_finish(&p);
+}
 
 struct strbuf {
 	int len;
 	int pos;
 	char *buf;
 
+	/* output into a caller buffer or a stream instead of a malloc'd one */
+	bool fixed;
+	int needed;
+	struct ustream *stream;
+	FILE *file;
+
 	blobmsg_json_format_t custom_format;
 	void *priv;
 	bool indent;
 	int indent_level;
 };
 
+static void blobmsg_write(struct strbuf *s, const char *c, int len)
+{
+	if (s->stream)
+		ustream_write(s->stream, c, len, true);
+	else
+		fwrite(c, 1, len, s->file);
+}
+
+static void blobmsg_flush(struct strbuf *s)
+{
+	if ((s->stream || s->file) && s->pos) {
+		blobmsg_write(s, s->buf, s->pos);
+		s->pos = 0;
+	}
+}
+
 static bool blobmsg_puts(struct strbuf *s, const char *c, int len)
 {
 	size_t new_len;
@@ -134,14 +989,31 @@ static bool blobmsg_puts(struct strbuf *s, const char *c, int len)
 	if (len <= 0)
 		return true;
 
+	s->needed += len;
 	if (s->pos + len >= s->len) {
-		new_len = s->len + 16 + len;
-		new_buf = realloc(s->buf, new_len);
-		if (!new_buf)
-			return false;
+		if (s->stream || s->file) {
+			blobmsg_flush(s);
+			if (len >= s->len) {
+				blobmsg_write(s, c, len);
+				return true;
+			}
+		} else if (s->fixed) {
+			len = s->len - s->pos - 1;
+			if (len <= 0)
+				return false;
+		} else {
+			/* grow geometrically, large dumps need only a few reallocs */
+			new_len = s->len * 2 + 16;
+			if (new_len < (size_t) s->pos + len + 1)
+				new_len = s->pos + len + 1;
 
-		s->len = new_len;
-		s->buf = new_buf;
+			new_buf = realloc(s->buf, new_len);
+			if (!new_buf)
+				return false;
+
+			s->len = new_len;
+			s->buf = new_buf;
+		}
 	}
 
 	memcpy(s->buf + s->pos, c, len);
@@ -164,41 +1036,30 @@ static void add_separator(struct strbuf *s)
 	blobmsg_puts(s, indent_chars, len);
 }
 
+/* characters that need escaping: 'u' for \u00XX, the escape char otherwise */
+static const char json_escape[256] = {
+	['\b'] = 'b', ['\n'] = 'n', ['\t'] = 't', ['\r'] = 'r',
+	[0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+	[0x05] = 'u', [0x06] = 'u', [0x07] = 'u', [0x0b] = 'u',
+	[0x0c] = 'u', [0x0e] = 'u', [0x0f] = 'u', [0x10] = 'u',
+	[0x11] = 'u', [0x12] = 'u', [0x13] = 'u', [0x14] = 'u',
+	[0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+	[0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u', [0x1c] = 'u',
+	[0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
 
 static void blobmsg_format_string(struct strbuf *s, const char *str)
 {
-	const unsigned char *p, *last, *end;
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *p, *last;
 	char buf[8] = "\\u00";
 
-	end = (unsigned char *) str + strlen(str);
 	blobmsg_puts(s, "\"", 1);
 	for (p = (unsigned char *) str, last = p; *p; p++) {
-		char escape = '\0';
+		char escape = json_escape[*p];
 		int len;
 
-		switch(*p) {
-		case '\b':
-			escape = 'b';
-			break;
-		case '\n':
-			escape = 'n';
-			break;
-		case '\t':
-			escape = 't';
-			break;
-		case '\r':
-			escape = 'r';
-			break;
-		case '"':
-		case '\\':
-			escape = *p;
-			break;
-		default:
-			if (*p < ' ')
-				escape = 'u';
-			break;
-		}
-
 		if (!escape)
 			continue;
 
@@ -208,7 +1069,8 @@ static void blobmsg_format_string(struct strbuf *s, const char *str)
 		buf[1] = escape;
 
 		if (escape == 'u') {
-			snprintf(buf + 4, sizeof(buf) - 4, "%02x", (unsigned char) *p);
+			buf[4] = hex[*p >> 4];
+			buf[5] = hex[*p & 0xf];
 			len = 6;
 		} else {
 			len = 2;
@@ -216,16 +1078,35 @@ static void blobmsg_format_string(struct strbuf *s, const char *str)
 		blobmsg_puts(s, buf, len);
 	}
 
-	blobmsg_puts(s, (char *) last, end - last);
+	blobmsg_puts(s, (char *) last, p - last);
 	blobmsg_puts(s, "\"", 1);
 }
 
+/* format val right aligned into the end of buf, returns the start */
+static char *blobmsg_format_int(char *end, int64_t val)
+{
+	uint64_t n = val < 0 ? -(uint64_t) val : (uint64_t) val;
+	char *p = end;
+
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	if (val < 0)
+		*--p = '-';
+
+	return p;
+}
+
 static void blobmsg_format_json_list(struct strbuf *s, struct blob_attr *attr, int len, bool array);
 
 static void blobmsg_format_element(struct strbuf *s, struct blob_attr *attr, bool without_name, bool head)
 {
 	const char *data_str;
 	char buf[317];
+	char *end = buf + sizeof(buf);
+	double d;
 	void *data;
 	int len;
 
@@ -246,25 +1127,36 @@ static void blobmsg_format_element(struct strbuf *s, struct blob_attr *attr, boo
 			goto out;
 	}
 
-	data_str = buf;
 	switch(blob_id(attr)) {
 	case BLOBMSG_TYPE_UNSPEC:
-		snprintf(buf, sizeof(buf), "null");
-		break;
+		blobmsg_puts(s, "null", 4);
+		return;
 	case BLOBMSG_TYPE_BOOL:
-		snprintf(buf, sizeof(buf), "%s", *(uint8_t *)data ? "true" : "false");
-		break;
+		if (*(uint8_t *)data)
+			blobmsg_puts(s, "true", 4);
+		else
+			blobmsg_puts(s, "false", 5);
+		return;
 	case BLOBMSG_TYPE_INT16:
-		snprintf(buf, sizeof(buf), "%" PRId16, (int16_t) be16_to_cpu(*(uint16_t *)data));
+		data_str = blobmsg_format_int(end, (int16_t) blobmsg_get_u16(attr));
 		break;
 	case BLOBMSG_TYPE_INT32:
-		snprintf(buf, sizeof(buf), "%" PRId32, (int32_t) be32_to_cpu(*(uint32_t *)data));
+		data_str = blobmsg_format_int(end, (int32_t) blobmsg_get_u32(attr));
 		break;
 	case BLOBMSG_TYPE_INT64:
-		snprintf(buf, sizeof(buf), "%" PRId64, (int64_t) be64_to_cpu(*(uint64_t *)data));
+		data_str = blobmsg_format_int(end, (int64_t) blobmsg_get_u64(attr));
 		break;
 	case BLOBMSG_TYPE_DOUBLE:
-		snprintf(buf, sizeof(buf), "%lf", blobmsg_get_double(attr));
+		d = blobmsg_get_double(attr);
+		if (d > -1e15 && d < 1e15 && d == (int64_t) d && !signbit(d)) {
+			/* same output as "%lf" for the common integral case */
+			memcpy(end - 7, ".000000", 7);
+			data_str = blobmsg_format_int(end - 7, (int64_t) d);
+		} else {
+			snprintf(buf, sizeof(buf), "%lf", d);
+			data_str = buf;
+			end = buf + strlen(buf);
+		}
 		break;
 	case BLOBMSG_TYPE_STRING:
 		blobmsg_format_string(s, data);
@@ -275,8 +1167,13 @@ static void blobmsg_format_element(struct strbuf *s, struct blob_attr *attr, boo
 	case BLOBMSG_TYPE_TABLE:
 		blobmsg_format_json_list(s, data, len, false);
 		return;
+	default:
+		return;
 	}
 
+	blobmsg_puts(s, data_str, end - data_str);
+	return;
+
 out:
 	blobmsg_puts(s, data_str, strlen(data_str));
 }
@@ -319,44 +1216,55 @@ static void setup_strbuf(struct strbuf *s, struct blob_attr *attr, blobmsg_json_
 	}
 }
 
-char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list, blobmsg_json_format_t cb, void *priv, int indent)
+static void blobmsg_format_json_strbuf(struct strbuf *s, struct blob_attr *attr, bool list)
 {
-	struct strbuf s = {0};
 	bool array;
-	char *ret;
-
-	setup_strbuf(&s, attr, cb, priv, indent);
-	if (!s.buf)
-		return NULL;
 
 	array = blob_is_extended(attr) &&
 		blobmsg_type(attr) == BLOBMSG_TYPE_ARRAY;
 
 	if (list)
-		blobmsg_format_json_list(&s, blobmsg_data(attr), blobmsg_data_len(attr), array);
+		blobmsg_format_json_list(s, blobmsg_data(attr), blobmsg_data_len(attr), array);
 	else
-		blobmsg_format_element(&s, attr, false, false);
+		blobmsg_format_element(s, attr, false, false);
+}
+
+static char *blobmsg_finish_strbuf(struct strbuf *s)
+{
+	char *ret;
 
-	if (!s.len) {
-		free(s.buf);
+	if (!s->len) {
+		free(s->buf);
 		return NULL;
 	}
 
-	ret = realloc(s.buf, s.pos + 1);
+	ret = realloc(s->buf, s->pos + 1);
 	if (!ret) {
-		free(s.buf);
+		free(s->buf);
 		return NULL;
 	}
 
-	ret[s.pos] = 0;
+	ret[s->pos] = 0;
 
 	return ret;
 }
 
+char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list, blobmsg_json_format_t cb, void *priv, int indent)
+{
+	struct strbuf s = {0};
+
+	setup_strbuf(&s, attr, cb, priv, indent);
+	if (!s.buf)
+		return NULL;
+
+	blobmsg_format_json_strbuf(&s, attr, list);
+
+	return blobmsg_finish_strbuf(&s);
+}
+
 char *blobmsg_format_json_value_with_cb(struct blob_attr *attr, blobmsg_json_format_t cb, void *priv, int indent)
 {
 	struct strbuf s = {0};
-	char *ret;
 
 	setup_strbuf(&s, attr, cb, priv, indent);
 	if (!s.buf)
@@ -364,18 +1272,58 @@ char *blobmsg_format_json_value_with_cb(struct blob_attr *attr, blobmsg_json_for
 
 	blobmsg_format_element(&s, attr, true, false);
 
-	if (!s.len) {
-		free(s.buf);
-		return NULL;
-	}
+	return blobmsg_finish_strbuf(&s);
+}
 
-	ret = realloc(s.buf, s.pos + 1);
-	if (!ret) {
-		free(s.buf);
-		return NULL;
-	}
+int blobmsg_format_json_buf(char *buf, size_t len, struct blob_attr *attr, bool list, int indent)
+{
+	struct strbuf s = {
+		.buf = buf,
+		.len = len,
+		.fixed = true,
+		.indent = indent >= 0,
+		.indent_level = indent,
+	};
 
-	ret[s.pos] = 0;
+	if (!len)
+		return -1;
 
-	return ret;
+	blobmsg_format_json_strbuf(&s, attr, list);
+	buf[s.pos] = 0;
+
+	return s.needed;
+}
+
+int blobmsg_format_json_ustream(struct ustream *us, struct blob_attr *attr, bool list, int indent)
+{
+	char buf[1024];
+	struct strbuf s = {
+		.buf = buf,
+		.len = sizeof(buf),
+		.stream = us,
+		.indent = indent >= 0,
+		.indent_level = indent,
+	};
+
+	blobmsg_format_json_strbuf(&s, attr, list);
+	blobmsg_flush(&s);
+
+	return s.needed;
+}
+
+int blobmsg_format_json_file(FILE *f, struct blob_attr *attr, bool list, int indent)
+{
+	char buf[4096];
+	struct strbuf s = {
+		.buf = buf,
+		.len = sizeof(buf),
+		.file = f,
+		.indent = indent >= 0,
+		.indent_level = indent,
+	};
+
+	blobmsg_format_json_strbuf(&s, attr, list);
+	blobmsg_flush(&s);
+
+	return ferror(f) ? -1 : s.needed;
 }
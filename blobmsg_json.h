@@ -17,8 +17,10 @@
 #define __BLOBMSG_JSON_H
 
 struct json_object;
+struct ustream;
 
 #include <stdbool.h>
+#include <stdio.h>
 #include "blobmsg.h"
 
 bool blobmsg_add_object(struct blob_buf *b, struct json_object *obj);
@@ -26,6 +28,87 @@ bool blobmsg_add_json_element(struct blob_buf *b, const char *name, struct json_
 bool blobmsg_add_json_from_string(struct blob_buf *b, const char *str);
 bool blobmsg_add_json_from_file(struct blob_buf *b, const char *file);
 
+/*
+ * blobmsg_add_json_element_from_file: add the top level value of a JSON
+ * file as a single element named name, which does not need to be an object
+ */
+bool blobmsg_add_json_element_from_file(struct blob_buf *b, const char *name,
+					const char *file);
+
+/*
+ * blobmsg_json_set_cache_dir: keep the parsed form of files loaded by
+ * absolute path in dir. Unchanged files (same size, mtime and inode) are
+ * then loaded from the cache without parsing them again. NULL disables it.
+ */
+void blobmsg_json_set_cache_dir(const char *dir);
+
+#define BLOBMSG_JSON_MAX_DEPTH	32
+
+/*
+ * Incremental JSON parser adding the members of a top level object to a
+ * blob_buf directly, without building a json-c object tree first.
+ * Input can be passed in arbitrary chunks.
+ */
+struct blobmsg_json_parser {
+	struct blob_buf *buf;
+	const char *name;
+	bool element;
+	unsigned int head;
+	unsigned int head_len;
+
+	int state;
+	int ret_state;
+	int depth;
+	uint64_t array;
+	void *cookie[BLOBMSG_JSON_MAX_DEPTH];
+
+	char quote;
+	bool is_key;
+	int esc_len;
+	uint32_t esc;
+	uint32_t surrogate;
+
+	char *tok;
+	int tok_len;
+	int tok_size;
+
+	char *key;
+	int key_size;
+};
+
+void blobmsg_json_parse_init(struct blobmsg_json_parser *p, struct blob_buf *b);
+
+/*
+ * blobmsg_json_parse_init_element: parse any JSON value and add it as a
+ * single element named name instead of merging a top level object
+ */
+void blobmsg_json_parse_init_element(struct blobmsg_json_parser *p, struct blob_buf *b,
+				     const char *name);
+
+/*
+ * blobmsg_json_parse_feed: parse the next chunk of input.
+ * Returns the number of bytes consumed, which is less than len if the
+ * object was completed before the end of the chunk, or -1 on error.
+ */
+int blobmsg_json_parse_feed(struct blobmsg_json_parser *p, const char *data, size_t len);
+
+/* blobmsg_json_parse_done: true once the top level object is complete */
+bool blobmsg_json_parse_done(struct blobmsg_json_parser *p);
+
+/*
+ * blobmsg_json_parse_ustream: feed all pending read data of a stream.
+ * Data after the object is left in the stream. Returns 1 when the object
+ * is complete, 0 if more data is needed, -1 on error.
+ */
+int blobmsg_json_parse_ustream(struct blobmsg_json_parser *p, struct ustream *s);
+
+/*
+ * blobmsg_json_parse_finish: release the parser state. Returns true if a
+ * complete object was parsed, otherwise everything that was added to the
+ * buffer is removed again.
+ */
+bool blobmsg_json_parse_finish(struct blobmsg_json_parser *p);
+
 typedef const char *(*blobmsg_json_format_t)(void *priv, struct blob_attr *attr);
 
 char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list,
@@ -56,4 +139,26 @@ static inline char *blobmsg_format_json_value_indent(struct blob_attr *attr, int
 	return blobmsg_format_json_value_with_cb(attr, NULL, NULL, indent);
 }
 
+/*
+ * blobmsg_format_json_buf: format into a caller buffer of len bytes.
+ * The output is truncated if needed and always terminated, the length
+ * of the full output is returned like snprintf does.
+ */
+int blobmsg_format_json_buf(char *buf, size_t len, struct blob_attr *attr,
+			    bool list, int indent);
+
+/*
+ * blobmsg_format_json_ustream: write the JSON output to a stream in chunks,
+ * without building the whole string first. Returns the output length.
+ */
+int blobmsg_format_json_ustream(struct ustream *s, struct blob_attr *attr,
+				bool list, int indent);
+
+/*
+ * blobmsg_format_json_file: like blobmsg_format_json_ustream, writing to a
+ * stdio stream. Returns the output length, or -1 on write errors.
+ */
+int blobmsg_format_json_file(FILE *f, struct blob_attr *attr, bool list,
+			     int indent);
+
 #endif
@@ -25,18 +25,12 @@ static void handle_command(struct json_script_ctx *ctx, const char *name,
 static struct json_script_file *
 handle_file(struct json_script_ctx *ctx, const char *filename)
 {
-	json_object *obj;
-
-	obj = json_object_from_file(filename);
-	if (!obj) {
+	blob_buf_init(&b_script, 0);
+	if (!blobmsg_add_json_element_from_file(&b_script, "", filename)) {
 		fprintf(stderr, "load JSON data from %s failed.\n", filename);
 		return NULL;
 	}
 
-	blob_buf_init(&b_script, 0);
-	blobmsg_add_json_element(&b_script, "", obj);
-	json_object_put(obj);
-
 	return json_script_file_from_blobmsg(filename,
 		blob_data(b_script.head), blob_len(b_script.head));
 }
@@ -89,6 +89,28 @@ udp_ev = uloop.fd_add(udp, function(ufd, events)
 	end
 end, uloop.ULOOP_READ)
 
+-- batched fd events: one call per loop iteration for all ready fds
+udp_batch = uloop.fd_batch(function(fds, events, n)
+	for i = 1, n do
+		local words = fds[i]:receive()
+		print('Batched UDP packet: '..words)
+	end
+end)
+
+local udp2 = socket.udp()
+udp2:settimeout(0)
+udp2:setsockname('*', 8081)
+udp2_ev = udp_batch:add(udp2, uloop.ULOOP_READ)
+
+-- buffered stream on stdin, closed on eof
+uloop.ustream(0, function(s, data)
+	io.write('stdin: '..data)
+end, function(s, eof, write_error)
+	if eof then
+		s:close()
+	end
+end)
+
 udp_count = 0
 udp_send_timer = uloop.timer(
 	function()
@@ -103,6 +125,7 @@ udp_send_timer = uloop.timer(
 		end
 		print('Send UDP packet to 127.0.0.1:8080 :'..words)
 		s:sendto(words, '127.0.0.1', 8080)
+		s:sendto(words, '127.0.0.1', 8081)
 		s:close()
 
 		udp_count = udp_count + 1
@@ -0,0 +1,561 @@
+/*
+ * uloop-stress - echo load generator for uloop and ustream
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Echo servers built on ustream_fd run on one or more loop threads, the
+ * clients run on the loop of the main thread. Each client keeps one
+ * message in flight and sends the next one once the echo is complete.
+ *
+ * Syscalls per request are the read/write calls counted in /proc/self/io
+ * plus the poll calls of all loops. Calls made through io_uring
+ * submissions are not part of the read/write count.
+ */
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "ustream.h"
+#include "uloop.h"
+#include "usock.h"
+
+#define LAT_SUB_BITS	4
+#define LAT_SUB_MASK	((1 << LAT_SUB_BITS) - 1)
+#define LAT_BUCKETS	(64 << LAT_SUB_BITS)
+
+struct conn {
+	struct ustream_fd s;
+
+	/* client side */
+	uint64_t start;
+	int received;
+};
+
+struct loop_thread {
+	pthread_t thread;
+	int idx;
+
+	struct uloop_post_queue queue;
+	struct uloop_post stop;
+
+	struct uloop_timeout *timers;
+	uint64_t timer_calls;
+
+	struct uloop_stats stats;
+};
+
+static int n_clients = 16;
+static int n_threads = 1;
+static int n_timers;
+static int msg_size = 64;
+static int duration = 5;
+static uint64_t max_requests;
+static bool use_tcp;
+static enum uloop_backend backend = ULOOP_BACKEND_DEFAULT;
+
+static struct conn *servers, *clients;
+static struct loop_thread *threads;
+static __thread struct loop_thread *cur_thread;
+static pthread_barrier_t barrier;
+static char *msg;
+
+static uint64_t requests;
+static uint64_t latency[LAT_BUCKETS];
+static uint64_t latency_max;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* log-linear histogram, 1/16 of a power of two resolution */
+static unsigned int lat_bucket(uint64_t val)
+{
+	int msb;
+
+	if (val <= LAT_SUB_MASK)
+		return val;
+
+	msb = 63 - __builtin_clzll(val);
+
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+	       ((val >> (msb - LAT_SUB_BITS)) & LAT_SUB_MASK);
+}
+
+static uint64_t lat_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket <= LAT_SUB_MASK)
+		return bucket;
+
+	shift = (bucket >> LAT_SUB_BITS) - 1;
+
+	return (uint64_t) ((1 << LAT_SUB_BITS) | (bucket & LAT_SUB_MASK)) << shift;
+}
+
+static double lat_percentile(double p)
+{
+	uint64_t target = requests * p, sum = 0;
+	unsigned int i;
+
+	if (target >= requests)
+		target = requests - 1;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		sum += latency[i];
+		if (sum > target)
+			break;
+	}
+
+	return lat_value(i) / 1000.0;
+}
+
+static void server_read_cb(struct ustream *s, int bytes)
+{
+	char *buf;
+	int len;
+
+	while ((buf = ustream_get_read_buf(s, &len)) != NULL) {
+		ustream_write(s, buf, len, false);
+		ustream_consume(s, len);
+	}
+
+	if (s->w.data_bytes > 4 * msg_size && !ustream_read_blocked(s))
+		ustream_set_read_blocked(s, true);
+}
+
+static void server_notify_write(struct ustream *s, int bytes)
+{
+	if (s->w.data_bytes < 2 * msg_size && ustream_read_blocked(s))
+		ustream_set_read_blocked(s, false);
+}
+
+static void client_send(struct conn *c)
+{
+	c->start = now_ns();
+	c->received = 0;
+	ustream_write(&c->s.stream, msg, msg_size, false);
+}
+
+static void client_read_cb(struct ustream *s, int bytes)
+{
+	struct conn *c = container_of(s, struct conn, s.stream);
+	uint64_t lat;
+	int len;
+
+	while (ustream_get_read_buf(s, &len)) {
+		ustream_consume(s, len);
+		c->received += len;
+	}
+
+	if (c->received < msg_size)
+		return;
+
+	lat = now_ns() - c->start;
+	latency[lat_bucket(lat)]++;
+	if (lat > latency_max)
+		latency_max = lat;
+
+	if (++requests == max_requests)
+		uloop_end();
+
+	if (!uloop_cancelled)
+		client_send(c);
+}
+
+static void conn_init(struct conn *c, int fd, bool server)
+{
+	struct ustream *s = &c->s.stream;
+
+	if (server) {
+		s->notify_read = server_read_cb;
+		s->notify_write = server_notify_write;
+	} else {
+		s->notify_read = client_read_cb;
+	}
+	ustream_fd_init(&c->s, fd);
+}
+
+static void conn_free(struct conn *c)
+{
+	ustream_free(&c->s.stream);
+	close(c->s.fd.fd);
+}
+
+static void timer_cb(struct uloop_timeout *t)
+{
+	struct loop_thread *lt = cur_thread;
+
+	lt->timer_calls++;
+	uloop_timeout_set(t, 1 + (t - lt->timers) % 100);
+}
+
+static void thread_stop_cb(struct uloop_post *p)
+{
+	uloop_end();
+}
+
+static void *server_thread(void *arg)
+{
+	struct loop_thread *lt = arg;
+	int i;
+
+	cur_thread = lt;
+	uloop_set_backend(backend);
+	uloop_init();
+	uloop_stats_enable(true);
+	uloop_post_queue_init(&lt->queue);
+
+	for (i = lt->idx; i < n_clients; i += n_threads)
+		conn_init(&servers[i], servers[i].s.fd.fd, true);
+
+	lt->timers = calloc(n_timers, sizeof(*lt->timers));
+	for (i = 0; i < n_timers; i++) {
+		lt->timers[i].cb = timer_cb;
+		uloop_timeout_set(&lt->timers[i], 1 + i % 100);
+	}
+
+	pthread_barrier_wait(&barrier);
+	uloop_run();
+	uloop_stats_get(&lt->stats, false);
+
+	for (i = 0; i < n_timers; i++)
+		uloop_timeout_cancel(&lt->timers[i]);
+	free(lt->timers);
+
+	for (i = lt->idx; i < n_clients; i += n_threads)
+		conn_free(&servers[i]);
+
+	uloop_post_queue_done(&lt->queue);
+	uloop_done();
+
+	return NULL;
+}
+
+static int set_nonblock(int fd)
+{
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static int tcp_pair(int lfd, const char *port, int *fds)
+{
+	int one = 1;
+
+	fds[0] = usock(USOCK_TCP | USOCK_IPV4ONLY | USOCK_NUMERIC, "127.0.0.1", port);
+	if (fds[0] < 0)
+		return -1;
+
+	fds[1] = accept(lfd, NULL, NULL);
+	if (fds[1] < 0) {
+		close(fds[0]);
+		return -1;
+	}
+
+	setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	set_nonblock(fds[0]);
+	set_nonblock(fds[1]);
+
+	return 0;
+}
+
+static int create_conns(void)
+{
+	struct sockaddr_in sin;
+	socklen_t sl = sizeof(sin);
+	char port[8];
+	int lfd = -1;
+	int fds[2];
+	int i;
+
+	if (use_tcp) {
+		lfd = usock(USOCK_TCP | USOCK_SERVER | USOCK_IPV4ONLY | USOCK_NUMERIC,
+			    "127.0.0.1", "0");
+		if (lfd < 0 || getsockname(lfd, (struct sockaddr *) &sin, &sl) < 0) {
+			perror("usock");
+			return -1;
+		}
+		snprintf(port, sizeof(port), "%d", ntohs(sin.sin_port));
+	}
+
+	for (i = 0; i < n_clients; i++) {
+		if (use_tcp) {
+			if (tcp_pair(lfd, port, fds) < 0)
+				break;
+		} else if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				      0, fds) < 0) {
+			break;
+		}
+
+		clients[i].s.fd.fd = fds[0];
+		servers[i].s.fd.fd = fds[1];
+	}
+
+	if (lfd >= 0)
+		close(lfd);
+
+	if (i < n_clients) {
+		fprintf(stderr, "Failed to create connection %d: %s\n", i, strerror(errno));
+		while (i-- > 0) {
+			close(clients[i].s.fd.fd);
+			close(servers[i].s.fd.fd);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t io_syscalls(void)
+{
+	unsigned long long val;
+	uint64_t total = 0;
+	char line[64];
+	FILE *f;
+
+	f = fopen("/proc/self/io", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "syscr: %llu", &val) == 1 ||
+		    sscanf(line, "syscw: %llu", &val) == 1)
+			total += val;
+	}
+	fclose(f);
+
+	return total;
+}
+
+static long rss_kb(void)
+{
+	long pages = 0, size;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%ld %ld", &size, &pages) != 2)
+		pages = 0;
+	fclose(f);
+
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static const char *backend_name(enum uloop_backend b)
+{
+	switch (b) {
+	case ULOOP_BACKEND_EPOLL:
+		return "epoll";
+	case ULOOP_BACKEND_KQUEUE:
+		return "kqueue";
+	case ULOOP_BACKEND_IO_URING:
+		return "io_uring";
+	default:
+		return "default";
+	}
+}
+
+static int parse_backend(const char *name)
+{
+	static const enum uloop_backend list[] = {
+		ULOOP_BACKEND_EPOLL, ULOOP_BACKEND_KQUEUE, ULOOP_BACKEND_IO_URING,
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(list); i++) {
+		if (!strcmp(name, backend_name(list[i]))) {
+			backend = list[i];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void duration_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+static void report(uint64_t elapsed, uint64_t io_calls, struct uloop_stats *main_stats)
+{
+	uint64_t polls = main_stats->iterations, timer_calls = 0;
+	double secs = elapsed / 1e9, reqs = requests ? requests : 1;
+	struct rusage ru;
+	int i;
+
+	for (i = 0; i < n_threads; i++) {
+		polls += threads[i].stats.iterations;
+		timer_calls += threads[i].timer_calls;
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("backend %s, %s, %d clients, %d loop threads, %d byte messages, %d timers per thread\n",
+	       backend_name(uloop_get_backend()), use_tcp ? "tcp" : "socketpair",
+	       n_clients, n_threads, msg_size, n_timers);
+	printf("requests: %llu in %.2f s, %.0f req/s\n",
+	       (unsigned long long) requests, secs, requests / secs);
+	if (requests)
+		printf("latency (us): p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+		       lat_percentile(0.5), lat_percentile(0.99),
+		       lat_percentile(0.999), latency_max / 1000.0);
+	printf("syscalls per request: %.2f (read/write %.2f, poll %.2f)\n",
+	       (io_calls + polls) / reqs, io_calls / reqs, polls / reqs);
+	printf("timer callbacks: %llu\n", (unsigned long long) timer_calls);
+	/* ru_maxrss is the peak of the whole run, in KiB on Linux */
+	printf("max RSS (KiB): %ld, RSS at exit (KiB): %ld\n", ru.ru_maxrss, rss_kb());
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [<options>]\n"
+		"Options:\n"
+		"  -c <n>	Number of clients (default: %d)\n"
+		"  -s <n>	Message size in bytes (default: %d)\n"
+		"  -j <n>	Number of server loop threads (default: %d)\n"
+		"  -t <n>	Periodic timers per server thread (default: 0)\n"
+		"  -d <n>	Duration in seconds (default: %d)\n"
+		"  -n <n>	Stop after <n> requests\n"
+		"  -T		Use TCP over loopback instead of socketpairs\n"
+		"  -b <name>	Backend: epoll, kqueue or io_uring\n"
+		"\n", name, n_clients, msg_size, n_threads, duration);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct uloop_timeout timeout = { .cb = duration_cb };
+	struct uloop_stats main_stats;
+	uint64_t start, elapsed, io_calls;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "c:s:j:t:d:n:Tb:")) != -1) {
+		switch (ch) {
+		case 'c':
+			n_clients = atoi(optarg);
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		case 't':
+			n_timers = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			max_requests = strtoull(optarg, NULL, 0);
+			break;
+		case 'T':
+			use_tcp = true;
+			break;
+		case 'b':
+			if (parse_backend(optarg) < 0)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n_clients < 1 || msg_size < 1 || n_threads < 1 || n_timers < 0 ||
+	    duration < 1)
+		return usage(argv[0]);
+
+	if (uloop_set_backend(backend) < 0) {
+		fprintf(stderr, "Backend %s not supported\n", backend_name(backend));
+		return 1;
+	}
+
+	/* the first loop handles signals, so that ^C ends the run */
+	uloop_init();
+	uloop_stats_enable(true);
+
+	msg = malloc(msg_size);
+	memset(msg, 'x', msg_size);
+	clients = calloc(n_clients, sizeof(*clients));
+	servers = calloc(n_clients, sizeof(*servers));
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!msg || !clients || !servers || !threads || create_conns() < 0)
+		return 1;
+
+	pthread_barrier_init(&barrier, NULL, n_threads + 1);
+	for (i = 0; i < n_threads; i++) {
+		threads[i].idx = i;
+		threads[i].stop.cb = thread_stop_cb;
+		pthread_create(&threads[i].thread, NULL, server_thread, &threads[i]);
+	}
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < n_clients; i++)
+		conn_init(&clients[i], clients[i].s.fd.fd, false);
+
+	io_calls = io_syscalls();
+	uloop_stats_get(&main_stats, true);
+	start = now_ns();
+
+	for (i = 0; i < n_clients; i++)
+		client_send(&clients[i]);
+	uloop_timeout_set(&timeout, duration * 1000);
+	uloop_run();
+
+	elapsed = now_ns() - start;
+	io_calls = io_syscalls() - io_calls;
+	uloop_stats_get(&main_stats, false);
+	uloop_timeout_cancel(&timeout);
+
+	for (i = 0; i < n_threads; i++) {
+		uloop_post(&threads[i].queue, &threads[i].stop);
+		pthread_join(threads[i].thread, NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	report(elapsed, io_calls, &main_stats);
+
+	for (i = 0; i < n_clients; i++)
+		conn_free(&clients[i]);
+	uloop_done();
+
+	free(threads);
+	free(servers);
+	free(clients);
+	free(msg);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * htable - intrusive open addressing hash table
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "htable.h"
+
+#define HTABLE_MIN_SIZE		16
+
+void htable_init(struct htable *h, htable_hash_fn hash, htable_comp comp,
+		 void *ptr)
+{
+	h->slots = NULL;
+	h->mask = 0;
+	h->count = 0;
+	h->hash = hash;
+	h->comp = comp;
+	h->cmp_ptr = ptr;
+}
+
+void htable_free(struct htable *h)
+{
+	free(h->slots);
+	h->slots = NULL;
+	h->mask = 0;
+	h->count = 0;
+}
+
+static void htable_place(struct htable_slot *slots, unsigned int mask,
+			 struct htable_node *node, uint32_t hash)
+{
+	unsigned int i = hash & mask;
+
+	while (slots[i].node)
+		i = (i + 1) & mask;
+
+	slots[i].node = node;
+	slots[i].hash = hash;
+}
+
+static int htable_grow(struct htable *h)
+{
+	unsigned int size = htable_size(h);
+	unsigned int new_size = size ? size * 2 : HTABLE_MIN_SIZE;
+	struct htable_slot *slots;
+
+	if (new_size < size)
+		return -1;
+
+	slots = calloc(new_size, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	for (unsigned int i = 0; i < size; i++)
+		if (h->slots[i].node)
+			htable_place(slots, new_size - 1, h->slots[i].node,
+				     h->slots[i].hash);
+
+	free(h->slots);
+	h->slots = slots;
+	h->mask = new_size - 1;
+
+	return 0;
+}
+
+static struct htable_slot *
+htable_find_slot(const struct htable *h, const void *key, uint32_t hash)
+{
+	unsigned int i = hash & h->mask;
+
+	for (;; i = (i + 1) & h->mask) {
+		struct htable_slot *slot = &h->slots[i];
+
+		if (!slot->node)
+			return slot;
+
+		if (slot->hash == hash &&
+		    !h->comp(key, slot->node->key, h->cmp_ptr))
+			return slot;
+	}
+}
+
+struct htable_node *htable_find(const struct htable *h, const void *key)
+{
+	if (!h->count)
+		return NULL;
+
+	return htable_find_slot(h, key, h->hash(key, h->cmp_ptr))->node;
+}
+
+int htable_insert(struct htable *h, struct htable_node *node)
+{
+	uint32_t hash = h->hash(node->key, h->cmp_ptr);
+	struct htable_slot *slot;
+
+	/* keep the load factor at or below 3/4 */
+	if ((h->count + 1) * 4 > htable_size(h) * 3 && htable_grow(h))
+		return -1;
+
+	slot = htable_find_slot(h, node->key, hash);
+	if (slot->node)
+		return -1;
+
+	slot->node = node;
+	slot->hash = hash;
+	h->count++;
+
+	return 0;
+}
+
+void htable_delete(struct htable *h, struct htable_node *node)
+{
+	unsigned int i, j, k;
+
+	if (!h->count)
+		return;
+
+	i = h->hash(node->key, h->cmp_ptr) & h->mask;
+	while (h->slots[i].node != node) {
+		if (!h->slots[i].node)
+			return;
+		i = (i + 1) & h->mask;
+	}
+
+	/*
+	 * Backward shift deletion: move up later entries of the probe run
+	 * whose home slot is not between the hole and themselves, so that
+	 * lookups never need tombstones.
+	 */
+	h->slots[i].node = NULL;
+	for (j = (i + 1) & h->mask; h->slots[j].node; j = (j + 1) & h->mask) {
+		k = h->slots[j].hash & h->mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		h->slots[i] = h->slots[j];
+		h->slots[j].node = NULL;
+		i = j;
+	}
+
+	h->count--;
+}
+
+void htable_replace(struct htable *h, struct htable_node *old,
+		    struct htable_node *node)
+{
+	unsigned int i;
+
+	if (!h->count)
+		return;
+
+	i = h->hash(old->key, h->cmp_ptr) & h->mask;
+	while (h->slots[i].node != old) {
+		if (!h->slots[i].node)
+			return;
+		i = (i + 1) & h->mask;
+	}
+
+	h->slots[i].node = node;
+}
+
+uint32_t htable_strhash(const void *key, void *ptr)
+{
+	const unsigned char *s = key;
+	uint32_t hash = 2166136261u;
+
+	/* FNV-1a, with a final mix since the slot index uses the low bits */
+	while (*s) {
+		hash ^= *s++;
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+
+	return hash;
+}
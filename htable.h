@@ -0,0 +1,100 @@
+/*
+ * htable - intrusive open addressing hash table
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __LIBUBOX_HTABLE_H
+#define __LIBUBOX_HTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * Exact-match lookup table for structs that embed a struct htable_node,
+ * the same way struct avl_node is embedded for an avl_tree. Collisions are
+ * resolved by linear probing in a power-of-two slot array, which also
+ * caches each entry's hash so that probes rarely touch the nodes.
+ *
+ * Iteration follows slot order, i.e. it is neither sorted nor stable
+ * across inserts. Deleting may move entries, so nodes must not be deleted
+ * while iterating with htable_for_each_element.
+ */
+
+struct htable_node {
+	const void *key;
+};
+
+typedef uint32_t (*htable_hash_fn)(const void *key, void *ptr);
+
+/* returns 0 if both keys are equal, avl_tree_comp comparators fit */
+typedef int (*htable_comp)(const void *k1, const void *k2, void *ptr);
+
+struct htable_slot {
+	struct htable_node *node;
+	uint32_t hash;
+};
+
+struct htable {
+	struct htable_slot *slots;
+	unsigned int mask;
+	unsigned int count;
+
+	htable_hash_fn hash;
+	htable_comp comp;
+	void *cmp_ptr;
+};
+
+#define HTABLE_INIT(_hash, _comp, _cmp_ptr)	\
+	{					\
+		.hash = _hash,			\
+		.comp = _comp,			\
+		.cmp_ptr = _cmp_ptr,		\
+	}
+
+void htable_init(struct htable *h, htable_hash_fn hash, htable_comp comp,
+		 void *ptr);
+/* frees the slot array, the nodes are left to the caller */
+void htable_free(struct htable *h);
+
+struct htable_node *htable_find(const struct htable *h, const void *key);
+/* returns -1 if the key already exists or the table could not grow */
+int htable_insert(struct htable *h, struct htable_node *node);
+void htable_delete(struct htable *h, struct htable_node *node);
+/* put node into the slot of old, both keys must be equal. Cannot fail. */
+void htable_replace(struct htable *h, struct htable_node *old,
+		    struct htable_node *node);
+
+uint32_t htable_strhash(const void *key, void *ptr);
+
+static inline unsigned int htable_size(const struct htable *h)
+{
+	return h->slots ? h->mask + 1 : 0;
+}
+
+#define htable_find_element(h, key, element, node_member)			\
+	({									\
+		struct htable_node *__n = htable_find(h, key);			\
+		__n ? container_of(__n, __typeof__(*(element)), node_member) : NULL; \
+	})
+
+#define htable_for_each_element(h, idx, element, node_member)			\
+	for (idx = 0; idx < htable_size(h); idx++)				\
+		if ((h)->slots[idx].node &&					\
+		    ((element) = container_of((h)->slots[idx].node,		\
+					      __typeof__(*(element)),		\
+					      node_member), 1))
+
+#endif
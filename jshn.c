@@ -30,13 +30,13 @@
 #include <inttypes.h>
 #include "list.h"
 
-#include "avl.h"
+#include "htable.h"
 #include "blob.h"
 #include "blobmsg_json.h"
 
 #define MAX_VARLEN	256
 
-static struct avl_tree env_vars;
+static struct htable env_vars;
 static struct blob_buf b = { 0 };
 
 static const char *var_prefix = "";
@@ -45,7 +45,7 @@ static int var_prefix_len = 0;
 static int add_json_element(const char *key, json_object *obj);
 
 struct env_var {
-	struct avl_node avl;
+	struct htable_node node;
 	char *val;
 };
 
@@ -191,9 +191,9 @@ static int jshn_parse(const char *str)
 	return 0;
 }
 
-static char *getenv_avl(const char *key)
+static char *getenv_var(const char *key)
 {
-	struct env_var *var = avl_find_element(&env_vars, key, var, avl);
+	struct env_var *var = htable_find_element(&env_vars, key, var, node);
 	return var ? var->val : NULL;
 }
 
@@ -204,7 +204,7 @@ static char *get_keys(const char *prefix)
 
 	keys = alloca(len);
 	snprintf(keys, len, "%sK_%s", var_prefix, prefix);
-	return getenv_avl(keys);
+	return getenv_var(keys);
 }
 
 static void get_var(const char *prefix, const char **name, char **var, char **type)
@@ -215,13 +215,13 @@ static void get_var(const char *prefix, const char **name, char **var, char **ty
 	tmpname = alloca(len);
 
 	snprintf(tmpname, len, "%s%s_%s", var_prefix, prefix, *name);
-	*var = getenv_avl(tmpname);
+	*var = getenv_var(tmpname);
 
 	snprintf(tmpname, len, "%sT_%s_%s", var_prefix, prefix, *name);
-	*type = getenv_avl(tmpname);
+	*type = getenv_var(tmpname);
 
 	snprintf(tmpname, len, "%sN_%s_%s", var_prefix, prefix, *name);
-	varname = getenv_avl(tmpname);
+	varname = getenv_var(tmpname);
 	if (varname)
 		*name = varname;
 }
@@ -280,7 +280,160 @@ out:
 	return obj;
 }
 
-static int jshn_format(bool no_newline, bool indent, FILE *stream)
+static void jshn_blob_add_objects(const char *prefix, bool array);
+
+static void jshn_blob_add_object_var(bool array, const char *prefix, const char *name)
+{
+	char *var, *type;
+	int64_t i64;
+	void *c;
+
+	get_var(prefix, &name, &var, &type);
+	if (!var || !type)
+		return;
+
+	if (array)
+		name = NULL;
+
+	if (!strcmp(type, "array")) {
+		c = blobmsg_open_array(&b, name);
+		jshn_blob_add_objects(var, true);
+		blobmsg_close_array(&b, c);
+	} else if (!strcmp(type, "object")) {
+		c = blobmsg_open_table(&b, name);
+		jshn_blob_add_objects(var, false);
+		blobmsg_close_table(&b, c);
+	} else if (!strcmp(type, "string")) {
+		blobmsg_add_string(&b, name, var);
+	} else if (!strcmp(type, "int")) {
+		i64 = atoll(var);
+		if (i64 >= INT32_MIN && i64 <= INT32_MAX)
+			blobmsg_add_u32(&b, name, (uint32_t)i64);
+		else
+			blobmsg_add_u64(&b, name, (uint64_t)i64);
+	} else if (!strcmp(type, "double")) {
+		blobmsg_add_double(&b, name, strtod(var, NULL));
+	} else if (!strcmp(type, "boolean")) {
+		blobmsg_add_u8(&b, name, !!atoi(var));
+	} else if (!strcmp(type, "null")) {
+		blobmsg_add_field(&b, BLOBMSG_TYPE_UNSPEC, name, NULL, 0);
+	}
+}
+
+static int jshn_key_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return strcmp(k1, k2);
+}
+
+static void jshn_blob_add_objects(const char *prefix, bool array)
+{
+	struct htable seen = HTABLE_INIT(htable_strhash, jshn_key_cmp, NULL);
+	struct htable_node *nodes = NULL;
+	char *keys, *key, *brk;
+	int n = 0;
+
+	keys = get_keys(prefix);
+	if (!keys)
+		return;
+
+	if (!array && !(nodes = calloc(strlen(keys) / 2 + 1, sizeof(*nodes))))
+		return;
+
+	for (key = strtok_r(keys, " ", &brk); key;
+	     key = strtok_r(NULL, " ", &brk)) {
+		/* a key added again replaces the value at its first position */
+		if (nodes) {
+			nodes[n].key = key;
+			if (htable_insert(&seen, &nodes[n]))
+				continue;
+			n++;
+		}
+
+		jshn_blob_add_object_var(array, prefix, key);
+	}
+
+	htable_free(&seen);
+	free(nodes);
+}
+
+/* environment entries are "name=value", keys end at the '=' */
+static uint32_t jshn_var_hash(const void *key, void *ptr)
+{
+	const unsigned char *s = key;
+	uint32_t hash = 2166136261u;
+
+	while (*s && *s != '=') {
+		hash ^= *s++;
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+static int jshn_var_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const char *s1 = k1;
+	const char *s2 = k2;
+	char c1, c2;
+
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+
+	c1 = *s1;
+	c2 = *s2;
+	if (c1 == '=')
+		c1 = 0;
+	if (c2 == '=')
+		c2 = 0;
+
+	return c1 - c2;
+}
+
+static struct env_var *jshn_index_vars(void)
+{
+	extern char **environ;
+	struct env_var *vars;
+	int i, n = 0;
+
+	/* only index the variables of our namespace */
+	htable_init(&env_vars, jshn_var_hash, jshn_var_cmp, NULL);
+	for (i = 0; environ[i]; i++);
+
+	vars = calloc(i + 1, sizeof(*vars));
+	if (!vars)
+		return NULL;
+
+	for (i = 0; environ[i]; i++) {
+		const char *name = environ[i];
+		char *c;
+
+		if (strncmp(name, var_prefix, var_prefix_len) != 0)
+			continue;
+
+		name += var_prefix_len;
+		if (!strchr("JKTN", name[0]) || name[1] != '_')
+			continue;
+
+		c = strchr(name, '=');
+		if (!c)
+			continue;
+
+		vars[n].node.key = environ[i];
+		vars[n].val = c + 1;
+		if (!htable_insert(&env_vars, &vars[n].node))
+			n++;
+	}
+
+	return vars;
+}
+
+static int jshn_format_json(bool no_newline, bool indent, FILE *stream)
 {
 	json_object *obj;
 	const char *output;
@@ -311,31 +464,50 @@ out:
 	return ret;
 }
 
-static int usage(const char *progname)
+static int jshn_format_blob(bool no_newline, bool indent, FILE *stream)
 {
-	fprintf(stderr, "Usage: %s [-n] [-i] -r <message>|-R <file>|-o <file>|-p <prefix>|-w\n", progname);
-	return 2;
+	int ret = -1;
+
+	/* stream the output directly from the blob, without a json-c tree */
+	blob_buf_init(&b, 0);
+	jshn_blob_add_objects("J_V", false);
+
+	if (blobmsg_format_json_file(stream, b.head, true, indent ? 0 : -1) < 0)
+		goto out;
+
+	if (!no_newline)
+		fputc('\n', stream);
+	ret = 0;
+
+out:
+	blob_buf_free(&b);
+	return ret;
 }
 
-static int avl_strcmp_var(const void *k1, const void *k2, void *ptr)
+static int jshn_format(bool no_newline, bool indent, bool blob, FILE *stream)
 {
-	const char *s1 = k1;
-	const char *s2 = k2;
-	char c1, c2;
+	struct env_var *vars;
+	int ret;
 
-	while (*s1 && *s1 == *s2) {
-		s1++;
-		s2++;
+	if (!(vars = jshn_index_vars())) {
+		fprintf(stderr, "%m\n");
+		return -1;
 	}
 
-	c1 = *s1;
-	c2 = *s2;
-	if (c1 == '=')
-		c1 = 0;
-	if (c2 == '=')
-		c2 = 0;
+	if (blob)
+		ret = jshn_format_blob(no_newline, indent, stream);
+	else
+		ret = jshn_format_json(no_newline, indent, stream);
 
-	return c1 - c2;
+	htable_free(&env_vars);
+	free(vars);
+	return ret;
+}
+
+static int usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-n] [-i] [-b] -r <message>|-R <file>|-o <file>|-p <prefix>|-w\n", progname);
+	return 2;
 }
 
 static int jshn_parse_file(const char *path)
@@ -376,7 +548,7 @@ static int jshn_parse_file(const char *path)
 	return ret;
 }
 
-static int jshn_format_file(const char *path, bool no_newline, bool indent)
+static int jshn_format_file(const char *path, bool no_newline, bool indent, bool blob)
 {
 	FILE *fp = NULL;
 	int ret = 0;
@@ -387,7 +559,7 @@ static int jshn_format_file(const char *path, bool no_newline, bool indent)
 		return 3;
 	}
 
-	ret = jshn_format(no_newline, indent, fp);
+	ret = jshn_format(no_newline, indent, blob, fp);
 	fclose(fp);
 
 	return ret;
@@ -395,35 +567,13 @@ static int jshn_format_file(const char *path, bool no_newline, bool indent)
 
 int main(int argc, char **argv)
 {
-	extern char **environ;
 	bool no_newline = false;
 	bool indent = false;
-	struct env_var *vars;
-	int i;
+	bool blob = false;
 	int ret = 0;
 	int ch;
 
-	avl_init(&env_vars, avl_strcmp_var, false, NULL);
-	for (i = 0; environ[i]; i++);
-
-	vars = calloc(i, sizeof(*vars));
-	if (!vars) {
-		fprintf(stderr, "%m\n");
-		return -1;
-	}
-	for (i = 0; environ[i]; i++) {
-		char *c;
-
-		vars[i].avl.key = environ[i];
-		c = strchr(environ[i], '=');
-		if (!c)
-			continue;
-
-		vars[i].val = c + 1;
-		avl_insert(&env_vars, &vars[i].avl);
-	}
-
-	while ((ch = getopt(argc, argv, "p:nir:R:o:w")) != -1) {
+	while ((ch = getopt(argc, argv, "p:nibr:R:o:w")) != -1) {
 		switch(ch) {
 		case 'p':
 			var_prefix = optarg;
@@ -436,10 +586,10 @@ int main(int argc, char **argv)
 			ret = jshn_parse_file(optarg);
 			goto exit;
 		case 'w':
-			ret = jshn_format(no_newline, indent, stdout);
+			ret = jshn_format(no_newline, indent, blob, stdout);
 			goto exit;
 		case 'o':
-			ret = jshn_format_file(optarg, no_newline, indent);
+			ret = jshn_format_file(optarg, no_newline, indent, blob);
 			goto exit;
 		case 'n':
 			no_newline = true;
@@ -447,16 +597,16 @@ int main(int argc, char **argv)
 		case 'i':
 			indent = true;
 			break;
+		case 'b':
+			blob = true;
+			break;
 		default:
-			free(vars);
 			return usage(argv[0]);
 		}
 	}
 
-	free(vars);
 	return usage(argv[0]);
 
 exit:
-	free(vars);
 	return ret;
 }
@@ -17,22 +17,82 @@
 #include <regex.h>
 
 #include "avl-cmp.h"
+#include "arena.h"
 #include "json_script.h"
 
+struct json_var_slot {
+	uint32_t hash;
+	struct blob_attr *attr;
+};
+
 struct json_call {
 	struct json_script_ctx *ctx;
 	struct blob_attr *vars;
 	unsigned int seq;
+
+	/* hash index over vars, built on the first lookup of a run */
+	bool var_indexed;
+	unsigned int var_mask;
+	struct json_var_slot *var_slots;
+	struct json_var_slot var_buf[64];
+};
+
+/* string with variable references split up front, see eval_pattern */
+struct json_pattern {
+	int n_seg;
+	bool unterminated;
+	struct json_pattern_seg {
+		const char *str;
+		int len;
+		bool var;
+	} seg[];
+};
+
+struct json_op;
+
+/* value of an eq/regex/has test, case label or command argument */
+struct json_match {
+	struct blob_attr *attr;
+	const char *str;
+	regex_t *re;
+	struct json_pattern *pat;
+	struct json_op *op;
+};
+
+struct json_op {
+	int (*cb)(struct json_call *call, struct json_op *op);
+	struct blob_attr *attr;
+	struct json_op *next;
+	struct json_op *sub[3];
+	bool cmd;
+	int val;
+
+	const char *name;
+	struct json_pattern *pat;
+	struct json_match *match;
+	int n_match;
+};
+
+struct json_regex {
+	struct json_regex *next;
+	regex_t re;
+};
+
+struct json_script_prog {
+	struct arena arena;
+	struct json_regex *regex;
+	struct json_op *root;
 };
 
 struct json_handler {
 	const char *name;
-	int (*cb)(struct json_call *call, struct blob_attr *cur);
+	struct json_op *(*compile)(struct json_script_prog *p, struct blob_attr *cur);
 };
 
-static int json_process_expr(struct json_call *call, struct blob_attr *cur);
-static int json_process_cmd(struct json_call *call, struct blob_attr *cur);
-static int eval_string(struct json_call *call, struct blob_buf *buf, const char *name, const char *pattern);
+static struct json_op *json_compile_expr(struct json_script_prog *p, struct blob_attr *cur);
+static struct json_op *json_compile_cmd(struct json_script_prog *p, struct blob_attr *cur);
+static int eval_pattern(struct json_call *call, struct blob_buf *buf, const char *name,
+			const struct json_pattern *pat);
 
 struct json_script_file *
 json_script_file_from_blobmsg(const char *name, void *data, int len)
@@ -55,6 +115,28 @@ json_script_file_from_blobmsg(const char *name, void *data, int len)
 	return f;
 }
 
+struct json_script_file *
+json_script_file_from_blobmsg_arena(struct arena *a, const char *name,
+				    void *data, int len)
+{
+	struct json_script_file *f;
+	int name_len = 0;
+
+	if (name)
+		name_len = strlen(name) + 1;
+
+	f = arena_calloc(a, sizeof(*f) + len + name_len);
+	if (!f)
+		return NULL;
+
+	f->arena = true;
+	memcpy(f->data, data, len);
+	if (name)
+		f->avl.key = strcpy((char *) f->data + len, name);
+
+	return f;
+}
+
 static struct json_script_file *
 json_script_get_file(struct json_script_ctx *ctx, const char *filename)
 {
@@ -72,6 +154,19 @@ json_script_get_file(struct json_script_ctx *ctx, const char *filename)
 	return f;
 }
 
+static int json_exec_block(struct json_call *call, struct json_op *op)
+{
+	if (op->cmd && call->ctx->abort)
+		return 0;
+
+	return op->cb(call, op);
+}
+
+static int json_exec_expr(struct json_call *call, struct json_op *op)
+{
+	return op->cb(call, op);
+}
+
 static void __json_script_run(struct json_call *call, struct json_script_file *file,
 			      struct blob_attr *context)
 {
@@ -86,7 +181,8 @@ static void __json_script_run(struct json_call *call, struct json_script_file *f
 
 	file->seq = call->seq;
 	while (file) {
-		json_process_cmd(call, file->data);
+		if (!json_script_file_compile(file))
+			json_exec_block(call, file->prog->root);
 		file = file->next;
 	}
 }
@@ -110,10 +206,93 @@ const char *json_script_find_var(struct json_script_ctx *ctx, struct blob_attr *
 	return ctx->handle_var(ctx, name, vars);
 }
 
+static uint32_t json_var_hash(const char *name)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 0x01000193;
+
+	return hash;
+}
+
+static void json_call_index_vars(struct json_call *call)
+{
+	struct blob_attr *cur;
+	unsigned int size = 16, n = 0;
+	size_t rem;
+
+	call->var_indexed = true;
+	if (!call->vars)
+		return;
+
+	blobmsg_for_each_attr(cur, call->vars, rem)
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_STRING)
+			n++;
+
+	while (size < 2 * n)
+		size <<= 1;
+
+	if (size <= ARRAY_SIZE(call->var_buf)) {
+		call->var_slots = call->var_buf;
+		memset(call->var_slots, 0, size * sizeof(*call->var_slots));
+	} else {
+		/* fall back to scanning vars if this fails */
+		call->var_slots = calloc(size, sizeof(*call->var_slots));
+		if (!call->var_slots)
+			return;
+	}
+	call->var_mask = size - 1;
+
+	blobmsg_for_each_attr(cur, call->vars, rem) {
+		uint32_t hash, i;
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			continue;
+
+		hash = json_var_hash(blobmsg_name(cur));
+		for (i = hash & call->var_mask; call->var_slots[i].attr;
+		     i = (i + 1) & call->var_mask) {
+			/* the first variable of a given name wins */
+			if (call->var_slots[i].hash == hash &&
+			    !strcmp(blobmsg_name(call->var_slots[i].attr), blobmsg_name(cur)))
+				break;
+		}
+
+		if (call->var_slots[i].attr)
+			continue;
+
+		call->var_slots[i].hash = hash;
+		call->var_slots[i].attr = cur;
+	}
+}
+
+static void json_call_free(struct json_call *call)
+{
+	if (call->var_slots != call->var_buf)
+		free(call->var_slots);
+}
+
 static const char *
 msg_find_var(struct json_call *call, const char *name)
 {
-	return json_script_find_var(call->ctx, call->vars, name);
+	struct json_var_slot *slot;
+	uint32_t hash, i;
+
+	if (!call->var_indexed)
+		json_call_index_vars(call);
+
+	if (!call->var_slots)
+		return json_script_find_var(call->ctx, call->vars, name);
+
+	hash = json_var_hash(name);
+	for (i = hash & call->var_mask; (slot = &call->var_slots[i])->attr;
+	     i = (i + 1) & call->var_mask) {
+		if (slot->hash == hash && !strcmp(blobmsg_name(slot->attr), name))
+			return blobmsg_data(slot->attr);
+	}
+
+	return call->ctx->handle_var(call->ctx, name, call->vars);
 }
 
 static void
@@ -130,11 +309,238 @@ json_get_tuple(struct blob_attr *cur, struct blob_attr **tb, int t1, int t2)
 	blobmsg_parse_array(expr_tuple, 3, tb, blobmsg_data(cur), blobmsg_data_len(cur));
 }
 
-static int handle_if(struct json_call *call, struct blob_attr *expr)
+static struct json_op *
+json_op_new(struct json_script_prog *p, struct blob_attr *attr,
+	    int (*cb)(struct json_call *call, struct json_op *op))
+{
+	struct json_op *op;
+
+	op = arena_calloc(&p->arena, sizeof(*op));
+	if (!op)
+		return NULL;
+
+	op->cb = cb;
+	op->attr = attr;
+	return op;
+}
+
+static int op_const(struct json_call *call, struct json_op *op)
+{
+	return op->val;
+}
+
+static struct json_op *
+json_op_const(struct json_script_prog *p, struct blob_attr *attr, int val)
+{
+	struct json_op *op = json_op_new(p, attr, op_const);
+
+	if (op)
+		op->val = val;
+
+	return op;
+}
+
+static int op_type_error(struct json_call *call, struct json_op *op)
+{
+	call->ctx->handle_error(call->ctx, "Unexpected element type", op->attr);
+	return -1;
+}
+
+static struct json_pattern *
+json_compile_pattern(struct arena *a, const char *pattern)
+{
+	struct json_pattern *pat;
+	char *next, *str, *end;
+	bool var = false;
+	int n = 1;
+
+	for (str = (char *) pattern; (str = strchr(str, '%')) != NULL; str++)
+		n++;
+
+	pat = arena_alloc(a, sizeof(*pat) + n * sizeof(pat->seg[0]));
+	next = arena_strdup(a, pattern);
+	if (!pat || !next)
+		return NULL;
+
+	pat->n_seg = 0;
+	for (str = next; str; str = next) {
+		struct json_pattern_seg *seg = &pat->seg[pat->n_seg];
+		bool cur_var = var;
+
+		end = strchr(str, '%');
+		if (end) {
+			*end = 0;
+			next = end + 1;
+			var = !var;
+		} else {
+			end = str + strlen(str);
+			next = NULL;
+		}
+
+		/* "%%" is a literal percent sign */
+		if (cur_var && end == str) {
+			seg->str = "%";
+			seg->len = 1;
+			seg->var = false;
+		} else if (!cur_var && end == str) {
+			continue;
+		} else {
+			seg->str = str;
+			seg->len = end - str;
+			seg->var = cur_var;
+		}
+		pat->n_seg++;
+	}
+	pat->unterminated = var;
+
+	return pat;
+}
+
+static int eval_pattern(struct json_call *call, struct blob_buf *buf, const char *name,
+			const struct json_pattern *pat)
+{
+	bool error = pat->unterminated;
+	char *dest;
+	int len = 0;
+	int i;
+
+	dest = blobmsg_alloc_string_buffer(buf, name, 0);
+	if (!dest)
+		return -1;
+
+	for (i = 0; i < pat->n_seg; i++) {
+		const struct json_pattern_seg *seg = &pat->seg[i];
+		const char *cur = seg->str;
+		int cur_len = seg->len;
+		char *new_buf;
+
+		if (seg->var) {
+			cur = msg_find_var(call, seg->str);
+			if (!cur)
+				continue;
+
+			cur_len = strlen(cur);
+		}
+
+		new_buf = blobmsg_realloc_string_buffer(buf, len + cur_len);
+		if (!new_buf) {
+			/* Make eval_pattern return -1 */
+			error = true;
+			break;
+		}
+
+		dest = new_buf;
+		memcpy(dest + len, cur, cur_len);
+		len += cur_len;
+	}
+
+	dest[len] = 0;
+	blobmsg_add_string_buffer(buf);
+
+	if (error)
+		return -1;
+
+	return 0;
+}
+
+static struct json_match *
+json_match_alloc(struct json_script_prog *p, struct json_op *op, int n)
+{
+	op->match = arena_calloc(&p->arena, n * sizeof(*op->match));
+	op->n_match = n;
+	return op->match;
+}
+
+static bool
+json_match_compile(struct json_script_prog *p, struct json_match *m,
+		   struct blob_attr *cur, bool regex)
+{
+	struct json_regex *r;
+
+	m->attr = cur;
+	if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+		return true;
+
+	m->str = blobmsg_data(cur);
+	if (!regex)
+		return true;
+
+	r = arena_alloc(&p->arena, sizeof(*r));
+	if (!r)
+		return false;
+
+	/* patterns that fail to compile never match */
+	if (regcomp(&r->re, m->str, REG_EXTENDED | REG_NOSUB))
+		return true;
+
+	r->next = p->regex;
+	p->regex = r;
+	m->re = &r->re;
+
+	return true;
+}
+
+/*
+ * Compile the values of an eq, regex or has test: a single string or an
+ * array of strings. Anything else becomes an entry without a string, which
+ * reports a type error once the test gets to it.
+ */
+static bool
+json_compile_values(struct json_script_prog *p, struct json_op *op,
+		    struct blob_attr *attr, bool regex)
+{
+	struct blob_attr *cur;
+	size_t rem;
+	int n = 0;
+
+	if (blobmsg_type(attr) != BLOBMSG_TYPE_ARRAY) {
+		if (!json_match_alloc(p, op, 1))
+			return false;
+
+		if (blobmsg_type(attr) != BLOBMSG_TYPE_STRING) {
+			op->match->attr = attr;
+			return true;
+		}
+
+		return json_match_compile(p, op->match, attr, regex);
+	}
+
+	blobmsg_for_each_attr(cur, attr, rem)
+		n++;
+
+	if (n && !json_match_alloc(p, op, n))
+		return false;
+
+	n = 0;
+	blobmsg_for_each_attr(cur, attr, rem)
+		if (!json_match_compile(p, &op->match[n++], cur, regex))
+			return false;
+
+	return true;
+}
+
+static int op_if(struct json_call *call, struct json_op *op)
 {
-	struct blob_attr *tb[4];
 	int ret;
 
+	ret = json_exec_expr(call, op->sub[0]);
+	if (ret < 0)
+		return 0;
+
+	if (ret)
+		return json_exec_block(call, op->sub[1]);
+
+	if (!op->sub[2])
+		return 0;
+
+	return json_exec_block(call, op->sub[2]);
+}
+
+static struct json_op *compile_if(struct json_script_prog *p, struct blob_attr *expr)
+{
+	struct blob_attr *tb[4];
+	struct json_op *op;
+
 	static const struct blobmsg_policy if_tuple[4] = {
 		{ .type = BLOBMSG_TYPE_STRING },
 		{ .type = BLOBMSG_TYPE_ARRAY },
@@ -145,226 +551,307 @@ static int handle_if(struct json_call *call, struct blob_attr *expr)
 	blobmsg_parse_array(if_tuple, 4, tb, blobmsg_data(expr), blobmsg_data_len(expr));
 
 	if (!tb[1] || !tb[2])
-		return 0;
+		return json_op_const(p, expr, 0);
 
-	ret = json_process_expr(call, tb[1]);
-	if (ret < 0)
-		return 0;
+	op = json_op_new(p, expr, op_if);
+	if (!op)
+		return NULL;
 
-	if (ret)
-		return json_process_cmd(call, tb[2]);
+	op->sub[0] = json_compile_expr(p, tb[1]);
+	op->sub[1] = json_compile_cmd(p, tb[2]);
+	if (tb[3])
+		op->sub[2] = json_compile_cmd(p, tb[3]);
 
-	if (!tb[3])
+	if (!op->sub[0] || !op->sub[1] || (tb[3] && !op->sub[2]))
+		return NULL;
+
+	return op;
+}
+
+static int op_case(struct json_call *call, struct json_op *op)
+{
+	const char *var;
+	int i;
+
+	var = msg_find_var(call, op->name);
+	if (!var)
 		return 0;
 
-	return json_process_cmd(call, tb[3]);
+	for (i = 0; i < op->n_match; i++) {
+		if (!strcmp(var, op->match[i].str))
+			return json_exec_block(call, op->match[i].op);
+	}
+
+	return 0;
 }
 
-static int handle_case(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_case(struct json_script_prog *p, struct blob_attr *expr)
 {
 	struct blob_attr *tb[3], *cur;
-	const char *var;
+	struct json_op *op;
 	size_t rem;
+	int n = 0;
 
 	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, BLOBMSG_TYPE_TABLE);
 	if (!tb[1] || !tb[2])
-		return 0;
+		return json_op_const(p, expr, 0);
 
-	var = msg_find_var(call, blobmsg_data(tb[1]));
-	if (!var)
-		return 0;
+	op = json_op_new(p, expr, op_case);
+	if (!op)
+		return NULL;
+
+	op->name = blobmsg_data(tb[1]);
+	blobmsg_for_each_attr(cur, tb[2], rem)
+		n++;
+
+	if (n && !json_match_alloc(p, op, n))
+		return NULL;
 
+	n = 0;
 	blobmsg_for_each_attr(cur, tb[2], rem) {
-		if (!strcmp(var, blobmsg_name(cur)))
-			return json_process_cmd(call, cur);
+		struct json_match *m = &op->match[n++];
+
+		m->attr = cur;
+		m->str = blobmsg_name(cur);
+		m->op = json_compile_cmd(p, cur);
+		if (!m->op)
+			return NULL;
 	}
 
-	return 0;
+	return op;
 }
 
-static int handle_return(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_return(struct json_script_prog *p, struct blob_attr *expr)
 {
-	return -2;
+	return json_op_const(p, expr, -2);
 }
 
-static int handle_include(struct json_call *call, struct blob_attr *expr)
+static int op_include(struct json_call *call, struct json_op *op)
 {
-	struct blob_attr *tb[3];
 	struct json_script_file *f;
 
-	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
-	if (!tb[1])
-		return 0;
-
-	f = json_script_get_file(call->ctx, blobmsg_data(tb[1]));
+	f = json_script_get_file(call->ctx, op->name);
 	if (!f)
 		return 0;
 
-	__json_script_run(call, f, expr);
+	__json_script_run(call, f, op->attr);
 	return 0;
 }
 
-static const struct json_handler cmd[] = {
-	{ "if", handle_if },
-	{ "case", handle_case },
-	{ "return", handle_return },
-	{ "include", handle_include },
-};
-
-static int eq_regex_cmp(const char *str, const char *pattern, bool regex)
+static struct json_op *compile_include(struct json_script_prog *p, struct blob_attr *expr)
 {
-	regex_t reg;
-	int ret;
-
-	if (!regex)
-		return !strcmp(str, pattern);
+	struct blob_attr *tb[3];
+	struct json_op *op;
 
-	if (regcomp(&reg, pattern, REG_EXTENDED | REG_NOSUB))
-		return 0;
+	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
+	if (!tb[1])
+		return json_op_const(p, expr, 0);
 
-	ret = !regexec(&reg, str, 0, NULL, 0);
-	regfree(&reg);
+	op = json_op_new(p, expr, op_include);
+	if (op)
+		op->name = blobmsg_data(tb[1]);
 
-	return ret;
+	return op;
 }
 
-static int expr_eq_regex(struct json_call *call, struct blob_attr *expr, bool regex)
+static const struct json_handler cmd[] = {
+	{ "if", compile_if },
+	{ "case", compile_case },
+	{ "return", compile_return },
+	{ "include", compile_include },
+};
+
+static int op_eq_regex(struct json_call *call, struct json_op *op)
 {
 	struct json_script_ctx *ctx = call->ctx;
-	struct blob_attr *tb[3], *cur;
 	const char *var;
-	size_t rem;
-
-	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
-	if (!tb[1] || !tb[2])
-		return -1;
+	int i;
 
-	var = msg_find_var(call, blobmsg_data(tb[1]));
+	var = msg_find_var(call, op->name);
 	if (!var)
 		return 0;
 
-	switch(blobmsg_type(tb[2])) {
-	case BLOBMSG_TYPE_STRING:
-		return eq_regex_cmp(var, blobmsg_data(tb[2]), regex);
-	case BLOBMSG_TYPE_ARRAY:
-		blobmsg_for_each_attr(cur, tb[2], rem) {
-			if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING) {
-				ctx->handle_error(ctx, "Unexpected element type", cur);
-				return -1;
-			}
-
-			if (eq_regex_cmp(var, blobmsg_data(cur), regex))
+	for (i = 0; i < op->n_match; i++) {
+		struct json_match *m = &op->match[i];
+
+		if (!m->str) {
+			ctx->handle_error(ctx, "Unexpected element type", m->attr);
+			return -1;
+		}
+
+		if (op->val) {
+			if (m->re && !regexec(m->re, var, 0, NULL, 0))
 				return 1;
+		} else if (!strcmp(var, m->str)) {
+			return 1;
 		}
-		return 0;
-	default:
-		ctx->handle_error(ctx, "Unexpected element type", tb[2]);
-		return -1;
 	}
+
+	return 0;
+}
+
+static struct json_op *
+compile_eq_regex(struct json_script_prog *p, struct blob_attr *expr, bool regex)
+{
+	struct blob_attr *tb[3];
+	struct json_op *op;
+
+	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
+	if (!tb[1] || !tb[2])
+		return json_op_const(p, expr, -1);
+
+	op = json_op_new(p, expr, op_eq_regex);
+	if (!op)
+		return NULL;
+
+	op->name = blobmsg_data(tb[1]);
+	op->val = regex;
+	if (!json_compile_values(p, op, tb[2], regex))
+		return NULL;
+
+	return op;
 }
 
-static int handle_expr_eq(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_expr_eq(struct json_script_prog *p, struct blob_attr *expr)
 {
-	return expr_eq_regex(call, expr, false);
+	return compile_eq_regex(p, expr, false);
 }
 
-static int handle_expr_regex(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_expr_regex(struct json_script_prog *p, struct blob_attr *expr)
 {
-	return expr_eq_regex(call, expr, true);
+	return compile_eq_regex(p, expr, true);
 }
 
-static int handle_expr_has(struct json_call *call, struct blob_attr *expr)
+static int op_has(struct json_call *call, struct json_op *op)
 {
 	struct json_script_ctx *ctx = call->ctx;
-	struct blob_attr *tb[3], *cur;
-	size_t rem;
+	int i;
+
+	for (i = 0; i < op->n_match; i++) {
+		struct json_match *m = &op->match[i];
+
+		if (!m->str) {
+			ctx->handle_error(ctx, "Unexpected element type", m->attr);
+			return -1;
+		}
+
+		if (msg_find_var(call, m->str))
+			return 1;
+	}
+
+	return 0;
+}
+
+static struct json_op *compile_expr_has(struct json_script_prog *p, struct blob_attr *expr)
+{
+	struct blob_attr *tb[3];
+	struct json_op *op;
 
 	json_get_tuple(expr, tb, 0, 0);
 	if (!tb[1])
-		return -1;
+		return json_op_const(p, expr, -1);
 
-	switch(blobmsg_type(tb[1])) {
-	case BLOBMSG_TYPE_STRING:
-		return !!msg_find_var(call, blobmsg_data(tb[1]));
-	case BLOBMSG_TYPE_ARRAY:
-		blobmsg_for_each_attr(cur, tb[1], rem) {
-			if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING) {
-				ctx->handle_error(ctx, "Unexpected element type", cur);
-				return -1;
-			}
-
-			if (msg_find_var(call, blobmsg_data(cur)))
-				return 1;
-		}
-		return 0;
-	default:
-		ctx->handle_error(ctx, "Unexpected element type", tb[1]);
-		return -1;
+	op = json_op_new(p, expr, op_has);
+	if (!op || !json_compile_values(p, op, tb[1], false))
+		return NULL;
+
+	return op;
+}
+
+static int op_and_or(struct json_call *call, struct json_op *op)
+{
+	struct json_op *cur;
+	int ret;
+
+	for (cur = op->sub[0]; cur; cur = cur->next) {
+		ret = json_exec_expr(call, cur);
+		if (ret < 0)
+			return ret;
+
+		if (ret != op->val)
+			return ret;
 	}
+
+	return op->val;
 }
 
-static int expr_and_or(struct json_call *call, struct blob_attr *expr, bool and)
+static struct json_op *
+compile_and_or(struct json_script_prog *p, struct blob_attr *expr, bool and)
 {
+	struct json_op *op, **tail;
 	struct blob_attr *cur;
-	int ret;
 	size_t rem;
 	int i = 0;
 
+	op = json_op_new(p, expr, op_and_or);
+	if (!op)
+		return NULL;
+
+	op->val = and;
+	tail = &op->sub[0];
 	blobmsg_for_each_attr(cur, expr, rem) {
 		if (i++ < 1)
 			continue;
 
-		ret = json_process_expr(call, cur);
-		if (ret < 0)
-			return ret;
+		*tail = json_compile_expr(p, cur);
+		if (!*tail)
+			return NULL;
 
-		if (ret != and)
-			return ret;
+		tail = &(*tail)->next;
 	}
 
-	return and;
+	return op;
 }
 
-static int handle_expr_and(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_expr_and(struct json_script_prog *p, struct blob_attr *expr)
 {
-	return expr_and_or(call, expr, 1);
+	return compile_and_or(p, expr, 1);
 }
 
-static int handle_expr_or(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_expr_or(struct json_script_prog *p, struct blob_attr *expr)
 {
-	return expr_and_or(call, expr, 0);
+	return compile_and_or(p, expr, 0);
 }
 
-static int handle_expr_not(struct json_call *call, struct blob_attr *expr)
+static int op_not(struct json_call *call, struct json_op *op)
 {
-	struct blob_attr *tb[3];
 	int ret;
 
-	json_get_tuple(expr, tb, BLOBMSG_TYPE_ARRAY, 0);
-	if (!tb[1])
-		return -1;
-
-	ret = json_process_expr(call, tb[1]);
+	ret = json_exec_expr(call, op->sub[0]);
 	if (ret < 0)
 		return ret;
 	return !ret;
 }
 
-static int handle_expr_isdir(struct json_call *call, struct blob_attr *expr)
+static struct json_op *compile_expr_not(struct json_script_prog *p, struct blob_attr *expr)
 {
-	static struct blob_buf b;
 	struct blob_attr *tb[3];
-	const char *pattern, *path;
+	struct json_op *op;
+
+	json_get_tuple(expr, tb, BLOBMSG_TYPE_ARRAY, 0);
+	if (!tb[1])
+		return json_op_const(p, expr, -1);
+
+	op = json_op_new(p, expr, op_not);
+	if (!op)
+		return NULL;
+
+	op->sub[0] = json_compile_expr(p, tb[1]);
+	if (!op->sub[0])
+		return NULL;
+
+	return op;
+}
+
+static int op_isdir(struct json_call *call, struct json_op *op)
+{
+	static struct blob_buf b;
+	const char *path;
 	struct stat s;
 	int ret;
 
-	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
-	if (!tb[1] || blobmsg_type(tb[1]) != BLOBMSG_TYPE_STRING)
-		return -1;
-	pattern = blobmsg_data(tb[1]);
-
 	blob_buf_init(&b, 0);
-	ret = eval_string(call, &b, NULL, pattern);
+	ret = eval_pattern(call, &b, NULL, op->pat);
 	if (ret < 0)
 		return ret;
 	path = blobmsg_data(blob_data(b.head));
@@ -374,236 +861,270 @@ static int handle_expr_isdir(struct json_call *call, struct blob_attr *expr)
 	return S_ISDIR(s.st_mode);
 }
 
+static struct json_op *compile_expr_isdir(struct json_script_prog *p, struct blob_attr *expr)
+{
+	struct blob_attr *tb[3];
+	struct json_op *op;
+
+	json_get_tuple(expr, tb, BLOBMSG_TYPE_STRING, 0);
+	if (!tb[1] || blobmsg_type(tb[1]) != BLOBMSG_TYPE_STRING)
+		return json_op_const(p, expr, -1);
+
+	op = json_op_new(p, expr, op_isdir);
+	if (!op)
+		return NULL;
+
+	op->pat = json_compile_pattern(&p->arena, blobmsg_data(tb[1]));
+	if (!op->pat)
+		return NULL;
+
+	return op;
+}
+
 static const struct json_handler expr[] = {
-	{ "eq", handle_expr_eq },
-	{ "regex", handle_expr_regex },
-	{ "has", handle_expr_has },
-	{ "and", handle_expr_and },
-	{ "or", handle_expr_or },
-	{ "not", handle_expr_not },
-	{ "isdir", handle_expr_isdir },
+	{ "eq", compile_expr_eq },
+	{ "regex", compile_expr_regex },
+	{ "has", compile_expr_has },
+	{ "and", compile_expr_and },
+	{ "or", compile_expr_or },
+	{ "not", compile_expr_not },
+	{ "isdir", compile_expr_isdir },
 };
 
-static int
-__json_process_type(struct json_call *call, struct blob_attr *cur,
-		    const struct json_handler *h, int n, bool *found)
+static const struct json_handler *
+json_find_handler(struct blob_attr *cur, const struct json_handler *h, int n)
 {
 	const char *name = blobmsg_data(blobmsg_data(cur));
 	int i;
 
 	for (i = 0; i < n; i++) {
-		if (strcmp(name, h[i].name) != 0)
-			continue;
-
-		*found = true;
-		return h[i].cb(call, cur);
+		if (!strcmp(name, h[i].name))
+			return &h[i];
 	}
 
-	*found = false;
-	return -1;
+	return NULL;
 }
 
-static int json_process_expr(struct json_call *call, struct blob_attr *cur)
+static bool json_is_call(struct blob_attr *cur)
 {
-	struct json_script_ctx *ctx = call->ctx;
-	bool found;
-	int ret;
-
-	if (blobmsg_type(cur) != BLOBMSG_TYPE_ARRAY ||
-	    blobmsg_type(blobmsg_data(cur)) != BLOBMSG_TYPE_STRING) {
-		ctx->handle_error(ctx, "Unexpected element type", cur);
-		return -1;
-	}
+	return blobmsg_type(cur) == BLOBMSG_TYPE_ARRAY &&
+	       blobmsg_data_len(cur) > 0 &&
+	       blobmsg_type(blobmsg_data(cur)) == BLOBMSG_TYPE_STRING;
+}
 
-	ret = __json_process_type(call, cur, expr, ARRAY_SIZE(expr), &found);
-	if (!found) {
-		const char *name = blobmsg_data(blobmsg_data(cur));
-		ctx->handle_expr(ctx, name, cur, call->vars);
-	}
+static int op_expr_ext(struct json_call *call, struct json_op *op)
+{
+	struct json_script_ctx *ctx = call->ctx;
 
-	return ret;
+	ctx->handle_expr(ctx, op->name, op->attr, call->vars);
+	return -1;
 }
 
-static int eval_string(struct json_call *call, struct blob_buf *buf, const char *name, const char *pattern)
+static struct json_op *json_compile_expr(struct json_script_prog *p, struct blob_attr *cur)
 {
-	char *dest, *next, *str;
-	int len = 0;
-	bool var = false;
-	char c = '%';
+	const struct json_handler *h;
+	struct json_op *op;
 
-	dest = blobmsg_alloc_string_buffer(buf, name, 0);
-	if (!dest)
-		return -1;
+	if (!json_is_call(cur))
+		return json_op_new(p, cur, op_type_error);
 
-	next = alloca(strlen(pattern) + 1);
-	strcpy(next, pattern);
+	h = json_find_handler(cur, expr, ARRAY_SIZE(expr));
+	if (h)
+		return h->compile(p, cur);
 
-	for (str = next; str; str = next) {
-		const char *cur;
-		char *end, *new_buf;
-		int cur_len = 0;
-		bool cur_var = var;
+	op = json_op_new(p, cur, op_expr_ext);
+	if (op)
+		op->name = blobmsg_data(blobmsg_data(cur));
 
-		end = strchr(str, '%');
-		if (end) {
-			*end = 0;
-			next = end + 1;
-			var = !var;
-		} else {
-			end = str + strlen(str);
-			next = NULL;
-		}
+	return op;
+}
 
-		if (cur_var) {
-			if (end > str) {
-				cur = msg_find_var(call, str);
-				if (!cur)
-					continue;
-
-				cur_len = strlen(cur);
-			} else {
-				cur = &c;
-				cur_len = 1;
-			}
-		} else {
-			if (str == end)
-				continue;
+static int op_command(struct json_call *call, struct json_op *op)
+{
+	struct json_script_ctx *ctx = call->ctx;
+	int ret;
+	int i;
+	void *c;
 
-			cur = str;
-			cur_len = end - str;
-		}
+	blob_buf_init(&ctx->buf, 0);
+	c = blobmsg_open_array(&ctx->buf, NULL);
+	for (i = 0; i < op->n_match; i++) {
+		struct json_match *m = &op->match[i];
 
-		new_buf = blobmsg_realloc_string_buffer(buf, len + cur_len);
-		if (!new_buf) {
-			/* Make eval_string return -1 */
-			var = true;
-			break;
+		if (!m->pat) {
+			blobmsg_add_blob(&ctx->buf, m->attr);
+			continue;
 		}
 
-		dest = new_buf;
-		memcpy(dest + len, cur, cur_len);
-		len += cur_len;
+		ret = eval_pattern(call, &ctx->buf, NULL, m->pat);
+		if (ret) {
+			ctx->handle_error(ctx, "Unterminated variable reference in string", op->attr);
+			return ret;
+		}
 	}
 
-	dest[len] = 0;
-	blobmsg_add_string_buffer(buf);
+	blobmsg_close_array(&ctx->buf, c);
 
-	if (var)
-		return -1;
+	ctx->handle_command(ctx, op->name, blob_data(ctx->buf.head), call->vars);
 
 	return 0;
 }
 
-static int cmd_add_string(struct json_call *call, const char *pattern)
+static struct json_op *json_compile_command(struct json_script_prog *p, struct blob_attr *cur)
 {
-	return eval_string(call, &call->ctx->buf, NULL, pattern);
-}
+	const struct json_handler *h;
+	struct blob_attr *arg;
+	struct json_op *op;
+	int args = -1;
+	size_t rem;
 
-int json_script_eval_string(struct json_script_ctx *ctx, struct blob_attr *vars,
-			    struct blob_buf *buf, const char *name,
-			    const char *pattern)
-{
-	struct json_call call = {
-		.ctx = ctx,
-		.vars = vars,
-	};
+	h = json_find_handler(cur, cmd, ARRAY_SIZE(cmd));
+	if (h)
+		op = h->compile(p, cur);
+	else
+		op = json_op_new(p, cur, op_command);
 
-	return eval_string(&call, buf, name, pattern);
-}
+	if (!op)
+		return NULL;
 
-static int cmd_process_strings(struct json_call *call, struct blob_attr *attr)
-{
-	struct json_script_ctx *ctx = call->ctx;
-	struct blob_attr *cur;
-	int args = -1;
-	int ret;
-	size_t rem;
-	void *c;
+	op->cmd = true;
+	if (h)
+		return op;
+
+	op->name = blobmsg_data(blobmsg_data(cur));
+	blobmsg_for_each_attr(arg, cur, rem)
+		args++;
+
+	if (args && !json_match_alloc(p, op, args))
+		return NULL;
+
+	args = -1;
+	blobmsg_for_each_attr(arg, cur, rem) {
+		struct json_match *m;
 
-	blob_buf_init(&ctx->buf, 0);
-	c = blobmsg_open_array(&ctx->buf, NULL);
-	blobmsg_for_each_attr(cur, attr, rem) {
 		if (args++ < 0)
 			continue;
 
-		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING) {
-			blobmsg_add_blob(&ctx->buf, cur);
+		m = &op->match[args - 1];
+		m->attr = arg;
+		if (blobmsg_type(arg) != BLOBMSG_TYPE_STRING)
 			continue;
-		}
 
-		ret = cmd_add_string(call, blobmsg_data(cur));
-		if (ret) {
-			ctx->handle_error(ctx, "Unterminated variable reference in string", attr);
-			return ret;
-		}
+		m->pat = json_compile_pattern(&p->arena, blobmsg_data(arg));
+		if (!m->pat)
+			return NULL;
 	}
 
-	blobmsg_close_array(&ctx->buf, c);
-
-	return 0;
+	return op;
 }
 
-static int __json_process_cmd(struct json_call *call, struct blob_attr *cur)
+static int op_block(struct json_call *call, struct json_op *op)
 {
-	struct json_script_ctx *ctx = call->ctx;
-	const char *name;
-	bool found;
+	struct json_op *cur;
 	int ret;
 
-	if (blobmsg_type(cur) != BLOBMSG_TYPE_ARRAY ||
-	    blobmsg_type(blobmsg_data(cur)) != BLOBMSG_TYPE_STRING) {
-		ctx->handle_error(ctx, "Unexpected element type", cur);
-		return -1;
-	}
-
-	ret = __json_process_type(call, cur, cmd, ARRAY_SIZE(cmd), &found);
-	if (found)
-		return ret;
-
-	name = blobmsg_data(blobmsg_data(cur));
-	ret = cmd_process_strings(call, cur);
-	if (ret)
-		return ret;
+	for (cur = op->sub[0]; cur; cur = cur->next) {
+		if (call->ctx->abort)
+			break;
 
-	ctx->handle_command(ctx, name, blob_data(ctx->buf.head), call->vars);
+		ret = json_exec_block(call, cur);
+		if (ret < -1)
+			return ret;
+	}
 
 	return 0;
 }
 
-static int json_process_cmd(struct json_call *call, struct blob_attr *block)
+/*
+ * A block is either a single command (an array starting with its name) or
+ * an array of blocks.
+ */
+static struct json_op *json_compile_cmd(struct json_script_prog *p, struct blob_attr *block)
 {
-	struct json_script_ctx *ctx = call->ctx;
+	struct json_op *op, **tail;
 	struct blob_attr *cur;
 	size_t rem;
-	int ret;
-	int i = 0;
 
-	if (blobmsg_type(block) != BLOBMSG_TYPE_ARRAY) {
-		ctx->handle_error(ctx, "Unexpected element type", block);
-		return -1;
-	}
+	if (blobmsg_type(block) != BLOBMSG_TYPE_ARRAY)
+		return json_op_new(p, block, op_type_error);
+
+	if (json_is_call(block))
+		return json_compile_command(p, block);
 
+	op = json_op_new(p, block, op_block);
+	if (!op)
+		return NULL;
+
+	tail = &op->sub[0];
 	blobmsg_for_each_attr(cur, block, rem) {
-		if (ctx->abort)
-			break;
+		*tail = json_compile_cmd(p, cur);
+		if (!*tail)
+			return NULL;
 
-		switch(blobmsg_type(cur)) {
-		case BLOBMSG_TYPE_STRING:
-			if (!i)
-				return __json_process_cmd(call, block);
-			fallthrough;
-		default:
-			ret = json_process_cmd(call, cur);
-			if (ret < -1)
-				return ret;
-			break;
-		}
-		i++;
+		tail = &(*tail)->next;
 	}
 
+	return op;
+}
+
+static void json_script_prog_free(struct json_script_prog *p)
+{
+	struct json_regex *r;
+
+	if (!p)
+		return;
+
+	for (r = p->regex; r; r = r->next)
+		regfree(&r->re);
+
+	arena_free(&p->arena);
+	free(p);
+}
+
+int json_script_file_compile(struct json_script_file *f)
+{
+	struct json_script_prog *p;
+
+	if (f->prog)
+		return 0;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -1;
+
+	arena_init(&p->arena, 0);
+	p->root = json_compile_cmd(p, f->data);
+	if (!p->root) {
+		json_script_prog_free(p);
+		return -1;
+	}
+
+	f->prog = p;
 	return 0;
 }
 
+int json_script_eval_string(struct json_script_ctx *ctx, struct blob_attr *vars,
+			    struct blob_buf *buf, const char *name,
+			    const char *pattern)
+{
+	struct json_call call = {
+		.ctx = ctx,
+		.vars = vars,
+	};
+	struct json_pattern *pat;
+	struct arena a;
+	int ret = -1;
+
+	arena_init(&a, 0);
+	pat = json_compile_pattern(&a, pattern);
+	if (pat)
+		ret = eval_pattern(&call, buf, name, pat);
+	arena_free(&a);
+	json_call_free(&call);
+
+	return ret;
+}
+
 void json_script_run_file(struct json_script_ctx *ctx, struct json_script_file *file,
 			  struct blob_attr *vars)
 {
@@ -621,6 +1142,7 @@ void json_script_run_file(struct json_script_ctx *ctx, struct json_script_file *
 	ctx->abort = false;
 
 	__json_script_run(&call, file, NULL);
+	json_call_free(&call);
 }
 
 void json_script_run(struct json_script_ctx *ctx, const char *name,
@@ -643,7 +1165,9 @@ static void __json_script_file_free(struct json_script_file *f)
 		return;
 
 	next = f->next;
-	free(f);
+	json_script_prog_free(f->prog);
+	if (!f->arena)
+		free(f);
 
 	__json_script_file_free(next);
 }
@@ -22,6 +22,7 @@
 #include "utils.h"
 
 struct json_script_file;
+struct json_script_prog;
 
 struct json_script_ctx {
 	struct avl_tree files;
@@ -83,6 +84,8 @@ struct json_script_file {
 	struct json_script_file *next;
 
 	unsigned int seq;
+	bool arena;
+	struct json_script_prog *prog;
 	struct blob_attr data[];
 };
 
@@ -98,6 +101,14 @@ void json_script_free(struct json_script_ctx *ctx);
 void json_script_run(struct json_script_ctx *ctx, const char *filename,
 		     struct blob_attr *vars);
 
+/*
+ * json_script_file_compile - resolve handlers, regular expressions and
+ * variable references of a file once. Files are compiled on their first
+ * run, calling this beforehand moves the cost out of the first run.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int json_script_file_compile(struct json_script_file *file);
+
 void json_script_run_file(struct json_script_ctx *ctx, struct json_script_file *file,
 			  struct blob_attr *vars);
 
@@ -125,6 +136,14 @@ int json_script_eval_string(struct json_script_ctx *ctx, struct blob_attr *vars,
 struct json_script_file *
 json_script_file_from_blobmsg(const char *name, void *data, int len);
 
+/*
+ * json_script_file_from_blobmsg_arena - like json_script_file_from_blobmsg,
+ * allocating from an arena. The file is released together with the arena.
+ */
+struct json_script_file *
+json_script_file_from_blobmsg_arena(struct arena *a, const char *name,
+				    void *data, int len);
+
 /*
  * json_script_find_var - helper function to find a runtime variable from
  * the list passed by json_script user.
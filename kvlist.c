@@ -23,6 +23,7 @@
 #include "blob.h"
 
 #include "kvlist.h"
+#include "arena.h"
 
 int kvlist_strlen(struct kvlist *kv, const void *data)
 {
@@ -37,14 +38,35 @@ int kvlist_blob_len(struct kvlist *kv, const void *data)
 void kvlist_init(struct kvlist *kv, int (*get_len)(struct kvlist *kv, const void *data))
 {
 	avl_init(&kv->avl, avl_strcmp, false, NULL);
+	avl_set_prefix(&kv->avl, avl_strprefix);
 	kv->get_len = get_len;
+	kv->arena = NULL;
+	kv->slab = NULL;
+	kv->mem_bytes = 0;
+	kv->data_bytes = 0;
+	kv->updates = 0;
+	htable_init(&kv->hash, NULL, NULL, NULL);
+}
+
+void kvlist_init_hash(struct kvlist *kv, int (*get_len)(struct kvlist *kv, const void *data))
+{
+	kvlist_init(kv, get_len);
+	htable_init(&kv->hash, htable_strhash, avl_strcmp, NULL);
+}
+
+static inline bool kvlist_is_hash(struct kvlist *kv)
+{
+	return !!kv->hash.hash;
 }
 
 static struct kvlist_node *__kvlist_get(struct kvlist *kv, const char *name)
 {
 	struct kvlist_node *node;
 
-	return avl_find_element(&kv->avl, name, node, avl);
+	if (kvlist_is_hash(kv))
+		return htable_find_element(&kv->hash, name, node, hnode);
+
+	return avl_find_element_cmp(&kv->avl, name, node, avl, avl_strcmp_inline);
 }
 
 void *kvlist_get(struct kvlist *kv, const char *name)
@@ -58,36 +80,205 @@ void *kvlist_get(struct kvlist *kv, const char *name)
 	return node->data;
 }
 
+struct kvlist_slab_chunk {
+	struct kvlist_slab_chunk *next;
+	char data[];
+};
+
+void kvlist_slab_init(struct kvlist_slab *slab)
+{
+	memset(slab, 0, sizeof(*slab));
+}
+
+void kvlist_slab_free(struct kvlist_slab *slab)
+{
+	struct kvlist_slab_chunk *chunk;
+
+	while ((chunk = slab->chunks) != NULL) {
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+	memset(slab->free, 0, sizeof(slab->free));
+	slab->chunk_bytes = 0;
+}
+
+static int kvlist_slab_class(size_t size)
+{
+	int i;
+
+	for (i = 0; i < KVLIST_SLAB_CLASSES; i++)
+		if (size <= (size_t) KVLIST_SLAB_MIN << i)
+			return i;
+
+	return -1;
+}
+
+static void *kvlist_slab_alloc(struct kvlist_slab *slab, size_t *size)
+{
+	struct kvlist_slab_chunk *chunk;
+	int class = kvlist_slab_class(*size);
+	size_t obj_size;
+	void *obj;
+	int i;
+
+	if (class < 0)
+		return malloc(*size);
+
+	obj_size = (size_t) KVLIST_SLAB_MIN << class;
+	*size = obj_size;
+
+	obj = slab->free[class];
+	if (obj) {
+		slab->free[class] = *(void **) obj;
+		slab->hits++;
+		return obj;
+	}
+
+	chunk = malloc(sizeof(*chunk) + KVLIST_SLAB_OBJS * obj_size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->chunk_bytes += sizeof(*chunk) + KVLIST_SLAB_OBJS * obj_size;
+	slab->misses++;
+
+	/* hand out the first object, the rest goes to the freelist */
+	for (i = KVLIST_SLAB_OBJS - 1; i > 0; i--) {
+		obj = chunk->data + i * obj_size;
+		*(void **) obj = slab->free[class];
+		slab->free[class] = obj;
+	}
+
+	return chunk->data;
+}
+
+static void kvlist_slab_release(struct kvlist_slab *slab, void *obj, size_t size)
+{
+	int class = kvlist_slab_class(size);
+
+	if (class < 0) {
+		free(obj);
+		return;
+	}
+
+	*(void **) obj = slab->free[class];
+	slab->free[class] = obj;
+}
+
+static struct kvlist_node *kvlist_alloc_node(struct kvlist *kv, size_t *size)
+{
+	if (kv->arena)
+		return arena_alloc(kv->arena, *size);
+
+	if (kv->slab)
+		return kvlist_slab_alloc(kv->slab, size);
+
+	return malloc(*size);
+}
+
+static void kvlist_free_node(struct kvlist *kv, struct kvlist_node *node)
+{
+	/* arena nodes are released with the arena */
+	if (kv->arena)
+		return;
+
+	if (kv->slab)
+		kvlist_slab_release(kv->slab, node, node->size);
+	else
+		free(node);
+}
+
+static void kvlist_release(struct kvlist *kv, struct kvlist_node *node)
+{
+	kv->mem_bytes -= node->size;
+	kv->data_bytes -= kv->get_len(kv, node->data);
+	kvlist_free_node(kv, node);
+}
+
+static void kvlist_unlink(struct kvlist *kv, struct kvlist_node *node)
+{
+	if (kvlist_is_hash(kv)) {
+		htable_delete(&kv->hash, &node->hnode);
+		list_del(&node->avl.list);
+		kv->avl.count--;
+	} else {
+		avl_delete(&kv->avl, &node->avl);
+	}
+
+	kvlist_release(kv, node);
+}
+
 bool kvlist_delete(struct kvlist *kv, const char *name)
 {
 	struct kvlist_node *node;
 
 	node = __kvlist_get(kv, name);
-	if (node) {
-		avl_delete(&kv->avl, &node->avl);
-		free(node);
-	}
+	if (!node)
+		return false;
+
+	kvlist_unlink(kv, node);
 
-	return !!node;
+	return true;
 }
 
 bool kvlist_set(struct kvlist *kv, const char *name, const void *data)
 {
-	struct kvlist_node *node;
+	struct kvlist_node *node, *old;
+	size_t namelen = strlen(name) + 1;
+	size_t size;
 	char *name_buf;
 	int len = kv->get_len(kv, data);
 
-	node = calloc_a(sizeof(struct kvlist_node) + len,
-		&name_buf, strlen(name) + 1);
+	old = __kvlist_get(kv, name);
+	if (old && (char *) old->avl.key - old->data >= len) {
+		kv->data_bytes -= kv->get_len(kv, old->data);
+		kv->data_bytes += len;
+		kv->updates++;
+		memmove(old->data, data, len);
+		return true;
+	}
+
+	size = sizeof(struct kvlist_node) + len + namelen;
+	node = kvlist_alloc_node(kv, &size);
 	if (!node)
 		return false;
 
-	kvlist_delete(kv, name);
+	memset(node, 0, sizeof(*node));
+	node->size = size;
+
+	/* the name goes to the end, any slack is usable by later updates */
+	name_buf = (char *) node + size - namelen;
+	node->avl.key = memcpy(name_buf, name, namelen);
 
+	/* data may point into the old value */
 	memcpy(node->data, data, len);
 
-	node->avl.key = strcpy(name_buf, name);
-	avl_insert(&kv->avl, &node->avl);
+	if (kvlist_is_hash(kv)) {
+		/*
+		 * replacing the slot of the old node cannot fail, a failed
+		 * insert of a new key leaves the list unchanged
+		 */
+		node->hnode.key = node->avl.key;
+		if (old) {
+			htable_replace(&kv->hash, &old->hnode, &node->hnode);
+			list_del(&old->avl.list);
+			kvlist_release(kv, old);
+		} else if (htable_insert(&kv->hash, &node->hnode)) {
+			kvlist_free_node(kv, node);
+			return false;
+		} else {
+			kv->avl.count++;
+		}
+		list_add_tail(&node->avl.list, &kv->avl.list_head);
+	} else {
+		if (old)
+			kvlist_unlink(kv, old);
+		avl_insert(&kv->avl, &node->avl);
+	}
+
+	kv->mem_bytes += size;
+	kv->data_bytes += len;
 
 	return true;
 }
@@ -97,5 +288,9 @@ void kvlist_free(struct kvlist *kv)
 	struct kvlist_node *node, *tmp;
 
 	avl_remove_all_elements(&kv->avl, node, avl, tmp)
-		free(node);
+		kvlist_free_node(kv, node);
+
+	htable_free(&kv->hash);
+	kv->mem_bytes = 0;
+	kv->data_bytes = 0;
 }
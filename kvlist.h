@@ -20,15 +20,64 @@
 
 #include "avl-cmp.h"
 #include "avl.h"
+#include "htable.h"
+
+struct arena;
+struct kvlist_slab_chunk;
+
+#define KVLIST_SLAB_MIN		128
+#define KVLIST_SLAB_CLASSES	5
+#define KVLIST_SLAB_OBJS	16
+
+/*
+ * Node allocator for lists whose values are replaced often. Nodes of up to
+ * KVLIST_SLAB_MIN << (KVLIST_SLAB_CLASSES - 1) bytes are carved from chunks
+ * of KVLIST_SLAB_OBJS objects in power of two size classes, deleted nodes
+ * go back to the freelist of their class. Larger nodes use the heap.
+ * A slab can be shared by several lists, chunks are only released by
+ * kvlist_slab_free, after all lists using it have been freed.
+ */
+struct kvlist_slab {
+	void *free[KVLIST_SLAB_CLASSES];
+	struct kvlist_slab_chunk *chunks;
+	size_t chunk_bytes;
+
+	/* allocations served from a freelist / needing a new chunk */
+	unsigned long hits;
+	unsigned long misses;
+};
 
 struct kvlist {
 	struct avl_tree avl;
 
 	int (*get_len)(struct kvlist *kv, const void *data);
+
+	/* optional, allocate nodes from an arena instead of the heap */
+	struct arena *arena;
+
+	/* optional, allocate nodes from a slab, see struct kvlist_slab */
+	struct kvlist_slab *slab;
+
+	/*
+	 * memory usage: bytes allocated for nodes including slack, and value
+	 * bytes stored. updates counts kvlist_set calls that overwrote an
+	 * existing value in place.
+	 */
+	size_t mem_bytes;
+	size_t data_bytes;
+	unsigned long updates;
+
+	/*
+	 * hash backend, see kvlist_init_hash. Nodes are then only linked
+	 * into avl.list_head (in insertion order) and not into the tree.
+	 */
+	struct htable hash;
 };
 
 struct kvlist_node {
 	struct avl_node avl;
+	struct htable_node hnode;
+	unsigned int size;
 
 	char data[0] __attribute__((aligned(4)));
 };
@@ -53,11 +102,21 @@ struct kvlist_node {
 	     name = (const char *) __ptr_to_kv(value)->avl.key)
 
 void kvlist_init(struct kvlist *kv, int (*get_len)(struct kvlist *kv, const void *data));
+/* O(1) lookups, kvlist_for_each then iterates in insertion order */
+void kvlist_init_hash(struct kvlist *kv, int (*get_len)(struct kvlist *kv, const void *data));
 void kvlist_free(struct kvlist *kv);
 void *kvlist_get(struct kvlist *kv, const char *name);
+/*
+ * kvlist_set: add or replace a value. A value that fits into the space of
+ * the one it replaces is overwritten in place, the node keeps its position
+ * in insertion order and pointers to it stay valid.
+ */
 bool kvlist_set(struct kvlist *kv, const char *name, const void *data);
 bool kvlist_delete(struct kvlist *kv, const char *name);
 
+void kvlist_slab_init(struct kvlist_slab *slab);
+void kvlist_slab_free(struct kvlist_slab *slab);
+
 int kvlist_strlen(struct kvlist *kv, const void *data);
 int kvlist_blob_len(struct kvlist *kv, const void *data);
 
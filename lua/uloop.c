@@ -23,12 +23,36 @@
 #include <lauxlib.h>
 
 #include "../uloop.h"
+#include "../ustream.h"
 #include "../list.h"
 
+#define UL_TIMER	"uloop.timer"
+#define UL_FD		"uloop.fd"
+#define UL_FD_BATCH	"uloop.fd_batch"
+#define UL_PROCESS	"uloop.process"
+#define UL_INTERVAL	"uloop.interval"
+#define UL_SIGNAL	"uloop.signal"
+#define UL_USTREAM	"uloop.ustream"
+
+struct lua_uloop_fd_batch {
+	struct uloop_timeout t;
+	struct list_head pending;
+	int r;
+	int fds_r;
+	int events_r;
+	int n;
+};
+
 struct lua_uloop_fd {
 	struct uloop_fd fd;
 	int r;
 	int fd_r;
+
+	/* fds added through a batch report their events to it */
+	struct lua_uloop_fd_batch *batch;
+	int batch_r;
+	struct list_head list;
+	unsigned int events;
 };
 
 struct lua_uloop_timeout {
@@ -51,24 +75,60 @@ struct lua_uloop_signal {
 	int r;
 };
 
+struct lua_uloop_ustream {
+	struct ustream_fd s;
+	struct uloop_timeout free;
+	bool closed;
+	int self_r;
+	int fd_r;
+	int r;
+	int state_r;
+};
+
 static lua_State *state;
 
-static void *
-ul_create_userdata(lua_State *L, size_t size, const luaL_Reg *reg, lua_CFunction gc)
+/*
+ * Callbacks and objects are referenced directly from the registry, so
+ * dispatching an event costs a single rawgeti.
+ */
+static int ul_ref(lua_State *L, int idx)
 {
-	void *ret = lua_newuserdata(L, size);
+	lua_pushvalue(L, idx);
+	return luaL_ref(L, LUA_REGISTRYINDEX);
+}
 
-	memset(ret, 0, size);
-	lua_createtable(L, 0, 2);
+static void ul_unref(lua_State *L, int *ref)
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+	*ref = LUA_NOREF;
+}
+
+static void ul_push_ref(lua_State *L, int ref)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+}
+
+/* metatables are created once per type and shared by all objects */
+static void
+ul_register_type(lua_State *L, const char *type, const luaL_Reg *reg, lua_CFunction gc)
+{
+	luaL_newmetatable(L, type);
 	lua_pushvalue(L, -1);
 	lua_setfield(L, -2, "__index");
 	lua_pushcfunction(L, gc);
 	lua_setfield(L, -2, "__gc");
-	lua_pushvalue(L, -1);
-	lua_setmetatable(L, -3);
-	lua_pushvalue(L, -2);
-	luaI_openlib(L, NULL, reg, 1);
-	lua_pushvalue(L, -2);
+	luaI_openlib(L, NULL, reg, 0);
+	lua_pop(L, 1);
+}
+
+static void *
+ul_create_userdata(lua_State *L, size_t size, const char *type)
+{
+	void *ret = lua_newuserdata(L, size);
+
+	memset(ret, 0, size);
+	luaL_getmetatable(L, type);
+	lua_setmetatable(L, -2);
 
 	return ret;
 }
@@ -77,12 +137,8 @@ static void ul_timer_cb(struct uloop_timeout *t)
 {
 	struct lua_uloop_timeout *tout = container_of(t, struct lua_uloop_timeout, t);
 
-	lua_getglobal(state, "__uloop_cb");
-	lua_rawgeti(state, -1, tout->r);
-	lua_remove(state, -2);
-
+	ul_push_ref(state, tout->r);
 	lua_call(state, 0, 0);
-
 }
 
 static int ul_timer_set(lua_State *L)
@@ -99,7 +155,8 @@ static int ul_timer_set(lua_State *L)
 
 	set = lua_tointeger(L, -1);
 	tout = lua_touserdata(L, 1);
-	uloop_timeout_set(&tout->t, set);
+	if (tout->r != LUA_NOREF)
+		uloop_timeout_set(&tout->t, set);
 
 	return 1;
 }
@@ -117,16 +174,12 @@ static int ul_timer_free(lua_State *L)
 {
 	struct lua_uloop_timeout *tout = lua_touserdata(L, 1);
 
-	uloop_timeout_cancel(&tout->t);
-
-	/* obj.__index.__gc = nil , make sure executing only once*/
-	lua_getfield(L, -1, "__index");
-	lua_pushstring(L, "__gc");
-	lua_pushnil(L);
-	lua_settable(L, -3);
+	/* executed only once, for both cancel and __gc */
+	if (tout->r == LUA_NOREF)
+		return 1;
 
-	lua_getglobal(state, "__uloop_cb");
-	luaL_unref(state, -1, tout->r);
+	uloop_timeout_cancel(&tout->t);
+	ul_unref(L, &tout->r);
 
 	return 1;
 }
@@ -156,11 +209,9 @@ static int ul_timer(lua_State *L)
 		return 0;
 	}
 
-	lua_getglobal(L, "__uloop_cb");
-	lua_pushvalue(L, -2);
-	ref = luaL_ref(L, -2);
+	ref = ul_ref(L, -1);
 
-	tout = ul_create_userdata(L, sizeof(*tout), timer_m, ul_timer_free);
+	tout = ul_create_userdata(L, sizeof(*tout), UL_TIMER);
 	tout->r = ref;
 	tout->t.cb = ul_timer_cb;
 
@@ -170,18 +221,35 @@ static int ul_timer(lua_State *L)
 	return 1;
 }
 
+static void ul_fd_batch_queue(struct lua_uloop_fd *ufd, unsigned int events)
+{
+	struct lua_uloop_fd_batch *batch = ufd->batch;
+
+	if (batch->r == LUA_NOREF)
+		return;
+
+	ufd->events |= events;
+	if (list_empty(&ufd->list))
+		list_add_tail(&ufd->list, &batch->pending);
+
+	/* delivered after this round of fd events has been processed */
+	if (!batch->t.pending)
+		uloop_timeout_set(&batch->t, 0);
+}
+
 static void ul_ufd_cb(struct uloop_fd *fd, unsigned int events)
 {
 	struct lua_uloop_fd *ufd = container_of(fd, struct lua_uloop_fd, fd);
 
-	lua_getglobal(state, "__uloop_cb");
-	lua_rawgeti(state, -1, ufd->r);
-	lua_remove(state, -2);
+	if (ufd->batch) {
+		ul_fd_batch_queue(ufd, events);
+		return;
+	}
+
+	ul_push_ref(state, ufd->r);
 
 	/* push fd object */
-	lua_getglobal(state, "__uloop_fds");
-	lua_rawgeti(state, -1, ufd->fd_r);
-	lua_remove(state, -2);
+	ul_push_ref(state, ufd->fd_r);
 
 	/* push events */
 	lua_pushinteger(state, events);
@@ -211,21 +279,17 @@ static int ul_ufd_delete(lua_State *L)
 {
 	struct lua_uloop_fd *ufd = lua_touserdata(L, 1);
 
-	uloop_fd_delete(&ufd->fd);
-
-	/* obj.__index.__gc = nil , make sure executing only once*/
-	lua_getfield(L, -1, "__index");
-	lua_pushstring(L, "__gc");
-	lua_pushnil(L);
-	lua_settable(L, -3);
+	/* executed only once, for both delete and __gc */
+	if (ufd->fd_r == LUA_NOREF)
+		return 1;
 
-	lua_getglobal(state, "__uloop_cb");
-	luaL_unref(state, -1, ufd->r);
-	lua_remove(state, -1);
+	uloop_fd_delete(&ufd->fd);
+	list_del_init(&ufd->list);
 
-	lua_getglobal(state, "__uloop_fds");
-	luaL_unref(state, -1, ufd->fd_r);
-	lua_remove(state, -1);
+	ul_unref(L, &ufd->r);
+	ul_unref(L, &ufd->fd_r);
+	ul_unref(L, &ufd->batch_r);
+	ufd->batch = NULL;
 
 	return 1;
 }
@@ -235,60 +299,280 @@ static const luaL_Reg ufd_m[] = {
 	{ NULL, NULL }
 };
 
-static int ul_ufd_add(lua_State *L)
+static struct lua_uloop_fd *
+ul_ufd_create(lua_State *L, int fd_idx, unsigned int flags)
 {
 	struct lua_uloop_fd *ufd;
-	int fd = 0;
-	unsigned int flags = 0;
-	int ref;
-	int fd_ref;
+	int fd;
 
-	flags = luaL_checkinteger(L, 3);
 	if (!flags) {
 		lua_pushstring(L, "flags cannot be zero");
 		lua_error(L);
 	}
 
+	fd = get_sock_fd(L, fd_idx);
+
+	ufd = ul_create_userdata(L, sizeof(*ufd), UL_FD);
+	INIT_LIST_HEAD(&ufd->list);
+	ufd->r = LUA_NOREF;
+	ufd->batch_r = LUA_NOREF;
+	ufd->fd_r = ul_ref(L, fd_idx);
+	ufd->fd.fd = fd;
+	ufd->fd.cb = ul_ufd_cb;
+
+	return ufd;
+}
+
+static int ul_ufd_add(lua_State *L)
+{
+	struct lua_uloop_fd *ufd;
+	unsigned int flags = 0;
+
+	flags = luaL_checkinteger(L, 3);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 
-	fd = get_sock_fd(L, 1);
+	ufd = ul_ufd_create(L, 1, flags);
+	ufd->r = ul_ref(L, 2);
+	uloop_fd_add(&ufd->fd, flags);
 
-	lua_getglobal(L, "__uloop_cb");
-	lua_pushvalue(L, 2);
-	ref = luaL_ref(L, -2);
-	lua_pop(L, 1);
+	return 1;
+}
 
-	lua_getglobal(L, "__uloop_fds");
-	lua_pushvalue(L, 1);
-	fd_ref = luaL_ref(L, -2);
-	lua_pop(L, 1);
+static void ul_fd_batch_cb(struct uloop_timeout *t)
+{
+	struct lua_uloop_fd_batch *batch = container_of(t, struct lua_uloop_fd_batch, t);
+	struct lua_uloop_fd *ufd;
+	int n = 0;
+
+	ul_push_ref(state, batch->r);
+	ul_push_ref(state, batch->fds_r);
+	ul_push_ref(state, batch->events_r);
+
+	/* the fds and events tables are reused across calls */
+	while (!list_empty(&batch->pending)) {
+		ufd = list_first_entry(&batch->pending, struct lua_uloop_fd, list);
+		list_del_init(&ufd->list);
+		n++;
+
+		ul_push_ref(state, ufd->fd_r);
+		lua_rawseti(state, -3, n);
+		lua_pushinteger(state, ufd->events);
+		lua_rawseti(state, -2, n);
+		ufd->events = 0;
+	}
 
-	ufd = ul_create_userdata(L, sizeof(*ufd), ufd_m, ul_ufd_delete);
-	ufd->r = ref;
-	ufd->fd.fd = fd;
-	ufd->fd_r = fd_ref;
-	ufd->fd.cb = ul_ufd_cb;
+	for (int i = n + 1; i <= batch->n; i++) {
+		lua_pushnil(state);
+		lua_rawseti(state, -3, i);
+		lua_pushnil(state);
+		lua_rawseti(state, -2, i);
+	}
+	batch->n = n;
+
+	lua_pushinteger(state, n);
+	lua_call(state, 3, 0);
+}
+
+static int ul_fd_batch_add(lua_State *L)
+{
+	struct lua_uloop_fd_batch *batch = lua_touserdata(L, 1);
+	struct lua_uloop_fd *ufd;
+	unsigned int flags;
+
+	flags = luaL_checkinteger(L, 3);
+	if (batch->r == LUA_NOREF)
+		return luaL_error(L, "fd batch was deleted");
+
+	ufd = ul_ufd_create(L, 2, flags);
+	ufd->batch = batch;
+	ufd->batch_r = ul_ref(L, 1);
 	uloop_fd_add(&ufd->fd, flags);
 
 	return 1;
 }
 
+static int ul_fd_batch_free(lua_State *L)
+{
+	struct lua_uloop_fd_batch *batch = lua_touserdata(L, 1);
+	struct lua_uloop_fd *ufd;
+
+	if (batch->r == LUA_NOREF)
+		return 1;
+
+	uloop_timeout_cancel(&batch->t);
+	while (!list_empty(&batch->pending)) {
+		ufd = list_first_entry(&batch->pending, struct lua_uloop_fd, list);
+		list_del_init(&ufd->list);
+	}
+
+	ul_unref(L, &batch->r);
+	ul_unref(L, &batch->fds_r);
+	ul_unref(L, &batch->events_r);
+
+	return 1;
+}
+
+static const luaL_Reg fd_batch_m[] = {
+	{ "add", ul_fd_batch_add },
+	{ "delete", ul_fd_batch_free },
+	{ NULL, NULL }
+};
+
+static int ul_fd_batch(lua_State *L)
+{
+	struct lua_uloop_fd_batch *batch;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+
+	batch = ul_create_userdata(L, sizeof(*batch), UL_FD_BATCH);
+	INIT_LIST_HEAD(&batch->pending);
+	batch->t.cb = ul_fd_batch_cb;
+	batch->r = ul_ref(L, 1);
+
+	lua_createtable(L, 8, 0);
+	batch->fds_r = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_createtable(L, 8, 0);
+	batch->events_r = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	return 1;
+}
+
+static void ul_ustream_notify_read(struct ustream *s, int bytes)
+{
+	struct lua_uloop_ustream *us = container_of(s, struct lua_uloop_ustream, s.stream);
+	char *buf;
+	int len;
+
+	while (us->r != LUA_NOREF &&
+	       (buf = ustream_get_read_buf(s, &len)) != NULL) {
+		ul_push_ref(state, us->r);
+		ul_push_ref(state, us->self_r);
+		lua_pushlstring(state, buf, len);
+		ustream_consume(s, len);
+		lua_call(state, 2, 0);
+	}
+}
+
+static void ul_ustream_notify_state(struct ustream *s)
+{
+	struct lua_uloop_ustream *us = container_of(s, struct lua_uloop_ustream, s.stream);
+
+	if (us->state_r == LUA_NOREF)
+		return;
+
+	ul_push_ref(state, us->state_r);
+	ul_push_ref(state, us->self_r);
+	lua_pushboolean(state, s->eof);
+	lua_pushboolean(state, s->write_error);
+	lua_call(state, 3, 0);
+}
+
+static int ul_ustream_write(lua_State *L)
+{
+	struct lua_uloop_ustream *us = lua_touserdata(L, 1);
+	const char *data;
+	size_t len;
+
+	data = luaL_checklstring(L, 2, &len);
+	if (us->closed)
+		return luaL_error(L, "stream is closed");
+
+	lua_pushinteger(L, ustream_write(&us->s.stream, data, len, false));
+
+	return 1;
+}
+
+static int ul_ustream_pending(lua_State *L)
+{
+	struct lua_uloop_ustream *us = lua_touserdata(L, 1);
+
+	lua_pushinteger(L, us->closed ? 0 :
+			ustream_pending_data(&us->s.stream, true));
+
+	return 1;
+}
+
+static void ul_ustream_free_cb(struct uloop_timeout *t)
+{
+	struct lua_uloop_ustream *us = container_of(t, struct lua_uloop_ustream, free);
+
+	ustream_free(&us->s.stream);
+	ul_unref(state, &us->fd_r);
+	ul_unref(state, &us->self_r);
+}
+
+static int ul_ustream_close(lua_State *L)
+{
+	struct lua_uloop_ustream *us = lua_touserdata(L, 1);
+
+	if (us->closed)
+		return 1;
+
+	us->closed = true;
+	ul_unref(L, &us->r);
+	ul_unref(L, &us->state_r);
+
+	/* may be called from a stream callback, free it from the loop */
+	uloop_timeout_set(&us->free, 0);
+
+	return 1;
+}
+
+static int ul_ustream_gc(lua_State *L)
+{
+	struct lua_uloop_ustream *us = lua_touserdata(L, 1);
+
+	/* only reached on lua_close() or after the stream has been freed */
+	if (us->self_r == LUA_NOREF)
+		return 1;
+
+	uloop_timeout_cancel(&us->free);
+	ul_ustream_free_cb(&us->free);
+
+	return 1;
+}
+
+static const luaL_Reg ustream_m[] = {
+	{ "write", ul_ustream_write },
+	{ "pending", ul_ustream_pending },
+	{ "close", ul_ustream_close },
+	{ NULL, NULL }
+};
+
+static int ul_ustream(lua_State *L)
+{
+	struct lua_uloop_ustream *us;
+	int fd;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (!lua_isnoneornil(L, 3))
+		luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	fd = get_sock_fd(L, 1);
+
+	us = ul_create_userdata(L, sizeof(*us), UL_USTREAM);
+	us->fd_r = ul_ref(L, 1);
+	us->r = ul_ref(L, 2);
+	us->state_r = lua_isnoneornil(L, 3) ? LUA_NOREF : ul_ref(L, 3);
+
+	/* an open stream stays alive until it is closed */
+	us->self_r = ul_ref(L, -1);
+
+	us->free.cb = ul_ustream_free_cb;
+	us->s.stream.notify_read = ul_ustream_notify_read;
+	us->s.stream.notify_state = ul_ustream_notify_state;
+	ustream_fd_init(&us->s, fd);
+
+	return 1;
+}
+
 static int ul_process_free(lua_State *L)
 {
 	struct lua_uloop_process *proc = lua_touserdata(L, 1);
 
-	/* obj.__index.__gc = nil , make sure executing only once*/
-	lua_getfield(L, -1, "__index");
-	lua_pushstring(L, "__gc");
-	lua_pushnil(L);
-	lua_settable(L, -3);
-
 	if (proc->r != LUA_NOREF) {
 		uloop_process_delete(&proc->p);
-
-		lua_getglobal(state, "__uloop_cb");
-		luaL_unref(state, -1, proc->r);
-		lua_remove(state, -1);
+		ul_unref(L, &proc->r);
 	}
 
 	return 1;
@@ -316,12 +600,8 @@ static void ul_process_cb(struct uloop_process *p, int ret)
 {
 	struct lua_uloop_process *proc = container_of(p, struct lua_uloop_process, p);
 
-	lua_getglobal(state, "__uloop_cb");
-	lua_rawgeti(state, -1, proc->r);
-
-	luaL_unref(state, -2, proc->r);
-	proc->r = LUA_NOREF;
-	lua_remove(state, -2);
+	ul_push_ref(state, proc->r);
+	ul_unref(state, &proc->r);
 	lua_pushinteger(state, ret >> 8);
 	lua_call(state, 1, 0);
 }
@@ -379,11 +659,9 @@ static int ul_process(lua_State *L)
 		_exit(-1);
 	}
 
-	lua_getglobal(L, "__uloop_cb");
-	lua_pushvalue(L, -2);
-	ref = luaL_ref(L, -2);
+	ref = ul_ref(L, -1);
 
-	proc = ul_create_userdata(L, sizeof(*proc), process_m, ul_process_free);
+	proc = ul_create_userdata(L, sizeof(*proc), UL_PROCESS);
 	proc->r = ref;
 	proc->p.pid = pid;
 	proc->p.cb = ul_process_cb;
@@ -396,10 +674,7 @@ static void ul_interval_cb(struct uloop_interval *i)
 {
 	struct lua_uloop_interval *intv = container_of(i, struct lua_uloop_interval, i);
 
-	lua_getglobal(state, "__uloop_cb");
-	lua_rawgeti(state, -1, intv->r);
-	lua_remove(state, -2);
-
+	ul_push_ref(state, intv->r);
 	lua_call(state, 0, 0);
 }
 
@@ -417,7 +692,8 @@ static int ul_interval_set(lua_State *L)
 
 	set = lua_tointeger(L, -1);
 	intv = lua_touserdata(L, 1);
-	uloop_interval_set(&intv->i, set);
+	if (intv->r != LUA_NOREF)
+		uloop_interval_set(&intv->i, set);
 
 	return 1;
 }
@@ -444,16 +720,12 @@ static int ul_interval_free(lua_State *L)
 {
 	struct lua_uloop_interval *intv = lua_touserdata(L, 1);
 
-	uloop_interval_cancel(&intv->i);
-
-	/* obj.__index.__gc = nil , make sure executing only once*/
-	lua_getfield(L, -1, "__index");
-	lua_pushstring(L, "__gc");
-	lua_pushnil(L);
-	lua_settable(L, -3);
+	/* executed only once, for both cancel and __gc */
+	if (intv->r == LUA_NOREF)
+		return 1;
 
-	lua_getglobal(state, "__uloop_cb");
-	luaL_unref(state, -1, intv->r);
+	uloop_interval_cancel(&intv->i);
+	ul_unref(L, &intv->r);
 
 	return 1;
 }
@@ -484,11 +756,9 @@ static int ul_interval(lua_State *L)
 		return 0;
 	}
 
-	lua_getglobal(L, "__uloop_cb");
-	lua_pushvalue(L, -2);
-	ref = luaL_ref(L, -2);
+	ref = ul_ref(L, -1);
 
-	intv = ul_create_userdata(L, sizeof(*intv), interval_m, ul_interval_free);
+	intv = ul_create_userdata(L, sizeof(*intv), UL_INTERVAL);
 	intv->r = ref;
 	intv->i.cb = ul_interval_cb;
 
@@ -502,9 +772,7 @@ static void ul_signal_cb(struct uloop_signal *s)
 {
 	struct lua_uloop_signal *sig = container_of(s, struct lua_uloop_signal, s);
 
-	lua_getglobal(state, "__uloop_cb");
-	lua_rawgeti(state, -1, sig->r);
-	lua_remove(state, -2);
+	ul_push_ref(state, sig->r);
 	lua_pushinteger(state, sig->s.signo);
 
 	lua_call(state, 1, 0);
@@ -523,16 +791,12 @@ static int ul_signal_free(lua_State *L)
 {
 	struct lua_uloop_signal *sig = lua_touserdata(L, 1);
 
-	uloop_signal_delete(&sig->s);
-
-	/* obj.__index.__gc = nil , make sure executing only once*/
-	lua_getfield(L, -1, "__index");
-	lua_pushstring(L, "__gc");
-	lua_pushnil(L);
-	lua_settable(L, -3);
+	/* executed only once, for both delete and __gc */
+	if (sig->r == LUA_NOREF)
+		return 1;
 
-	lua_getglobal(state, "__uloop_cb");
-	luaL_unref(state, -1, sig->r);
+	uloop_signal_delete(&sig->s);
+	ul_unref(L, &sig->r);
 
 	return 1;
 }
@@ -561,11 +825,9 @@ static int ul_signal(lua_State *L)
 		return 0;
 	}
 
-	lua_getglobal(L, "__uloop_cb");
-	lua_pushvalue(L, -2);
-	ref = luaL_ref(L, -2);
+	ref = ul_ref(L, -1);
 
-	sig = ul_create_userdata(L, sizeof(*sig), signal_m, ul_signal_free);
+	sig = ul_create_userdata(L, sizeof(*sig), UL_SIGNAL);
 	sig->r = ref;
 	sig->s.cb = ul_signal_cb;
 	sig->s.signo = signo;
@@ -603,6 +865,8 @@ static luaL_reg uloop_func[] = {
 	{"timer", ul_timer},
 	{"process", ul_process},
 	{"fd_add", ul_ufd_add},
+	{"fd_batch", ul_fd_batch},
+	{"ustream", ul_ustream},
 	{"interval", ul_interval},
 	{"signal", ul_signal},
 	{"cancel", ul_end},
@@ -617,11 +881,13 @@ int luaopen_uloop(lua_State *L)
 {
 	state = L;
 
-	lua_createtable(L, 1, 0);
-	lua_setglobal(L, "__uloop_cb");
-
-	lua_createtable(L, 1, 0);
-	lua_setglobal(L, "__uloop_fds");
+	ul_register_type(L, UL_TIMER, timer_m, ul_timer_free);
+	ul_register_type(L, UL_FD, ufd_m, ul_ufd_delete);
+	ul_register_type(L, UL_FD_BATCH, fd_batch_m, ul_fd_batch_free);
+	ul_register_type(L, UL_PROCESS, process_m, ul_process_free);
+	ul_register_type(L, UL_INTERVAL, interval_m, ul_interval_free);
+	ul_register_type(L, UL_SIGNAL, signal_m, ul_signal_free);
+	ul_register_type(L, UL_USTREAM, ustream_m, ul_ustream_gc);
 
 	luaL_openlib(L, "uloop", uloop_func, 0);
 	lua_pushstring(L, "_VERSION");
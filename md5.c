@@ -50,8 +50,17 @@
  * compile-time configuration.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "md5.h"
@@ -59,12 +68,11 @@
 /*
  * The basic MD5 functions.
  *
- * F and G are optimized compared to their RFC 1321 definitions for
- * architectures that lack an AND-NOT instruction, just like in Colin Plumb's
- * implementation.
+ * F is optimized compared to its RFC 1321 definition for architectures
+ * that lack an AND-NOT instruction, just like in Colin Plumb's
+ * implementation.  G is folded into STEP_G below.
  */
 #define F(x, y, z)			((z) ^ ((x) & ((y) ^ (z))))
-#define G(x, y, z)			((y) ^ ((z) & ((x) ^ (y))))
 #define H(x, y, z)			(((x) ^ (y)) ^ (z))
 #define H2(x, y, z)			((x) ^ ((y) ^ (z)))
 #define I(x, y, z)			((y) ^ ((x) | ~(z)))
@@ -77,13 +85,25 @@
 	(a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); \
 	(a) += (b);
 
+/*
+ * Round 2 step: G(b, c, d) = (b & d) | (c & ~d), and since the two halves
+ * are disjoint they can be added separately.  (c & ~d) does not depend on the previous step's result,
+ * which takes one operation off the critical path of every step.
+ */
+#define STEP_G(a, b, c, d, x, t, s) \
+	(a) += (x) + (t) + ((c) & ~(d)); \
+	(a) += (b) & (d); \
+	(a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); \
+	(a) += (b);
+
 /*
  * SET reads 4 input bytes in little-endian byte order and stores them
- * in a properly aligned word in host byte order.
+ * in a properly aligned word in host byte order.  Little-endian hosts
+ * copy the whole block up front, which keeps the loads aligned.
  */
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 #define SET(n) \
-	(*(uint32_t *)&ptr[(n) * 4])
+	(block[(n)])
 #define GET(n) \
 	SET(n)
 #else
@@ -106,9 +126,7 @@ static const void *body(md5_ctx_t *ctx, const void *data, unsigned long size)
 	const unsigned char *ptr;
 	uint32_t a, b, c, d;
 	uint32_t saved_a, saved_b, saved_c, saved_d;
-#if __BYTE_ORDER != __LITTLE_ENDIAN
 	uint32_t block[16];
-#endif
 
 	ptr = (const unsigned char *)data;
 
@@ -122,6 +140,9 @@ static const void *body(md5_ctx_t *ctx, const void *data, unsigned long size)
 		saved_b = b;
 		saved_c = c;
 		saved_d = d;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		memcpy(block, ptr, sizeof(block));
+#endif
 
 /* Round 1 */
 		STEP(F, a, b, c, d, SET(0), 0xd76aa478, 7)
@@ -142,22 +163,22 @@ static const void *body(md5_ctx_t *ctx, const void *data, unsigned long size)
 		STEP(F, b, c, d, a, SET(15), 0x49b40821, 22)
 
 /* Round 2 */
-		STEP(G, a, b, c, d, GET(1), 0xf61e2562, 5)
-		STEP(G, d, a, b, c, GET(6), 0xc040b340, 9)
-		STEP(G, c, d, a, b, GET(11), 0x265e5a51, 14)
-		STEP(G, b, c, d, a, GET(0), 0xe9b6c7aa, 20)
-		STEP(G, a, b, c, d, GET(5), 0xd62f105d, 5)
-		STEP(G, d, a, b, c, GET(10), 0x02441453, 9)
-		STEP(G, c, d, a, b, GET(15), 0xd8a1e681, 14)
-		STEP(G, b, c, d, a, GET(4), 0xe7d3fbc8, 20)
-		STEP(G, a, b, c, d, GET(9), 0x21e1cde6, 5)
-		STEP(G, d, a, b, c, GET(14), 0xc33707d6, 9)
-		STEP(G, c, d, a, b, GET(3), 0xf4d50d87, 14)
-		STEP(G, b, c, d, a, GET(8), 0x455a14ed, 20)
-		STEP(G, a, b, c, d, GET(13), 0xa9e3e905, 5)
-		STEP(G, d, a, b, c, GET(2), 0xfcefa3f8, 9)
-		STEP(G, c, d, a, b, GET(7), 0x676f02d9, 14)
-		STEP(G, b, c, d, a, GET(12), 0x8d2a4c8a, 20)
+		STEP_G(a, b, c, d, GET(1), 0xf61e2562, 5)
+		STEP_G(d, a, b, c, GET(6), 0xc040b340, 9)
+		STEP_G(c, d, a, b, GET(11), 0x265e5a51, 14)
+		STEP_G(b, c, d, a, GET(0), 0xe9b6c7aa, 20)
+		STEP_G(a, b, c, d, GET(5), 0xd62f105d, 5)
+		STEP_G(d, a, b, c, GET(10), 0x02441453, 9)
+		STEP_G(c, d, a, b, GET(15), 0xd8a1e681, 14)
+		STEP_G(b, c, d, a, GET(4), 0xe7d3fbc8, 20)
+		STEP_G(a, b, c, d, GET(9), 0x21e1cde6, 5)
+		STEP_G(d, a, b, c, GET(14), 0xc33707d6, 9)
+		STEP_G(c, d, a, b, GET(3), 0xf4d50d87, 14)
+		STEP_G(b, c, d, a, GET(8), 0x455a14ed, 20)
+		STEP_G(a, b, c, d, GET(13), 0xa9e3e905, 5)
+		STEP_G(d, a, b, c, GET(2), 0xfcefa3f8, 9)
+		STEP_G(c, d, a, b, GET(7), 0x676f02d9, 14)
+		STEP_G(b, c, d, a, GET(12), 0x8d2a4c8a, 20)
 
 /* Round 3 */
 		STEP(H, a, b, c, d, GET(5), 0xfffa3942, 4)
@@ -308,29 +329,173 @@ void md5_end(void *resbuf, md5_ctx_t *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
-int md5sum(const char *file, void *md5_buf)
+#define MD5SUM_MAP_SIZE		(16 * 1024 * 1024)
+#define MD5SUM_READ_SIZE	(64 * 1024)
+
+static int md5sum_read(int fd, md5_ctx_t *ctx)
 {
-	char buf[256];
-	md5_ctx_t ctx;
+	char *buf;
 	int ret = 0;
-	FILE *f;
 
-	f = fopen(file, "r");
-	if (!f)
+	buf = malloc(MD5SUM_READ_SIZE);
+	if (!buf)
 		return -1;
 
-	md5_begin(&ctx);
 	do {
-		int len = fread(buf, 1, sizeof(buf), f);
-		if (!len)
+		ssize_t len = read(fd, buf, MD5SUM_READ_SIZE);
+
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
 			break;
 
-		md5_hash(buf, len, &ctx);
+		md5_hash(buf, len, ctx);
 		ret += len;
-	} while(1);
+	} while (1);
+
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Truncating a mapped file makes accesses past the new end raise SIGBUS,
+ * where read() would just return early. Only files on read-only mounts
+ * (e.g. a squashfs root) cannot shrink underneath us, so only those are
+ * mapped.
+ */
+static bool md5sum_can_map(int fd, struct stat *st)
+{
+	struct statvfs vfs;
+
+	if (fstat(fd, st) || !S_ISREG(st->st_mode))
+		return false;
+
+	return !fstatvfs(fd, &vfs) && (vfs.f_flag & ST_RDONLY);
+}
+
+/*
+ * Files that cannot change are mapped in windows of MD5SUM_MAP_SIZE, so
+ * that hashing a large image neither copies it through a buffer nor needs
+ * address space for all of it at once. Anything else, or a failing mmap,
+ * falls back to plain reads from where the mapping left off.
+ */
+static int md5sum_fd(int fd, md5_ctx_t *ctx)
+{
+	struct stat st;
+	off_t ofs = 0;
+	int ret;
+
+	if (!md5sum_can_map(fd, &st)) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return md5sum_read(fd, ctx);
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	while (ofs < st.st_size) {
+		size_t len = st.st_size - ofs;
+		void *map;
+
+		if (len > MD5SUM_MAP_SIZE)
+			len = MD5SUM_MAP_SIZE;
 
+		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, ofs);
+		if (map == MAP_FAILED)
+			break;
+
+		madvise(map, len, MADV_SEQUENTIAL);
+		md5_hash(map, len, ctx);
+		munmap(map, len);
+		ofs += len;
+	}
+
+	if (lseek(fd, ofs, SEEK_SET) != ofs)
+		return ofs;
+
+	ret = md5sum_read(fd, ctx);
+	if (ret < 0)
+		return ofs;
+
+	return ofs + ret;
+}
+
+int md5sum(const char *file, void *md5_buf)
+{
+	md5_ctx_t ctx;
+	int ret;
+	int fd;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	md5_begin(&ctx);
+	ret = md5sum_fd(fd, &ctx);
 	md5_end(md5_buf, &ctx);
-	fclose(f);
+	close(fd);
 
 	return ret;
 }
+
+struct md5sum_batch {
+	struct md5sum_job *jobs;
+	size_t n_jobs;
+	size_t next;
+};
+
+static void *md5sum_batch_worker(void *arg)
+{
+	struct md5sum_batch *b = arg;
+	size_t i;
+
+	while ((i = __sync_fetch_and_add(&b->next, 1)) < b->n_jobs) {
+		struct md5sum_job *job = &b->jobs[i];
+
+		job->len = md5sum(job->file, job->md5);
+	}
+
+	return NULL;
+}
+
+int md5sum_batch(struct md5sum_job *jobs, size_t n_jobs, int n_threads)
+{
+	struct md5sum_batch b = {
+		.jobs = jobs,
+		.n_jobs = n_jobs,
+	};
+	sigset_t set, oldset;
+	pthread_t *threads;
+	int i, started = 0, failed = 0;
+
+	if (n_threads <= 0)
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)n_threads > n_jobs)
+		n_threads = n_jobs;
+
+	/* the calling thread is one of the workers */
+	threads = n_threads > 1 ? calloc(n_threads - 1, sizeof(*threads)) : NULL;
+	if (threads) {
+		/* leave signal delivery to the threads of the application */
+		sigfillset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, &oldset);
+		for (i = 0; i < n_threads - 1; i++) {
+			if (pthread_create(&threads[started], NULL,
+					   md5sum_batch_worker, &b))
+				break;
+			started++;
+		}
+		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	}
+
+	md5sum_batch_worker(&b);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (size_t j = 0; j < n_jobs; j++)
+		if (jobs[j].len < 0)
+			failed++;
+
+	return failed;
+}
@@ -55,4 +55,18 @@ extern void md5_hash(const void *data, size_t length, md5_ctx_t *ctx);
 extern void md5_end(void *resbuf, md5_ctx_t *ctx);
 int md5sum(const char *file, void *md5_buf);
 
+struct md5sum_job {
+	const char *file;
+	uint8_t md5[16];
+
+	/* bytes hashed, or -1 if the file could not be opened */
+	int len;
+};
+
+/*
+ * Hash the files of all jobs, spread across n_threads threads (one per
+ * online CPU if n_threads <= 0). Returns the number of failed jobs.
+ */
+int md5sum_batch(struct md5sum_job *jobs, size_t n_jobs, int n_threads);
+
 #endif
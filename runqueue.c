@@ -16,6 +16,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "runqueue.h"
@@ -34,6 +36,39 @@ void runqueue_init(struct runqueue *q)
 	INIT_SAFE_LIST(&q->tasks_inactive);
 }
 
+static int runqueue_task_prio(struct runqueue_task *t)
+{
+	if (t->priority < 0)
+		return 0;
+
+	if (t->priority >= __RUNQUEUE_PRIO_MAX)
+		return __RUNQUEUE_PRIO_MAX - 1;
+
+	return t->priority;
+}
+
+static void runqueue_task_running(struct runqueue *q, struct runqueue_task *t, int n)
+{
+	q->running_tasks += n;
+	q->running_prio[runqueue_task_prio(t)] += n;
+}
+
+static struct runqueue_task *runqueue_next_task(struct runqueue *q)
+{
+	struct runqueue_task *t;
+	int prio, max;
+
+	/* the first pending task of a class that has not hit its limit */
+	list_for_each_entry(t, &q->tasks_inactive.list, list.list) {
+		prio = runqueue_task_prio(t);
+		max = q->max_running_prio[prio];
+		if (!max || q->running_prio[prio] < max)
+			return t;
+	}
+
+	return NULL;
+}
+
 static void __runqueue_start_next(struct uloop_timeout *timeout)
 {
 	struct runqueue *q = container_of(timeout, struct runqueue, timeout);
@@ -43,17 +78,17 @@ static void __runqueue_start_next(struct uloop_timeout *timeout)
 		if (q->stopped)
 			break;
 
-		if (list_empty(&q->tasks_inactive.list))
+		if (q->max_running_tasks && q->running_tasks >= q->max_running_tasks)
 			break;
 
-		if (q->max_running_tasks && q->running_tasks >= q->max_running_tasks)
+		t = runqueue_next_task(q);
+		if (!t)
 			break;
 
-		t = list_first_entry(&q->tasks_inactive.list, struct runqueue_task, list.list);
 		safe_list_del(&t->list);
 		safe_list_add(&t->list, &q->tasks_active);
 		t->running = true;
-		q->running_tasks++;
+		runqueue_task_running(q, t, 1);
 		if (t->run_timeout)
 			uloop_timeout_set(&t->timeout, t->run_timeout);
 		t->type->run(q, t);
@@ -145,10 +180,43 @@ __runqueue_task_timeout(struct uloop_timeout *timeout)
 		runqueue_task_cancel(t, t->cancel_type);
 }
 
-static void _runqueue_task_add(struct runqueue *q, struct runqueue_task *t, bool running, bool first)
+/*
+ * Queue a pending task, keeping the list sorted by priority. Searching
+ * from the end the task goes to makes this O(1) while all pending tasks
+ * share the same class.
+ */
+static void
+runqueue_add_pending(struct runqueue *q, struct runqueue_task *t, bool first)
 {
-	struct safe_list *head;
+	struct list_head *head = &q->tasks_inactive.list;
+	struct runqueue_task *cur;
+	int prio = runqueue_task_prio(t);
+
+	if (first) {
+		/* before the first task of the same or a lower class */
+		list_for_each_entry(cur, head, list.list) {
+			if (runqueue_task_prio(cur) <= prio) {
+				safe_list_add(&t->list, &cur->list);
+				return;
+			}
+		}
 
+		safe_list_add(&t->list, &q->tasks_inactive);
+	} else {
+		/* after the last task of the same or a higher class */
+		list_for_each_entry_reverse(cur, head, list.list) {
+			if (runqueue_task_prio(cur) >= prio) {
+				safe_list_add_first(&t->list, &cur->list);
+				return;
+			}
+		}
+
+		safe_list_add_first(&t->list, &q->tasks_inactive);
+	}
+}
+
+static void _runqueue_task_add(struct runqueue *q, struct runqueue_task *t, bool running, bool first)
+{
 	if (t->queued)
 		return;
 
@@ -157,19 +225,17 @@ static void _runqueue_task_add(struct runqueue *q, struct runqueue_task *t, bool
 		return;
 	}
 
+	t->timeout.cb = __runqueue_task_timeout;
+	t->q = q;
 	if (running) {
-		q->running_tasks++;
-		head = &q->tasks_active;
+		runqueue_task_running(q, t, 1);
+		if (first)
+			safe_list_add_first(&t->list, &q->tasks_active);
+		else
+			safe_list_add(&t->list, &q->tasks_active);
 	} else {
-		head = &q->tasks_inactive;
+		runqueue_add_pending(q, t, first);
 	}
-
-	t->timeout.cb = __runqueue_task_timeout;
-	t->q = q;
-	if (first)
-		safe_list_add_first(&t->list, head);
-	else
-		safe_list_add(&t->list, head);
 	t->cancelled = false;
 	t->queued = true;
 	t->running = running;
@@ -221,7 +287,7 @@ void runqueue_task_complete(struct runqueue_task *t)
 		return;
 
 	if (t->running)
-		t->q->running_tasks--;
+		runqueue_task_running(q, t, -1);
 
 	uloop_timeout_cancel(&t->timeout);
 
@@ -279,3 +345,232 @@ void runqueue_process_add(struct runqueue *q, struct runqueue_process *p, pid_t
 	if (!p->task.running)
 		runqueue_task_add(q, &p->task, true);
 }
+
+int runqueue_process_spawn(struct runqueue *q, struct runqueue_process *p,
+			   char *const argv[], const struct uloop_spawn_attr *attr)
+{
+	if (p->proc.pending)
+		return -1;
+
+	p->proc.cb = __runqueue_proc_cb;
+	if (uloop_process_spawn(&p->proc, argv, attr) < 0)
+		return -1;
+
+	if (!p->task.type)
+		p->task.type = &runqueue_proc_type;
+	if (!p->task.running)
+		runqueue_task_add(q, &p->task, true);
+
+	return 0;
+}
+
+enum {
+	RUNQUEUE_WORK_IDLE,
+	RUNQUEUE_WORK_PENDING,
+	RUNQUEUE_WORK_RUNNING,
+	RUNQUEUE_WORK_DONE,
+};
+
+static void *runqueue_worker_thread(void *arg)
+{
+	struct runqueue_worker_pool *pool = arg;
+	struct runqueue_work *w;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->stop && list_empty(&pool->pending))
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		if (pool->stop)
+			break;
+
+		w = list_first_entry(&pool->pending, struct runqueue_work, list);
+		list_del(&w->list);
+		w->state = RUNQUEUE_WORK_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		w->work(w);
+
+		pthread_mutex_lock(&pool->lock);
+		w->state = RUNQUEUE_WORK_DONE;
+		list_add_tail(&w->list, &pool->done);
+		pthread_cond_broadcast(&pool->done_cond);
+
+		/* one wakeup covers everything finished until the loop runs */
+		if (!pool->post_pending) {
+			pool->post_pending = true;
+			uloop_post(&pool->queue, &pool->post);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void runqueue_worker_pool_complete(struct runqueue_worker_pool *pool)
+{
+	struct runqueue_work *w, *tmp;
+	LIST_HEAD(done);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->post_pending = false;
+	list_splice_init(&pool->done, &done);
+	pthread_mutex_unlock(&pool->lock);
+
+	list_for_each_entry_safe(w, tmp, &done, list) {
+		list_del(&w->list);
+		w->state = RUNQUEUE_WORK_IDLE;
+		runqueue_task_complete(&w->task);
+	}
+}
+
+static void runqueue_worker_pool_post_cb(struct uloop_post *p)
+{
+	struct runqueue_worker_pool *pool = container_of(p, struct runqueue_worker_pool, post);
+
+	runqueue_worker_pool_complete(pool);
+}
+
+int runqueue_worker_pool_init(struct runqueue_worker_pool *pool, int n_threads)
+{
+	sigset_t set, oldset;
+
+	memset(pool, 0, sizeof(*pool));
+	INIT_LIST_HEAD(&pool->pending);
+	INIT_LIST_HEAD(&pool->done);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pool->post.cb = runqueue_worker_pool_post_cb;
+
+	if (n_threads < 1)
+		n_threads = 1;
+
+	pool->threads = calloc(n_threads, sizeof(*pool->threads));
+	if (!pool->threads)
+		goto error;
+
+	if (uloop_post_queue_init(&pool->queue) < 0)
+		goto error;
+
+	/* leave signal delivery to the threads of the application */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	for (; pool->n_threads < n_threads; pool->n_threads++)
+		if (pthread_create(&pool->threads[pool->n_threads], NULL,
+				   runqueue_worker_thread, pool))
+			break;
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (pool->n_threads)
+		return 0;
+
+	uloop_post_queue_done(&pool->queue);
+error:
+	free(pool->threads);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	return -1;
+}
+
+/* pending work has to be cancelled or killed by the caller before */
+void runqueue_worker_pool_done(struct runqueue_worker_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	runqueue_worker_pool_complete(pool);
+	uloop_post_queue_done(&pool->queue);
+
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->n_threads = 0;
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static void runqueue_work_run(struct runqueue *q, struct runqueue_task *t)
+{
+	struct runqueue_work *w = container_of(t, struct runqueue_work, task);
+	struct runqueue_worker_pool *pool = w->pool;
+
+	__atomic_store_n(&w->cancelled, false, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&pool->lock);
+	w->state = RUNQUEUE_WORK_PENDING;
+	list_add_tail(&w->list, &pool->pending);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* take the work item back from the pool, waiting for it if it is running */
+static void runqueue_work_detach(struct runqueue_work *w, bool wait)
+{
+	struct runqueue_worker_pool *pool = w->pool;
+
+	while (wait && w->state == RUNQUEUE_WORK_RUNNING)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+	if (w->state == RUNQUEUE_WORK_PENDING || w->state == RUNQUEUE_WORK_DONE) {
+		list_del(&w->list);
+		w->state = RUNQUEUE_WORK_IDLE;
+	}
+}
+
+static void runqueue_work_cancel(struct runqueue *q, struct runqueue_task *t, int type)
+{
+	struct runqueue_work *w = container_of(t, struct runqueue_work, task);
+	struct runqueue_worker_pool *pool = w->pool;
+	bool pending;
+
+	__atomic_store_n(&w->cancelled, true, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&pool->lock);
+	pending = w->state == RUNQUEUE_WORK_PENDING;
+	if (pending)
+		runqueue_work_detach(w, false);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* running work completes when it returns */
+	if (pending)
+		runqueue_task_complete(t);
+}
+
+static void runqueue_work_kill(struct runqueue *q, struct runqueue_task *t)
+{
+	struct runqueue_work *w = container_of(t, struct runqueue_work, task);
+
+	__atomic_store_n(&w->cancelled, true, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&w->pool->lock);
+	runqueue_work_detach(w, true);
+	pthread_mutex_unlock(&w->pool->lock);
+}
+
+static const struct runqueue_task_type runqueue_work_type = {
+	.name = "work",
+	.run = runqueue_work_run,
+	.cancel = runqueue_work_cancel,
+	.kill = runqueue_work_kill,
+};
+
+void runqueue_work_add(struct runqueue *q, struct runqueue_worker_pool *pool,
+		       struct runqueue_work *w)
+{
+	if (w->task.queued)
+		return;
+
+	w->pool = pool;
+	w->state = RUNQUEUE_WORK_IDLE;
+	w->task.type = &runqueue_work_type;
+	runqueue_task_add(q, &w->task, false);
+}
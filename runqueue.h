@@ -19,6 +19,8 @@
 #ifndef __LIBUBOX_RUNQUEUE_H
 #define __LIBUBOX_RUNQUEUE_H
 
+#include <pthread.h>
+
 #include "list.h"
 #include "safe_list.h"
 #include "uloop.h"
@@ -27,6 +29,17 @@ struct runqueue;
 struct runqueue_task;
 struct runqueue_task_type;
 
+/*
+ * Priority classes for runqueue tasks. Pending tasks of a higher class are
+ * started before any of a lower one, tasks within a class in FIFO order.
+ */
+enum runqueue_prio {
+	RUNQUEUE_PRIO_NORMAL,
+	RUNQUEUE_PRIO_HIGH,
+	RUNQUEUE_PRIO_CRITICAL,
+	__RUNQUEUE_PRIO_MAX
+};
+
 struct runqueue {
 	struct safe_list tasks_active;
 	struct safe_list tasks_inactive;
@@ -34,6 +47,15 @@ struct runqueue {
 
 	int running_tasks;
 	int max_running_tasks;
+
+	/*
+	 * optional per priority class limits (0: unlimited), on top of
+	 * max_running_tasks. Capping the normal class below max_running_tasks
+	 * keeps slots free for higher priority tasks.
+	 */
+	int max_running_prio[__RUNQUEUE_PRIO_MAX];
+	int running_prio[__RUNQUEUE_PRIO_MAX];
+
 	bool stopped;
 	bool empty;
 
@@ -80,6 +102,9 @@ struct runqueue_task {
 	int cancel_timeout;
 	int cancel_type;
 
+	/* enum runqueue_prio, must not be changed while the task is queued */
+	int priority;
+
 	bool queued;
 	bool running;
 	bool cancelled;
@@ -90,6 +115,42 @@ struct runqueue_process {
 	struct uloop_process proc;
 };
 
+/*
+ * A pool of worker threads for runqueue_work tasks. Completions are handed
+ * back to the loop thread that initialized the pool.
+ */
+struct runqueue_worker_pool {
+	struct uloop_post_queue queue;
+	struct uloop_post post;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+	struct list_head pending;
+	struct list_head done;
+	bool post_pending;
+	bool stop;
+
+	pthread_t *threads;
+	int n_threads;
+};
+
+struct runqueue_work {
+	struct runqueue_task task;
+	struct runqueue_worker_pool *pool;
+
+	/*
+	 * called on a worker thread when the task is run. The task is
+	 * completed on the loop thread after this returns.
+	 */
+	void (*work)(struct runqueue_work *w);
+
+	/* internal */
+	struct list_head list;
+	int state;
+	bool cancelled;
+};
+
 #define RUNQUEUE_INIT(_name, _max_running) { \
 		.tasks_active = SAFE_LIST_INIT(_name.tasks_active), \
 		.tasks_inactive = SAFE_LIST_INIT(_name.tasks_inactive), \
@@ -117,6 +178,25 @@ void runqueue_task_kill(struct runqueue_task *t);
 
 void runqueue_process_add(struct runqueue *q, struct runqueue_process *p, pid_t pid);
 
+/* like runqueue_process_add, with the process started by uloop_process_spawn */
+int runqueue_process_spawn(struct runqueue *q, struct runqueue_process *p,
+			   char *const argv[], const struct uloop_spawn_attr *attr);
+
+int runqueue_worker_pool_init(struct runqueue_worker_pool *pool, int n_threads);
+void runqueue_worker_pool_done(struct runqueue_worker_pool *pool);
+
+void runqueue_work_add(struct runqueue *q, struct runqueue_worker_pool *pool,
+		       struct runqueue_work *w);
+
+/*
+ * May be polled by work functions. Cancelling a work item that is already
+ * running does not interrupt it; killing it waits for it to return.
+ */
+static inline bool runqueue_work_cancelled(struct runqueue_work *w)
+{
+	return __atomic_load_n(&w->cancelled, __ATOMIC_RELAXED);
+}
+
 /* to be used only from runqueue_process callbacks */
 void runqueue_process_cancel_cb(struct runqueue *q, struct runqueue_task *t, int type);
 void runqueue_process_kill_cb(struct runqueue *q, struct runqueue_task *t);
@@ -0,0 +1,46 @@
+#ifndef __BLOBMSG_GEN_POLICY_H
+#define __BLOBMSG_GEN_POLICY_H
+
+#include "blobmsg.h"
+
+/* policy for testing blobmsg-gen, with the corner cases of blobmsg_parse */
+enum {
+	GEN_MESSAGE,
+	GEN_LIST,
+	GEN_TESTDATA,
+	GEN_MTU,
+	GEN_MAC,
+	GEN_MASK,
+	GEN_ANY,
+	GEN_COUNT,
+	GEN_COUNT_STR,
+	GEN_COUNT_ANY,
+	GEN_UNNAMED,
+	GEN_EMPTY,
+	GEN_LONG,
+	GEN_NO_NAME,
+	__GEN_MAX
+};
+
+static const struct blobmsg_policy gen_policy[__GEN_MAX] = {
+	[GEN_MESSAGE] = {
+		.name = "message",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+	[GEN_LIST] = { .name = "list", .type = BLOBMSG_TYPE_ARRAY },
+	[GEN_TESTDATA] = { "testdata", BLOBMSG_TYPE_TABLE },
+	/* same length and first byte */
+	{ "mtu", BLOBMSG_TYPE_INT32 },
+	{ "mac", BLOBMSG_TYPE_STRING },
+	{ "mask", BLOBMSG_TYPE_INT8 },
+	[GEN_ANY] = { "any" },
+	/* the same name several times */
+	[GEN_COUNT] = { "count", BLOBMSG_CAST_INT64 },
+	[GEN_COUNT_STR] = { "count", BLOBMSG_TYPE_STRING },
+	[GEN_COUNT_ANY] = { "count", BLOBMSG_TYPE_UNSPEC },
+	[GEN_UNNAMED] = { NULL, BLOBMSG_TYPE_STRING },
+	[GEN_EMPTY] = { "", BLOBMSG_TYPE_INT32 },
+	[GEN_LONG] = { "a\x7f" "b\\c\"d", BLOBMSG_TYPE_DOUBLE },
+};
+
+#endif
@@ -0,0 +1,20 @@
+check that arena allocations are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-arena
+  test_alloc: aligned: yes, realloc in place: yes, copy: hello
+  test_alloc: realloc after other alloc moved: yes, copy: hello
+  test_alloc: reset reuses chunk: yes
+  test_blob: round 0: 1000 values, copy ok
+  test_blob: round 1: 1000 values, copy ok
+  test_kvlist: a=3
+  test_kvlist: entries: 1
+
+  $ test-arena-san
+  test_alloc: aligned: yes, realloc in place: yes, copy: hello
+  test_alloc: realloc after other alloc moved: yes, copy: hello
+  test_alloc: reset reuses chunk: yes
+  test_blob: round 0: 1000 values, copy ok
+  test_blob: round 1: 1000 values, copy ok
+  test_kvlist: a=3
+  test_kvlist: entries: 1
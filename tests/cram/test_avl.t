@@ -9,6 +9,25 @@ check that avl is producing expected results:
   test_basics: delete 'one' element
   test_basics: for each element reverse: zero two twelve three ten six seven nine four five eleven eight 
   test_basics: delete all elements
+  test_prefix: for each element: '' '' 'e' 'e' 'eigh' 'eigh' 'eight' 'eight' 'eighteen' 'eighteen' 'eighty' 'eighty' 'eighty-one' 'eighty-one' 'z' 'z' 'zero' 'zero' '\xff\xfe' '\xff\xfe' 
+  test_prefix: found 10 of 10, missing: none none
+  test_prefix: le 'eighty-': eighty
+  test_prefix: ge 'eighty-': eighty-one
+  test_prefix: int elements: -2147483648 -3 -1 0 5 42 2147483647 
+  test_prefix: int found 7 of 7
+  test_build: 0 nodes: ret 0, count 0, height 0, found 0
+  test_build: 1 nodes: ret 0, count 1, height 1, found 1
+  test_build: 2 nodes: ret 0, count 2, height 2, found 2
+  test_build: 3 nodes: ret 0, count 3, height 2, found 3
+  test_build: 7 nodes: ret 0, count 7, height 3, found 7
+  test_build: 100 nodes: ret 0, count 100, height 7, found 100
+  test_build: 1000 nodes: ret 0, count 1000, height 10, found 1000
+  test_build: not empty: -1
+  test_build: cleared: count 0, empty yes
+  test_build: duplicates: -1
+  test_build: unsorted: -1, empty yes
+  test_build: dups: ret 0, count 100, first of 7 ok
+  test_build: errors 0
 
   $ test-avl-san
   test_basics: insert: 0=zero 0=one 0=two 0=three 0=four 0=five 0=six 0=seven 0=eight 0=nine 0=ten 0=eleven 0=twelve 
@@ -18,3 +37,22 @@ check that avl is producing expected results:
   test_basics: delete 'one' element
   test_basics: for each element reverse: zero two twelve three ten six seven nine four five eleven eight 
   test_basics: delete all elements
+  test_prefix: for each element: '' '' 'e' 'e' 'eigh' 'eigh' 'eight' 'eight' 'eighteen' 'eighteen' 'eighty' 'eighty' 'eighty-one' 'eighty-one' 'z' 'z' 'zero' 'zero' '\xff\xfe' '\xff\xfe' 
+  test_prefix: found 10 of 10, missing: none none
+  test_prefix: le 'eighty-': eighty
+  test_prefix: ge 'eighty-': eighty-one
+  test_prefix: int elements: -2147483648 -3 -1 0 5 42 2147483647 
+  test_prefix: int found 7 of 7
+  test_build: 0 nodes: ret 0, count 0, height 0, found 0
+  test_build: 1 nodes: ret 0, count 1, height 1, found 1
+  test_build: 2 nodes: ret 0, count 2, height 2, found 2
+  test_build: 3 nodes: ret 0, count 3, height 2, found 3
+  test_build: 7 nodes: ret 0, count 7, height 3, found 7
+  test_build: 100 nodes: ret 0, count 100, height 7, found 100
+  test_build: 1000 nodes: ret 0, count 1000, height 10, found 1000
+  test_build: not empty: -1
+  test_build: cleared: count 0, empty yes
+  test_build: duplicates: -1
+  test_build: unsorted: -1, empty yes
+  test_build: dups: ret 0, count 100, first of 7 ok
+  test_build: errors 0
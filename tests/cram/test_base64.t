@@ -19,6 +19,9 @@ check that base64 is producing expected results:
   4 foob
   5 fooba
   6 foobar
+  1336 1000 same
+  1000 same
+  -1
 
   $ test-b64-san
   0 
@@ -35,6 +38,9 @@ check that base64 is producing expected results:
   4 foob
   5 fooba
   6 foobar
+  1336 1000 same
+  1000 same
+  -1
 
 check that b64_encode and b64_decode assert invalid input
 
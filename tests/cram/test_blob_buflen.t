@@ -4,6 +4,12 @@ check that blob buffer cannot exceed maximum buffer length:
 
   $ valgrind --quiet --leak-check=full test-blob-buflen
   SUCCESS: failed to allocate attribute
+  SUCCESS: reserved buffer was not reallocated
+  SUCCESS: reset buffer was reused
+  SUCCESS: reset buffer was trimmed
 
   $ test-blob-buflen-san
   SUCCESS: failed to allocate attribute
+  SUCCESS: reserved buffer was not reallocated
+  SUCCESS: reset buffer was reused
+  SUCCESS: reset buffer was trimmed
@@ -0,0 +1,44 @@
+check that blob hashing is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-blob-hash
+  test_vectors: '': ok
+  test_vectors: 'a': ok
+  test_vectors: 'abc': ok
+  test_vectors: 'Nobody inspects the spammish repetition': ok
+  test_vectors: sanity 1: ok
+  test_vectors: sanity 14: ok
+  test_vectors: sanity 222: ok
+  test_vectors: message: eaba830d7664faf3
+  test_hash: n 0: equal 1, same hash 1
+  test_hash: n 0: changed equal 1, same hash 1
+  test_hash: n 1: equal 1, same hash 1
+  test_hash: n 1: changed equal 0, same hash 0
+  test_hash: n 2: equal 1, same hash 1
+  test_hash: n 2: changed equal 0, same hash 0
+  test_hash: n 3: equal 1, same hash 1
+  test_hash: n 3: changed equal 0, same hash 0
+  test_hashed_equal: cached hash matches 1
+  test_hashed_equal: same 1, changed 0, shorter 0, null 0/1
+  test_hashed_equal: copy equal to source 1
+
+  $ test-blob-hash-san
+  test_vectors: '': ok
+  test_vectors: 'a': ok
+  test_vectors: 'abc': ok
+  test_vectors: 'Nobody inspects the spammish repetition': ok
+  test_vectors: sanity 1: ok
+  test_vectors: sanity 14: ok
+  test_vectors: sanity 222: ok
+  test_vectors: message: eaba830d7664faf3
+  test_hash: n 0: equal 1, same hash 1
+  test_hash: n 0: changed equal 1, same hash 1
+  test_hash: n 1: equal 1, same hash 1
+  test_hash: n 1: changed equal 0, same hash 0
+  test_hash: n 2: equal 1, same hash 1
+  test_hash: n 2: changed equal 0, same hash 0
+  test_hash: n 3: equal 1, same hash 1
+  test_hash: n 3: changed equal 0, same hash 0
+  test_hashed_equal: cached hash matches 1
+  test_hashed_equal: same 1, changed 0, shorter 0, null 0/1
+  test_hashed_equal: copy equal to source 1
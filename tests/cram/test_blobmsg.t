@@ -37,6 +37,11 @@ check that blobmsg is producing expected results:
   
   [*] blobmsg to json: {"message":"Hello, world!","testdata":{"dbl-min":0.000000,"dbl-max":179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000,"foo":false,"poo":true,"moo-min":true,"moo-max":true,"bar-min":-32768,"bar-max":32767,"baz-min":-2147483648,"baz-max":2147483647,"taz-min":-9223372036854775808,"taz-max":9223372036854775807,"world":"2"},"list":[false,true,true,true,-32768,32767,-2147483648,2147483647,-9223372036854775808,9223372036854775807,0.000000,179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000]}
   
+  [*] blobmsg to json buffer: same
+  [*] truncated: 31 of 1021 bytes: {"message":"Hello, world!","tes
+  [*] escaped: {"esc":"a\"b\\c\n\t\u0001\u001f/","dbl":-42.000000,"frac":0.500000}
+  [*] doubles as %lf: 10 of 10
+  
   [*] blobmsg from json:
   Message: Hello, world!
   List: {
@@ -68,6 +73,11 @@ check that blobmsg is producing expected results:
   \ttaz-max : 9223372036854775807 (i64) (esc)
   \tworld : 2 (str) (esc)
   }
+  
+  [*] chunked json parse: same
+  [*] incomplete json: dropped
+  [*] duplicate keys: {"a":"keep","a":"last","b":{"x":[3],"y":2},"c":[{"k":2}]}
+  [*] json file: same, from cache: same, after change: reparsed
 
   $ test-blobmsg-san
   [*] blobmsg dump:
@@ -104,6 +114,11 @@ check that blobmsg is producing expected results:
   
   [*] blobmsg to json: {"message":"Hello, world!","testdata":{"dbl-min":0.000000,"dbl-max":179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000,"foo":false,"poo":true,"moo-min":true,"moo-max":true,"bar-min":-32768,"bar-max":32767,"baz-min":-2147483648,"baz-max":2147483647,"taz-min":-9223372036854775808,"taz-max":9223372036854775807,"world":"2"},"list":[false,true,true,true,-32768,32767,-2147483648,2147483647,-9223372036854775808,9223372036854775807,0.000000,179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000]}
   
+  [*] blobmsg to json buffer: same
+  [*] truncated: 31 of 1021 bytes: {"message":"Hello, world!","tes
+  [*] escaped: {"esc":"a\"b\\c\n\t\u0001\u001f/","dbl":-42.000000,"frac":0.500000}
+  [*] doubles as %lf: 10 of 10
+  
   [*] blobmsg from json:
   Message: Hello, world!
   List: {
@@ -135,6 +150,11 @@ check that blobmsg is producing expected results:
   \ttaz-max : 9223372036854775807 (i64) (esc)
   \tworld : 2 (str) (esc)
   }
+  
+  [*] chunked json parse: same
+  [*] incomplete json: dropped
+  [*] duplicate keys: {"a":"keep","a":"last","b":{"x":[3],"y":2},"c":[{"k":2}]}
+  [*] json file: same, from cache: same, after change: reparsed
 
   $ test-blobmsg-san
   [*] blobmsg dump:
@@ -171,6 +191,11 @@ check that blobmsg is producing expected results:
   
   [*] blobmsg to json: {"message":"Hello, world!","testdata":{"dbl-min":0.000000,"dbl-max":179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000,"foo":false,"poo":true,"moo-min":true,"moo-max":true,"bar-min":-32768,"bar-max":32767,"baz-min":-2147483648,"baz-max":2147483647,"taz-min":-9223372036854775808,"taz-max":9223372036854775807,"world":"2"},"list":[false,true,true,true,-32768,32767,-2147483648,2147483647,-9223372036854775808,9223372036854775807,0.000000,179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000]}
   
+  [*] blobmsg to json buffer: same
+  [*] truncated: 31 of 1021 bytes: {"message":"Hello, world!","tes
+  [*] escaped: {"esc":"a\"b\\c\n\t\u0001\u001f/","dbl":-42.000000,"frac":0.500000}
+  [*] doubles as %lf: 10 of 10
+  
   [*] blobmsg from json:
   Message: Hello, world!
   List: {
@@ -202,6 +227,11 @@ check that blobmsg is producing expected results:
   \ttaz-max : 9223372036854775807 (i64) (esc)
   \tworld : 2 (str) (esc)
   }
+  
+  [*] chunked json parse: same
+  [*] incomplete json: dropped
+  [*] duplicate keys: {"a":"keep","a":"last","b":{"x":[3],"y":2},"c":[{"k":2}]}
+  [*] json file: same, from cache: same, after change: reparsed
 
   $ test-blobmsg-san
   [*] blobmsg dump:
@@ -238,6 +268,11 @@ check that blobmsg is producing expected results:
   
   [*] blobmsg to json: {"message":"Hello, world!","testdata":{"dbl-min":0.000000,"dbl-max":179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000,"foo":false,"poo":true,"moo-min":true,"moo-max":true,"bar-min":-32768,"bar-max":32767,"baz-min":-2147483648,"baz-max":2147483647,"taz-min":-9223372036854775808,"taz-max":9223372036854775807,"world":"2"},"list":[false,true,true,true,-32768,32767,-2147483648,2147483647,-9223372036854775808,9223372036854775807,0.000000,179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.000000]}
   
+  [*] blobmsg to json buffer: same
+  [*] truncated: 31 of 1021 bytes: {"message":"Hello, world!","tes
+  [*] escaped: {"esc":"a\"b\\c\n\t\u0001\u001f/","dbl":-42.000000,"frac":0.500000}
+  [*] doubles as %lf: 10 of 10
+  
   [*] blobmsg from json:
   Message: Hello, world!
   List: {
@@ -269,3 +304,8 @@ check that blobmsg is producing expected results:
   \ttaz-max : 9223372036854775807 (i64) (esc)
   \tworld : 2 (str) (esc)
   }
+  
+  [*] chunked json parse: same
+  [*] incomplete json: dropped
+  [*] duplicate keys: {"a":"keep","a":"last","b":{"x":[3],"y":2},"c":[{"k":2}]}
+  [*] json file: same, from cache: same, after change: reparsed
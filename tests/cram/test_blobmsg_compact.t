@@ -0,0 +1,60 @@
+check that compact blobmsg names are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-blobmsg-compact
+  test_compact: size 10840 -> 9256, valid 1
+  test_compact: plain: 0, 100 interfaces, mtu sum 145050, last eth99
+  test_compact: compact: 0, 100 interfaces, mtu sum 145050, last eth99
+  test_compact: reused: valid 1, 0, 1 interfaces, mtu sum 1500, last eth0
+  test_refs: ifname: ref 1
+  test_refs: proto: ref 1
+  test_refs: mtu: ref 1
+  test_refs: ipv4-address: ref 0
+  test_refs: after: ifname: ref 0
+  test_refs: check attr 0, check array -1
+  test_refs: container: check attr 1, check array 2
+  test_refs: bad ref valid 0
+  test_refs: cleared: name '', valid 0
+  test_refs: sort: -22
+  test_refs: nested: refused
+  test_refs: inner: compact 1, valid 1
+  test_copy: member: refs 3, valid 0, ret -1, - - 0
+  test_copy: add_blob: refs 0, valid 1, ret 0, eth1 dhcp 1499
+  test_copy: expand: refs 0, valid 1, ret 0, eth1 dhcp 1499
+  test_copy: expand member: ifname, ref 0
+  test_copy: add_field: refs 3, valid 1, ret -1, - - 0
+  test_copy: memdup: refs 3, valid 0, ret -1, - - 0
+  test_copy: container: compact 1, refs 3, valid 1, same 1
+  test_copy: into compact: refs 4, valid 1
+  test_bad_copy: long name: valid 1, copy 0
+  test_bad_copy: long name compact: valid 0, copy -1
+  test_bad_copy: deep: valid 0, copy -1
+
+  $ test-blobmsg-compact-san
+  test_compact: size 10840 -> 9256, valid 1
+  test_compact: plain: 0, 100 interfaces, mtu sum 145050, last eth99
+  test_compact: compact: 0, 100 interfaces, mtu sum 145050, last eth99
+  test_compact: reused: valid 1, 0, 1 interfaces, mtu sum 1500, last eth0
+  test_refs: ifname: ref 1
+  test_refs: proto: ref 1
+  test_refs: mtu: ref 1
+  test_refs: ipv4-address: ref 0
+  test_refs: after: ifname: ref 0
+  test_refs: check attr 0, check array -1
+  test_refs: container: check attr 1, check array 2
+  test_refs: bad ref valid 0
+  test_refs: cleared: name '', valid 0
+  test_refs: sort: -22
+  test_refs: nested: refused
+  test_refs: inner: compact 1, valid 1
+  test_copy: member: refs 3, valid 0, ret -1, - - 0
+  test_copy: add_blob: refs 0, valid 1, ret 0, eth1 dhcp 1499
+  test_copy: expand: refs 0, valid 1, ret 0, eth1 dhcp 1499
+  test_copy: expand member: ifname, ref 0
+  test_copy: add_field: refs 3, valid 1, ret -1, - - 0
+  test_copy: memdup: refs 3, valid 0, ret -1, - - 0
+  test_copy: container: compact 1, refs 3, valid 1, same 1
+  test_copy: into compact: refs 4, valid 1
+  test_bad_copy: long name: valid 1, copy 0
+  test_bad_copy: long name compact: valid 0, copy -1
+  test_bad_copy: deep: valid 0, copy -1
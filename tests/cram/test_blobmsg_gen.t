@@ -0,0 +1,18 @@
+check that generated blobmsg parsers are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-blobmsg-gen
+  test_messages: plain: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: validate: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: compact: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: compact validate: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_mutations: mismatches 0
+  test_mutations: compact: mismatches 0
+
+  $ test-blobmsg-gen-san
+  test_messages: plain: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: validate: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: compact: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_messages: compact validate: equal 1, ret 0, set 0 1 2 4 5 6 7 8 9 11 12
+  test_mutations: mismatches 0
+  test_mutations: compact: mismatches 0
@@ -0,0 +1,28 @@
+check that sorted blobmsg tables are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-blobmsg-sorted
+  test_find: plain: valid 1, sorted 0, name state
+  test_find: found 200, ordered 0, missing 0/0, dup first
+  test_find: path lan, short path sub, bad path 0, after ok
+  test_find: sorted: valid 1, sorted 1, name state
+  test_find: found 200, ordered 1, missing 0/0, dup first
+  test_find: path lan, short path sub, bad path 0, after ok
+  test_check: members 203, index valid 1
+  test_check: bad offset valid 0
+  test_check: bad count valid 0
+  test_check: array: -22
+  test_check: array valid 1, sorted 0
+
+  $ test-blobmsg-sorted-san
+  test_find: plain: valid 1, sorted 0, name state
+  test_find: found 200, ordered 0, missing 0/0, dup first
+  test_find: path lan, short path sub, bad path 0, after ok
+  test_find: sorted: valid 1, sorted 1, name state
+  test_find: found 200, ordered 1, missing 0/0, dup first
+  test_find: path lan, short path sub, bad path 0, after ok
+  test_check: members 203, index valid 1
+  test_check: bad offset valid 0
+  test_check: bad count valid 0
+  test_check: array: -22
+  test_check: array valid 1, sorted 0
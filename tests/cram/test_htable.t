@@ -0,0 +1,14 @@
+check that htable and the kvlist hash backend are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-htable
+  test_htable: strhash: count ok, duplicates rejected 715, iterated all, errors 0
+  test_htable: colliding: count ok, duplicates rejected 72, iterated all, errors 0
+  test_kvlist: avl: 1000 of 1000 ok, 800 entries, first 'first'
+  test_kvlist: hash: 1000 of 1000 ok, 800 entries, first 'k1'
+
+  $ test-htable-san
+  test_htable: strhash: count ok, duplicates rejected 715, iterated all, errors 0
+  test_htable: colliding: count ok, duplicates rejected 72, iterated all, errors 0
+  test_kvlist: avl: 1000 of 1000 ok, 800 entries, first 'first'
+  test_kvlist: hash: 1000 of 1000 ok, 800 entries, first 'k1'
@@ -6,11 +6,11 @@ set jshn for convenience:
 check usage:
 
   $ jshn
-  Usage: jshn [-n] [-i] -r <message>|-R <file>|-o <file>|-p <prefix>|-w
+  Usage: jshn [-n] [-i] [-b] -r <message>|-R <file>|-o <file>|-p <prefix>|-w
   [2]
 
   $ jshn-san
-  Usage: jshn-san [-n] [-i] -r <message>|-R <file>|-o <file>|-p <prefix>|-w
+  Usage: jshn-san [-n] [-i] [-b] -r <message>|-R <file>|-o <file>|-p <prefix>|-w
   [2]
 
 test bad json:
@@ -331,3 +331,56 @@ test json formatting with prepared environment:
   $ jshn-san -n -i -p procd -o test.json
   Error opening test.json
   [3]
+
+test json formatting of a large object:
+
+  $ keys=; for i in $(seq 1 300); do export bigJ_V_k$i=$i bigT_J_V_k$i=int; keys="$keys k$i"; done; export bigK_J_V="$keys"
+
+  $ jshn -p big -w | tr ',' '\n' | sed -n '1p;$p'
+  { "k1": 1
+   "k300": 300 }
+
+  $ jshn-san -p big -w | tr ',' '\n' | sed -n '1p;$p'
+  { "k1": 1
+   "k300": 300 }
+
+  $ jshn -p big -w | grep -o '"k[0-9]*": [0-9]*' | wc -l
+  300
+
+test keys added more than once keep their first position:
+
+  $ export dupJ_V_a=1 dupT_J_V_a=int dupJ_V_b=x dupT_J_V_b=string dupJ_V_c=null dupT_J_V_c=null dupK_J_V="a b a c"
+
+  $ jshn -p dup -w
+  { "a": 1, "b": "x", "c": null }
+
+  $ jshn-san -p dup -w
+  { "a": 1, "b": "x", "c": null }
+
+  $ jshn -b -p dup -w
+  {"a":1,"b":"x","c":null}
+
+  $ jshn-san -b -p dup -w
+  {"a":1,"b":"x","c":null}
+
+test json formatting straight from a blob_buf:
+
+  $ jshn -b -p procd -w
+  {"name":"urngd","script":"/etc/init.d/urngd","instances":{"instance1":{"command":["/sbin/urngd"]}},"triggers":[],"data":{}}
+
+  $ jshn-san -b -p procd -w
+  {"name":"urngd","script":"/etc/init.d/urngd","instances":{"instance1":{"command":["/sbin/urngd"]}},"triggers":[],"data":{}}
+
+  $ [ "$(jshn -b -i -p procd -w)" = "$(jshn -i -p procd -w)" ] && echo same
+  same
+
+  $ [ "$(jshn-san -b -i -p big -w)" = "$(jshn-san -i -p big -w)" ] && echo same
+  same
+
+  $ jshn -b -p big -w | tr ',' '\n' | sed -n '1p;$p'
+  {"k1":1
+  "k300":300}
+
+  $ jshn-san -b -p big -w | tr ',' '\n' | sed -n '1p;$p'
+  {"k1":1
+  "k300":300}
@@ -149,3 +149,13 @@ check regex single expression:
 
   $ js-san VAR=hell test.json
   echo baz
+
+check variable lookup with many and duplicate variables:
+
+  $ echo '[ [ "echo", "%V1%", "%V20%", "%V40%", "%DUP%" ] ]' > test.json
+  $ VARS=$(for i in $(seq 1 40); do printf 'V%d=v%d ' $i $i; done)
+  $ js $VARS DUP=first DUP=second test.json
+  echo v1 v20 v40 first
+
+  $ js-san $VARS DUP=first DUP=second test.json
+  echo v1 v20 v40 first
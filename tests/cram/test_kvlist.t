@@ -0,0 +1,38 @@
+check that kvlist is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-kvlist
+  test_in_place: avl: same node 1, updates 1, value 'short'
+  test_in_place: avl: self 'ort'
+  test_in_place: avl: moved 1, updates 2, data 30, order a=a value that does not fit b=2 c=3
+  test_in_place: avl: data 2, mem ok
+  test_in_place: avl: freed data 0, mem 0
+  test_in_place: hash: same node 1, updates 1, value 'short'
+  test_in_place: hash: self 'ort'
+  test_in_place: hash: moved 1, updates 2, data 30, order b=2 c=3 a=a value that does not fit
+  test_in_place: hash: data 2, mem ok
+  test_in_place: hash: freed data 0, mem 0
+  test_slab: chunks 13, hits 187
+  test_slab: updates 100, chunks 13
+  test_slab: chunks 34, hits 1466
+  test_slab: big 1, chunk bytes unchanged 1
+  test_slab: 100 of 100 ok, entries 100/100
+  test_arena: same node 1, updates 1, data 5, order a=12 b=3
+
+  $ test-kvlist-san
+  test_in_place: avl: same node 1, updates 1, value 'short'
+  test_in_place: avl: self 'ort'
+  test_in_place: avl: moved 1, updates 2, data 30, order a=a value that does not fit b=2 c=3
+  test_in_place: avl: data 2, mem ok
+  test_in_place: avl: freed data 0, mem 0
+  test_in_place: hash: same node 1, updates 1, value 'short'
+  test_in_place: hash: self 'ort'
+  test_in_place: hash: moved 1, updates 2, data 30, order b=2 c=3 a=a value that does not fit
+  test_in_place: hash: data 2, mem ok
+  test_in_place: hash: freed data 0, mem 0
+  test_slab: chunks 13, hits 187
+  test_slab: updates 100, chunks 13
+  test_slab: chunks 34, hits 1466
+  test_slab: big 1, chunk bytes unchanged 1
+  test_slab: 100 of 100 ok, entries 100/100
+  test_arena: same node 1, updates 1, data 5, order a=12 b=3
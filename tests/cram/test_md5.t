@@ -0,0 +1,18 @@
+check that md5 is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-md5
+  test_vectors: d41d8cd98f00b204e9800998ecf8427e
+  test_vectors: 900150983cd24fb0d6963f7d28e17f72
+  test_vectors: f96b697d7cb7938d525a2f31aaf161d0
+  test_vectors: 57edf4a22be3c955ac49da2e2107b67a
+  test_chunked: d90040973d679b36365939677b4a4156, chunked: same
+  test_files: md5sum: 8 of 8 ok, failed: 1, missing: -1
+
+  $ test-md5-san
+  test_vectors: d41d8cd98f00b204e9800998ecf8427e
+  test_vectors: 900150983cd24fb0d6963f7d28e17f72
+  test_vectors: f96b697d7cb7938d525a2f31aaf161d0
+  test_vectors: 57edf4a22be3c955ac49da2e2107b67a
+  test_chunked: d90040973d679b36365939677b4a4156, chunked: same
+  test_files: md5sum: 8 of 8 ok, failed: 1, missing: -1
@@ -17,6 +17,22 @@ check that runqueue is producing expected results:
   [1/1] cancel 'sleep 1' (sleeper)
   [0/1] finish 'sleep 1' (sleeper) 
   All done!
+  [1/2] start 'critical' (normal running: 0)
+  [2/2] start 'high 0' (normal running: 0)
+  [1/2] start 'high 1' (normal running: 0)
+  [2/2] start 'high 2' (normal running: 0)
+  [1/2] start 'normal 0' (normal running: 1)
+  [1/2] start 'normal 1' (normal running: 1)
+  [1/2] start 'normal 2' (normal running: 1)
+  Priorities done!
+  cancelled 'pending' while queued: completed
+  killed 'blocker' while running: completed
+  work 'blocker': done, result 0
+  work 'sum 1': done, result 500500
+  work 'sum 2': done, result 5050
+  work 'pending': done, result 0
+  work 'sum 3': done, result 50005000
+  worker signals blocked: yes
 
   $ test-runqueue-san
   [1/1] start 'sleep 1' (killer)
@@ -34,3 +50,19 @@ check that runqueue is producing expected results:
   [1/1] cancel 'sleep 1' (sleeper)
   [0/1] finish 'sleep 1' (sleeper) 
   All done!
+  [1/2] start 'critical' (normal running: 0)
+  [2/2] start 'high 0' (normal running: 0)
+  [1/2] start 'high 1' (normal running: 0)
+  [2/2] start 'high 2' (normal running: 0)
+  [1/2] start 'normal 0' (normal running: 1)
+  [1/2] start 'normal 1' (normal running: 1)
+  [1/2] start 'normal 2' (normal running: 1)
+  Priorities done!
+  cancelled 'pending' while queued: completed
+  killed 'blocker' while running: completed
+  work 'blocker': done, result 0
+  work 'sum 1': done, result 500500
+  work 'sum 2': done, result 5050
+  work 'pending': done, result 0
+  work 'sum 3': done, result 50005000
+  worker signals blocked: yes
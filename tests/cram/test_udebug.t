@@ -0,0 +1,66 @@
+check that udebug ring writes are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-udebug
+  test_alloc: lazy: data 512 KiB, at least 5120 entries, resident none
+  test_alloc: prefault: data 512 KiB, at least 5120 entries, resident all
+  test_deferred: 10 entries, truncated: '-42 42 ' (20)
+  test_notify: default: 10 notifications
+  test_notify: per loop iteration: 0, then 1 notifications
+  test_notify: max 4 entries: 2, then 0 notifications
+  test_notify: flushed: 1 notifications
+  export_file: export: ret 0, skipped 50
+  check_pcapng: pcapng: 1 section, 1 interfaces, 150 packets, 0 bad, 0 left
+  check_binary: binary: string 'string 0 at 1005'
+  check_binary: binary: string 'string 3 at 1035'
+  check_binary: binary: 150 packets, 50 strings, 0 left
+  test_merge: 3360 of 3360 entries merged, 0 out of order
+  test_commit_order: before first commit: 0 entries
+  test_commit_order: 0: 'entry 0' ts 1
+  test_commit_order: 1: 'entry 1' ts 2
+  test_commit_order: 2: 'entry 2' ts 3
+  test_threads: 800 entries: concurrent snapshot reader ok
+  test_threads: 800 entries: snapshot complete, head 800
+  test_threads: 80000 entries: concurrent snapshot reader ok
+  test_threads: 80000 entries: snapshot partial, head 80000
+  test_threads: 80000 entries: concurrent incremental reader ok
+  test_threads: 80000 entries: snapshot partial, head 80000
+  read_all: five: first 'entry 0'
+  read_all: five: read 5, dropped 0
+  read_all: none: read 0, dropped 0
+  read_all: wrapped: first 'entry 11'
+  read_all: wrapped: read -1, dropped 11
+  test_read: valid before: yes
+  test_read: valid after: no
+
+  $ test-udebug-san
+  test_alloc: lazy: data 512 KiB, at least 5120 entries, resident none
+  test_alloc: prefault: data 512 KiB, at least 5120 entries, resident all
+  test_deferred: 10 entries, truncated: '-42 42 ' (20)
+  test_notify: default: 10 notifications
+  test_notify: per loop iteration: 0, then 1 notifications
+  test_notify: max 4 entries: 2, then 0 notifications
+  test_notify: flushed: 1 notifications
+  export_file: export: ret 0, skipped 50
+  check_pcapng: pcapng: 1 section, 1 interfaces, 150 packets, 0 bad, 0 left
+  check_binary: binary: string 'string 0 at 1005'
+  check_binary: binary: string 'string 3 at 1035'
+  check_binary: binary: 150 packets, 50 strings, 0 left
+  test_merge: 3360 of 3360 entries merged, 0 out of order
+  test_commit_order: before first commit: 0 entries
+  test_commit_order: 0: 'entry 0' ts 1
+  test_commit_order: 1: 'entry 1' ts 2
+  test_commit_order: 2: 'entry 2' ts 3
+  test_threads: 800 entries: concurrent snapshot reader ok
+  test_threads: 800 entries: snapshot complete, head 800
+  test_threads: 80000 entries: concurrent snapshot reader ok
+  test_threads: 80000 entries: snapshot partial, head 80000
+  test_threads: 80000 entries: concurrent incremental reader ok
+  test_threads: 80000 entries: snapshot partial, head 80000
+  read_all: five: first 'entry 0'
+  read_all: five: read 5, dropped 0
+  read_all: none: read 0, dropped 0
+  read_all: wrapped: first 'entry 11'
+  read_all: wrapped: read -1, dropped 11
+  test_read: valid before: yes
+  test_read: valid after: no
@@ -0,0 +1,10 @@
+check that udgram is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-udgram
+  test_batch: queued: 100, too large: -1
+  test_batch: received: 100, in order: yes, batched: yes, pending: 0
+
+  $ test-udgram-san
+  test_batch: queued: 100, too large: -1
+  test_batch: received: 100, in order: yes, batched: yes, pending: 0
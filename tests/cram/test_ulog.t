@@ -0,0 +1,38 @@
+check that ulog output is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-ulog
+  test_async: lines 100, dropped 0, last ok
+  test_async_blocked: dropped yes, accounted yes, reported yes
+  test_async_blocked: sync: test: sync message
+  test_ratelimit: limited 5, other 2
+  test_ratelimit: test: 95 similar messages suppressed
+  test_dedup: output:
+  test: same
+  test: last message repeated 2 times
+  test: value 1
+  test: last message repeated 1 times
+  test: value 2
+  test: last message repeated 1 times
+  test_thresholds: enabled 1/1/0, evaluated 1, test: warn 2
+  test_thresholds: udebug: 1
+  test_thresholds: udebug flag clear: 0
+  test_thresholds: udebug flag set: 1
+
+  $ test-ulog-san
+  test_async: lines 100, dropped 0, last ok
+  test_async_blocked: dropped yes, accounted yes, reported yes
+  test_async_blocked: sync: test: sync message
+  test_ratelimit: limited 5, other 2
+  test_ratelimit: test: 95 similar messages suppressed
+  test_dedup: output:
+  test: same
+  test: last message repeated 2 times
+  test: value 1
+  test: last message repeated 1 times
+  test: value 2
+  test: last message repeated 1 times
+  test_thresholds: enabled 1/1/0, evaluated 1, test: warn 2
+  test_thresholds: udebug: 1
+  test_thresholds: udebug flag clear: 0
+  test_thresholds: udebug flag set: 1
@@ -0,0 +1,70 @@
+check the uloop scenarios on the io_uring backend, where it is available:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ test-uloop io_uring > /dev/null 2>&1 || [ $? -ne 77 ] || exit 80
+
+  $ valgrind --quiet --leak-check=full test-uloop io_uring
+  test_backend_fallback: without kernel support: epoll
+  test_timeout_order: add again: -1
+  test_timeout_order: cancel: 0
+  test_timeout_order: cancel again: -1
+  test_timeout_order: pending: no
+  test_timeout_order: fire order: zero-a zero-b zero-c one two three four five moved 
+  test_timeout_order: next timeout: -1
+  test_slow_callback: next timer on time: yes
+  test_fd_batch: single: 1 fd callbacks before timeout
+  test_fd_batch: batch: 10 fd callbacks before timeout
+  test_fd_flags: write events after toggle: 0
+  test_fd_flags: write events after enable: 1
+  test_fd_error: error callbacks with ULOOP_ERROR_CB: 3
+  test_fd_error: error callbacks without: 1, registered: no
+  test_thread_loops: fired: 3 4 5 6
+  test_post: received 4000 posts, in order: yes
+  test_stats: timeouts: 2, lateness samples: 2, polled: yes
+  test_stats: slowest: slow, at least 5ms: yes
+  test_stats: after reset: 0 timeouts
+  run_slack: slack 0: 3 wakeups, fired early: no
+  run_slack: slack 50: 1 wakeups, fired early: no
+  test_signalfd: handler: none, blocked: yes
+  test_signalfd: child blocked: no
+  test_signalfd: usr1 1, rt 1
+  test_signalfd: sigterm: loop ended
+  test_signalfd: after done: blocked no
+  test_processes: 100 children, 34 registered twice, 0 pending, 0 wrong
+  test_spawn: spawn: 0
+  test_spawn: missing: -1
+  test_spawn: 100 children, 0 pending, 0 wrong, output: from env
+  to stderr
+
+  $ test-uloop-san io_uring
+  test_backend_fallback: without kernel support: epoll
+  test_timeout_order: add again: -1
+  test_timeout_order: cancel: 0
+  test_timeout_order: cancel again: -1
+  test_timeout_order: pending: no
+  test_timeout_order: fire order: zero-a zero-b zero-c one two three four five moved 
+  test_timeout_order: next timeout: -1
+  test_slow_callback: next timer on time: yes
+  test_fd_batch: single: 1 fd callbacks before timeout
+  test_fd_batch: batch: 10 fd callbacks before timeout
+  test_fd_flags: write events after toggle: 0
+  test_fd_flags: write events after enable: 1
+  test_fd_error: error callbacks with ULOOP_ERROR_CB: 3
+  test_fd_error: error callbacks without: 1, registered: no
+  test_thread_loops: fired: 3 4 5 6
+  test_post: received 4000 posts, in order: yes
+  test_stats: timeouts: 2, lateness samples: 2, polled: yes
+  test_stats: slowest: slow, at least 5ms: yes
+  test_stats: after reset: 0 timeouts
+  run_slack: slack 0: 3 wakeups, fired early: no
+  run_slack: slack 50: 1 wakeups, fired early: no
+  test_signalfd: handler: none, blocked: yes
+  test_signalfd: child blocked: no
+  test_signalfd: usr1 1, rt 1
+  test_signalfd: sigterm: loop ended
+  test_signalfd: after done: blocked no
+  test_processes: 100 children, 34 registered twice, 0 pending, 0 wrong
+  test_spawn: spawn: 0
+  test_spawn: missing: -1
+  test_spawn: 100 children, 0 pending, 0 wrong, output: from env
+  to stderr
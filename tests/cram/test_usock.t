@@ -0,0 +1,28 @@
+check that usock async connects are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-usock
+  test_async: server: rejected
+  test_async: numeric: connected (inet)
+  test_async: resolved: connected (inet)
+  test_async: refused: failed (refused)
+  test_async: bad address: failed (resolve)
+  test_async: cancelled: no callback
+  test_async: timeout while resolving: failed (timeout)
+  test_shards: 2 shards, same port: yes
+  test_shards: accepted 32, per shard counts match: yes
+  test_listener: accepted after fd limit: 4 of 4
+  test_listener: accepted before delete: 1
+
+  $ test-usock-san
+  test_async: server: rejected
+  test_async: numeric: connected (inet)
+  test_async: resolved: connected (inet)
+  test_async: refused: failed (refused)
+  test_async: bad address: failed (resolve)
+  test_async: cancelled: no callback
+  test_async: timeout while resolving: failed (timeout)
+  test_shards: 2 shards, same port: yes
+  test_shards: accepted 32, per shard counts match: yes
+  test_listener: accepted after fd limit: 4 of 4
+  test_listener: accepted before delete: 1
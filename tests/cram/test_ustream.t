@@ -0,0 +1,78 @@
+check that ustream is producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-ustream
+  test_write_buffered: write: received 262144 bytes, data ok, pending 0
+  test_write_buffered: writev: received 262144 bytes, data ok, pending 0
+  test_writev: write: received 262144 bytes, data ok, pending 0
+  test_writev: writev: received 262144 bytes, data ok, pending 0
+  test_write_ext: received 262144 bytes, data ok, done 131, pending 0
+  test_sendfile: queued 262144 bytes
+  test_sendfile: received 262144 bytes, data ok, pending 0
+  test_sendfile_mapped: head buffered: yes
+  test_sendfile_mapped: queued 262144 bytes
+  test_sendfile_mapped: queued past the end: 0 bytes
+  test_sendfile_mapped: received 262144 bytes, data ok, pending 0
+  test_buf_pool: data ok, reused: yes, cached: 8
+  test_read_records: 1 buffers: received 262144 bytes, data ok
+  test_read_records: 4 buffers: received 262144 bytes, data ok
+  test_read_cbuf: raw: buffer 16384, received 262144 bytes, data ok, contiguous yes
+  test_read_cbuf: string: buffer 16384, received 262144 bytes, data ok, contiguous yes
+  test_read_budget: budget 0: received 262144 bytes, data ok
+  test_read_budget: budget 0: other fd waited for all data
+  test_read_budget: budget 16384: received 262144 bytes, data ok
+  test_read_budget: budget 16384: other fd served after 16384 bytes
+  test_forward: copy: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: yes
+  test_forward: copy with one write buffer: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: yes
+  test_forward: copy with user block: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: user block kept: yes
+  test_forward: relay buffers used: yes
+  test_forward: splice: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: no
+  test_forward: splice with user block: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: user block kept: yes
+  test_forward: relay buffers used: no
+  test_stats: writer: 262144 bytes written, buffered: yes, again: yes
+  test_stats: reader: 262144 bytes read, calls: yes
+  test_stats: loop: 262144 bytes read, 262144 bytes written
+  test_blob_write: queued all, received all, data ok, pending 0
+
+  $ test-ustream-san
+  test_write_buffered: write: received 262144 bytes, data ok, pending 0
+  test_write_buffered: writev: received 262144 bytes, data ok, pending 0
+  test_writev: write: received 262144 bytes, data ok, pending 0
+  test_writev: writev: received 262144 bytes, data ok, pending 0
+  test_write_ext: received 262144 bytes, data ok, done 131, pending 0
+  test_sendfile: queued 262144 bytes
+  test_sendfile: received 262144 bytes, data ok, pending 0
+  test_sendfile_mapped: head buffered: yes
+  test_sendfile_mapped: queued 262144 bytes
+  test_sendfile_mapped: queued past the end: 0 bytes
+  test_sendfile_mapped: received 262144 bytes, data ok, pending 0
+  test_buf_pool: data ok, reused: yes, cached: 8
+  test_read_records: 1 buffers: received 262144 bytes, data ok
+  test_read_records: 4 buffers: received 262144 bytes, data ok
+  test_read_cbuf: raw: buffer 16384, received 262144 bytes, data ok, contiguous yes
+  test_read_cbuf: string: buffer 16384, received 262144 bytes, data ok, contiguous yes
+  test_read_budget: budget 0: received 262144 bytes, data ok
+  test_read_budget: budget 0: other fd waited for all data
+  test_read_budget: budget 16384: received 262144 bytes, data ok
+  test_read_budget: budget 16384: other fd served after 16384 bytes
+  test_forward: copy: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: yes
+  test_forward: copy with one write buffer: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: yes
+  test_forward: copy with user block: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: user block kept: yes
+  test_forward: relay buffers used: yes
+  test_forward: splice: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: relay buffers used: no
+  test_forward: splice with user block: received 262144 bytes, data ok, forwarded 262144, blocked yes
+  test_forward: user block kept: yes
+  test_forward: relay buffers used: no
+  test_stats: writer: 262144 bytes written, buffered: yes, again: yes
+  test_stats: reader: 262144 bytes read, calls: yes
+  test_stats: loop: 262144 bytes read, 262144 bytes written
+  test_blob_write: queued all, received all, data ok, pending 0
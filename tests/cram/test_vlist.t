@@ -0,0 +1,42 @@
+check that vlist bulk updates are producing expected results:
+
+  $ [ -n "$TEST_BIN_DIR" ] && export PATH="$TEST_BIN_DIR:$PATH"
+  $ valgrind --quiet --leak-check=full test-vlist
+  bulk: ret 0, added 100, deleted 0, changed 0, size 100
+  bulk: ret 0, added 25, deleted 50, changed 50, size 75
+  bulk: ret 0, added 0, deleted 0, changed 75, size 75
+  dump: size 75, sorted yes, sum 90
+  dump: size 0, sorted yes, sum 0
+  bulk: ret 0, added 100, deleted 0, changed 0, size 100
+  bulk: ret 0, added 25, deleted 50, changed 9, size 75
+  bulk: ret 0, added 0, deleted 0, changed 0, size 75
+  dump: size 75, sorted yes, sum 90
+  dump: size 0, sorted yes, sum 0
+  dump: size 2, sorted yes, sum 4
+  test_mixed: unsorted: -1
+  dump: size 2, sorted yes, sum 4
+  test_mixed: empty: 0, deleted 2
+  dump: size 0, sorted yes, sum 0
+  bulk: ret 0, added 20, deleted 0, changed 0, size 20
+  bulk: ret 0, added 10, deleted 10, changed 10, size 20
+  dump: size 20, sorted yes, sum 60
+
+  $ test-vlist-san
+  bulk: ret 0, added 100, deleted 0, changed 0, size 100
+  bulk: ret 0, added 25, deleted 50, changed 50, size 75
+  bulk: ret 0, added 0, deleted 0, changed 75, size 75
+  dump: size 75, sorted yes, sum 90
+  dump: size 0, sorted yes, sum 0
+  bulk: ret 0, added 100, deleted 0, changed 0, size 100
+  bulk: ret 0, added 25, deleted 50, changed 9, size 75
+  bulk: ret 0, added 0, deleted 0, changed 0, size 75
+  dump: size 75, sorted yes, sum 90
+  dump: size 0, sorted yes, sum 0
+  dump: size 2, sorted yes, sum 4
+  test_mixed: unsorted: -1
+  dump: size 2, sorted yes, sum 4
+  test_mixed: empty: 0, deleted 2
+  dump: size 0, sorted yes, sum 0
+  bulk: ret 0, added 20, deleted 0, changed 0, size 20
+  bulk: ret 0, added 10, deleted 10, changed 10, size 20
+  dump: size 20, sorted yes, sum 60
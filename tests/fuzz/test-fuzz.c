@@ -5,6 +5,8 @@
 
 #include "blob.h"
 #include "blobmsg.h"
+#include "blobmsg-gen-policy.h"
+#include "blobmsg-gen-policy.parse.h"
 
 #define BLOBMSG_TYPE_TROUBLE INT_MAX
 
@@ -45,13 +47,21 @@ static void fuzz_blobmsg_parse(const uint8_t *data, size_t size)
 		},
 	};
 
+	static struct blobmsg_compiled_policy *foo_compiled;
 	struct blob_attr *tb[__FOO_MAX];
 
+	if (!foo_compiled)
+		foo_compiled = blobmsg_policy_compile(foo_policy, __FOO_MAX);
+
 	blobmsg_parse(foo_policy, __FOO_MAX, tb, (uint8_t *)data, size);
+	blobmsg_parse_compiled(foo_compiled, tb, (uint8_t *)data, size);
+	blobmsg_parse_ext(foo_policy, __FOO_MAX, tb, (uint8_t *)data, size,
+			  BLOBMSG_PARSE_VALIDATE);
 	blobmsg_parse_array(foo_policy, __FOO_MAX, tb, (uint8_t *)data, size);
 
 	blobmsg_check_attr_len((struct blob_attr *)data, false, size);
 	blobmsg_check_attr_len((struct blob_attr *)data, true, size);
+	blobmsg_check_tree_len(data, size);
 
 	for (size_t i=0; i < ARRAY_SIZE(blobmsg_type); i++) {
 		blobmsg_check_array_len((struct blob_attr *)data, blobmsg_type[i], size);
@@ -59,6 +69,22 @@ static void fuzz_blobmsg_parse(const uint8_t *data, size_t size)
 	}
 }
 
+/* the generated parser has to agree with blobmsg_parse on any input */
+static void fuzz_blobmsg_gen_parse(const uint8_t *data, size_t size)
+{
+	static const unsigned int flags[] = { 0, BLOBMSG_PARSE_VALIDATE };
+	struct blob_attr *tb[__GEN_MAX], *tb_gen[__GEN_MAX];
+
+	for (size_t i = 0; i < ARRAY_SIZE(flags); i++) {
+		int ret = blobmsg_parse_ext(gen_policy, __GEN_MAX, tb, (uint8_t *)data,
+					    size, flags[i]);
+		int ret_gen = gen_policy_parse_ext(tb_gen, (uint8_t *)data, size, flags[i]);
+
+		if (ret != ret_gen || memcmp(tb, tb_gen, sizeof(tb)) != 0)
+			abort();
+	}
+}
+
 static void fuzz_blob_parse(const uint8_t *data, size_t size)
 {
 	enum {
@@ -102,6 +128,7 @@ int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size)
 	memcpy(data, input, size);
 	fuzz_blob_parse(data, size);
 	fuzz_blobmsg_parse(data, size);
+	fuzz_blobmsg_gen_parse(data, size);
 	free(data);
 
 	return 0;
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "blobmsg.h"
+#include "kvlist.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static void test_alloc(void)
+{
+	struct arena a;
+	bool aligned = true;
+	char *p, *q, *big;
+
+	arena_init(&a, 256);
+
+	for (int i = 1; i < 100; i++) {
+		p = arena_alloc(&a, i);
+		if ((uintptr_t) p % ARENA_ALIGN)
+			aligned = false;
+		memset(p, i, i);
+	}
+
+	p = arena_strdup(&a, "hello");
+	q = arena_realloc(&a, p, 6, 64);
+	big = arena_alloc(&a, 4096);
+	memset(big, 0, 4096);
+	OUT("aligned: %s, realloc in place: %s, copy: %s\n",
+	    aligned ? "yes" : "no", p == q ? "yes" : "no", q);
+
+	p = arena_realloc(&a, q, 64, 128);
+	OUT("realloc after other alloc moved: %s, copy: %s\n",
+	    p != q ? "yes" : "no", p);
+
+	arena_reset(&a);
+	p = arena_alloc(&a, 16);
+	OUT("reset reuses chunk: %s\n", p == arena_alloc(&a, 0) - 16 ? "yes" : "no");
+	arena_free(&a);
+}
+
+static void test_blob(void)
+{
+	struct blob_arena_buf b = {};
+	struct blob_attr *attr, *cur, *dup;
+	struct arena a;
+	size_t rem;
+	int n = 0;
+
+	arena_init(&a, 0);
+
+	for (int round = 0; round < 2; round++) {
+		blobmsg_arena_buf_init(&b, &a);
+		for (int i = 0; i < 1000; i++)
+			blobmsg_add_u32(&b.buf, "value", i);
+
+		n = 0;
+		blobmsg_for_each_attr(cur, b.buf.head, rem)
+			if (blobmsg_get_u32(cur) == (uint32_t) n)
+				n++;
+
+		attr = b.buf.head;
+		dup = blob_memdup_arena(&a, attr);
+		OUT("round %d: %d values, copy %s\n", round, n,
+		    blob_pad_len(dup) == blob_pad_len(attr) &&
+		    !memcmp(dup, attr, blob_pad_len(attr)) ? "ok" : "differs");
+		arena_reset(&a);
+	}
+
+	arena_free(&a);
+}
+
+static void test_kvlist(void)
+{
+	struct kvlist kv;
+	struct arena a;
+	const char *name;
+	void *val;
+	int n = 0;
+
+	arena_init(&a, 0);
+	kvlist_init(&kv, kvlist_strlen);
+	kv.arena = &a;
+
+	kvlist_set(&kv, "a", "1");
+	kvlist_set(&kv, "b", "2");
+	kvlist_set(&kv, "a", "3");
+	kvlist_delete(&kv, "b");
+
+	kvlist_for_each(&kv, name, val) {
+		OUT("%s=%s\n", name, (char *) val);
+		n++;
+	}
+	OUT("entries: %d\n", n);
+
+	kvlist_free(&kv);
+	arena_free(&a);
+}
+
+int main()
+{
+	test_alloc();
+	test_blob();
+	test_kvlist();
+
+	return 0;
+}
@@ -80,8 +80,178 @@ static void test_basics()
 	}
 }
 
+static void test_prefix()
+{
+	static const char * const vals[] = {
+		"eighty", "eight", "eighteen", "", "e", "eigh", "zero", "z",
+		"\xff\xfe", "eighty-one"
+	};
+	static const int ints[] = { 5, -3, 0, 2147483647, -2147483647 - 1, 42, -1 };
+	struct node nodes[2 * ARRAY_SIZE(vals)];
+	struct {
+		struct avl_node avl;
+		int val;
+	} inodes[ARRAY_SIZE(ints)], *ielem;
+	struct node *elem;
+	struct avl_tree t;
+	size_t i;
+	int found = 0;
+
+	/* duplicates of every key, with the prefix set before and after */
+	avl_init(&t, avl_strcmp, true, NULL);
+	avl_set_prefix(&t, avl_strprefix);
+	for (i = 0; i < ARRAY_SIZE(vals); i++) {
+		nodes[i].avl.key = vals[i];
+		avl_insert(&t, &nodes[i].avl);
+	}
+	avl_set_prefix(&t, NULL);
+	for (i = 0; i < ARRAY_SIZE(vals); i++) {
+		nodes[ARRAY_SIZE(vals) + i].avl.key = vals[i];
+		avl_insert(&t, &nodes[ARRAY_SIZE(vals) + i].avl);
+	}
+	avl_set_prefix(&t, avl_strprefix);
+
+	OUT("for each element: ");
+	avl_for_each_element(&t, elem, avl)
+		fprintf(stdout, "'%s' ", *(char *)elem->avl.key == '\xff' ?
+			"\\xff\\xfe" : (char *)elem->avl.key);
+	fprintf(stdout, "\n");
+
+	for (i = 0; i < ARRAY_SIZE(vals); i++) {
+		if (avl_find_element(&t, vals[i], elem, avl) == &nodes[i] &&
+		    avl_find_element_cmp(&t, vals[i], elem, avl,
+					 avl_strcmp_inline) == &nodes[i])
+			found++;
+	}
+	OUT("found %d of %zu, missing: %s %s\n", found, ARRAY_SIZE(vals),
+	    avl_find(&t, "eighty-") ? "found" : "none",
+	    avl_find_element_cmp(&t, "ei", elem, avl, avl_strcmp_inline) ?
+	    "found" : "none");
+
+	elem = avl_find_le_element(&t, "eighty-", elem, avl);
+	OUT("le 'eighty-': %s\n", (char *)elem->avl.key);
+	elem = avl_find_ge_element(&t, "eighty-", elem, avl);
+	OUT("ge 'eighty-': %s\n", (char *)elem->avl.key);
+
+	avl_init(&t, avl_intcmp, false, NULL);
+	avl_set_prefix(&t, avl_intprefix);
+	for (i = 0; i < ARRAY_SIZE(ints); i++) {
+		inodes[i].val = ints[i];
+		inodes[i].avl.key = &inodes[i].val;
+		avl_insert(&t, &inodes[i].avl);
+	}
+
+	OUT("int elements: ");
+	avl_for_each_element(&t, ielem, avl)
+		fprintf(stdout, "%d ", ielem->val);
+	fprintf(stdout, "\n");
+
+	found = 0;
+	for (i = 0; i < ARRAY_SIZE(ints); i++)
+		if (avl_find_element_cmp(&t, &ints[i], ielem, avl,
+					 avl_intcmp_inline) == &inodes[i])
+			found++;
+	OUT("int found %d of %zu\n", found, ARRAY_SIZE(ints));
+}
+
+static int check_tree(struct avl_node *node, struct avl_node *parent, int *errors)
+{
+	int lh, rh;
+
+	if (!node)
+		return 0;
+
+	if (node->parent != parent || !node->leader)
+		(*errors)++;
+
+	lh = check_tree(node->left, node, errors);
+	rh = check_tree(node->right, node, errors);
+	if (node->balance != rh - lh || rh - lh > 1 || lh - rh > 1)
+		(*errors)++;
+
+	return (lh > rh ? lh : rh) + 1;
+}
+
+static void test_build()
+{
+	static const int sizes[] = { 0, 1, 2, 3, 7, 100, 1000 };
+	struct {
+		struct avl_node avl;
+		int val;
+	} inodes[1000], *ielem;
+	struct avl_node *nodes[1000];
+	struct avl_tree t;
+	int errors = 0, height = 0, found = 0, ret;
+	unsigned int count;
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		avl_init(&t, avl_intcmp, false, NULL);
+		avl_set_prefix(&t, avl_intprefix);
+		for (j = 0; j < (size_t)sizes[i]; j++) {
+			inodes[j].val = j * 2;
+			inodes[j].avl.key = &inodes[j].val;
+			nodes[j] = &inodes[j].avl;
+		}
+
+		ret = avl_build_from_sorted(&t, nodes, sizes[i]);
+		count = t.count;
+		height = check_tree(t.root, NULL, &errors);
+
+		j = 0;
+		avl_for_each_element(&t, ielem, avl)
+			if (ielem != &inodes[j++])
+				errors++;
+
+		found = 0;
+		for (j = 0; j < (size_t)sizes[i]; j++)
+			if (avl_find_element_cmp(&t, &inodes[j].val, ielem, avl,
+						 avl_intcmp_inline) == &inodes[j])
+				found++;
+
+		/* the tree has to stay usable for regular updates */
+		for (j = 0; j < (size_t)sizes[i]; j += 3)
+			avl_delete(&t, &inodes[j].avl);
+		check_tree(t.root, NULL, &errors);
+
+		OUT("%d nodes: ret %d, count %u, height %d, found %d\n",
+		    sizes[i], ret, count, height, found);
+	}
+
+	OUT("not empty: %d\n", avl_build_from_sorted(&t, nodes, 2));
+	avl_clear(&t);
+	OUT("cleared: count %u, empty %s\n", t.count,
+	    list_empty(&t.list_head) && !t.root ? "yes" : "no");
+
+	/* unsorted and duplicate keys */
+	inodes[1].val = inodes[0].val;
+	OUT("duplicates: %d\n", avl_build_from_sorted(&t, nodes, 3));
+	inodes[1].val = -1;
+	OUT("unsorted: %d, empty %s\n", avl_build_from_sorted(&t, nodes, 3),
+	    avl_is_empty(&t) ? "yes" : "no");
+
+	avl_init(&t, avl_intcmp, true, NULL);
+	for (j = 0; j < 100; j++) {
+		inodes[j].val = j / 4;
+		nodes[j] = &inodes[j].avl;
+	}
+	ret = avl_build_from_sorted(&t, nodes, 100);
+	check_tree(t.root, NULL, &errors);
+	j = 0;
+	avl_for_each_element(&t, ielem, avl)
+		if (ielem != &inodes[j] || ielem->avl.leader != !(j++ % 4))
+			errors++;
+	OUT("dups: ret %d, count %u, first of 7 %s\n", ret, t.count,
+	    avl_find_element(&t, &inodes[28].val, ielem, avl) == &inodes[28] ?
+	    "ok" : "wrong");
+
+	OUT("errors %d\n", errors);
+}
+
 int main()
 {
 	test_basics();
+	test_prefix();
+	test_build();
 	return 0;
 }
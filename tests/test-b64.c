@@ -22,6 +22,43 @@ static void test_b64_decode(const char *src)
 	free(dst);
 }
 
+static void test_b64_long(void)
+{
+	size_t len = 1000, enc_len = B64_ENCODE_LEN(len);
+	unsigned char *src = malloc(len), *dst = malloc(len + 1);
+	char *enc = malloc(enc_len), *wrapped = malloc(enc_len * 2);
+	int r, d, w = 0;
+
+	for (size_t i = 0; i < len; i++)
+		src[i] = i * 7 + i / 251;
+
+	r = b64_encode(src, len, enc, enc_len);
+	d = b64_decode(enc, dst, len + 1);
+	fprintf(stdout, "%d %d %s\n", r, d,
+		d == (int)len && !memcmp(src, dst, len) ? "same" : "different");
+
+	/* PEM style line breaks */
+	for (int i = 0; i < r; i++) {
+		wrapped[w++] = enc[i];
+		if (i % 64 == 63)
+			wrapped[w++] = '\n';
+	}
+	wrapped[w] = 0;
+	memset(dst, 0, len);
+	d = b64_decode(wrapped, dst, len + 1);
+	fprintf(stdout, "%d %s\n", d,
+		d == (int)len && !memcmp(src, dst, len) ? "same" : "different");
+
+	/* a bad character in the middle of a long run */
+	enc[700] = '*';
+	fprintf(stdout, "%d\n", b64_decode(enc, dst, len + 1));
+
+	free(src);
+	free(dst);
+	free(enc);
+	free(wrapped);
+}
+
 int main()
 {
 	test_b64_encode("");
@@ -40,5 +77,7 @@ int main()
 	test_b64_decode("Zm9vYmE=");
 	test_b64_decode("Zm9vYmFy");
 
+	test_b64_long();
+
 	return 0;
 }
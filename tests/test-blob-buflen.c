@@ -12,7 +12,7 @@ int main(int argc, char **argv)
 	int i;
 	static struct blob_buf buf;
 	blobmsg_buf_init(&buf);
-	int prev_len = buf.buflen;
+	void *buf_ptr;
 
 	for (i = 0; i < BUFF_CHUNKS; i++) {
 		struct blob_attr *attr = blob_new(&buf, 0, BUFF_SIZE);
@@ -20,12 +20,36 @@ int main(int argc, char **argv)
 			fprintf(stderr, "SUCCESS: failed to allocate attribute\n");
 			break;
 		}
-		if (prev_len < buf.buflen) {
-			prev_len = buf.buflen;
-			continue;
+		if ((char *)blob_next(attr) > (char *)buf.buf + buf.buflen) {
+			fprintf(stderr, "ERROR: buffer too small for attribute\n");
+			return -1;
 		}
-		fprintf(stderr, "ERROR: buffer length did not increase\n");
-		return -1;
 	}
+	blob_buf_free(&buf);
+
+	/* a reserved buffer must not be reallocated while filling it */
+	blob_buf_reserve(&buf, 16 * BUFF_SIZE + 256);
+	blobmsg_buf_init(&buf);
+	buf_ptr = buf.buf;
+	for (i = 0; i < 16; i++)
+		blob_new(&buf, 0, BUFF_SIZE - sizeof(struct blob_attr));
+
+	fprintf(stderr, "%s: reserved buffer %s\n",
+		buf.buf == buf_ptr ? "SUCCESS" : "ERROR",
+		buf.buf == buf_ptr ? "was not reallocated" : "was reallocated");
+
+	/* reset keeps the allocation unless it exceeds the trim size */
+	blobmsg_buf_reset(&buf, 0);
+	for (i = 0; i < 16; i++)
+		blob_new(&buf, 0, BUFF_SIZE - sizeof(struct blob_attr));
+	fprintf(stderr, "%s: reset buffer %s\n",
+		buf.buf == buf_ptr ? "SUCCESS" : "ERROR",
+		buf.buf == buf_ptr ? "was reused" : "was reallocated");
+
+	blobmsg_buf_reset(&buf, BUFF_SIZE);
+	fprintf(stderr, "%s: reset buffer was trimmed\n",
+		buf.buflen == BUFF_SIZE ? "SUCCESS" : "ERROR");
+	blob_buf_free(&buf);
+
 	return 0;
 }
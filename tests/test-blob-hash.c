@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobmsg.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static void fill_config(struct blob_buf *b, int n, int changed)
+{
+	void *tbl, *arr;
+
+	blobmsg_buf_init(b);
+	blobmsg_add_string(b, "name", "wan");
+	for (int i = 0; i < n; i++) {
+		/* room for any int */
+		char key[sizeof("iface") + 11];
+
+		snprintf(key, sizeof(key), "iface%d", i);
+		tbl = blobmsg_open_table(b, key);
+		blobmsg_add_u32(b, "mtu", i == changed ? 1400 : 1500);
+		blobmsg_add_u8(b, "up", 1);
+		arr = blobmsg_open_array(b, "dns");
+		blobmsg_add_string(b, NULL, "192.168.1.1");
+		blobmsg_add_string(b, NULL, "8.8.8.8");
+		blobmsg_close_array(b, arr);
+		blobmsg_close_table(b, tbl);
+	}
+}
+
+static void test_hash(void)
+{
+	struct blob_buf b1 = {}, b2 = {};
+
+	/* sizes below and above the 32 byte block size */
+	for (int n = 0; n < 4; n++) {
+		fill_config(&b1, n, -1);
+		fill_config(&b2, n, -1);
+		OUT("n %d: equal %d, same hash %d\n", n,
+		    blob_attr_equal(b1.head, b2.head),
+		    blob_hash(b1.head) == blob_hash(b2.head));
+
+		fill_config(&b2, n, n - 1);
+		OUT("n %d: changed equal %d, same hash %d\n", n,
+		    blob_attr_equal(b1.head, b2.head),
+		    blob_hash(b1.head) == blob_hash(b2.head));
+	}
+
+	blob_buf_free(&b1);
+	blob_buf_free(&b2);
+}
+
+static void test_hashed_equal(void)
+{
+	struct blob_buf b = {};
+	struct blob_attr *orig, *same, *changed, *other;
+
+	fill_config(&b, 8, -1);
+	orig = blob_memdup_hash(b.head);
+	same = blob_memdup_hash(b.head);
+	fill_config(&b, 8, 5);
+	changed = blob_memdup_hash(b.head);
+	fill_config(&b, 7, -1);
+	other = blob_memdup_hash(b.head);
+
+	OUT("cached hash matches %d\n", blob_cached_hash(orig) == blob_hash(orig));
+	OUT("same %d, changed %d, shorter %d, null %d/%d\n",
+	    blob_hashed_equal(orig, same), blob_hashed_equal(orig, changed),
+	    blob_hashed_equal(orig, other), blob_hashed_equal(orig, NULL),
+	    blob_hashed_equal(NULL, NULL));
+	OUT("copy equal to source %d\n", blob_attr_equal(orig, same));
+
+	free(orig);
+	free(same);
+	free(changed);
+	free(other);
+	blob_buf_free(&b);
+}
+
+static void test_vectors(void)
+{
+	/* reference XXH64 results, seed 0 */
+	static const struct {
+		const char *str;
+		uint64_t hash;
+	} strs[] = {
+		{ "", 0xef46db3751d8e999ULL },
+		{ "a", 0xd24ec4f1a98c6e5bULL },
+		{ "abc", 0x44bc2cf5ad770999ULL },
+		{ "Nobody inspects the spammish repetition", 0xfbcea83c8a378bf1ULL },
+	};
+	/* xxHash sanity test buffer */
+	static const struct {
+		size_t len;
+		uint64_t hash;
+	} sanity[] = {
+		{ 1, 0xe934a84adb052768ULL },
+		{ 14, 0x8282dcc4994e35c8ULL },
+		{ 222, 0xb641ae8cb691c174ULL },
+	};
+	uint64_t gen = 2654435761ULL;
+	uint8_t buf[222];
+	struct blob_buf b = {};
+
+	for (size_t i = 0; i < ARRAY_SIZE(strs); i++)
+		OUT("'%s': %s\n", strs[i].str,
+		    blob_hash_data(strs[i].str, strlen(strs[i].str)) == strs[i].hash ?
+		    "ok" : "wrong");
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = gen >> 56;
+		gen *= 11400714785074694797ULL;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(sanity); i++)
+		OUT("sanity %zu: %s\n", sanity[i].len,
+		    blob_hash_data(buf, sanity[i].len) == sanity[i].hash ?
+		    "ok" : "wrong");
+
+	/* blob data is big endian, so this is the same on every host */
+	fill_config(&b, 2, -1);
+	OUT("message: %016llx\n", (unsigned long long) blob_hash(b.head));
+	blob_buf_free(&b);
+}
+
+int main()
+{
+	test_vectors();
+	test_hash();
+	test_hashed_equal();
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobmsg.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+enum {
+	IFACE_NAME,
+	IFACE_PROTO,
+	IFACE_MTU,
+	IFACE_ADDR,
+	__IFACE_MAX
+};
+
+static const struct blobmsg_policy iface_policy[__IFACE_MAX] = {
+	[IFACE_NAME] = { "ifname", BLOBMSG_TYPE_STRING },
+	[IFACE_PROTO] = { "proto", BLOBMSG_TYPE_STRING },
+	[IFACE_MTU] = { "mtu", BLOBMSG_TYPE_INT32 },
+	[IFACE_ADDR] = { "ipv4-address", BLOBMSG_TYPE_ARRAY },
+};
+
+static const struct blobmsg_policy list_policy = {
+	"interface", BLOBMSG_TYPE_ARRAY
+};
+
+static void fill(struct blob_buf *b, int n, bool compact)
+{
+	void *arr, *tbl, *addr;
+	char name[16];
+
+	blobmsg_buf_init(b);
+	if (compact)
+		arr = blobmsg_open_compact(b, "interface", true);
+	else
+		arr = blobmsg_open_array(b, "interface");
+	for (int i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "eth%d", i);
+		tbl = blobmsg_open_table(b, NULL);
+		blobmsg_add_string(b, "ifname", name);
+		blobmsg_add_string(b, "proto", i % 2 ? "dhcp" : "static");
+		blobmsg_add_u32(b, "mtu", 1500 - i);
+		addr = blobmsg_open_array(b, "ipv4-address");
+		blobmsg_add_string(b, NULL, "192.168.1.1");
+		blobmsg_close_array(b, addr);
+		blobmsg_close_table(b, tbl);
+	}
+	if (compact)
+		blobmsg_close_compact(b, arr);
+	else
+		blobmsg_close_array(b, arr);
+	blobmsg_add_string(b, "ifname", "lo");
+}
+
+static int count_refs(const void *data, size_t len)
+{
+	const struct blob_attr *cur;
+	int n = 0;
+
+	__blob_for_each_attr(cur, data, len) {
+		n += blobmsg_hdr_is_ref(blob_data(cur));
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_TABLE ||
+		    blobmsg_type(cur) == BLOBMSG_TYPE_ARRAY)
+			n += count_refs(blobmsg_data(cur), blobmsg_data_len(cur));
+	}
+
+	return n;
+}
+
+static void print_iface(const char *prefix, struct blob_attr *attr)
+{
+	struct blob_attr *tb[__IFACE_MAX];
+	int ret;
+
+	ret = blobmsg_parse_attr(iface_policy, __IFACE_MAX, tb, attr);
+	printf("test_copy: %s: refs %d, valid %d, ret %d, %s %s %u\n", prefix,
+	    count_refs(blobmsg_data(attr), blobmsg_data_len(attr)),
+	    blobmsg_check_attr(attr, false), ret,
+	    tb[IFACE_NAME] ? blobmsg_get_string(tb[IFACE_NAME]) : "-",
+	    tb[IFACE_PROTO] ? blobmsg_get_string(tb[IFACE_PROTO]) : "-",
+	    tb[IFACE_MTU] ? blobmsg_get_u32(tb[IFACE_MTU]) : 0);
+}
+
+static int summary(struct blob_buf *b, char *str, size_t len)
+{
+	struct blob_attr *tb[__IFACE_MAX], *list, *cur;
+	unsigned int mtu = 0;
+	int n = 0, ret;
+	size_t rem;
+
+	/* checks the compact container as a whole */
+	ret = blobmsg_parse(&list_policy, 1, &list, blob_data(b->head),
+			    blob_len(b->head));
+	if (ret || !list)
+		return -1;
+
+	blobmsg_for_each_attr(cur, list, rem) {
+		blobmsg_parse_ext(iface_policy, __IFACE_MAX, tb, blobmsg_data(cur),
+				  blobmsg_len(cur), BLOBMSG_PARSE_TRUSTED);
+		if (!tb[IFACE_NAME] || !tb[IFACE_PROTO] || !tb[IFACE_MTU] ||
+		    !tb[IFACE_ADDR])
+			return -1;
+
+		mtu += blobmsg_get_u32(tb[IFACE_MTU]);
+		n++;
+	}
+
+	snprintf(str, len, "%d interfaces, mtu sum %u, last %s", n, mtu,
+		 blobmsg_get_string(tb[IFACE_NAME]));
+	return 0;
+}
+
+static void test_compact(void)
+{
+	struct blob_buf plain = {}, compact = {};
+	char s1[64] = "", s2[64] = "";
+
+	fill(&plain, 100, false);
+	fill(&compact, 100, true);
+
+	OUT("size %zu -> %zu, valid %d\n", blob_pad_len(plain.head), blob_pad_len(compact.head),
+	    blobmsg_check_tree_len(blob_data(compact.head), blob_len(compact.head)));
+	OUT("plain: %d, %s\n", summary(&plain, s1, sizeof(s1)), s1);
+	OUT("compact: %d, %s\n", summary(&compact, s2, sizeof(s2)), s2);
+
+	/* a new message must not refer to the previous one */
+	fill(&compact, 1, true);
+	OUT("reused: valid %d, %d, %s\n",
+	    blobmsg_check_tree_len(blob_data(compact.head), blob_len(compact.head)),
+	    summary(&compact, s2, sizeof(s2)), s2);
+
+	blob_buf_free(&plain);
+	blob_buf_free(&compact);
+}
+
+static void test_refs(void)
+{
+	struct blob_buf b = {};
+	struct blob_attr *arr, *tbl, *cur;
+	struct blobmsg_hdr *hdr;
+	void *cookie, *arr_cookie;
+	size_t rem;
+
+	fill(&b, 2, true);
+	arr = blob_data(b.head);
+	tbl = blob_next(blobmsg_data(arr));
+
+	/* the second table only holds references */
+	blobmsg_for_each_attr(cur, tbl, rem) {
+		hdr = blob_data(cur);
+		OUT("%s: ref %d\n", blobmsg_name(cur), blobmsg_hdr_is_ref(hdr));
+	}
+	cur = blob_next(arr);
+	OUT("after: %s: ref %d\n", blobmsg_name(cur), blobmsg_hdr_is_ref(blob_data(cur)));
+
+	/* without the container, references can not be checked */
+	OUT("check attr %d, check array %d\n",
+	    blobmsg_check_attr_len(tbl, false, blob_pad_len(tbl)),
+	    blobmsg_check_array(tbl, BLOBMSG_TYPE_UNSPEC));
+	OUT("container: check attr %d, check array %d\n",
+	    blobmsg_check_attr(arr, false),
+	    blobmsg_check_array(arr, BLOBMSG_TYPE_TABLE));
+
+	hdr = blob_data(blobmsg_data(tbl));
+	hdr->name[0] += 2;
+	OUT("bad ref valid %d\n",
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)));
+	hdr->name[0] -= 2;
+
+	blobmsg_clear_name(blobmsg_data(tbl));
+	OUT("cleared: name '%s', valid %d\n", blobmsg_name(blobmsg_data(tbl)),
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)));
+
+	blobmsg_buf_init(&b);
+	arr_cookie = blobmsg_open_compact(&b, "compact", false);
+	cookie = blobmsg_open_table(&b, "sorted");
+	blobmsg_add_u8(&b, "b", 1);
+	OUT("sort: %d\n", blobmsg_close_table_sorted(&b, cookie));
+	OUT("nested: %s\n", blobmsg_open_compact(&b, "inner", false) ? "opened" : "refused");
+	blobmsg_close_compact(&b, arr_cookie);
+
+	/* containers inside of it are marked as well */
+	arr = blob_data(b.head);
+	OUT("inner: compact %d, valid %d\n", blobmsg_is_compact(blobmsg_data(arr)),
+	    blobmsg_check_attr(arr, false));
+
+	blob_buf_free(&b);
+}
+
+static void test_copy(void)
+{
+	struct blob_buf b = {}, copy = {};
+	struct blob_attr *arr, *tbl, *dup;
+	void *cookie;
+
+	fill(&b, 2, true);
+	arr = blob_data(b.head);
+	tbl = blob_next(blobmsg_data(arr));
+	print_iface("member", tbl);
+
+	blobmsg_buf_init(&copy);
+	blobmsg_add_blob(&copy, tbl);
+	print_iface("add_blob", blob_data(copy.head));
+
+	dup = blobmsg_expand(&copy, tbl);
+	print_iface("expand", dup);
+
+	dup = blobmsg_expand(&copy, blobmsg_data(tbl));
+	OUT("expand member: %s, ref %d\n", blobmsg_name(dup),
+	    blobmsg_hdr_is_ref(blob_data(dup)));
+
+	/* plain copies keep the references, which are rejected then */
+	blobmsg_buf_init(&copy);
+	blobmsg_add_field(&copy, BLOBMSG_TYPE_TABLE, "eth1",
+			  blobmsg_data(tbl), blobmsg_data_len(tbl));
+	print_iface("add_field", blob_data(copy.head));
+
+	dup = blob_memdup(tbl);
+	print_iface("memdup", dup);
+	free(dup);
+
+	/* whole containers are rebuilt the same way */
+	blobmsg_buf_init(&copy);
+	blobmsg_add_string(&copy, "first", "entry");
+	blobmsg_add_blob(&copy, arr);
+	dup = blob_next(blob_data(copy.head));
+	OUT("container: compact %d, refs %d, valid %d, same %d\n",
+	    blobmsg_is_compact(dup), count_refs(blobmsg_data(dup), blobmsg_data_len(dup)),
+	    blobmsg_check_tree_len(blob_data(copy.head), blob_len(copy.head)),
+	    !memcmp(blobmsg_data(dup), blobmsg_data(arr), blobmsg_data_len(arr)));
+
+	/* copies into another compact container refer to its names */
+	blobmsg_buf_init(&copy);
+	cookie = blobmsg_open_compact(&copy, "copy", false);
+	blobmsg_add_u32(&copy, "mtu", 1);
+	blobmsg_add_blob(&copy, arr);
+	blobmsg_close_compact(&copy, cookie);
+	dup = blob_data(copy.head);
+	OUT("into compact: refs %d, valid %d\n",
+	    count_refs(blobmsg_data(dup), blobmsg_data_len(dup)),
+	    blobmsg_check_attr(dup, false));
+
+	blob_buf_free(&copy);
+	blob_buf_free(&b);
+}
+
+/* deeper than blobmsg_check_attr and blobmsg_add_blob allow */
+#define DEPTH		66
+
+static void test_bad_copy(void)
+{
+	struct blob_buf b = {}, copy = {};
+	struct blob_attr *tbl, *inner;
+	struct blobmsg_hdr *hdr;
+	void *cookie[DEPTH];
+	int i, ret;
+
+	/* an inner table with a name longer than the attribute */
+	blobmsg_buf_init(&b);
+	cookie[0] = blobmsg_open_table(&b, "t");
+	cookie[1] = blobmsg_open_table(&b, "inner");
+	blobmsg_close_table(&b, cookie[1]);
+	blobmsg_close_table(&b, cookie[0]);
+	tbl = blob_data(b.head);
+	inner = blobmsg_data(tbl);
+	blob_set_raw_len(inner, 8);
+	hdr = blob_data(inner);
+	hdr->namelen = cpu_to_be16(0x1000);
+
+	blobmsg_buf_init(&copy);
+	OUT("long name: valid %d, copy %d\n", blobmsg_check_attr(tbl, false),
+	    blobmsg_add_blob(&copy, tbl));
+
+	hdr = blob_data(tbl);
+	hdr->namelen |= cpu_to_be16(BLOBMSG_NAMELEN_COMPACT);
+	blobmsg_buf_init(&copy);
+	OUT("long name compact: valid %d, copy %d\n", blobmsg_check_attr(tbl, false),
+	    blobmsg_add_blob(&copy, tbl));
+
+	blobmsg_buf_init(&b);
+	cookie[0] = blobmsg_open_compact(&b, "deep", false);
+	for (i = 1; i < DEPTH; i++)
+		cookie[i] = blobmsg_open_table(&b, "t");
+	for (i--; i > 0; i--)
+		blobmsg_close_table(&b, cookie[i]);
+	blobmsg_close_compact(&b, cookie[0]);
+	tbl = blob_data(b.head);
+
+	blobmsg_buf_init(&copy);
+	ret = blobmsg_add_blob(&copy, tbl);
+	OUT("deep: valid %d, copy %d\n", blobmsg_check_attr(tbl, false), ret);
+
+	blob_buf_free(&copy);
+	blob_buf_free(&b);
+}
+
+int main()
+{
+	test_compact();
+	test_refs();
+	test_copy();
+	test_bad_copy();
+
+	return 0;
+}
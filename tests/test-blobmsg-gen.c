@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobmsg.h"
+#include "blobmsg-gen-policy.h"
+#include "blobmsg-gen-policy.parse.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static bool compare(struct blob_buf *b, unsigned int flags, char *str, size_t len)
+{
+	struct blob_attr *tb[__GEN_MAX], *tb_gen[__GEN_MAX];
+	int ret, ret_gen, n = 0;
+
+	ret = blobmsg_parse_ext(gen_policy, __GEN_MAX, tb, blob_data(b->head),
+				blob_len(b->head), flags);
+	ret_gen = gen_policy_parse_ext(tb_gen, blob_data(b->head), blob_len(b->head),
+				       flags);
+
+	if (str) {
+		n += snprintf(str + n, len - n, "ret %d, set", ret_gen);
+		for (int i = 0; i < __GEN_MAX; i++)
+			if (tb_gen[i])
+				n += snprintf(str + n, len - n, " %d", i);
+	}
+
+	return ret == ret_gen && !memcmp(tb, tb_gen, sizeof(tb));
+}
+
+static void fill(struct blob_buf *b, bool compact)
+{
+	void *c;
+
+	blobmsg_buf_init(b);
+	blobmsg_add_string(b, "message", "hello");
+	c = blobmsg_open_array(b, "list");
+	blobmsg_close_array(b, c);
+	if (compact) {
+		c = blobmsg_open_compact(b, "testdata", false);
+		blobmsg_add_u32(b, "mtu", 1500);
+		/* written as a reference to the first one */
+		blobmsg_add_u32(b, "mtu", 1280);
+		blobmsg_close_compact(b, c);
+	} else {
+		c = blobmsg_open_table(b, "testdata");
+		blobmsg_add_u32(b, "mtu", 1500);
+		blobmsg_close_table(b, c);
+	}
+	/* wrong type */
+	blobmsg_add_u32(b, "mac", 1);
+	blobmsg_add_string(b, "mac", "00:11:22:33:44:55");
+	blobmsg_add_u8(b, "mask", 24);
+	blobmsg_add_u64(b, "any", 1);
+	blobmsg_add_u16(b, "count", 3);
+	blobmsg_add_string(b, "count", "three");
+	blobmsg_add_u32(b, "", 7);
+	blobmsg_add_double(b, "a\x7f" "b\\c\"d", 1.5);
+	blobmsg_add_u32(b, "mt", 1);
+	blobmsg_add_u32(b, "mtux", 1);
+	blob_put_string(b, 0, "raw");
+}
+
+static void test_messages(void)
+{
+	struct blob_buf b = {};
+	char str[128];
+
+	fill(&b, false);
+	OUT("plain: equal %d, %s\n", compare(&b, 0, str, sizeof(str)), str);
+	OUT("validate: equal %d, %s\n",
+	    compare(&b, BLOBMSG_PARSE_VALIDATE, str, sizeof(str)), str);
+
+	fill(&b, true);
+	OUT("compact: equal %d, %s\n", compare(&b, 0, str, sizeof(str)), str);
+	OUT("compact validate: equal %d, %s\n",
+	    compare(&b, BLOBMSG_PARSE_VALIDATE, str, sizeof(str)), str);
+
+	blob_buf_free(&b);
+}
+
+static void test_mutations(bool compact)
+{
+	struct blob_buf b = {};
+	unsigned int seed = 1, mismatch = 0;
+	size_t len;
+	char *orig;
+
+	fill(&b, compact);
+	len = blob_pad_len(b.head);
+	orig = malloc(len);
+	memcpy(orig, b.head, len);
+
+	for (int i = 0; i < 20000; i++) {
+		unsigned char *data = (unsigned char *) b.head;
+
+		memcpy(data, orig, len);
+		for (int j = 0; j < 1 + i % 3; j++) {
+			seed = seed * 1103515245 + 12345;
+			data[sizeof(struct blob_attr) + (seed >> 8) % (len - 4)] = seed >> 24;
+		}
+
+		if (!compare(&b, i & 1 ? BLOBMSG_PARSE_VALIDATE : 0, NULL, 0))
+			mismatch++;
+	}
+	OUT("%smismatches %u\n", compact ? "compact: " : "", mismatch);
+
+	free(orig);
+	blob_buf_free(&b);
+}
+
+int main()
+{
+	test_messages();
+	test_mutations(false);
+	test_mutations(true);
+
+	return 0;
+}
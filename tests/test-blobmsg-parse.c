@@ -44,6 +44,7 @@ static void test_blobmsg(const char *filename)
 	FILE *fd = NULL;
 	char *buf = NULL;
 	struct blob_attr *tb[__FOO_MAX];
+	struct blobmsg_compiled_policy *cp;
 
 	fd = fopen(filename, "r");
 	if (!fd) {
@@ -61,6 +62,24 @@ static void test_blobmsg(const char *filename)
 	r = blobmsg_parse(foo_policy, ARRAY_SIZE(foo_policy), tb, buf, len);
 	dump_result("blobmsg_parse", r, filename, tb);
 
+	r = blobmsg_parse_ext(foo_policy, ARRAY_SIZE(foo_policy), tb, buf, len,
+			      BLOBMSG_PARSE_VALIDATE);
+	dump_result("blobmsg_parse_ext", r, filename, tb);
+	if (!r && tb[FOO_TESTDATA]) {
+		struct blob_attr *tb_nested[__FOO_MAX];
+
+		r = blobmsg_parse_ext(foo_policy, ARRAY_SIZE(foo_policy), tb_nested,
+				      blobmsg_data(tb[FOO_TESTDATA]),
+				      blobmsg_data_len(tb[FOO_TESTDATA]),
+				      BLOBMSG_PARSE_TRUSTED);
+		dump_result("blobmsg_parse_ext nested", r, filename, tb_nested);
+	}
+
+	cp = blobmsg_policy_compile(foo_policy, ARRAY_SIZE(foo_policy));
+	r = blobmsg_parse_compiled(cp, tb, buf, len);
+	dump_result("blobmsg_parse_compiled", r, filename, tb);
+	blobmsg_compiled_policy_free(cp);
+
 	r = blobmsg_parse_array(foo_policy, ARRAY_SIZE(foo_policy), tb, buf, len);
 	dump_result("blobmsg_parse_array", r, filename, tb);
 
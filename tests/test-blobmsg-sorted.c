@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "blobmsg.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define N_KEYS	200
+
+static void fill(struct blob_buf *b, bool sorted)
+{
+	void *tbl, *sub;
+	char key[16];
+
+	blobmsg_buf_init(b);
+	tbl = blobmsg_open_table(b, "state");
+	for (int i = 0; i < N_KEYS; i++) {
+		/* visit all keys in a scrambled order */
+		int k = (i * 77) % N_KEYS;
+
+		snprintf(key, sizeof(key), "key%03d", k);
+		blobmsg_add_u32(b, key, k);
+	}
+	blobmsg_add_string(b, "dup", "first");
+	blobmsg_add_string(b, "dup", "second");
+
+	sub = blobmsg_open_table(b, "sub");
+	blobmsg_add_string(b, "zone", "lan");
+	blobmsg_add_u8(b, "enabled", 1);
+	if (sorted)
+		blobmsg_close_table_sorted(b, sub);
+	else
+		blobmsg_close_table(b, sub);
+
+	if (sorted)
+		blobmsg_close_table_sorted(b, tbl);
+	else
+		blobmsg_close_table(b, tbl);
+	blobmsg_add_string(b, "after", "ok");
+}
+
+static void test_find(bool sorted)
+{
+	static const char * const path[] = { "state", "sub", "zone" };
+	struct blob_buf b = {};
+	struct blob_attr *tbl, *cur, *prev = NULL;
+	bool ordered = true;
+	int found = 0;
+	char key[16];
+	size_t rem;
+
+	fill(&b, sorted);
+	tbl = blobmsg_find(b.head, "state");
+	OUT("%s: valid %d, sorted %d, name %s\n", sorted ? "sorted" : "plain",
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)),
+	    blobmsg_is_sorted(tbl), blobmsg_name(tbl));
+
+	for (int i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%03d", i);
+		cur = blobmsg_find(tbl, key);
+		if (cur && blobmsg_get_u32(cur) == (uint32_t) i)
+			found++;
+	}
+
+	blobmsg_for_each_attr(cur, tbl, rem) {
+		if (prev && strcmp(blobmsg_name(prev), blobmsg_name(cur)) > 0)
+			ordered = false;
+		prev = cur;
+	}
+
+	OUT("found %d, ordered %d, missing %d/%d, dup %s\n", found, ordered,
+	    !!blobmsg_find(tbl, "key200"), !!blobmsg_find(tbl, "a"),
+	    blobmsg_get_string(blobmsg_find(tbl, "dup")));
+	OUT("path %s, short path %s, bad path %d, after %s\n",
+	    blobmsg_get_string(blobmsg_lookup_path(b.head, path, 3)),
+	    blobmsg_name(blobmsg_lookup_path(b.head, path, 2)),
+	    !!blobmsg_lookup_path(b.head, (const char * const[]) { "state", "key001", "x" }, 3),
+	    blobmsg_get_string(blobmsg_find(b.head, "after")));
+
+	blob_buf_free(&b);
+}
+
+static void test_check(void)
+{
+	struct blob_buf b = {};
+	struct blob_attr *tbl;
+	uint32_t *idx;
+
+	fill(&b, true);
+	tbl = blobmsg_find(b.head, "state");
+	idx = (uint32_t *) ((char *) blobmsg_data(tbl) - (N_KEYS + 4) * sizeof(uint32_t));
+	OUT("members %u, index valid %d\n", be32_to_cpu(idx[0]),
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)));
+
+	/* an index that does not match the members must be rejected */
+	idx[2] = cpu_to_be32(be32_to_cpu(idx[2]) + 4);
+	OUT("bad offset valid %d\n",
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)));
+	idx[2] = cpu_to_be32(be32_to_cpu(idx[2]) - 4);
+
+	idx[0] = cpu_to_be32(0x40000000);
+	OUT("bad count valid %d\n",
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)));
+
+	blob_buf_free(&b);
+
+	/* only named tables can be sorted */
+	blobmsg_buf_init(&b);
+	tbl = blobmsg_open_array(&b, "list");
+	blobmsg_add_string(&b, NULL, "b");
+	blobmsg_add_string(&b, NULL, "a");
+	OUT("array: %d\n", blobmsg_close_table_sorted(&b, tbl));
+	OUT("array valid %d, sorted %d\n",
+	    blobmsg_check_tree_len(blob_data(b.head), blob_len(b.head)),
+	    blobmsg_is_sorted(blob_data(b.head)));
+	blob_buf_free(&b);
+}
+
+int main()
+{
+	test_find(false);
+	test_find(true);
+	test_check();
+
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <glob.h>
 #include <float.h>
 #include <limits.h>
 #include <stdint.h>
@@ -150,6 +151,155 @@ fill_message(struct blob_buf *buf)
 	blobmsg_close_table(buf, tbl);
 }
 
+static void
+dump_json_buf(struct blob_buf *buf, const char *json)
+{
+	static struct blob_buf esc;
+	char out[32], big[128];
+	char *full;
+	int len;
+
+	full = malloc(strlen(json) + 1);
+	len = blobmsg_format_json_buf(full, strlen(json) + 1, buf->head, true, -1);
+	fprintf(stderr, "\n[*] blobmsg to json buffer: %s\n",
+		len == (int) strlen(json) && !strcmp(full, json) ? "same" : "differs");
+	free(full);
+
+	len = blobmsg_format_json_buf(out, sizeof(out), buf->head, true, -1);
+	fprintf(stderr, "[*] truncated: %d of %d bytes: %s\n", (int) strlen(out), len, out);
+
+	blobmsg_buf_init(&esc);
+	blobmsg_add_string(&esc, "esc", "a\"b\\c\n\t\x01\x1f/");
+	blobmsg_add_double(&esc, "dbl", -42);
+	blobmsg_add_double(&esc, "frac", 0.5);
+	blobmsg_format_json_buf(big, sizeof(big), esc.head, true, -1);
+	fprintf(stderr, "[*] escaped: %s\n", big);
+	blob_buf_free(&esc);
+}
+
+static void
+dump_json_doubles(void)
+{
+	static const double vals[] = {
+		0.0, -0.0, 1.0, -1.0, 699.0, 1e14, -1e14, 1e15 - 1, 1e15, 0.25,
+	};
+	static struct blob_buf b;
+	char out[64], ref[64];
+	int same = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(vals); i++) {
+		blobmsg_buf_init(&b);
+		blobmsg_add_double(&b, "v", vals[i]);
+		blobmsg_format_json_buf(out, sizeof(out), b.head, true, -1);
+		snprintf(ref, sizeof(ref), "{\"v\":%lf}", vals[i]);
+		if (!strcmp(out, ref))
+			same++;
+		else
+			fprintf(stderr, "[*] double %s, expected %s\n", out, ref);
+	}
+	fprintf(stderr, "[*] doubles as %%lf: %d of %d\n", same, (int) ARRAY_SIZE(vals));
+	blob_buf_free(&b);
+}
+
+static void
+dump_json_chunked(struct blob_buf *buf, const char *json)
+{
+	static struct blob_buf b;
+	struct blobmsg_json_parser p;
+	const char *pos = json;
+	int len = strlen(json);
+	char *dup;
+	bool same;
+
+	/* feed in small chunks, splitting tokens at arbitrary points */
+	blobmsg_buf_init(&b);
+	blobmsg_json_parse_init(&p, &b);
+	while (len > 0) {
+		int cur = len < 7 ? len : 7;
+
+		if (blobmsg_json_parse_feed(&p, pos, cur) < 0)
+			break;
+		pos += cur;
+		len -= cur;
+	}
+
+	same = blobmsg_json_parse_finish(&p) &&
+	       blob_raw_len(b.head) == blob_raw_len(buf->head) &&
+	       !memcmp(b.head, buf->head, blob_raw_len(b.head));
+	fprintf(stderr, "\n[*] chunked json parse: %s\n", same ? "same" : "differs");
+
+	blobmsg_buf_init(&b);
+	blobmsg_add_string(&b, "keep", "me");
+	blobmsg_add_json_from_string(&b, "{\"a\": [1, 2, {\"b\": ");
+	fprintf(stderr, "[*] incomplete json: %s\n",
+		blob_len(b.head) == blob_pad_len(blob_data(b.head)) ? "dropped" : "kept");
+
+	/* the last value wins, data added before the parse is left alone */
+	blobmsg_buf_init(&b);
+	blobmsg_add_string(&b, "a", "keep");
+	blobmsg_add_json_from_string(&b, "{\"a\": 1, \"b\": {\"x\": 1, \"y\": 2, "
+				     "\"x\": [3]}, \"a\": \"last\", "
+				     "\"c\": [{\"k\": 1, \"k\": 2}]}");
+	dup = blobmsg_format_json(b.head, true);
+	fprintf(stderr, "[*] duplicate keys: %s\n", dup);
+	free(dup);
+	blob_buf_free(&b);
+}
+
+static bool
+load_json_file(struct blob_buf *b, const char *file, struct blob_buf *ref)
+{
+	blobmsg_buf_init(b);
+	return blobmsg_add_json_from_file(b, file) &&
+	       blob_raw_len(b->head) == blob_raw_len(ref->head) &&
+	       !memcmp(b->head, ref->head, blob_raw_len(b->head));
+}
+
+static void
+dump_json_file_cache(struct blob_buf *buf, const char *json)
+{
+	char dir[] = "/tmp/test-blobmsg.XXXXXX";
+	static struct blob_buf b, ref;
+	char file[64], cmd[96];
+	bool parsed, cached, changed;
+	glob_t gl;
+	FILE *f;
+
+	if (!mkdtemp(dir))
+		return;
+
+	snprintf(file, sizeof(file), "%s/data.json", dir);
+	f = fopen(file, "w");
+	fputs(json, f);
+	fclose(f);
+
+	blobmsg_json_set_cache_dir(dir);
+	parsed = load_json_file(&b, file, buf);
+	snprintf(cmd, sizeof(cmd), "%s/*.blob", dir);
+	cached = !glob(cmd, 0, NULL, &gl) && gl.gl_pathc == 1;
+	globfree(&gl);
+	cached = load_json_file(&b, file, buf) && cached;
+
+	/* a changed file must not be served from the cache */
+	f = fopen(file, "w");
+	fputs("{\"changed\":true}", f);
+	fclose(f);
+	blobmsg_buf_init(&ref);
+	blobmsg_add_u8(&ref, "changed", 1);
+	changed = load_json_file(&b, file, &ref);
+
+	fprintf(stderr, "[*] json file: %s, from cache: %s, after change: %s\n",
+		parsed ? "same" : "differs", cached ? "same" : "differs",
+		changed ? "reparsed" : "stale");
+
+	blobmsg_json_set_cache_dir(NULL);
+	blob_buf_free(&b);
+	blob_buf_free(&ref);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd))
+		return;
+}
+
 int main(int argc, char **argv)
 {
 	char *json = NULL;
@@ -165,6 +315,8 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 
 	fprintf(stderr, "\n[*] blobmsg to json: %s\n", json);
+	dump_json_buf(&buf, json);
+	dump_json_doubles();
 
 	blobmsg_buf_init(&buf);
 	if (!blobmsg_add_json_from_string(&buf, json))
@@ -172,6 +324,8 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "\n[*] blobmsg from json:\n");
 	dump_message(&buf);
+	dump_json_chunked(&buf, json);
+	dump_json_file_cache(&buf, json);
 
 	if (buf.buf)
 		free(buf.buf);
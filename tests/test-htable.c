@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl-cmp.h"
+#include "htable.h"
+#include "kvlist.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define N_NODES		5000
+
+struct node {
+	struct htable_node h;
+	char key[16];
+	bool present;
+};
+
+static uint32_t bad_hash(const void *key, void *ptr)
+{
+	/* force long probe runs and wrap-around */
+	return 7;
+}
+
+static int check_all(struct htable *h, struct node *nodes, int n)
+{
+	int errors = 0;
+
+	for (int i = 0; i < n; i++) {
+		struct node *found;
+
+		found = htable_find_element(h, nodes[i].key, found, h);
+		if ((found == &nodes[i]) != nodes[i].present)
+			errors++;
+	}
+
+	return errors;
+}
+
+static void test_htable(htable_hash_fn hash, int n)
+{
+	struct node *nodes = calloc(n, sizeof(*nodes));
+	struct htable h;
+	struct node *elem;
+	unsigned int idx;
+	int dup = 0, iter = 0, errors = 0, present = n;
+
+	htable_init(&h, hash, avl_strcmp, NULL);
+	for (int i = 0; i < n; i++) {
+		snprintf(nodes[i].key, sizeof(nodes[i].key), "key%d", i);
+		nodes[i].h.key = nodes[i].key;
+		nodes[i].present = !htable_insert(&h, &nodes[i].h);
+	}
+
+	for (int i = 0; i < n; i += 7) {
+		struct node tmp = { .h.key = nodes[i].key };
+		struct node *found;
+
+		if (htable_insert(&h, &tmp.h))
+			dup++;
+
+		/* swap in the copy and back */
+		htable_replace(&h, &nodes[i].h, &tmp.h);
+		found = htable_find_element(&h, nodes[i].key, found, h);
+		errors += found != &tmp;
+		htable_replace(&h, &tmp.h, &nodes[i].h);
+	}
+
+	errors += check_all(&h, nodes, n);
+
+	/* delete two thirds in a scattered order, then re-add some */
+	for (int i = 0; i < n; i++) {
+		if (i % 3 == 0)
+			continue;
+
+		htable_delete(&h, &nodes[(i * 7919) % n].h);
+		nodes[(i * 7919) % n].present = false;
+		present--;
+	}
+	errors += check_all(&h, nodes, n);
+
+	for (int i = 1; i < n; i += 3) {
+		if (nodes[i].present)
+			continue;
+		nodes[i].present = !htable_insert(&h, &nodes[i].h);
+		present++;
+	}
+	errors += check_all(&h, nodes, n);
+
+	htable_for_each_element(&h, idx, elem, h)
+		iter++;
+
+	OUT("%s: count %s, duplicates rejected %d, iterated %s, errors %d\n",
+	    hash == bad_hash ? "colliding" : "strhash",
+	    h.count == (unsigned int)present ? "ok" : "wrong", dup,
+	    iter == present ? "all" : "some", errors);
+
+	htable_free(&h);
+	free(nodes);
+}
+
+static void test_kvlist(bool hash)
+{
+	struct kvlist kv;
+	const char *name;
+	char key[16], *val;
+	int n = 0, ok = 0;
+
+	if (hash)
+		kvlist_init_hash(&kv, kvlist_strlen);
+	else
+		kvlist_init(&kv, kvlist_strlen);
+
+	for (int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		kvlist_set(&kv, key, "old");
+	}
+	for (int i = 0; i < 1000; i += 2) {
+		snprintf(key, sizeof(key), "k%d", i);
+		kvlist_set(&kv, key, key);
+	}
+	for (int i = 0; i < 1000; i += 5) {
+		snprintf(key, sizeof(key), "k%d", i);
+		kvlist_delete(&kv, key);
+	}
+
+	for (int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		val = kvlist_get(&kv, key);
+		if (i % 5 == 0)
+			ok += !val;
+		else if (i % 2 == 0)
+			ok += val && !strcmp(val, key);
+		else
+			ok += val && !strcmp(val, "old");
+	}
+
+	kvlist_for_each(&kv, name, val)
+		n++;
+
+	kvlist_set(&kv, "first", "1");
+	kvlist_for_each(&kv, name, val)
+		break;
+
+	OUT("%s: %d of 1000 ok, %d entries, first '%s'\n",
+	    hash ? "hash" : "avl", ok, n, name);
+
+	kvlist_free(&kv);
+}
+
+int main()
+{
+	test_htable(htable_strhash, N_NODES);
+	test_htable(bad_hash, 500);
+	test_kvlist(false);
+	test_kvlist(true);
+
+	return 0;
+}
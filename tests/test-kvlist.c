@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvlist.h"
+#include "arena.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static void dump(struct kvlist *kv)
+{
+	const char *name;
+	char *val;
+
+	kvlist_for_each(kv, name, val)
+		fprintf(stdout, " %s=%s", name, val);
+	fprintf(stdout, "\n");
+}
+
+static void test_in_place(bool hash)
+{
+	struct kvlist kv;
+	char *val, *prev;
+	bool moved;
+
+	if (hash)
+		kvlist_init_hash(&kv, kvlist_strlen);
+	else
+		kvlist_init(&kv, kvlist_strlen);
+
+	kvlist_set(&kv, "a", "first value");
+	kvlist_set(&kv, "b", "2");
+	kvlist_set(&kv, "c", "3");
+	prev = kvlist_get(&kv, "a");
+
+	/* shorter values reuse the node */
+	kvlist_set(&kv, "a", "short");
+	val = kvlist_get(&kv, "a");
+	OUT("%s: same node %d, updates %lu, value '%s'\n",
+	    hash ? "hash" : "avl", val == prev, kv.updates, val);
+
+	/* setting a value from its own storage */
+	kvlist_set(&kv, "a", val + 2);
+	OUT("%s: self '%s'\n", hash ? "hash" : "avl", (char *) kvlist_get(&kv, "a"));
+
+	/* longer than the original allocation */
+	kvlist_set(&kv, "a", "a value that does not fit");
+	moved = kvlist_get(&kv, "a") != prev;
+	OUT("%s: moved %d, updates %lu, data %zu, order", hash ? "hash" : "avl",
+	    moved, kv.updates, kv.data_bytes);
+	dump(&kv);
+
+	kvlist_delete(&kv, "a");
+	kvlist_delete(&kv, "b");
+	OUT("%s: data %zu, mem %s\n", hash ? "hash" : "avl", kv.data_bytes,
+	    kv.mem_bytes > sizeof(struct kvlist_node) ? "ok" : "wrong");
+
+	kvlist_free(&kv);
+	OUT("%s: freed data %zu, mem %zu\n", hash ? "hash" : "avl",
+	    kv.data_bytes, kv.mem_bytes);
+}
+
+static void test_slab(void)
+{
+	struct kvlist_slab slab;
+	struct kvlist kv, kv2;
+	char key[16], val[600], *big;
+	size_t bytes;
+	int ok = 0;
+
+	kvlist_slab_init(&slab);
+	kvlist_init_hash(&kv, kvlist_strlen);
+	kvlist_init(&kv2, kvlist_strlen);
+	kv.slab = &slab;
+	kv2.slab = &slab;
+
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		kvlist_set(&kv, key, key);
+		kvlist_set(&kv2, key, "x");
+	}
+	OUT("chunks %lu, hits %lu\n", slab.misses, slab.hits);
+
+	/* rounding to the size class leaves room for growth */
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		snprintf(val, sizeof(val), "value %d", i);
+		kvlist_set(&kv, key, val);
+	}
+	OUT("updates %lu, chunks %lu\n", kv.updates, slab.misses);
+
+	/* replaced nodes are recycled through the freelists */
+	for (int round = 0; round < 10; round++) {
+		for (int i = 0; i < 100; i++) {
+			snprintf(key, sizeof(key), "k%d", i);
+			memset(val, 'a' + round, 100 + round * 50);
+			val[100 + round * 50] = 0;
+			kvlist_set(&kv, key, val);
+			kvlist_delete(&kv2, key);
+			kvlist_set(&kv2, key, "y");
+		}
+	}
+	bytes = slab.chunk_bytes;
+	OUT("chunks %lu, hits %lu\n", slab.misses, slab.hits);
+
+	/* larger than the largest class */
+	big = malloc(4000);
+	memset(big, 'b', 3999);
+	big[3999] = 0;
+	kvlist_set(&kv, "big", big);
+	ok += !strcmp(kvlist_get(&kv, "big"), big);
+	kvlist_delete(&kv, "big");
+	free(big);
+	OUT("big %d, chunk bytes unchanged %d\n", ok, bytes == slab.chunk_bytes);
+
+	ok = 0;
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		ok += strlen(kvlist_get(&kv, key)) == 550 &&
+		      !strcmp(kvlist_get(&kv2, key), "y");
+	}
+	OUT("%d of 100 ok, entries %d/%d\n", ok, kv.avl.count, kv2.avl.count);
+
+	kvlist_free(&kv);
+	kvlist_free(&kv2);
+	kvlist_slab_free(&slab);
+}
+
+static void test_arena(void)
+{
+	struct arena arena;
+	struct kvlist kv;
+	char *prev;
+
+	arena_init(&arena, 0);
+	kvlist_init(&kv, kvlist_strlen);
+	kv.arena = &arena;
+
+	kvlist_set(&kv, "a", "1234");
+	prev = kvlist_get(&kv, "a");
+	kvlist_set(&kv, "a", "12");
+	kvlist_set(&kv, "b", "3");
+	OUT("same node %d, updates %lu, data %zu, order",
+	    prev == kvlist_get(&kv, "a"), kv.updates, kv.data_bytes);
+	dump(&kv);
+
+	kvlist_free(&kv);
+	arena_free(&arena);
+}
+
+int main()
+{
+	test_in_place(false);
+	test_in_place(true);
+	test_slab();
+	test_arena();
+
+	return 0;
+}
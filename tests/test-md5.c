@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define N_FILES		8
+
+static char *hex(const uint8_t *md5)
+{
+	static char buf[33];
+
+	for (int i = 0; i < 16; i++)
+		sprintf(buf + i * 2, "%02x", md5[i]);
+
+	return buf;
+}
+
+static void test_vectors(void)
+{
+	static const char * const vectors[] = {
+		"",
+		"abc",
+		"message digest",
+		"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+	};
+	uint8_t md5[16];
+	md5_ctx_t ctx;
+
+	for (size_t i = 0; i < ARRAY_SIZE(vectors); i++) {
+		md5_begin(&ctx);
+		md5_hash(vectors[i], strlen(vectors[i]), &ctx);
+		md5_end(md5, &ctx);
+		OUT("%s\n", hex(md5));
+	}
+}
+
+static void test_chunked(const uint8_t *data, size_t len)
+{
+	uint8_t md5[16], ref[16];
+	md5_ctx_t ctx;
+	bool same = true;
+
+	md5_begin(&ctx);
+	md5_hash(data, len, &ctx);
+	md5_end(ref, &ctx);
+
+	/* odd chunk sizes and misaligned starts must give the same result */
+	for (size_t step = 1; step < 200; step += 13) {
+		md5_begin(&ctx);
+		for (size_t i = 0; i < len; i += step)
+			md5_hash(data + i, len - i < step ? len - i : step, &ctx);
+		md5_end(md5, &ctx);
+
+		if (memcmp(md5, ref, sizeof(md5)) != 0)
+			same = false;
+	}
+
+	OUT("%s, chunked: %s\n", hex(ref), same ? "same" : "different");
+}
+
+static void write_file(const char *path, const uint8_t *data, size_t len)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f || fwrite(data, 1, len, f) != len)
+		exit(1);
+
+	fclose(f);
+}
+
+static void test_files(const uint8_t *data, size_t len)
+{
+	struct md5sum_job jobs[N_FILES + 1] = {};
+	char dir[] = "/tmp/test-md5.XXXXXX";
+	/* dir, a slash and any int */
+	char paths[N_FILES][sizeof(dir) + 12];
+	int ok = 0, failed;
+
+	if (!mkdtemp(dir))
+		exit(1);
+
+	for (int i = 0; i < N_FILES; i++) {
+		snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+		write_file(paths[i], data, len >> i);
+		jobs[i].file = paths[i];
+	}
+	jobs[N_FILES].file = "/tmp/test-md5.nonexistent";
+
+	failed = md5sum_batch(jobs, ARRAY_SIZE(jobs), 4);
+
+	for (int i = 0; i < N_FILES; i++) {
+		uint8_t md5[16], ref[16];
+		md5_ctx_t ctx;
+
+		md5_begin(&ctx);
+		md5_hash(data, len >> i, &ctx);
+		md5_end(ref, &ctx);
+
+		if (md5sum(paths[i], md5) == (int)(len >> i) &&
+		    !memcmp(md5, ref, sizeof(md5)) &&
+		    jobs[i].len == (int)(len >> i) &&
+		    !memcmp(jobs[i].md5, ref, sizeof(ref)))
+			ok++;
+
+		unlink(paths[i]);
+	}
+	rmdir(dir);
+
+	OUT("md5sum: %d of %d ok, failed: %d, missing: %d\n", ok, N_FILES,
+	    failed, jobs[N_FILES].len);
+}
+
+int main()
+{
+	size_t len = 1024 * 1024 + 13;
+	uint8_t *data = malloc(len);
+
+	for (size_t i = 0; i < len; i++)
+		data[i] = i * 7 + i / 251;
+
+	test_vectors();
+	test_chunked(data, 64 * 1024 + 13);
+	test_files(data, len);
+
+	free(data);
+
+	return 0;
+}
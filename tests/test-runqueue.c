@@ -16,6 +16,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -23,6 +24,7 @@
 
 #include "uloop.h"
 #include "runqueue.h"
+#include "utils.h"
 
 static struct runqueue q;
 
@@ -137,6 +139,165 @@ static void add_sleeper(int val)
 	runqueue_task_add(&q, &s->proc.task, false);
 }
 
+struct prio_task {
+	const char *name;
+	struct uloop_timeout t;
+	struct runqueue_task task;
+};
+
+static void prio_empty(struct runqueue *q)
+{
+	fprintf(stderr, "Priorities done!\n");
+	uloop_end();
+}
+
+static void prio_timer_cb(struct uloop_timeout *t)
+{
+	struct prio_task *p = container_of(t, struct prio_task, t);
+
+	runqueue_task_complete(&p->task);
+}
+
+static void prio_run(struct runqueue *q, struct runqueue_task *t)
+{
+	struct prio_task *p = container_of(t, struct prio_task, task);
+
+	fprintf(stderr, "[%d/%d] start '%s' (normal running: %d)\n",
+		q->running_tasks, q->max_running_tasks, p->name,
+		q->running_prio[RUNQUEUE_PRIO_NORMAL]);
+	uloop_timeout_set(&p->t, 10);
+}
+
+static void prio_complete(struct runqueue *q, struct runqueue_task *t)
+{
+	free(container_of(t, struct prio_task, task));
+}
+
+static void add_prio_task(struct runqueue *q, const char *name, int prio, bool first)
+{
+	static const struct runqueue_task_type prio_type = {
+		.run = prio_run,
+	};
+	struct prio_task *p = calloc(1, sizeof(*p));
+
+	p->name = name;
+	p->t.cb = prio_timer_cb;
+	p->task.type = &prio_type;
+	p->task.priority = prio;
+	p->task.complete = prio_complete;
+	if (first)
+		runqueue_task_add_first(q, &p->task, false);
+	else
+		runqueue_task_add(q, &p->task, false);
+}
+
+static void test_priority(void)
+{
+	static struct runqueue pq;
+
+	runqueue_init(&pq);
+	pq.empty_cb = prio_empty;
+	pq.max_running_tasks = 2;
+	/* one slot is always left to the higher classes */
+	pq.max_running_prio[RUNQUEUE_PRIO_NORMAL] = 1;
+
+	add_prio_task(&pq, "normal 1", RUNQUEUE_PRIO_NORMAL, false);
+	add_prio_task(&pq, "normal 2", RUNQUEUE_PRIO_NORMAL, false);
+	add_prio_task(&pq, "high 1", RUNQUEUE_PRIO_HIGH, false);
+	add_prio_task(&pq, "normal 0", RUNQUEUE_PRIO_NORMAL, true);
+	add_prio_task(&pq, "high 2", RUNQUEUE_PRIO_HIGH, false);
+	add_prio_task(&pq, "critical", RUNQUEUE_PRIO_CRITICAL, false);
+	add_prio_task(&pq, "high 0", RUNQUEUE_PRIO_HIGH, true);
+
+	uloop_run();
+}
+
+struct work_item {
+	const char *name;
+	struct runqueue_work work;
+	unsigned long n, result;
+	bool spin, done;
+};
+
+static bool worker_sigs_blocked = true;
+
+static struct runqueue wq;
+static struct runqueue_worker_pool pool;
+static struct work_item items[] = {
+	{ .name = "blocker", .spin = true },
+	{ .name = "sum 1", .n = 1000 },
+	{ .name = "sum 2", .n = 100 },
+	{ .name = "pending", .n = 10 },
+	{ .name = "sum 3", .n = 10000 },
+};
+
+static void work_fn(struct runqueue_work *w)
+{
+	struct work_item *item = container_of(w, struct work_item, work);
+	sigset_t set;
+
+	/* runs on a worker thread */
+	pthread_sigmask(SIG_BLOCK, NULL, &set);
+	if (sigismember(&set, SIGTERM) != 1 || sigismember(&set, SIGUSR1) != 1)
+		worker_sigs_blocked = false;
+
+	while (item->spin && !runqueue_work_cancelled(w))
+		usleep(1000);
+
+	for (unsigned long i = 0; i <= item->n; i++)
+		item->result += i;
+}
+
+static void work_complete(struct runqueue *q, struct runqueue_task *t)
+{
+	struct work_item *item = container_of(t, struct work_item, work.task);
+
+	item->done = true;
+}
+
+static void work_empty(struct runqueue *q)
+{
+	uloop_end();
+}
+
+static void work_timer_cb(struct uloop_timeout *t)
+{
+	/* the single worker is still busy with the blocker */
+	runqueue_task_cancel(&items[3].work.task, 0);
+	fprintf(stderr, "cancelled '%s' while queued: %s\n", items[3].name,
+		items[3].done ? "completed" : "pending");
+
+	runqueue_task_kill(&items[0].work.task);
+	fprintf(stderr, "killed '%s' while running: %s\n", items[0].name,
+		items[0].done ? "completed" : "pending");
+}
+
+static void test_work(void)
+{
+	struct uloop_timeout t = { .cb = work_timer_cb };
+
+	runqueue_init(&wq);
+	wq.empty_cb = work_empty;
+	if (runqueue_worker_pool_init(&pool, 1))
+		return;
+
+	for (size_t i = 0; i < ARRAY_SIZE(items); i++) {
+		items[i].work.work = work_fn;
+		items[i].work.task.complete = work_complete;
+		runqueue_work_add(&wq, &pool, &items[i].work);
+	}
+	uloop_timeout_set(&t, 20);
+
+	uloop_run();
+	runqueue_worker_pool_done(&pool);
+
+	for (size_t i = 0; i < ARRAY_SIZE(items); i++)
+		fprintf(stderr, "work '%s': %s, result %lu\n", items[i].name,
+			items[i].done ? "done" : "not done", items[i].result);
+	fprintf(stderr, "worker signals blocked: %s\n",
+		worker_sigs_blocked ? "yes" : "no");
+}
+
 int main(int argc, char **argv)
 {
 	uloop_init();
@@ -153,6 +314,9 @@ int main(int argc, char **argv)
 	add_sleeper(1);
 
 	uloop_run();
+
+	test_priority();
+	test_work();
 	uloop_done();
 
 	return 0;
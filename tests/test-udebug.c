@@ -0,0 +1,718 @@
+#include <pthread.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+#include "blob.h"
+#include "udebug.h"
+#include "udebug-proto.h"
+#include "ustream.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define N_THREADS	4
+
+static struct udebug_buf buf;
+static struct udebug_remote_buf rb;
+static int n_entries;
+static bool running;
+static bool incremental;
+
+static void *producer(void *arg)
+{
+	int id = (intptr_t)arg;
+
+	for (int i = 0; i < n_entries; i++)
+		while (udebug_mp_entry_printf(&buf, "thread %d entry %d%s", id, i,
+					      i % 7 ? "" : " with some padding") < 0)
+			;
+
+	return NULL;
+}
+
+static void remote_init(void)
+{
+	/* read the ring through a second handle on the same mapping */
+	memset(&rb, 0, sizeof(rb));
+	rb.buf.hdr = buf.hdr;
+	rb.buf.data = buf.data;
+	rb.buf.data_size = buf.data_size;
+	rb.buf.ring_size = buf.ring_size;
+}
+
+static bool check_entry(struct udebug_iter *it, int *next, int *id)
+{
+	char str[64];
+	int entry, len;
+
+	/* the terminating 0 is not part of the entry */
+	if (it->len >= sizeof(str))
+		return false;
+
+	memcpy(str, it->data, it->len);
+	str[it->len] = 0;
+	if (strlen(str) != it->len ||
+	    sscanf(str, "thread %d entry %d%n", id, &entry, &len) != 2 ||
+	    *id < 0 || *id >= N_THREADS || entry < next[*id] ||
+	    strcmp(str + len, entry % 7 ? "" : " with some padding") != 0)
+		return false;
+
+	/* entries of each thread must be in order and show up only once */
+	next[*id] = entry + 1;
+	return true;
+}
+
+/* returns the number of entries read, or -1 on inconsistency */
+static int read_entries(int *next, int *dropped)
+{
+	struct udebug_snapshot *s;
+	struct udebug_iter it;
+	int count = 0, id;
+
+	s = udebug_remote_buf_snapshot(&rb);
+	if (!s)
+		return 0;
+
+	*dropped += s->dropped;
+	for (unsigned int i = 0; i < s->n_entries; i++) {
+		if (!udebug_snapshot_get_entry(s, &it, i) ||
+		    !check_entry(&it, next, &id))
+			goto error;
+
+		count++;
+	}
+
+	free(s);
+	return count;
+
+error:
+	free(s);
+	return -1;
+}
+
+static int read_entries_incremental(int *next, int *dropped)
+{
+	struct udebug_iter it;
+	int count = 0;
+
+	while (udebug_remote_buf_read(&rb, &it)) {
+		int cur[N_THREADS], id;
+		bool ok;
+
+		memcpy(cur, next, sizeof(cur));
+		ok = check_entry(&it, cur, &id);
+
+		/* results from clobbered data are discarded */
+		if (!udebug_remote_buf_read_valid(&rb)) {
+			(*dropped)++;
+			continue;
+		}
+
+		if (!ok)
+			return -1;
+
+		next[id] = cur[id];
+		count++;
+	}
+
+	return count;
+}
+
+static void *reader(void *arg)
+{
+	int *ret = arg;
+	int next[N_THREADS] = {};
+	int dropped = 0;
+
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) && *ret >= 0) {
+		int n;
+
+		if (incremental)
+			n = read_entries_incremental(next, &dropped);
+		else
+			n = read_entries(next, &dropped);
+
+		if (n < 0)
+			*ret = -1;
+		else
+			*ret += n;
+	}
+
+	return NULL;
+}
+
+static void test_threads(int entries, size_t ring, size_t size, bool inc)
+{
+	pthread_t threads[N_THREADS], rthread;
+	int next[N_THREADS] = {};
+	int total = 0, dropped = 0, ret;
+
+	udebug_buf_init(&buf, ring, size);
+	udebug_buf_mp_init(&buf);
+	remote_init();
+
+	n_entries = entries;
+	incremental = inc;
+	running = true;
+	pthread_create(&rthread, NULL, reader, &total);
+	for (int i = 0; i < N_THREADS; i++)
+		pthread_create(&threads[i], NULL, producer, (void *)(intptr_t)i);
+	for (int i = 0; i < N_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+	pthread_join(rthread, NULL);
+
+	OUT("%d entries: concurrent %s reader %s\n", N_THREADS * entries,
+	    inc ? "incremental" : "snapshot", total >= 0 ? "ok" : "inconsistent");
+
+	/* the ring holds everything when it is large enough */
+	remote_init();
+	ret = read_entries(next, &dropped);
+	if (ret == N_THREADS * entries)
+		for (int i = 0; i < N_THREADS; i++)
+			if (next[i] != entries)
+				ret = -1;
+
+	OUT("%d entries: snapshot %s, head %d\n", N_THREADS * entries,
+	    ret < 0 ? "inconsistent" :
+	    ret == N_THREADS * entries ? "complete" : "partial",
+	    (int)rb.head);
+
+	udebug_buf_free(&buf);
+}
+
+static void test_commit_order(void)
+{
+	struct udebug_mp_entry e[3];
+	struct udebug_snapshot *s;
+	struct udebug_iter it;
+
+	udebug_buf_init(&buf, 16, 4096);
+	udebug_buf_mp_init(&buf);
+	remote_init();
+
+	for (int i = 0; i < 3; i++) {
+		udebug_mp_entry_reserve(&buf, &e[i], i + 1, 16);
+		e[i].len = sprintf(e[i].data, "entry %d", i);
+	}
+
+	/* later entries stay hidden until the earlier ones are committed */
+	udebug_mp_entry_commit(&buf, &e[2]);
+	udebug_mp_entry_commit(&buf, &e[1]);
+	s = udebug_remote_buf_snapshot(&rb);
+	OUT("before first commit: %d entries\n", s ? (int)s->n_entries : 0);
+	free(s);
+
+	udebug_mp_entry_commit(&buf, &e[0]);
+	s = udebug_remote_buf_snapshot(&rb);
+	for (unsigned int i = 0; s && i < s->n_entries; i++) {
+		udebug_snapshot_get_entry(s, &it, i);
+		OUT("%d: '%s' ts %d\n", i, (char *)it.data, (int)it.timestamp);
+	}
+	free(s);
+
+	udebug_buf_free(&buf);
+}
+
+#define DEFERRED_CHECK(...) do { \
+	snprintf(expect[n_expect++], sizeof(expect[0]), __VA_ARGS__); \
+	udebug_entry_init(&buf); \
+	udebug_entry_deferred_printf(&buf, __VA_ARGS__); \
+	udebug_entry_add(&buf); \
+} while (0)
+
+static void test_deferred(void)
+{
+	static const struct udebug_buf_meta meta = {
+		.name = "deferred",
+		.format = UDEBUG_FORMAT_DEFERRED,
+	};
+	static char expect[16][128];
+	struct udebug_snapshot *s;
+	struct udebug_iter it;
+	struct udebug ctx = {};
+	int n_expect = 0;
+	char str[128];
+
+	udebug_init(&ctx);
+	udebug_buf_init(&buf, 32, 4096);
+	udebug_buf_add(&ctx, &buf, &meta);
+	remote_init();
+
+	DEFERRED_CHECK("plain text");
+	DEFERRED_CHECK("%d %u %x %05d%% %c", -42, 42u, 0xbeef, 7, 'z');
+	DEFERRED_CHECK("%ld %lld %zu %jd %td", -1L, 1LL << 40, (size_t)12345,
+		       (intmax_t)-7, (ptrdiff_t)3);
+	DEFERRED_CHECK("%hhd %hu", 300, 70000);
+	DEFERRED_CHECK("%.3f %e %g %Lf", 3.14159, 1e-9, 0.5, (long double)2.25);
+	DEFERRED_CHECK("[%s] [%-8s] [%.2s]", "str", "left", "trunc");
+	DEFERRED_CHECK("[%*d] [%-*.*f]", 6, 42, 8, 2, 1.5);
+	DEFERRED_CHECK("%p", (void *)&buf);
+	errno = ENOENT;
+	/* not deferrable, formatted while logging */
+	DEFERRED_CHECK("error: %m");
+
+	/* appending to an entry concatenates the text */
+	snprintf(expect[n_expect++], sizeof(expect[0]), "first 1, second 2");
+	udebug_entry_init(&buf);
+	udebug_entry_deferred_printf(&buf, "first %d", 1);
+	udebug_entry_deferred_printf(&buf, ", second %d", 2);
+	udebug_entry_add(&buf);
+
+	s = udebug_remote_buf_snapshot(&rb);
+	for (unsigned int i = 0; s && i < s->n_entries; i++) {
+		udebug_snapshot_get_entry(s, &it, i);
+		udebug_iter_format(&it, str, sizeof(str));
+		if (strcmp(str, expect[i]) != 0)
+			OUT("%d: '%s' != '%s'\n", i, str, expect[i]);
+	}
+
+	if (s) {
+		int len;
+
+		udebug_snapshot_get_entry(s, &it, 1);
+		len = udebug_iter_format(&it, str, 8);
+		OUT("%d entries, truncated: '%s' (%d)\n", s->n_entries, str, len);
+	}
+	free(s);
+
+	udebug_free(&ctx);
+}
+
+static int notify_fd;
+
+static int read_notify(void)
+{
+	struct {
+		struct udebug_client_msg msg;
+		struct blob_attr meta;
+	} m;
+	int n = 0;
+
+	while (read(notify_fd, &m, sizeof(m)) == sizeof(m))
+		if (m.msg.type == CL_MSG_RING_NOTIFY)
+			n++;
+
+	return n;
+}
+
+static void add_notify_entries(int n)
+{
+	for (int i = 0; i < n; i++) {
+		/* a polling reader re-arms its notification bit */
+		buf.hdr->notify |= 1;
+		udebug_entry_init(&buf);
+		udebug_entry_printf(&buf, "entry %d", i);
+		udebug_entry_add(&buf);
+	}
+}
+
+static void test_notify(void)
+{
+	static const struct udebug_buf_meta meta = {
+		.name = "notify",
+		.format = UDEBUG_FORMAT_STRING,
+	};
+	struct udebug ctx = {};
+	int sv[2], n;
+
+	udebug_init(&ctx);
+	udebug_buf_init(&buf, 32, 4096);
+	udebug_buf_add(&ctx, &buf, &meta);
+
+	/* stand in for the udebugd connection */
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	ctx.fd.fd = sv[0];
+	notify_fd = sv[1];
+
+	add_notify_entries(10);
+	OUT("default: %d notifications\n", read_notify());
+
+	udebug_buf_set_notify(&buf, 0, 0);
+	add_notify_entries(10);
+	n = read_notify();
+	uloop_run_timeout(20);
+	OUT("per loop iteration: %d, then %d notifications\n", n, read_notify());
+
+	udebug_buf_set_notify(&buf, 1000, 4);
+	add_notify_entries(10);
+	n = read_notify();
+	uloop_run_timeout(20);
+	OUT("max 4 entries: %d, then %d notifications\n", n, read_notify());
+
+	/* changing the settings flushes what is still pending */
+	udebug_buf_set_notify(&buf, -1, 0);
+	OUT("flushed: %d notifications\n", read_notify());
+
+	ctx.fd.fd = -1;
+	close(sv[0]);
+	close(sv[1]);
+	udebug_free(&ctx);
+}
+
+static void read_all(const char *name)
+{
+	struct udebug_iter it;
+	int n = 0;
+
+	while (udebug_remote_buf_read(&rb, &it)) {
+		if (!n)
+			OUT("%s: first '%s'\n", name, (char *)it.data);
+		n++;
+	}
+
+	OUT("%s: read %d, dropped %d\n", name,
+	    n == (int)buf.ring_size - 1 ? -1 : n, rb.dropped);
+}
+
+static void test_read(void)
+{
+	struct udebug_iter it;
+
+	udebug_buf_init(&buf, 32, 4096);
+	remote_init();
+
+	for (int i = 0; i < 5; i++) {
+		udebug_entry_init(&buf);
+		udebug_entry_printf(&buf, "entry %d", i);
+		udebug_entry_add(&buf);
+	}
+	read_all("five");
+	read_all("none");
+
+	/* more entries than ring slots since the last read: only the last
+	 * ring_size - 1 can be read, which read_all() prints as -1 */
+	for (int i = 0; i < (int)buf.ring_size + 10; i++) {
+		udebug_entry_init(&buf);
+		udebug_entry_printf(&buf, "entry %d", i);
+		udebug_entry_add(&buf);
+	}
+	read_all("wrapped");
+
+	/* data overwritten while the entry is still in use */
+	udebug_entry_init(&buf);
+	udebug_entry_printf(&buf, "last entry");
+	udebug_entry_add(&buf);
+	udebug_remote_buf_read(&rb, &it);
+	OUT("valid before: %s\n", udebug_remote_buf_read_valid(&rb) ? "yes" : "no");
+	for (int i = 0; i < 4; i++) {
+		udebug_entry_init(&buf);
+		udebug_entry_append(&buf, NULL, 1024);
+		udebug_entry_add(&buf);
+	}
+	OUT("valid after: %s\n", udebug_remote_buf_read_valid(&rb) ? "yes" : "no");
+
+	udebug_buf_free(&buf);
+}
+
+static void remote_map(struct udebug_remote_buf *r, struct udebug_buf *b)
+{
+	memset(r, 0, sizeof(*r));
+	r->buf.hdr = b->hdr;
+	r->buf.data = b->data;
+	r->buf.data_size = b->data_size;
+	r->buf.ring_size = b->ring_size;
+	r->node.key = (void *)(uintptr_t)b->id;
+}
+
+static void check_pcapng(const uint8_t *data, size_t len)
+{
+	int blocks[7] = {}, bad = 0, last_id = -1;
+	uint64_t last_ts = 0;
+
+	while (len >= 12) {
+		uint32_t type, blen, trailer;
+
+		memcpy(&type, data, 4);
+		memcpy(&blen, data + 4, 4);
+		if (blen < 12 || blen > len || blen & 3)
+			break;
+
+		memcpy(&trailer, data + blen - 4, 4);
+		if (trailer != blen)
+			bad++;
+
+		if (type == 0x0a0d0d0a)
+			blocks[0]++;
+		else if (type < ARRAY_SIZE(blocks))
+			blocks[type]++;
+
+		if (type == 6) {
+			uint32_t id, hi, lo, caplen;
+			uint64_t ts;
+
+			memcpy(&hi, data + 12, 4);
+			memcpy(&lo, data + 16, 4);
+			memcpy(&caplen, data + 20, 4);
+			memcpy(&id, data + 28, 4);
+			ts = ((uint64_t)hi << 32) | lo;
+			if (ts < last_ts || (int)id != last_id + 1 ||
+			    caplen != 4 + id % 61)
+				bad++;
+			last_ts = ts;
+			last_id = id;
+		}
+
+		data += blen;
+		len -= blen;
+	}
+
+	OUT("pcapng: %d section, %d interfaces, %d packets, %d bad, %d left\n",
+	    blocks[0], blocks[1], blocks[6], bad, (int)len);
+}
+
+static void check_binary(const uint8_t *data, size_t len)
+{
+	struct udebug_export_record rec;
+	int n[4] = {};
+
+	if (len < 8 || memcmp(data, UDEBUG_EXPORT_MAGIC, 8) != 0) {
+		OUT("binary: bad magic\n");
+		return;
+	}
+
+	data += 8;
+	len -= 8;
+	while (len >= sizeof(rec)) {
+		uint32_t rlen, format;
+
+		memcpy(&rec, data, sizeof(rec));
+		rlen = be32_to_cpu(rec.len);
+		format = be32_to_cpu(rec.format);
+		if (rlen > len - sizeof(rec) || format >= ARRAY_SIZE(n))
+			break;
+
+		if (format == UDEBUG_FORMAT_STRING && n[format] < 2)
+			OUT("binary: string '%.*s'\n", (int)rlen, data + sizeof(rec));
+
+		n[format]++;
+		data += sizeof(rec) + rlen;
+		len -= sizeof(rec) + rlen;
+	}
+
+	OUT("binary: %d packets, %d strings, %d left\n",
+	    n[UDEBUG_FORMAT_PACKET], n[UDEBUG_FORMAT_STRING], (int)len);
+}
+
+static void export_file(enum udebug_export_format format,
+			struct udebug_snapshot **s, int n_s)
+{
+	char path[] = "/tmp/test-udebug.XXXXXX";
+	struct udebug_export e;
+	struct ustream_fd sfd = {};
+	struct udebug_iter it;
+	uint8_t *data;
+	off_t len;
+	int fd, ret;
+
+	fd = mkstemp(path);
+	unlink(path);
+	ustream_fd_init(&sfd, fd);
+
+	udebug_export_init(&e, &sfd.stream, format);
+	udebug_iter_start(&it, s, n_s);
+	ret = udebug_export_iter(&e, &it);
+	if (ret || e.skipped)
+		OUT("export: ret %d, skipped %d\n", ret, e.skipped);
+	udebug_export_free(&e);
+	ustream_free(&sfd.stream);
+
+	len = lseek(fd, 0, SEEK_END);
+	data = malloc(len);
+	if (pread(fd, data, len, 0) != len)
+		len = 0;
+	close(fd);
+
+	if (format == UDEBUG_EXPORT_PCAPNG)
+		check_pcapng(data, len);
+	else
+		check_binary(data, len);
+	free(data);
+}
+
+static void test_export(void)
+{
+	static const struct udebug_buf_meta pkt_meta = {
+		.name = "packets",
+		.format = UDEBUG_FORMAT_PACKET,
+		.sub_format = UDEBUG_DLT_ETHERNET,
+	};
+	static const struct udebug_buf_meta str_meta = {
+		.name = "strings",
+		.format = UDEBUG_FORMAT_DEFERRED,
+	};
+	struct udebug_buf pkt = {}, str = {};
+	struct udebug_remote_buf rpkt, rstr;
+	struct udebug_snapshot *s[2];
+	struct udebug ctx = {};
+	uint8_t payload[64];
+
+	udebug_init(&ctx);
+	udebug_buf_init(&pkt, 256, 64 * 1024);
+	udebug_buf_add(&ctx, &pkt, &pkt_meta);
+	udebug_buf_init(&str, 256, 16 * 1024);
+	udebug_buf_add(&ctx, &str, &str_meta);
+
+	for (int i = 0; i < 150; i++) {
+		uint64_t ts = 1000 + i * 10;
+
+		/* the entry index is stored in the packet data */
+		memset(payload, i, sizeof(payload));
+		memcpy(payload, &i, sizeof(i));
+		udebug_entry_init_ts(&pkt, ts);
+		udebug_entry_append(&pkt, payload, 4 + i % 61);
+		udebug_entry_add(&pkt);
+
+		if (i % 3)
+			continue;
+
+		udebug_entry_init_ts(&str, ts + 5);
+		udebug_entry_deferred_printf(&str, "string %d at %llu", i,
+					     (unsigned long long)ts + 5);
+		udebug_entry_add(&str);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		remote_map(&rpkt, &pkt);
+		remote_map(&rstr, &str);
+		s[0] = udebug_remote_buf_snapshot(&rpkt);
+		s[1] = udebug_remote_buf_snapshot(&rstr);
+		export_file(i ? UDEBUG_EXPORT_BINARY : UDEBUG_EXPORT_PCAPNG, s, 2);
+		free(s[0]);
+		free(s[1]);
+	}
+
+	udebug_free(&ctx);
+}
+
+#define N_MERGE	20
+
+static void test_merge(void)
+{
+	static struct udebug_buf bufs[N_MERGE];
+	struct udebug_remote_buf rbs[N_MERGE];
+	struct udebug_snapshot *s[N_MERGE];
+	unsigned int pos[N_MERGE] = {};
+	struct udebug_iter it;
+	uint32_t seed = 1;
+	int total = 0, n = 0, bad = 0;
+
+	for (int i = 0; i < N_MERGE; i++) {
+		uint64_t ts = 0;
+
+		udebug_buf_init(&bufs[i], 1024, 64 * 1024);
+		/* rings without entries and with colliding timestamps */
+		for (int j = 0; j < (i % 5 ? 200 + i : 0); j++) {
+			seed = seed * 1103515245 + 12345;
+			ts += (seed >> 16) % 4;
+			udebug_entry_init_ts(&bufs[i], ts);
+			udebug_entry_printf(&bufs[i], "%d", j);
+			udebug_entry_add(&bufs[i]);
+			total++;
+		}
+
+		remote_map(&rbs[i], &bufs[i]);
+		s[i] = udebug_remote_buf_snapshot(&rbs[i]);
+		if (!s[i])
+			s[i] = calloc(1, sizeof(*s[i]));
+	}
+
+	/* compare against a linear scan, which picks the last of equal ones */
+	udebug_iter_start(&it, s, N_MERGE);
+	while (udebug_iter_next(&it)) {
+		int cur = -1;
+
+		for (int i = 0; i < N_MERGE; i++) {
+			if (pos[i] >= s[i]->n_entries)
+				continue;
+			if (cur >= 0 && s[i]->entries[pos[i]].timestamp >
+					s[cur]->entries[pos[cur]].timestamp)
+				continue;
+			cur = i;
+		}
+
+		if (cur != (int)it.s_idx || atoi(it.data) != (int)pos[cur])
+			bad++;
+		pos[cur]++;
+		n++;
+	}
+
+	OUT("%d of %d entries merged, %d out of order\n", n, total, bad);
+
+	for (int i = 0; i < N_MERGE; i++) {
+		free(s[i]);
+		udebug_buf_free(&bufs[i]);
+	}
+}
+
+static int resident_pages(void *ptr, size_t len)
+{
+	size_t page = sysconf(_SC_PAGESIZE), n = len / page;
+	unsigned char *vec = calloc(n, 1);
+	int ret = 0;
+
+	if (!mincore(ptr, len, vec))
+		for (size_t i = 0; i < n; i++)
+			ret += vec[i] & 1;
+
+	free(vec);
+	return ret;
+}
+
+static void test_alloc(bool prefault)
+{
+	struct udebug_buf_opts opts = {
+		.rate = 100 * 1024,
+		.seconds = 5,
+		.entry_len = 100,
+		.prefault = prefault,
+		.huge_pages = true,
+	};
+	struct udebug_buf b = {};
+	int pages;
+
+	if (udebug_buf_init_opts(&b, &opts) < 0) {
+		OUT("init failed\n");
+		return;
+	}
+
+	pages = resident_pages(b.data, b.data_size);
+	OUT("%s: data %zu KiB, at least %zu entries, resident %s\n",
+	    prefault ? "prefault" : "lazy", b.data_size / 1024,
+	    b.ring_size >= 5120 ? (size_t)5120 : b.ring_size,
+	    pages == (int)(b.data_size / sysconf(_SC_PAGESIZE)) ? "all" :
+	    pages ? "some" : "none");
+
+	udebug_buf_free(&b);
+}
+
+int main()
+{
+	uloop_init();
+
+	test_alloc(false);
+	test_alloc(true);
+	test_deferred();
+	test_notify();
+	test_export();
+	test_merge();
+	test_commit_order();
+	test_threads(200, 1024, 64 * 1024, false);
+	test_threads(20000, 256, 16 * 1024, false);
+	test_threads(20000, 256, 16 * 1024, true);
+	test_read();
+
+	uloop_done();
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "udgram.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define N_MSGS	100
+
+static struct udgram sender, receiver;
+static int received, max_batch;
+static bool in_order = true;
+
+static void recv_cb(struct udgram *d, struct udgram_msg *msg, int n)
+{
+	if (n > max_batch)
+		max_batch = n;
+
+	for (int i = 0; i < n; i++) {
+		int seq;
+
+		if (msg[i].len != sizeof(seq) || msg[i].truncated) {
+			in_order = false;
+			continue;
+		}
+
+		memcpy(&seq, msg[i].data, sizeof(seq));
+		if (seq != received)
+			in_order = false;
+		received++;
+	}
+
+	if (received == N_MSGS)
+		uloop_end();
+}
+
+static void test_batch(void)
+{
+	int sv[2];
+	int queued = 0;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		exit(1);
+
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+	uloop_init();
+
+	/* enough send slots to queue everything while the peer is not reading */
+	sender.slots = 128;
+	udgram_init(&sender, sv[0]);
+	receiver.recv = recv_cb;
+	udgram_init(&receiver, sv[1]);
+
+	for (int i = 0; i < N_MSGS; i++) {
+		if (udgram_send(&sender, &i, sizeof(i), NULL, 0) == 0)
+			queued++;
+	}
+
+	OUT("queued: %d, too large: %d\n", queued,
+	    udgram_send(&sender, "", sender.slot_len + 1, NULL, 0));
+
+	uloop_run();
+	OUT("received: %d, in order: %s, batched: %s, pending: %d\n",
+	    received, in_order ? "yes" : "no", max_batch > 1 ? "yes" : "no",
+	    udgram_pending(&sender));
+
+	udgram_free(&sender);
+	udgram_free(&receiver);
+	close(sv[0]);
+	close(sv[1]);
+	uloop_done();
+}
+
+int main()
+{
+	test_batch();
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "udebug-proto.h"
+#include "ulog.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static int pipe_fds[2], saved_stderr;
+static char output[256 * 1024];
+static int output_len;
+
+static void *read_thread(void *arg)
+{
+	int len;
+
+	while ((len = read(pipe_fds[0], output + output_len,
+			   sizeof(output) - output_len - 1)) > 0)
+		output_len += len;
+	output[output_len] = 0;
+
+	return NULL;
+}
+
+static void capture_start(pthread_t *thread, bool reader)
+{
+	fflush(stdout);
+	if (pipe(pipe_fds) < 0)
+		exit(1);
+
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, 4096);
+	saved_stderr = dup(2);
+	dup2(pipe_fds[1], 2);
+	close(pipe_fds[1]);
+
+	output_len = 0;
+	if (reader)
+		pthread_create(thread, NULL, read_thread, NULL);
+}
+
+static void capture_stop(pthread_t *thread)
+{
+	dup2(saved_stderr, 2);
+	close(saved_stderr);
+	pthread_join(*thread, NULL);
+	close(pipe_fds[0]);
+}
+
+static int count_lines(const char *prefix)
+{
+	int n = 0;
+
+	for (char *p = output; (p = strstr(p, prefix)) != NULL; p++)
+		n++;
+
+	return n;
+}
+
+static void test_async(void)
+{
+	pthread_t thread;
+
+	ulog_open(ULOG_STDIO, LOG_USER, "test");
+	ulog_async(8192);
+
+	capture_start(&thread, true);
+	for (int i = 0; i < 100; i++)
+		ulog(LOG_INFO, "message %d\n", i);
+	ulog_flush();
+	capture_stop(&thread);
+
+	OUT("lines %d, dropped %u, last %s\n", count_lines("test: message "),
+	    ulog_dropped(), strstr(output, "test: message 99\n") ? "ok" : "missing");
+
+	ulog_async(0);
+	ulog_close();
+}
+
+static void test_async_blocked(void)
+{
+	pthread_t thread;
+	unsigned int dropped;
+	int lines;
+
+	ulog_open(ULOG_STDIO, LOG_USER, "test");
+	ulog_async(4096);
+
+	/* nobody reads the pipe until all messages have been queued */
+	capture_start(&thread, false);
+	for (int i = 0; i < 5000; i++)
+		ulog(LOG_INFO, "blocked message %d\n", i);
+	dropped = ulog_dropped();
+
+	pthread_create(&thread, NULL, read_thread, NULL);
+	ulog_async(0);
+	capture_stop(&thread);
+
+	lines = count_lines("test: blocked message ");
+	OUT("dropped %s, accounted %s, reported %s\n", dropped > 0 ? "yes" : "no",
+	    lines + (int)dropped == 5000 ? "yes" : "no",
+	    strstr(output, " log messages dropped\n") ? "yes" : "no");
+
+	/* synchronous output again */
+	capture_start(&thread, true);
+	ulog(LOG_INFO, "sync message\n");
+	capture_stop(&thread);
+	OUT("sync: %s", output);
+
+	ulog_close();
+}
+
+static void test_ratelimit(void)
+{
+	pthread_t thread;
+
+	ulog_open(ULOG_STDIO, LOG_USER, "test");
+	ulog_ratelimit(60 * 1000, 5);
+
+	capture_start(&thread, true);
+	for (int i = 0; i < 100; i++) {
+		ulog(LOG_ERR, "limited %d\n", i);
+		if (!(i % 50))
+			ulog(LOG_ERR, "other %d\n", i);
+	}
+	/* disabling reports the pending suppressed count */
+	ulog_ratelimit(0, 0);
+	ulog_close();
+	capture_stop(&thread);
+
+	OUT("limited %d, other %d\n", count_lines("test: limited "),
+	    count_lines("test: other "));
+	OUT("%s", strstr(output, "test: 95 "));
+}
+
+static void test_dedup(void)
+{
+	pthread_t thread;
+
+	ulog_open(ULOG_STDIO, LOG_USER, "test");
+	ulog_dedup(true);
+
+	capture_start(&thread, true);
+	for (int i = 0; i < 3; i++)
+		ulog(LOG_INFO, "same\n");
+	ulog(LOG_INFO, "value %d\n", 1);
+	ulog(LOG_INFO, "value %d\n", 1);
+	ulog(LOG_INFO, "value %d\n", 2);
+	ulog(LOG_INFO, "value %d\n", 2);
+	ulog_close();
+	capture_stop(&thread);
+
+	OUT("output:\n%s", output);
+	ulog_dedup(false);
+}
+
+static int evaluated;
+
+static int expensive(int val)
+{
+	evaluated++;
+	return val;
+}
+
+static void test_thresholds(void)
+{
+	struct udebug_buf udb = {};
+	pthread_t thread;
+
+	ulog_open(ULOG_STDIO | ULOG_SYSLOG, LOG_USER, "test");
+	ulog_channel_threshold(ULOG_SYSLOG, LOG_ERR);
+	ulog_channel_threshold(ULOG_STDIO, LOG_WARNING);
+
+	capture_start(&thread, true);
+	evaluated = 0;
+	ULOG_INFO("info %d\n", expensive(1));
+	ULOG_WARN("warn %d\n", expensive(2));
+	capture_stop(&thread);
+	OUT("enabled %d/%d/%d, evaluated %d, %s", ulog_enabled(LOG_ERR),
+	    ulog_enabled(LOG_WARNING), ulog_enabled(LOG_INFO), evaluated, output);
+
+	/* the udebug buffer takes everything while its flags allow it */
+	udebug_buf_init(&udb, 32, 4096);
+	ulog_udebug(&udb);
+	OUT("udebug: %d\n", ulog_enabled(LOG_DEBUG));
+	ulog_udebug_flags(1);
+	OUT("udebug flag clear: %d\n", ulog_enabled(LOG_DEBUG));
+	udb.hdr->flags[0] = 1;
+	OUT("udebug flag set: %d\n", ulog_enabled(LOG_DEBUG));
+
+	ulog_udebug_flags(0);
+	ulog_udebug(NULL);
+	udebug_buf_free(&udb);
+
+	ulog_threshold(LOG_DEBUG);
+	ulog_close();
+}
+
+int main()
+{
+	test_async();
+	test_async_blocked();
+	test_ratelimit();
+	test_dedup();
+	test_thresholds();
+
+	return 0;
+}
@@ -0,0 +1,809 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include "uloop.h"
+#include "utils.h"
+
+struct timer {
+	const char *name;
+	int msecs;
+	struct uloop_timeout t;
+};
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+static enum uloop_backend test_backend = ULOOP_BACKEND_DEFAULT;
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup	425
+#endif
+
+static int fired;
+
+static void timer_cb(struct uloop_timeout *t)
+{
+	struct timer *tm = container_of(t, struct timer, t);
+
+	fprintf(stdout, "%s ", tm->name);
+	if (--fired == 0)
+		uloop_end();
+}
+
+static void test_timeout_order(void)
+{
+	struct timer timers[] = {
+		{ .name = "five", .msecs = 50 },
+		{ .name = "two", .msecs = 20 },
+		{ .name = "zero-a", .msecs = 0 },
+		{ .name = "four", .msecs = 40 },
+		{ .name = "zero-b", .msecs = 0 },
+		{ .name = "one", .msecs = 10 },
+		{ .name = "three", .msecs = 30 },
+		{ .name = "zero-c", .msecs = 0 },
+		{ .name = "cancelled", .msecs = 15 },
+		{ .name = "moved", .msecs = 5 },
+	};
+	struct timer *cancelled = &timers[8], *moved = &timers[9];
+
+	uloop_init();
+
+	for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+		timers[i].t.cb = timer_cb;
+		uloop_timeout_set(&timers[i].t, timers[i].msecs);
+	}
+	fired = ARRAY_SIZE(timers) - 1;
+
+	OUT("add again: %d\n", uloop_timeout_add(&timers[0].t));
+	OUT("cancel: %d\n", uloop_timeout_cancel(&cancelled->t));
+	OUT("cancel again: %d\n", uloop_timeout_cancel(&cancelled->t));
+	OUT("pending: %s\n", cancelled->t.pending ? "yes" : "no");
+
+	uloop_timeout_set(&moved->t, 60);
+
+	OUT("fire order: ");
+	uloop_run();
+	fprintf(stdout, "\n");
+
+	OUT("next timeout: %d\n", uloop_get_next_timeout());
+	uloop_done();
+}
+
+static int64_t slow_start, next_fired;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void slow_cb(struct uloop_timeout *t)
+{
+	/* busy wait, the loop time is not refreshed meanwhile */
+	while (now_ms() - slow_start < 90)
+		;
+}
+
+static void next_cb(struct uloop_timeout *t)
+{
+	next_fired = now_ms() - slow_start;
+	uloop_end();
+}
+
+static void test_slow_callback(void)
+{
+	struct uloop_timeout slow = { .cb = slow_cb }, next = { .cb = next_cb };
+
+	uloop_init();
+	slow_start = now_ms();
+	uloop_timeout_set(&slow, 10);
+	uloop_timeout_set(&next, 100);
+	uloop_run();
+
+	OUT("next timer on time: %s\n", next_fired < 150 ? "yes" : "no");
+	uloop_done();
+}
+
+#define N_PIPES 32
+
+static struct uloop_fd pipe_fds[N_PIPES];
+static int fd_calls, fd_calls_at_timer;
+
+static void pipe_timer_cb(struct uloop_timeout *t)
+{
+	fd_calls_at_timer = fd_calls;
+}
+
+static struct uloop_timeout pipe_timer = {
+	.cb = pipe_timer_cb,
+};
+
+static void pipe_read_cb(struct uloop_fd *u, unsigned int events)
+{
+	char buf[1];
+
+	if (read(u->fd, buf, sizeof(buf)) != sizeof(buf))
+		return;
+
+	if (!fd_calls++)
+		uloop_timeout_set(&pipe_timer, 0);
+
+	if (fd_calls == N_PIPES)
+		uloop_end();
+}
+
+static void run_pipes(bool batch)
+{
+	int fds[N_PIPES][2];
+
+	uloop_init();
+	uloop_set_max_events(N_PIPES);
+	uloop_set_batch_dispatch(batch);
+
+	for (size_t i = 0; i < N_PIPES; i++) {
+		if (pipe(fds[i]) < 0)
+			exit(1);
+
+		pipe_fds[i].fd = fds[i][0];
+		pipe_fds[i].cb = pipe_read_cb;
+		uloop_fd_add(&pipe_fds[i], ULOOP_READ);
+		if (write(fds[i][1], "x", 1) != 1)
+			exit(1);
+	}
+
+	fd_calls = fd_calls_at_timer = 0;
+	uloop_run();
+
+	for (size_t i = 0; i < N_PIPES; i++) {
+		uloop_fd_delete(&pipe_fds[i]);
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+
+	uloop_timeout_cancel(&pipe_timer);
+	uloop_done();
+}
+
+static void test_fd_batch(void)
+{
+	run_pipes(false);
+	OUT("single: %d fd callbacks before timeout\n", fd_calls_at_timer);
+
+	run_pipes(true);
+	OUT("batch: %d fd callbacks before timeout\n", fd_calls_at_timer);
+}
+
+static struct uloop_fd flag_fd;
+static int flag_writes;
+
+static void flag_done_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+static struct uloop_timeout flag_done = {
+	.cb = flag_done_cb,
+};
+
+static void flag_fd_cb(struct uloop_fd *u, unsigned int events)
+{
+	if (!(events & ULOOP_WRITE))
+		return;
+
+	/* drop ULOOP_WRITE again, no further write events may be reported */
+	flag_writes++;
+	uloop_fd_add(u, ULOOP_READ | ULOOP_WRITE);
+	uloop_fd_add(u, ULOOP_READ);
+	uloop_fd_add(u, ULOOP_READ);
+}
+
+static void test_fd_flags(void)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		exit(1);
+
+	uloop_init();
+
+	flag_fd.fd = sv[0];
+	flag_fd.cb = flag_fd_cb;
+	uloop_fd_add(&flag_fd, ULOOP_READ);
+
+	/* toggling ULOOP_WRITE within one iteration must not report it */
+	uloop_fd_add(&flag_fd, ULOOP_READ | ULOOP_WRITE);
+	uloop_fd_add(&flag_fd, ULOOP_READ);
+	uloop_timeout_set(&flag_done, 20);
+	uloop_run();
+	OUT("write events after toggle: %d\n", flag_writes);
+
+	uloop_fd_add(&flag_fd, ULOOP_READ | ULOOP_WRITE);
+	uloop_timeout_set(&flag_done, 20);
+	uloop_run();
+	OUT("write events after enable: %d\n", flag_writes);
+
+	uloop_fd_delete(&flag_fd);
+	close(sv[0]);
+	close(sv[1]);
+	uloop_done();
+}
+
+static int error_calls;
+static bool error_registered;
+
+static void error_fd_cb(struct uloop_fd *u, unsigned int events)
+{
+	if (!u->error)
+		return;
+
+	/*
+	 * with ULOOP_ERROR_CB the error keeps being reported until the fd
+	 * is deleted, otherwise it is deleted before the callback runs
+	 */
+	error_registered = u->registered;
+	if (++error_calls < 3 && error_registered)
+		return;
+
+	uloop_fd_delete(u);
+	uloop_end();
+}
+
+static void test_fd_error(void)
+{
+	struct uloop_fd u = { .cb = error_fd_cb };
+	int pfd[2];
+
+	uloop_init();
+
+	/* writing to a pipe without readers reports an error */
+	if (pipe(pfd) < 0)
+		exit(1);
+	close(pfd[0]);
+
+	u.fd = pfd[1];
+	uloop_fd_add(&u, ULOOP_WRITE | ULOOP_ERROR_CB);
+	uloop_timeout_set(&flag_done, 500);
+	uloop_run();
+	OUT("error callbacks with ULOOP_ERROR_CB: %d\n", error_calls);
+
+	error_calls = 0;
+	uloop_fd_add(&u, ULOOP_WRITE);
+	uloop_timeout_set(&flag_done, 500);
+	uloop_run();
+	OUT("error callbacks without: %d, registered: %s\n", error_calls,
+	    error_registered ? "yes" : "no");
+
+	uloop_timeout_cancel(&flag_done);
+	close(pfd[1]);
+	uloop_done();
+}
+
+#define N_THREADS 4
+
+struct loop_thread {
+	pthread_t thread;
+	int id;
+	int fired;
+	struct uloop_timeout t;
+};
+
+static void thread_timer_cb(struct uloop_timeout *t)
+{
+	struct loop_thread *lt = container_of(t, struct loop_thread, t);
+
+	if (++lt->fired < 3 + lt->id)
+		uloop_timeout_set(t, 1);
+	else
+		uloop_end();
+}
+
+static void *thread_loop(void *arg)
+{
+	struct loop_thread *lt = arg;
+
+	uloop_set_backend(test_backend);
+	uloop_init();
+	lt->t.cb = thread_timer_cb;
+	uloop_timeout_set(&lt->t, 1);
+	uloop_run();
+	uloop_done();
+
+	return NULL;
+}
+
+static void test_thread_loops(void)
+{
+	struct loop_thread threads[N_THREADS] = {};
+
+	for (int i = 0; i < N_THREADS; i++) {
+		threads[i].id = i;
+		pthread_create(&threads[i].thread, NULL, thread_loop, &threads[i]);
+	}
+
+	OUT("fired:");
+	for (int i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i].thread, NULL);
+		fprintf(stdout, " %d", threads[i].fired);
+	}
+	fprintf(stdout, "\n");
+}
+
+#define N_POSTS 1000
+
+struct post_item {
+	struct uloop_post post;
+	int producer;
+	int seq;
+};
+
+static struct uloop_post_queue post_queue;
+static struct post_item post_items[N_THREADS][N_POSTS];
+static int post_next[N_THREADS];
+static int post_received;
+static bool post_in_order = true;
+
+static void post_cb(struct uloop_post *p)
+{
+	struct post_item *item = container_of(p, struct post_item, post);
+
+	if (item->seq != post_next[item->producer]++)
+		post_in_order = false;
+
+	if (++post_received == N_THREADS * N_POSTS)
+		uloop_end();
+}
+
+static void *post_thread(void *arg)
+{
+	int id = (intptr_t)arg;
+
+	for (int i = 0; i < N_POSTS; i++) {
+		struct post_item *item = &post_items[id][i];
+
+		item->producer = id;
+		item->seq = i;
+		item->post.cb = post_cb;
+		uloop_post(&post_queue, &item->post);
+	}
+
+	return NULL;
+}
+
+static void test_post(void)
+{
+	pthread_t threads[N_THREADS];
+
+	uloop_init();
+	uloop_post_queue_init(&post_queue);
+
+	for (int i = 0; i < N_THREADS; i++)
+		pthread_create(&threads[i], NULL, post_thread, (void *)(intptr_t)i);
+
+	uloop_run();
+
+	for (int i = 0; i < N_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	uloop_post_queue_done(&post_queue);
+	uloop_done();
+
+	OUT("received %d posts, in order: %s\n", post_received,
+	    post_in_order ? "yes" : "no");
+}
+
+static void stats_quick_cb(struct uloop_timeout *t)
+{
+}
+
+static void stats_slow_cb(struct uloop_timeout *t)
+{
+	usleep(5000);
+	uloop_end();
+}
+
+static void test_stats(void)
+{
+	struct uloop_timeout quick = {
+		.cb = stats_quick_cb,
+	};
+	struct uloop_timeout slow = {
+		.cb = stats_slow_cb,
+	};
+	struct uloop_stats st;
+	uint32_t late = 0;
+
+	uloop_init();
+	uloop_stats_enable(true);
+	uloop_timeout_set(&quick, 1);
+	uloop_timeout_set(&slow, 10);
+	uloop_run();
+	uloop_stats_enable(false);
+	uloop_stats_get(&st, true);
+	uloop_done();
+
+	for (int i = 0; i < ULOOP_STATS_BUCKETS; i++)
+		late += st.timer_lateness[i];
+
+	OUT("timeouts: %llu, lateness samples: %u, polled: %s\n",
+	    (unsigned long long) st.timeout_calls, late,
+	    st.iterations > 0 ? "yes" : "no");
+	OUT("slowest: %s, at least 5ms: %s\n",
+	    st.slowest_cb == (void *) stats_slow_cb ? "slow" : "other",
+	    st.slowest_usec >= 5000 ? "yes" : "no");
+
+	uloop_stats_get(&st, false);
+	OUT("after reset: %llu timeouts\n", (unsigned long long) st.timeout_calls);
+}
+
+struct slack_timer {
+	struct uloop_timeout t;
+	int msecs;
+	uint64_t iteration;
+	bool early;
+};
+
+static struct timeval slack_start;
+static int slack_pending;
+
+static void slack_cb(struct uloop_timeout *t)
+{
+	struct slack_timer *st = container_of(t, struct slack_timer, t);
+	struct uloop_stats stats;
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &slack_start, &diff);
+	/* uloop rounds down to msecs */
+	st->early = diff.tv_sec * 1000 + diff.tv_usec / 1000 + 1 < st->msecs;
+
+	uloop_stats_get(&stats, false);
+	st->iteration = stats.iterations;
+
+	if (--slack_pending == 0)
+		uloop_end();
+}
+
+static void run_slack(unsigned int slack)
+{
+	struct slack_timer timers[] = {
+		{ .msecs = 20, .t.slack = slack },
+		{ .msecs = 40, .t.slack = slack },
+		{ .msecs = 60 },
+	};
+	int wakeups = 1;
+	bool early = false;
+
+	uloop_init();
+	uloop_stats_enable(true);
+	gettimeofday(&slack_start, NULL);
+	for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+		timers[i].t.cb = slack_cb;
+		uloop_timeout_set(&timers[i].t, timers[i].msecs);
+	}
+	slack_pending = ARRAY_SIZE(timers);
+
+	uloop_run();
+	uloop_stats_enable(false);
+	uloop_done();
+
+	for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+		if (i && timers[i].iteration != timers[i - 1].iteration)
+			wakeups++;
+		early |= timers[i].early;
+	}
+
+	OUT("slack %u: %d wakeups, fired early: %s\n", slack, wakeups,
+	    early ? "yes" : "no");
+}
+
+static void test_timeout_slack(void)
+{
+	run_slack(0);
+	run_slack(50);
+}
+
+static int usr1_calls, rt_calls;
+
+static void signal_cb(struct uloop_signal *s)
+{
+	if (s->signo == SIGUSR1) {
+		usr1_calls++;
+	} else {
+		rt_calls++;
+		uloop_end();
+	}
+}
+
+static bool signal_blocked(int signo)
+{
+	sigset_t mask;
+
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+	return sigismember(&mask, signo) == 1;
+}
+
+static void test_signalfd(void)
+{
+	struct uloop_signal usr1 = { .cb = signal_cb, .signo = SIGUSR1 };
+	struct uloop_signal rt = { .cb = signal_cb, .signo = SIGRTMIN + 2 };
+	struct sigaction sa;
+	int status, ret;
+	pid_t pid;
+
+	uloop_use_signalfd = true;
+	uloop_init();
+	uloop_signal_add(&usr1);
+	uloop_signal_add(&rt);
+
+	sigaction(SIGUSR1, NULL, &sa);
+	OUT("handler: %s, blocked: %s\n", sa.sa_handler == SIG_DFL ? "none" : "set",
+	    signal_blocked(SIGUSR1) ? "yes" : "no");
+
+	/* the child gets the original mask */
+	pid = fork();
+	if (!pid)
+		_exit(signal_blocked(SIGUSR1) || signal_blocked(SIGTERM));
+	waitpid(pid, &status, 0);
+	OUT("child blocked: %s\n", WEXITSTATUS(status) ? "yes" : "no");
+
+	kill(getpid(), SIGUSR1);
+	kill(getpid(), SIGUSR1);
+	kill(getpid(), SIGRTMIN + 2);
+	uloop_run();
+	OUT("usr1 %d, rt %d\n", usr1_calls, rt_calls);
+
+	kill(getpid(), SIGTERM);
+	ret = uloop_run();
+	OUT("sigterm: %s\n", ret == SIGTERM ? "loop ended" : "missed");
+
+	uloop_signal_delete(&usr1);
+	uloop_signal_delete(&rt);
+	uloop_done();
+	uloop_use_signalfd = false;
+
+	OUT("after done: blocked %s\n",
+	    signal_blocked(SIGUSR1) || signal_blocked(SIGTERM) ? "yes" : "no");
+}
+
+#define N_PROCS		100
+
+struct child {
+	struct uloop_process proc[2];
+	int code;
+};
+
+static int procs_pending, procs_wrong;
+
+static void proc_done(struct child *c, int ret)
+{
+	if (!WIFEXITED(ret) || WEXITSTATUS(ret) != c->code)
+		procs_wrong++;
+
+	if (--procs_pending == 0)
+		uloop_end();
+}
+
+static void proc_cb(struct uloop_process *p, int ret)
+{
+	proc_done(container_of(p, struct child, proc[0]), ret);
+}
+
+static void proc_dup_cb(struct uloop_process *p, int ret)
+{
+	struct child *c = container_of(p, struct child, proc[1]);
+
+	/* entries for the same pid are called in the order they were added */
+	if (c->proc[0].pending)
+		procs_wrong++;
+
+	proc_done(c, ret);
+}
+
+static void test_processes(void)
+{
+	static struct child children[N_PROCS];
+	int n_dup = 0;
+
+	uloop_init();
+
+	for (int i = 0; i < N_PROCS; i++) {
+		struct child *c = &children[N_PROCS - 1 - i];
+		pid_t pid = fork();
+
+		if (pid < 0)
+			exit(1);
+
+		if (!pid)
+			_exit(i);
+
+		/* register in descending pid order, every third one twice */
+		c->code = i;
+		c->proc[0].pid = pid;
+		c->proc[0].cb = proc_cb;
+		procs_pending++;
+		if (!(i % 3)) {
+			c->proc[1].pid = pid;
+			c->proc[1].cb = proc_dup_cb;
+			procs_pending++;
+			n_dup++;
+		}
+	}
+
+	for (int i = 0; i < N_PROCS; i++) {
+		uloop_process_add(&children[i].proc[0]);
+		if (children[i].proc[1].cb)
+			uloop_process_add(&children[i].proc[1]);
+	}
+
+	uloop_run();
+	uloop_done();
+
+	OUT("%d children, %d registered twice, %d pending, %d wrong\n",
+	    N_PROCS, n_dup, procs_pending, procs_wrong);
+}
+
+static void test_spawn(void)
+{
+	static struct child children[N_PROCS];
+	char *env[] = { "SPAWN_TEST=from env", NULL };
+	char *sh[] = { "sh", "-c", "echo $SPAWN_TEST; echo to stderr >&2; exit 7", NULL };
+	char *missing[] = { "/nonexistent/binary", NULL };
+	struct uloop_process missing_proc = { .cb = proc_cb };
+	struct child *c = &children[0];
+	struct uloop_spawn_attr attr = {};
+	char buf[64] = {};
+	int fds[3], out[2];
+	ssize_t len;
+
+	uloop_init();
+	procs_pending = procs_wrong = 0;
+
+	/* stdout and stderr both go to the pipe, stdin is /dev/null */
+	if (pipe(out) < 0)
+		exit(1);
+	fds[0] = -1;
+	fds[1] = fds[2] = out[1];
+	attr.fds = fds;
+	attr.n_fds = 3;
+	attr.envp = env;
+
+	c->code = 7;
+	c->proc[0].cb = proc_cb;
+	OUT("spawn: %d\n", uloop_process_spawn(&c->proc[0], sh, &attr));
+	close(out[1]);
+	procs_pending++;
+
+	OUT("missing: %d\n", uloop_process_spawn(&missing_proc, missing, NULL));
+
+	for (int i = 1; i < N_PROCS; i++) {
+		char *argv[] = { "true", NULL };
+
+		children[i].proc[0].cb = proc_cb;
+		if (!uloop_process_spawn(&children[i].proc[0], argv, NULL))
+			procs_pending++;
+	}
+
+	uloop_run();
+	uloop_done();
+
+	len = read(out[0], buf, sizeof(buf) - 1);
+	close(out[0]);
+	OUT("%d children, %d pending, %d wrong, output: %s", N_PROCS,
+	    procs_pending, procs_wrong, len > 0 ? buf : "none\n");
+}
+
+static bool fallback_read;
+
+static void fallback_fd_cb(struct uloop_fd *u, unsigned int events)
+{
+	fallback_read = true;
+	uloop_end();
+}
+
+static int fallback_child(void)
+{
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_io_uring_setup, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = ARRAY_SIZE(filter),
+		.filter = filter,
+	};
+	struct uloop_fd u = { .cb = fallback_fd_cb };
+	int fds[2];
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) ||
+	    prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog))
+		return 2;
+
+	uloop_init();
+	if (uloop_get_backend() != ULOOP_BACKEND_EPOLL)
+		return 1;
+
+	/* the fallback has to deliver events as well */
+	if (pipe(fds) || write(fds[1], "x", 1) != 1)
+		return 2;
+
+	u.fd = fds[0];
+	uloop_fd_add(&u, ULOOP_READ);
+	uloop_run_timeout(1000);
+	uloop_fd_delete(&u);
+
+	return fallback_read ? 0 : 1;
+}
+
+static void test_backend_fallback(void)
+{
+	int status;
+	pid_t pid;
+
+	/* io_uring_setup() fails in the child, uloop_init must use epoll */
+	pid = fork();
+	if (!pid)
+		_exit(fallback_child());
+
+	waitpid(pid, &status, 0);
+	OUT("without kernel support: %s\n",
+	    !WEXITSTATUS(status) ? "epoll" : "failed");
+}
+
+/*
+ * "test-uloop io_uring" runs the same scenarios on the io_uring backend and
+ * exits with 77 if it is not built in or not supported by the kernel.
+ */
+static void set_backend(const char *name)
+{
+	if (strcmp(name, "io_uring") != 0 ||
+	    uloop_set_backend(ULOOP_BACKEND_IO_URING) < 0)
+		exit(77);
+
+	/* uloop_init falls back to epoll without kernel support */
+	uloop_init();
+	if (uloop_get_backend() != ULOOP_BACKEND_IO_URING)
+		exit(77);
+	uloop_done();
+
+	test_backend = ULOOP_BACKEND_IO_URING;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		set_backend(argv[1]);
+		test_backend_fallback();
+	}
+
+	test_timeout_order();
+	test_slow_callback();
+	test_fd_batch();
+	test_fd_flags();
+	test_fd_error();
+	test_thread_loops();
+	test_post();
+	test_stats();
+	test_timeout_slack();
+	test_signalfd();
+	test_processes();
+	test_spawn();
+
+	return 0;
+}
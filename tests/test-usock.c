@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+#include "uloop.h"
+#include "usock.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+struct request {
+	const char *name;
+	struct usock_async a;
+	int timeout;
+	int fd;
+	bool done;
+};
+
+static int pending;
+
+static void connect_cb(struct usock_async *a, int fd)
+{
+	struct request *r = container_of(a, struct request, a);
+
+	r->fd = fd;
+	r->done = true;
+	if (--pending == 0)
+		uloop_end();
+}
+
+static const char *result(struct request *r)
+{
+	static char buf[64];
+
+	if (!r->done)
+		return "no callback";
+
+	if (r->fd < 0) {
+		snprintf(buf, sizeof(buf), "failed (%s)",
+			 r->a.error == ECONNREFUSED ? "refused" :
+			 r->a.error == ETIMEDOUT ? "timeout" :
+			 r->a.error < 0 ? "resolve" : "other");
+		return buf;
+	}
+
+	snprintf(buf, sizeof(buf), "connected (%s)",
+		 r->a.addr.ss_family == AF_INET ? "inet" : "other");
+	close(r->fd);
+
+	return buf;
+}
+
+static int listen_port(int *port)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int fd;
+
+	fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NUMERIC | USOCK_IPV4ONLY,
+		   "127.0.0.1", "0");
+	if (fd < 0 || getsockname(fd, (struct sockaddr *) &sin, &len))
+		exit(1);
+
+	*port = ntohs(sin.sin_port);
+
+	return fd;
+}
+
+static void start(struct request *r, int type, const char *host, int port)
+{
+	char service[8];
+
+	snprintf(service, sizeof(service), "%d", port);
+	r->a.cb = connect_cb;
+	r->a.timeout = r->timeout ? r->timeout : 5000;
+	if (usock_inet_async(&r->a, type, host, service) == 0)
+		pending++;
+	else
+		OUT("%s: not started\n", r->name);
+}
+
+static void test_async(void)
+{
+	struct request reqs[] = {
+		{ .name = "numeric" },
+		{ .name = "resolved" },
+		{ .name = "refused" },
+		{ .name = "bad address" },
+		{ .name = "cancelled" },
+		{ .name = "timeout while resolving", .timeout = 50 },
+	};
+	int lfd, closed_fd, port, closed_port;
+
+	uloop_init();
+
+	lfd = listen_port(&port);
+	closed_fd = listen_port(&closed_port);
+	close(closed_fd);
+
+	start(&reqs[0], USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", port);
+	start(&reqs[1], USOCK_TCP, "localhost", port);
+	start(&reqs[2], USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", closed_port);
+	start(&reqs[3], USOCK_TCP | USOCK_NUMERIC, "localhost", port);
+	start(&reqs[4], USOCK_TCP, "localhost", port);
+	usock_async_cancel(&reqs[4].a);
+	pending--;
+
+	/* expire the timeout before the loop sees the lookup result */
+	start(&reqs[5], USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", port);
+	usleep(100 * 1000);
+
+	OUT("server: %s\n", usock_inet_async(&reqs[4].a, USOCK_TCP | USOCK_SERVER,
+					     "127.0.0.1", "0") ? "rejected" : "started");
+
+	uloop_run();
+
+	/* give the cancelled lookup a chance to return and clean up */
+	uloop_run_timeout(200);
+
+	for (size_t i = 0; i < ARRAY_SIZE(reqs); i++)
+		OUT("%s: %s\n", reqs[i].name, result(&reqs[i]));
+
+	close(lfd);
+	uloop_done();
+}
+
+#define N_CLIENTS	32
+
+static int accepted, accepted_shard[2];
+static struct usock_listener listeners[2];
+
+static void accept_cb(struct usock_listener *l, int fd,
+		      struct sockaddr_storage *addr)
+{
+	accepted_shard[l - listeners]++;
+	close(fd);
+
+	if (++accepted == N_CLIENTS)
+		uloop_end();
+}
+
+static int sock_port(int fd)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if (getsockname(fd, (struct sockaddr *) &sin, &len))
+		return -1;
+
+	return ntohs(sin.sin_port);
+}
+
+static void test_shards(void)
+{
+	struct usock_listen_opts opts = {
+		.backlog = 64,
+		.defer_accept = 1,
+		.fastopen = 16,
+	};
+	int fds[2], clients[N_CLIENTS], n;
+	char service[8];
+
+	uloop_init();
+
+	n = usock_listen_shards(USOCK_TCP | USOCK_NUMERIC | USOCK_IPV4ONLY,
+				"127.0.0.1", "0", &opts, fds, 2);
+	OUT("%d shards, same port: %s\n", n,
+	    n == 2 && sock_port(fds[0]) == sock_port(fds[1]) ? "yes" : "no");
+	if (n != 2)
+		return;
+
+	for (int i = 0; i < 2; i++) {
+		listeners[i].accept_cb = accept_cb;
+		usock_listener_add(&listeners[i], fds[i]);
+	}
+
+	/* clients send data right away, so deferred accepts still complete */
+	snprintf(service, sizeof(service), "%d", sock_port(fds[0]));
+	for (int i = 0; i < N_CLIENTS; i++) {
+		clients[i] = usock(USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", service);
+		if (clients[i] < 0 || write(clients[i], "x", 1) != 1)
+			exit(1);
+	}
+
+	uloop_run();
+	OUT("accepted %d, per shard counts match: %s\n", accepted,
+	    accepted_shard[0] + accepted_shard[1] == N_CLIENTS ? "yes" : "no");
+
+	for (int i = 0; i < N_CLIENTS; i++)
+		close(clients[i]);
+	for (int i = 0; i < 2; i++) {
+		usock_listener_delete(&listeners[i]);
+		close(fds[i]);
+	}
+	uloop_done();
+}
+
+#define N_PENDING	4
+
+static struct rlimit saved_limit;
+static int limited_accepts;
+
+static void limit_accept_cb(struct usock_listener *l, int fd,
+			    struct sockaddr_storage *addr)
+{
+	close(fd);
+	if (++limited_accepts == N_PENDING)
+		uloop_end();
+}
+
+static void restore_limit_cb(struct uloop_timeout *t)
+{
+	setrlimit(RLIMIT_NOFILE, &saved_limit);
+}
+
+static void give_up_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+static void delete_accept_cb(struct usock_listener *l, int fd,
+			     struct sockaddr_storage *addr)
+{
+	close(fd);
+	limited_accepts++;
+
+	/* the remaining backlog must not be accepted through a freed listener */
+	usock_listener_delete(l);
+	free(l);
+}
+
+static void test_listener(void)
+{
+	struct uloop_timeout restore = { .cb = restore_limit_cb };
+	struct uloop_timeout give_up = { .cb = give_up_cb };
+	struct usock_listener *l;
+	struct rlimit limit;
+	int lfd, clients[N_PENDING], next_fd;
+	char service[8];
+
+	uloop_init();
+	lfd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NUMERIC | USOCK_IPV4ONLY,
+		    "127.0.0.1", "0");
+	snprintf(service, sizeof(service), "%d", sock_port(lfd));
+	for (int i = 0; i < N_PENDING; i++)
+		clients[i] = usock(USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", service);
+
+	/* no fd is left for accept until the limit is restored */
+	next_fd = dup(0);
+	close(next_fd);
+	getrlimit(RLIMIT_NOFILE, &saved_limit);
+	limit = saved_limit;
+	limit.rlim_cur = next_fd;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	l = calloc(1, sizeof(*l));
+	l->accept_cb = limit_accept_cb;
+	usock_listener_add(l, lfd);
+	uloop_timeout_set(&restore, 50);
+	uloop_timeout_set(&give_up, 2000);
+	uloop_run();
+	OUT("accepted after fd limit: %d of %d\n", limited_accepts, N_PENDING);
+	usock_listener_delete(l);
+	free(l);
+	uloop_timeout_cancel(&restore);
+
+	for (int i = 0; i < N_PENDING; i++) {
+		close(clients[i]);
+		clients[i] = usock(USOCK_TCP | USOCK_NUMERIC, "127.0.0.1", service);
+	}
+
+	limited_accepts = 0;
+	l = calloc(1, sizeof(*l));
+	l->accept_cb = delete_accept_cb;
+	usock_listener_add(l, lfd);
+	uloop_timeout_set(&give_up, 100);
+	uloop_run();
+	OUT("accepted before delete: %d\n", limited_accepts);
+
+	uloop_timeout_cancel(&give_up);
+	for (int i = 0; i < N_PENDING; i++)
+		close(clients[i]);
+	close(lfd);
+	uloop_done();
+}
+
+int main()
+{
+	test_async();
+	test_shards();
+	test_listener();
+
+	return 0;
+}
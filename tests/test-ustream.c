@@ -0,0 +1,626 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "blobmsg.h"
+#include "ustream.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+#define DATA_LEN	(256 * 1024)
+
+static struct ustream_fd writer, reader;
+static char *data;
+static int received;
+static bool data_ok = true;
+
+static void reader_notify_read(struct ustream *s, int bytes)
+{
+	char *buf;
+	int len;
+
+	while ((buf = ustream_get_read_buf(s, &len)) != NULL) {
+		if (received + len > DATA_LEN ||
+		    memcmp(buf, data + received, len) != 0)
+			data_ok = false;
+
+		received += len;
+		ustream_consume(s, len);
+	}
+
+	if (received >= DATA_LEN)
+		uloop_end();
+}
+
+static void reader_notify_read_records(struct ustream *s, int bytes)
+{
+	char rec[1000];
+
+	/* only consume complete records, leaving partial ones buffered */
+	while (ustream_pending_data(s, false) >= (int)sizeof(rec) ||
+	       (received + ustream_pending_data(s, false) == DATA_LEN &&
+		received < DATA_LEN)) {
+		int len = ustream_read(s, rec, sizeof(rec));
+
+		if (memcmp(rec, data + received, len) != 0)
+			data_ok = false;
+
+		received += len;
+	}
+
+	if (received >= DATA_LEN)
+		uloop_end();
+}
+
+static void init_pair_pool(struct ustream_buf_pool *pool)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		exit(1);
+
+	memset(&writer, 0, sizeof(writer));
+	memset(&reader, 0, sizeof(reader));
+	if (pool) {
+		ustream_set_buf_pool(&writer.stream, pool);
+		ustream_set_buf_pool(&reader.stream, pool);
+	}
+	reader.stream.notify_read = reader_notify_read;
+	ustream_fd_init(&writer, sv[0]);
+	ustream_fd_init(&reader, sv[1]);
+	received = 0;
+	data_ok = true;
+}
+
+static void init_pair(void)
+{
+	init_pair_pool(NULL);
+}
+
+static void free_pair(void)
+{
+	ustream_free(&writer.stream);
+	ustream_free(&reader.stream);
+	close(writer.fd.fd);
+	close(reader.fd.fd);
+}
+
+static void test_write_buffered(bool iov)
+{
+	uloop_init();
+	init_pair();
+
+	if (!iov)
+		writer.stream.write_iov = NULL;
+
+	/* queue data in many small chunks, most of it ends up buffered */
+	for (int i = 0; i < DATA_LEN; i += 1000) {
+		int len = DATA_LEN - i < 1000 ? DATA_LEN - i : 1000;
+
+		ustream_write(&writer.stream, data + i, len, true);
+	}
+
+	uloop_run();
+	OUT("%s: received %d bytes, data %s, pending %d\n", iov ? "writev" : "write",
+	    received, data_ok ? "ok" : "corrupt",
+	    ustream_pending_data(&writer.stream, true));
+
+	free_pair();
+	uloop_done();
+}
+
+static void test_writev(bool iov)
+{
+	struct iovec vec[3];
+
+	uloop_init();
+	init_pair();
+
+	if (!iov)
+		writer.stream.write_iov = NULL;
+
+	/* three pieces per call, the socket fills up quickly */
+	for (int i = 0; i < DATA_LEN; i += 3000) {
+		for (int j = 0; j < 3; j++) {
+			int ofs = i + j * 1000;
+			int len = DATA_LEN - ofs < 1000 ? DATA_LEN - ofs : 1000;
+
+			vec[j].iov_base = data + ofs;
+			vec[j].iov_len = len > 0 ? len : 0;
+		}
+		ustream_writev(&writer.stream, vec, 3, true);
+	}
+
+	uloop_run();
+	OUT("%s: received %d bytes, data %s, pending %d\n", iov ? "writev" : "write",
+	    received, data_ok ? "ok" : "corrupt",
+	    ustream_pending_data(&writer.stream, true));
+
+	free_pair();
+	uloop_done();
+}
+
+static int ext_done;
+
+static void ext_done_cb(struct ustream *s, void *priv)
+{
+	ext_done += (intptr_t)priv;
+}
+
+static void test_write_ext(void)
+{
+	uloop_init();
+	init_pair();
+
+	/* alternate copied and external chunks, order must be kept */
+	ext_done = 0;
+	for (int i = 0; i < DATA_LEN; i += 1000) {
+		int len = DATA_LEN - i < 1000 ? DATA_LEN - i : 1000;
+
+		if ((i / 1000) % 2)
+			ustream_write_ext(&writer.stream, data + i, len, true,
+					  ext_done_cb, (void *)(intptr_t)1);
+		else
+			ustream_write(&writer.stream, data + i, len, true);
+	}
+
+	uloop_run();
+	OUT("received %d bytes, data %s, done %d, pending %d\n",
+	    received, data_ok ? "ok" : "corrupt", ext_done,
+	    ustream_pending_data(&writer.stream, true));
+
+	free_pair();
+	uloop_done();
+}
+
+static void test_sendfile(void)
+{
+	char path[] = "/tmp/test-ustream.XXXXXX";
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		exit(1);
+
+	unlink(path);
+	if (write(fd, data, DATA_LEN) != DATA_LEN)
+		exit(1);
+
+	uloop_init();
+	init_pair();
+
+	/* a copied head, then the rest of the file from an unaligned offset */
+	ustream_write(&writer.stream, data, 100, true);
+	OUT("queued %d bytes\n",
+	    100 + (int) ustream_fd_sendfile(&writer, fd, 100, DATA_LEN - 100));
+	close(fd);
+
+	uloop_run();
+	OUT("received %d bytes, data %s, pending %d\n",
+	    received, data_ok ? "ok" : "corrupt",
+	    ustream_pending_data(&writer.stream, true));
+
+	free_pair();
+	uloop_done();
+}
+
+static void test_sendfile_mapped(void)
+{
+	char path[] = "/tmp/test-ustream.XXXXXX";
+	int head = DATA_LEN / 4, size = 4096;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		exit(1);
+
+	unlink(path);
+	if (write(fd, data, DATA_LEN) != DATA_LEN)
+		exit(1);
+
+	uloop_init();
+	init_pair();
+
+	/* keep part of the head buffered so that the rest has to be mapped */
+	setsockopt(writer.fd.fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	ustream_write(&writer.stream, data, head, false);
+	OUT("head buffered: %s\n", writer.stream.w.data_bytes ? "yes" : "no");
+
+	/* asking for more than the file holds only queues up to its end */
+	OUT("queued %d bytes\n",
+	    head + (int) ustream_fd_sendfile(&writer, fd, head, DATA_LEN));
+	OUT("queued past the end: %d bytes\n",
+	    (int) ustream_fd_sendfile(&writer, fd, DATA_LEN + 1, 100));
+	close(fd);
+
+	uloop_run();
+	OUT("received %d bytes, data %s, pending %d\n",
+	    received, data_ok ? "ok" : "corrupt",
+	    ustream_pending_data(&writer.stream, true));
+
+	free_pair();
+	uloop_done();
+}
+
+static void test_read_records(int max_buffers)
+{
+	uloop_init();
+	init_pair();
+
+	reader.stream.notify_read = reader_notify_read_records;
+	reader.stream.r.max_buffers = max_buffers;
+	ustream_write(&writer.stream, data, DATA_LEN, false);
+
+	uloop_run();
+	OUT("%d buffers: received %d bytes, data %s\n", max_buffers, received,
+	    data_ok ? "ok" : "corrupt");
+
+	free_pair();
+	uloop_done();
+}
+
+static bool contiguous;
+
+static void reader_notify_read_ring(struct ustream *s, int bytes)
+{
+	char *buf;
+	int len;
+
+	/* consume in odd sized steps, the read position keeps wrapping */
+	while ((buf = ustream_get_read_buf(s, &len)) != NULL &&
+	       (len >= 1000 || received + len == DATA_LEN)) {
+		if (len != ustream_pending_data(s, false))
+			contiguous = false;
+
+		if (s->string_data && buf[len] != 0)
+			data_ok = false;
+
+		if (len > 1000)
+			len = 1000;
+
+		if (memcmp(buf, data + received, len) != 0)
+			data_ok = false;
+
+		received += len;
+		ustream_consume(s, len);
+	}
+
+	if (received >= DATA_LEN)
+		uloop_end();
+}
+
+static void test_read_cbuf(bool string_data)
+{
+	uloop_init();
+	init_pair();
+
+	reader.stream.notify_read = reader_notify_read_ring;
+	reader.stream.string_data = string_data;
+	ustream_set_read_cbuf(&reader.stream, 10000);
+	contiguous = true;
+	ustream_write(&writer.stream, data, DATA_LEN, false);
+
+	uloop_run();
+	OUT("%s: buffer %d, received %d bytes, data %s, contiguous %s\n",
+	    string_data ? "string" : "raw", reader.stream.r.buffer_len, received,
+	    data_ok ? "ok" : "corrupt", contiguous ? "yes" : "no");
+
+	free_pair();
+	uloop_done();
+}
+
+static struct ustream_fd relay_in, relay_out;
+static struct ustream_forward fwd;
+static bool was_blocked, user_block, user_kept;
+static uint64_t blocked_bytes, user_bytes;
+
+/* everything read from relay_in so far */
+static uint64_t relay_taken(void)
+{
+	return fwd.bytes + fwd.pipe_bytes + relay_in.stream.r.data_bytes;
+}
+
+static void relay_user_unblock(struct uloop_timeout *t)
+{
+	user_kept = relay_taken() == user_bytes;
+	ustream_set_read_blocked(&relay_in.stream, false);
+}
+
+static struct uloop_timeout user_timeout = { .cb = relay_user_unblock };
+
+static void relay_unblock(struct uloop_timeout *t)
+{
+	/* the reader has not consumed anything yet, the relay must wait */
+	was_blocked = relay_in.stream.read_blocked & READ_BLOCKED_FORWARD;
+	blocked_bytes = fwd.bytes;
+	ustream_set_read_blocked(&reader.stream, false);
+
+	/* draining dst must not lift a block set by the user */
+	if (user_block) {
+		user_bytes = relay_taken();
+		ustream_set_read_blocked(&relay_in.stream, true);
+		uloop_timeout_set(&user_timeout, 100);
+	}
+}
+
+static void test_forward(bool splice, int max_buffers, bool user)
+{
+	struct uloop_timeout t = { .cb = relay_unblock };
+	int sv[2];
+	bool spliced;
+
+	uloop_init();
+	init_pair();
+
+	/* writer -> relay_in, relay_out -> reader */
+	memset(&relay_in, 0, sizeof(relay_in));
+	memset(&relay_out, 0, sizeof(relay_out));
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		exit(1);
+	ustream_free(&reader.stream);
+	ustream_fd_init(&relay_in, reader.fd.fd);
+	ustream_fd_init(&relay_out, sv[0]);
+	ustream_fd_init(&reader, sv[1]);
+	if (max_buffers)
+		relay_out.stream.w.max_buffers = max_buffers;
+
+	if (splice)
+		spliced = ustream_fd_forward_init(&fwd, &relay_in, &relay_out, 4096);
+	else
+		ustream_forward_init(&fwd, &relay_in.stream, &relay_out.stream, 4096);
+
+	user_block = user;
+	user_kept = false;
+	ustream_set_read_blocked(&reader.stream, true);
+	uloop_timeout_set(&t, 100);
+	ustream_write(&writer.stream, data, DATA_LEN, false);
+
+	uloop_run();
+	/* all data may have been read before the block */
+	if (user_timeout.pending)
+		user_kept = relay_taken() == user_bytes;
+	OUT("%s%s: received %d bytes, data %s, forwarded %llu, blocked %s\n",
+	    !splice ? "copy" : spliced ? "splice" : "no splice",
+	    max_buffers ? " with one write buffer" : user ? " with user block" : "",
+	    received, data_ok ? "ok" : "corrupt", (unsigned long long) fwd.bytes,
+	    was_blocked && blocked_bytes < DATA_LEN ? "yes" : "no");
+	if (user)
+		OUT("user block kept: %s\n", user_kept ? "yes" : "no");
+	uloop_timeout_cancel(&user_timeout);
+	OUT("relay buffers used: %s\n",
+	    relay_in.stream.r.head || relay_out.stream.w.head ? "yes" : "no");
+
+	ustream_forward_done(&fwd);
+	ustream_free(&relay_in.stream);
+	ustream_free(&relay_out.stream);
+	close(relay_in.fd.fd);
+	close(relay_out.fd.fd);
+	free_pair();
+	uloop_done();
+}
+
+static struct ustream_fd quiet;
+static int received_at_quiet = -1;
+
+static void quiet_notify_read(struct ustream *s, int bytes)
+{
+	ustream_consume(s, bytes);
+	received_at_quiet = received;
+}
+
+static void test_read_budget(int budget)
+{
+	int bulk[2], small[2];
+
+	if (pipe(bulk) < 0 || pipe(small) < 0)
+		exit(1);
+
+	/* everything is ready before the loop starts, the bulk fd first */
+	if (fcntl(bulk[1], F_SETPIPE_SZ, DATA_LEN) < DATA_LEN ||
+	    write(bulk[1], data, DATA_LEN) != DATA_LEN ||
+	    write(small[1], "ping", 4) != 4)
+		exit(1);
+
+	uloop_init();
+	memset(&reader, 0, sizeof(reader));
+	memset(&quiet, 0, sizeof(quiet));
+	reader.stream.notify_read = reader_notify_read;
+	reader.read_budget = budget;
+	quiet.stream.notify_read = quiet_notify_read;
+	ustream_fd_init(&reader, bulk[0]);
+	ustream_fd_init(&quiet, small[0]);
+	received = 0;
+	received_at_quiet = -1;
+	data_ok = true;
+
+	uloop_run();
+	OUT("budget %d: received %d bytes, data %s\n", budget, received,
+	    data_ok ? "ok" : "corrupt");
+	if (received_at_quiet < 0) {
+		OUT("budget %d: other fd waited for all data\n", budget);
+	} else {
+		OUT("budget %d: other fd served after %d bytes\n", budget,
+		    received_at_quiet);
+	}
+
+	ustream_free(&reader.stream);
+	ustream_free(&quiet.stream);
+	close(bulk[0]);
+	close(bulk[1]);
+	close(small[0]);
+	close(small[1]);
+	uloop_done();
+}
+
+static void test_buf_pool(void)
+{
+	struct ustream_buf_pool pool;
+	bool ok = true;
+
+	ustream_buf_pool_init(&pool, 4096, 8);
+	uloop_init();
+
+	for (int i = 0; i < 3; i++) {
+		init_pair_pool(&pool);
+		ustream_write(&writer.stream, data, DATA_LEN, false);
+		uloop_run();
+
+		if (received != DATA_LEN || !data_ok)
+			ok = false;
+
+		free_pair();
+	}
+
+	OUT("data %s, reused: %s, cached: %d\n", ok ? "ok" : "corrupt",
+	    pool.hits > 0 ? "yes" : "no", pool.buffers);
+
+	uloop_done();
+	ustream_buf_pool_done(&pool);
+}
+
+static void test_stats(void)
+{
+	struct ustream_stats wst = {}, rst = {};
+	struct ustream_stats *lst = ustream_loop_stats();
+
+	uloop_init();
+	init_pair();
+	ustream_set_stats(&writer.stream, &wst);
+	ustream_set_stats(&reader.stream, &rst);
+
+	ustream_write(&writer.stream, data, DATA_LEN, false);
+	uloop_run();
+
+	OUT("writer: %llu bytes written, buffered: %s, again: %s\n",
+	    (unsigned long long) wst.write_bytes,
+	    wst.max_write_buffered > 0 ? "yes" : "no",
+	    wst.write_again > 0 ? "yes" : "no");
+	OUT("reader: %llu bytes read, calls: %s\n",
+	    (unsigned long long) rst.read_bytes,
+	    rst.read_calls > 1 ? "yes" : "no");
+	OUT("loop: %llu bytes read, %llu bytes written\n",
+	    (unsigned long long) lst->read_bytes,
+	    (unsigned long long) lst->write_bytes);
+
+	free_pair();
+	uloop_done();
+}
+
+static char *expect;
+static int expect_len;
+
+static void reader_notify_read_expect(struct ustream *s, int bytes)
+{
+	char *buf;
+	int len;
+
+	while ((buf = ustream_get_read_buf(s, &len)) != NULL) {
+		if (received + len > expect_len ||
+		    memcmp(buf, expect + received, len) != 0)
+			data_ok = false;
+
+		received += len;
+		ustream_consume(s, len);
+	}
+
+	if (received >= expect_len)
+		uloop_end();
+}
+
+static void fill_msg(struct blob_buf *b, int entries)
+{
+	void *c;
+
+	c = blobmsg_open_table(b, "data");
+	for (int i = 0; i < entries; i++)
+		blobmsg_add_u32(b, "value", i);
+	blobmsg_close_table(b, c);
+	blobmsg_add_string(b, "end", "done");
+}
+
+static void test_blob_write(void)
+{
+	static const int sizes[] = { 4, 20000, 10, 0, 5000 };
+	struct ustream_blob_buf ub;
+	struct blob_buf b = {};
+	int queued = 0;
+
+	uloop_init();
+	init_pair();
+	reader.stream.notify_read = reader_notify_read_expect;
+
+	/* the same messages built the regular way */
+	expect = NULL;
+	expect_len = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		blobmsg_buf_init(&b);
+		fill_msg(&b, sizes[i]);
+		expect = realloc(expect, expect_len + blob_raw_len(b.head));
+		memcpy(expect + expect_len, b.head, blob_raw_len(b.head));
+		expect_len += blob_raw_len(b.head);
+	}
+	blob_buf_free(&b);
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		ustream_blob_buf_init(&ub, &writer.stream, BLOBMSG_TYPE_TABLE);
+		fill_msg(&ub.buf, sizes[i]);
+		queued += ustream_blob_buf_write(&ub, true);
+	}
+
+	/* dropped messages leave no trace in the stream */
+	ustream_blob_buf_init(&ub, &writer.stream, BLOBMSG_TYPE_TABLE);
+	fill_msg(&ub.buf, 1000);
+	ustream_blob_buf_free(&ub);
+
+	uloop_run();
+	OUT("queued %s, received %s, data %s, pending %d\n",
+	    queued == expect_len ? "all" : "partial",
+	    received == expect_len ? "all" : "partial",
+	    data_ok ? "ok" : "corrupt",
+	    ustream_pending_data(&writer.stream, true));
+
+	free(expect);
+	free_pair();
+	uloop_done();
+}
+
+int main()
+{
+	data = malloc(DATA_LEN);
+	for (int i = 0; i < DATA_LEN; i++)
+		data[i] = i * 7 + i / 251;
+
+	test_write_buffered(false);
+	test_write_buffered(true);
+	test_writev(false);
+	test_writev(true);
+	test_write_ext();
+	test_sendfile();
+	test_sendfile_mapped();
+	test_buf_pool();
+	test_read_records(1);
+	test_read_records(4);
+	test_read_cbuf(false);
+	test_read_cbuf(true);
+	test_read_budget(0);
+	test_read_budget(16384);
+	test_forward(false, 0, false);
+	test_forward(false, 1, false);
+	test_forward(false, 0, true);
+	test_forward(true, 0, false);
+	test_forward(true, 0, true);
+	test_stats();
+	test_blob_write();
+
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl-cmp.h"
+#include "vlist.h"
+#include "utils.h"
+
+#define OUT(fmt, ...) do { \
+	fprintf(stdout, "%s: " fmt, __func__, ## __VA_ARGS__); \
+} while (0);
+
+struct item {
+	struct vlist_node node;
+	char name[16];
+	int value;
+};
+
+static int n_add, n_del, n_change;
+
+static void item_update(struct vlist_tree *tree, struct vlist_node *node_new,
+			struct vlist_node *node_old)
+{
+	if (node_new && node_old)
+		n_change++;
+	else if (node_new)
+		n_add++;
+	else
+		n_del++;
+
+	/* with keep_old, the new node of a change is not linked in */
+	if (node_new && node_old && tree->keep_old)
+		free(container_of(node_new, struct item, node));
+	else if (node_old)
+		free(container_of(node_old, struct item, node));
+}
+
+static bool item_equal(struct vlist_tree *tree, struct vlist_node *node_new,
+		       struct vlist_node *node_old)
+{
+	struct item *a = container_of(node_new, struct item, node);
+	struct item *b = container_of(node_old, struct item, node);
+
+	return a->value == b->value;
+}
+
+static struct vlist_node *item_new(int key, int value)
+{
+	struct item *it = calloc(1, sizeof(*it));
+
+	snprintf(it->name, sizeof(it->name), "k%04d", key);
+	it->value = value;
+	it->node.avl.key = it->name;
+
+	return &it->node;
+}
+
+static void bulk(struct vlist_tree *tree, int from, int to, int step,
+		 int value, int bump)
+{
+	struct vlist_node *nodes[1000];
+	size_t n = 0;
+	int ret;
+
+	for (int i = from; i < to; i += step)
+		nodes[n++] = item_new(i, value + (i % bump == 0));
+
+	n_add = n_del = n_change = 0;
+	ret = vlist_bulk_update(tree, nodes, n);
+
+	/* unchanged nodes are handed back */
+	for (size_t i = 0; i < n; i++)
+		free(nodes[i] ? container_of(nodes[i], struct item, node) : NULL);
+
+	OUT("ret %d, added %d, deleted %d, changed %d, size %d\n",
+	    ret, n_add, n_del, n_change, tree->avl.count);
+}
+
+static void dump(struct vlist_tree *tree)
+{
+	struct item *it, *prev = NULL;
+	bool sorted = true;
+	int sum = 0;
+
+	vlist_for_each_element(tree, it, node) {
+		if (prev && strcmp(prev->name, it->name) >= 0)
+			sorted = false;
+		sum += it->value;
+		prev = it;
+	}
+
+	OUT("size %d, sorted %s, sum %d\n", tree->avl.count,
+	    sorted ? "yes" : "no", sum);
+}
+
+static void test_bulk(bool equal)
+{
+	struct vlist_tree tree = {};
+
+	vlist_init(&tree, avl_strcmp, item_update);
+	if (equal)
+		tree.equal = item_equal;
+
+	bulk(&tree, 0, 100, 1, 1, 1000);
+	/* drop the odd keys, add 100..149 and bump every tenth value */
+	bulk(&tree, 0, 150, 2, 1, 10);
+	/* same contents again, only reported without the equal hook */
+	bulk(&tree, 0, 150, 2, 1, 10);
+	dump(&tree);
+
+	vlist_flush_all(&tree);
+	dump(&tree);
+}
+
+static void test_mixed(void)
+{
+	struct vlist_tree tree = {};
+	struct vlist_node *nodes[2];
+	int ret;
+
+	vlist_init(&tree, avl_strcmp, item_update);
+
+	/* regular vlist_add replaces in place too */
+	vlist_update(&tree);
+	for (int i = 0; i < 3; i++) {
+		struct vlist_node *node = item_new(1 + (i > 0), 1 + i);
+
+		vlist_add(&tree, node, node->avl.key);
+	}
+	vlist_flush(&tree);
+	dump(&tree);
+
+	/* unsorted batches are rejected without touching the tree */
+	nodes[0] = item_new(5, 1);
+	nodes[1] = item_new(3, 1);
+	OUT("unsorted: %d\n", vlist_bulk_update(&tree, nodes, 2));
+	free(container_of(nodes[0], struct item, node));
+	free(container_of(nodes[1], struct item, node));
+	dump(&tree);
+
+	n_add = n_del = n_change = 0;
+	ret = vlist_bulk_update(&tree, NULL, 0);
+	OUT("empty: %d, deleted %d\n", ret, n_del);
+	dump(&tree);
+}
+
+static void test_keep_old(void)
+{
+	struct vlist_tree tree = {};
+
+	vlist_init(&tree, avl_strcmp, item_update);
+	tree.keep_old = true;
+
+	bulk(&tree, 0, 20, 1, 1, 1000);
+	bulk(&tree, 10, 30, 1, 5, 1000);
+	dump(&tree);
+
+	vlist_flush_all(&tree);
+}
+
+int main()
+{
+	test_bulk(false);
+	test_bulk(true);
+	test_mixed();
+	test_keep_old();
+
+	return 0;
+}
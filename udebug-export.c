@@ -0,0 +1,298 @@
+/*
+ * udebug - debug ring buffer library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "udebug.h"
+#include "ustream.h"
+#include "utils.h"
+
+#define PCAPNG_BLOCK_SHB	0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB	1
+#define PCAPNG_BLOCK_EPB	6
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+
+/* room for the largest set of headers queued by a single entry */
+#define EXPORT_HDR_MAX		128
+
+static const uint8_t export_pad[4];
+
+struct pcapng_shb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t byte_order;
+	uint16_t major, minor;
+	int64_t section_len;
+	uint32_t len_trailer;
+} __attribute__((packed));
+
+struct pcapng_idb {
+	uint32_t type;
+	uint32_t len;
+	uint16_t linktype;
+	uint16_t reserved;
+	uint32_t snaplen;
+	uint32_t len_trailer;
+} __attribute__((packed));
+
+struct pcapng_epb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t iface;
+	uint32_t ts_hi, ts_lo;
+	uint32_t caplen;
+	uint32_t origlen;
+} __attribute__((packed));
+
+static void
+export_add_iov(struct udebug_export *e, const void *data, size_t len)
+{
+	struct iovec *iov;
+
+	if (!len)
+		return;
+
+	/* headers queued back to back end up in the same iovec */
+	iov = e->n_iov ? &e->iov[e->n_iov - 1] : NULL;
+	if (iov && iov->iov_base + iov->iov_len == data) {
+		iov->iov_len += len;
+		return;
+	}
+
+	iov = &e->iov[e->n_iov++];
+	iov->iov_base = (void *)data;
+	iov->iov_len = len;
+}
+
+static void *
+export_add_hdr(struct udebug_export *e, size_t len)
+{
+	void *hdr = e->hdr + e->hdr_len;
+
+	e->hdr_len += len;
+	export_add_iov(e, hdr, len);
+
+	return hdr;
+}
+
+static void
+export_start(struct udebug_export *e)
+{
+	struct pcapng_shb *shb;
+
+	e->started = true;
+	if (e->format == UDEBUG_EXPORT_BINARY) {
+		memcpy(export_add_hdr(e, strlen(UDEBUG_EXPORT_MAGIC)),
+		       UDEBUG_EXPORT_MAGIC, strlen(UDEBUG_EXPORT_MAGIC));
+		return;
+	}
+
+	shb = export_add_hdr(e, sizeof(*shb));
+	shb->type = PCAPNG_BLOCK_SHB;
+	shb->len = shb->len_trailer = sizeof(*shb);
+	shb->byte_order = PCAPNG_BYTE_ORDER;
+	shb->major = 1;
+	shb->minor = 0;
+	shb->section_len = -1;
+}
+
+static int
+export_iface(struct udebug_export *e, struct udebug_snapshot *s)
+{
+	struct pcapng_idb *idb;
+	uint32_t *ifaces;
+
+	for (unsigned int i = 0; i < e->n_ifaces; i++)
+		if (e->ifaces[i] == s->rbuf_idx)
+			return i;
+
+	ifaces = realloc(e->ifaces, (e->n_ifaces + 1) * sizeof(*ifaces));
+	if (!ifaces)
+		return -1;
+
+	e->ifaces = ifaces;
+	e->ifaces[e->n_ifaces] = s->rbuf_idx;
+
+	idb = export_add_hdr(e, sizeof(*idb));
+	idb->type = PCAPNG_BLOCK_IDB;
+	idb->len = idb->len_trailer = sizeof(*idb);
+	idb->linktype = s->sub_format;
+	idb->reserved = 0;
+	idb->snaplen = 0;
+
+	return e->n_ifaces++;
+}
+
+static int
+export_pcapng(struct udebug_export *e, struct udebug_iter *it)
+{
+	struct udebug_snapshot *s = it->s;
+	struct pcapng_epb *epb;
+	uint32_t *trailer;
+	int iface, pad;
+
+	if (s->format != UDEBUG_FORMAT_PACKET) {
+		e->skipped++;
+		return 0;
+	}
+
+	iface = export_iface(e, s);
+	if (iface < 0)
+		return -1;
+
+	pad = (4 - (it->len & 3)) & 3;
+	epb = export_add_hdr(e, sizeof(*epb));
+	epb->type = PCAPNG_BLOCK_EPB;
+	epb->len = sizeof(*epb) + it->len + pad + sizeof(*trailer);
+	epb->iface = iface;
+	epb->ts_hi = it->timestamp >> 32;
+	epb->ts_lo = it->timestamp;
+	epb->caplen = epb->origlen = it->len;
+
+	export_add_iov(e, it->data, it->len);
+	export_add_iov(e, export_pad, pad);
+
+	trailer = export_add_hdr(e, sizeof(*trailer));
+	*trailer = epb->len;
+
+	return 0;
+}
+
+static int
+export_text(struct udebug_export *e, struct udebug_iter *it, char **str)
+{
+	int len;
+
+	len = udebug_iter_format(it, NULL, 0);
+	if (len < 0)
+		return -1;
+
+	if (e->text_len + len + 1 > e->text_size) {
+		char *text;
+
+		/* queued entries may point into the text buffer */
+		if (udebug_export_flush(e) < 0)
+			return -1;
+
+		if ((size_t)len + 1 > e->text_size) {
+			text = realloc(e->text, len + 1);
+			if (!text)
+				return -1;
+
+			e->text = text;
+			e->text_size = len + 1;
+		}
+	}
+
+	*str = e->text + e->text_len;
+	udebug_iter_format(it, *str, len + 1);
+	e->text_len += len;
+
+	return len;
+}
+
+static int
+export_binary(struct udebug_export *e, struct udebug_iter *it)
+{
+	struct udebug_snapshot *s = it->s;
+	struct udebug_export_record *rec;
+	uint32_t format = s->format;
+	char *data = it->data;
+	int len = it->len;
+
+	if (format == UDEBUG_FORMAT_DEFERRED) {
+		len = export_text(e, it, &data);
+		if (len < 0)
+			return -1;
+
+		format = UDEBUG_FORMAT_STRING;
+	}
+
+	rec = export_add_hdr(e, sizeof(*rec));
+	rec->len = cpu_to_be32(len);
+	rec->ring = cpu_to_be32(s->rbuf_idx);
+	rec->timestamp = cpu_to_be64(it->timestamp);
+	rec->format = cpu_to_be32(format);
+	rec->sub_format = cpu_to_be32(s->sub_format);
+	export_add_iov(e, data, len);
+
+	return 0;
+}
+
+void udebug_export_init(struct udebug_export *e, struct ustream *s,
+			enum udebug_export_format format)
+{
+	memset(e, 0, sizeof(*e));
+	e->s = s;
+	e->format = format;
+}
+
+int udebug_export_entry(struct udebug_export *e, struct udebug_iter *it)
+{
+	if (!it->s || !it->data)
+		return -1;
+
+	if (e->n_iov + 3 > ARRAY_SIZE(e->iov) ||
+	    e->hdr_len + EXPORT_HDR_MAX > sizeof(e->hdr))
+		if (udebug_export_flush(e) < 0)
+			return -1;
+
+	if (!e->started)
+		export_start(e);
+
+	if (e->format == UDEBUG_EXPORT_PCAPNG)
+		return export_pcapng(e, it);
+
+	return export_binary(e, it);
+}
+
+int udebug_export_iter(struct udebug_export *e, struct udebug_iter *it)
+{
+	while (udebug_iter_next(it))
+		if (udebug_export_entry(e, it) < 0)
+			return -1;
+
+	return udebug_export_flush(e);
+}
+
+int udebug_export_flush(struct udebug_export *e)
+{
+	size_t total = 0;
+	int ret;
+
+	if (!e->started)
+		export_start(e);
+
+	for (unsigned int i = 0; i < e->n_iov; i++)
+		total += e->iov[i].iov_len;
+
+	ret = ustream_writev(e->s, e->iov, e->n_iov, false);
+	e->n_iov = 0;
+	e->hdr_len = 0;
+	e->text_len = 0;
+
+	if (ret < 0 || (size_t)ret < total)
+		return -1;
+
+	return 0;
+}
+
+void udebug_export_free(struct udebug_export *e)
+{
+	free(e->ifaces);
+	free(e->text);
+	memset(e, 0, sizeof(*e));
+}
@@ -24,9 +24,33 @@
 
 #define UDEBUG_TIMEOUT	1000
 
+enum udebug_fmt_arg {
+	UDEBUG_ARG_NONE,
+	UDEBUG_ARG_INT,
+	UDEBUG_ARG_LONG,
+	UDEBUG_ARG_LLONG,
+	UDEBUG_ARG_INTMAX,
+	UDEBUG_ARG_SIZE,
+	UDEBUG_ARG_PTRDIFF,
+	UDEBUG_ARG_DOUBLE,
+	UDEBUG_ARG_LDOUBLE,
+	UDEBUG_ARG_PTR,
+	UDEBUG_ARG_STRING,
+	UDEBUG_ARG_INVALID,
+};
+
+struct udebug_fmt_spec {
+	const char *start;
+	unsigned int len;
+	enum udebug_fmt_arg type;
+	bool width_arg;
+	bool prec_arg;
+};
+
 __hidden int udebug_buf_open(struct udebug_buf *buf, int fd, uint32_t ring_size, uint32_t data_size);
 __hidden struct udebug_client_msg *
 udebug_send_and_wait(struct udebug *ctx, struct udebug_client_msg *msg, int *rfd);
+__hidden const char *udebug_fmt_next(const char *fmt, struct udebug_fmt_spec *spec);
 
 static inline int32_t u32_sub(uint32_t a, uint32_t b)
 {
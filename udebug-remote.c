@@ -15,6 +15,9 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "udebug-priv.h"
 
 static int
@@ -108,18 +111,26 @@ int udebug_remote_buf_set_poll(struct udebug *ctx, struct udebug_remote_buf *rb,
 	return 0;
 }
 
+static uint32_t
+rbuf_min_head(struct udebug_remote_buf *rb, uint32_t head)
+{
+	uint32_t min_head = head + 1 - rb->buf.ring_size;
+
+	if (!u32_get(&rb->buf.hdr->head_hi) && u32_sub(0, min_head) > 0)
+		min_head = 0;
+
+	return min_head;
+}
+
 static void
 rbuf_advance_read_head(struct udebug_remote_buf *rb, uint32_t head,
 		       uint32_t *data_start)
 {
 	struct udebug_hdr *hdr = rb->buf.hdr;
-	uint32_t min_head = head + 1 - rb->buf.ring_size;
+	uint32_t min_head = rbuf_min_head(rb, head);
 	uint32_t min_data = u32_get(&hdr->data_used) - rb->buf.data_size;
 	struct udebug_ptr *last_ptr = udebug_ring_ptr(hdr, head - 1);
 
-	if (!u32_get(&hdr->head_hi) && u32_sub(0, min_head) > 0)
-		min_head = 0;
-
 	/* advance head to skip over any entries that are guaranteed
 	 * to be overwritten now. final check will be performed after
 	 * data copying */
@@ -287,6 +298,76 @@ out:
 	return s;
 }
 
+bool udebug_remote_buf_read(struct udebug_remote_buf *rb, struct udebug_iter *it)
+{
+	struct udebug_hdr *hdr = rb->buf.hdr;
+	struct udebug_ptr ptr;
+	uint32_t head, min_head, min_data;
+
+	if (!hdr)
+		return false;
+
+	while (1) {
+		head = u32_get(&hdr->head);
+		if (rb->head == head)
+			return false;
+
+		/* the slot at head is the one being written next, anything
+		 * older than a full ring has been reused already */
+		min_head = rbuf_min_head(rb, head);
+		if (u32_sub(rb->head, min_head) < 0) {
+			rb->dropped += min_head - rb->head;
+			rb->head = min_head;
+		}
+
+		/* only loads need ordering here, which avoids a full barrier
+		 * per entry: the entry is read after the head it belongs to,
+		 * and before head is checked again */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		ptr = *udebug_ring_ptr(hdr, rb->head);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		/* retry if the slot was reused while copying it */
+		if (u32_sub(rb->head, rbuf_min_head(rb, u32_get(&hdr->head))) < 0)
+			continue;
+
+		rb->head++;
+		min_data = u32_get(&hdr->data_used) - rb->buf.data_size;
+		if (ptr.len > rb->buf.data_size / 2 ||
+		    u32_sub(ptr.start, min_data) < 0) {
+			rb->dropped++;
+			continue;
+		}
+
+		break;
+	}
+
+	rb->read_start = ptr.start;
+
+	memset(it, 0, sizeof(*it));
+	it->data = udebug_buf_ptr(&rb->buf, ptr.start);
+	it->len = ptr.len;
+	it->timestamp = ptr.timestamp;
+	it->format = hdr->format;
+
+	return true;
+}
+
+bool udebug_remote_buf_read_valid(struct udebug_remote_buf *rb)
+{
+	struct udebug_hdr *hdr = rb->buf.hdr;
+	uint32_t min_data;
+
+	if (!hdr)
+		return false;
+
+	/* ensure that all reads of the entry data happened before */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	min_data = u32_get(&hdr->data_used) - rb->buf.data_size;
+
+	return u32_sub(rb->read_start, min_data) >= 0;
+}
+
 bool udebug_snapshot_get_entry(struct udebug_snapshot *s, struct udebug_iter *it, unsigned int entry)
 {
 	struct udebug_ptr *ptr;
@@ -304,6 +385,7 @@ bool udebug_snapshot_get_entry(struct udebug_snapshot *s, struct udebug_iter *it
 	it->data = s->data + ptr->start;
 	it->len = ptr->len;
 	it->timestamp = ptr->timestamp;
+	it->format = s->format;
 	return true;
 
 error:
@@ -311,6 +393,48 @@ error:
 	return false;
 }
 
+static bool
+udebug_iter_before(struct udebug_iter *it, uint32_t a, uint32_t b)
+{
+	struct udebug_snapshot *sa = it->list[a], *sb = it->list[b];
+	uint64_t ts_a = sa->entries[sa->iter_idx].timestamp;
+	uint64_t ts_b = sb->entries[sb->iter_idx].timestamp;
+
+	/* on equal timestamps, the later snapshot comes first */
+	return ts_a < ts_b || (ts_a == ts_b && a > b);
+}
+
+static void
+udebug_iter_sift_down(struct udebug_iter *it, size_t i)
+{
+	uint32_t *heap = it->heap;
+
+	while (1) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+		uint32_t tmp;
+
+		if (l < it->heap_len && udebug_iter_before(it, heap[l], heap[min]))
+			min = l;
+		if (r < it->heap_len && udebug_iter_before(it, heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+void udebug_iter_free(struct udebug_iter *it)
+{
+	if (it->heap != it->heap_buf)
+		free(it->heap);
+	it->heap = NULL;
+	it->heap_len = 0;
+}
+
 void udebug_iter_start(struct udebug_iter *it, struct udebug_snapshot **s, size_t n)
 {
 	memset(it, 0, sizeof(*it));
@@ -320,38 +444,242 @@ void udebug_iter_start(struct udebug_iter *it, struct udebug_snapshot **s, size_
 
 	for (size_t i = 0; i < it->n; i++)
 		it->list[i]->iter_idx = 0;
+
+	it->heap = it->heap_buf;
+	if (n > ARRAY_SIZE(it->heap_buf))
+		it->heap = calloc(n, sizeof(*it->heap));
+	if (!it->heap)
+		return;
+
+	for (size_t i = 0; i < it->n; i++)
+		if (it->list[i]->n_entries)
+			it->heap[it->heap_len++] = i;
+
+	for (size_t i = it->heap_len / 2; i > 0; i--)
+		udebug_iter_sift_down(it, i - 1);
 }
 
 bool udebug_iter_next(struct udebug_iter *it)
 {
-	while (1) {
-		struct udebug_snapshot *s;
-		uint64_t cur_ts;
-		int cur = -1;
+	while (it->heap_len > 0) {
+		uint32_t cur = it->heap[0];
+		struct udebug_snapshot *s = it->list[cur];
+		unsigned int idx = s->iter_idx++;
+
+		/* the snapshot moves down by its next entry, or is removed */
+		if (s->iter_idx >= s->n_entries)
+			it->heap[0] = it->heap[--it->heap_len];
+		udebug_iter_sift_down(it, 0);
+
+		it->s_idx = cur;
+		if (!udebug_snapshot_get_entry(s, it, idx))
+			continue;
 
-		for (size_t i = 0; i < it->n; i++) {
-			struct udebug_ptr *ptr;
+		return true;
+	}
+
+	udebug_iter_free(it);
+
+	return false;
+}
+
+struct udebug_fmt_out {
+	char *buf;
+	size_t size;
+	int len;
+};
+
+static void
+udebug_fmt_out_add(struct udebug_fmt_out *out, int len)
+{
+	size_t cur;
+
+	if (len < 0)
+		return;
+
+	out->len += len;
+	if (!out->size)
+		return;
+
+	cur = (size_t)len < out->size ? (size_t)len : out->size - 1;
+	out->buf += cur;
+	out->size -= cur;
+}
+
+static void
+udebug_fmt_out_str(struct udebug_fmt_out *out, const char *str, size_t len)
+{
+	if (out->size > 1)
+		snprintf(out->buf, out->size, "%.*s", (int)len, str);
+	udebug_fmt_out_add(out, len);
+}
+
+static bool
+udebug_fmt_get_val(const char **data, const char *end, uint64_t *val)
+{
+	if (end - *data < (ssize_t)sizeof(*val))
+		return false;
 
-			s = it->list[i];
-			if (s->iter_idx >= s->n_entries)
-				continue;
+	memcpy(val, *data, sizeof(*val));
+	*data += sizeof(*val);
 
-			ptr = &s->entries[s->iter_idx];
-			if (cur >= 0 && ptr->timestamp > cur_ts)
-				continue;
+	return true;
+}
+
+static bool
+udebug_fmt_spec(char *dest, size_t size, const struct udebug_fmt_spec *spec,
+		const char **data, const char *end)
+{
+	const char *p = spec->start;
+	uint64_t val;
 
-			cur = i;
-			cur_ts = ptr->timestamp;
+	for (unsigned int i = 0; i < spec->len; i++, p++) {
+		int len;
+
+		if (*p != '*') {
+			len = 1;
+			*dest = *p;
+		} else if (!udebug_fmt_get_val(data, end, &val)) {
+			return false;
+		} else {
+			len = snprintf(dest, size, "%d", (int)val);
 		}
 
-		if (cur < 0)
+		if ((size_t)len >= size)
 			return false;
 
-		s = it->list[cur];
-		it->s_idx = cur;
-		if (!udebug_snapshot_get_entry(s, it, s->iter_idx++))
-			continue;
+		dest += len;
+		size -= len;
+	}
+	*dest = 0;
 
-		return true;
+	return true;
+}
+
+/* the format is rebuilt from a single spec checked by udebug_fmt_next() */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static bool
+udebug_fmt_arg(struct udebug_fmt_out *out, const struct udebug_fmt_spec *spec,
+	       const char **data, const char *end)
+{
+	char fmt[64], *str, *tmp = NULL;
+	double dval;
+	uint64_t val = 0;
+	size_t len;
+	int ret;
+
+	if (!udebug_fmt_spec(fmt, sizeof(fmt), spec, data, end))
+		return false;
+
+	switch (spec->type) {
+	case UDEBUG_ARG_STRING:
+		str = (char *)*data;
+		len = strnlen(str, end - str);
+		if (len == (size_t)(end - str)) {
+			/* the last string may run up to the end of the entry */
+			str = tmp = strndup(str, len);
+			if (!str)
+				return false;
+			*data = end;
+		} else {
+			*data += len + 1;
+		}
+		ret = snprintf(out->buf, out->size, fmt, str);
+		free(tmp);
+		break;
+	case UDEBUG_ARG_DOUBLE:
+	case UDEBUG_ARG_LDOUBLE:
+		if (!udebug_fmt_get_val(data, end, &val))
+			return false;
+
+		memcpy(&dval, &val, sizeof(dval));
+		if (spec->type == UDEBUG_ARG_LDOUBLE)
+			ret = snprintf(out->buf, out->size, fmt, (long double)dval);
+		else
+			ret = snprintf(out->buf, out->size, fmt, dval);
+		break;
+	default:
+		if (!udebug_fmt_get_val(data, end, &val))
+			return false;
+
+		switch (spec->type) {
+		case UDEBUG_ARG_INT:
+			ret = snprintf(out->buf, out->size, fmt, (int)val);
+			break;
+		case UDEBUG_ARG_LONG:
+			ret = snprintf(out->buf, out->size, fmt, (long)val);
+			break;
+		case UDEBUG_ARG_LLONG:
+			ret = snprintf(out->buf, out->size, fmt, (long long)val);
+			break;
+		case UDEBUG_ARG_INTMAX:
+			ret = snprintf(out->buf, out->size, fmt, (intmax_t)val);
+			break;
+		case UDEBUG_ARG_SIZE:
+			ret = snprintf(out->buf, out->size, fmt, (size_t)val);
+			break;
+		case UDEBUG_ARG_PTRDIFF:
+			ret = snprintf(out->buf, out->size, fmt, (ptrdiff_t)val);
+			break;
+		case UDEBUG_ARG_PTR:
+			ret = snprintf(out->buf, out->size, fmt, (void *)(uintptr_t)val);
+			break;
+		default:
+			return false;
+		}
+		break;
 	}
+
+	udebug_fmt_out_add(out, ret);
+
+	return true;
+}
+#pragma GCC diagnostic pop
+
+int udebug_iter_format(struct udebug_iter *it, char *buf, size_t size)
+{
+	struct udebug_fmt_out out = {
+		.buf = buf,
+		.size = size,
+	};
+	const char *data = it->data, *end = data + it->len;
+
+	if (!it->data)
+		return -1;
+
+	if (size)
+		*buf = 0;
+
+	if (it->format != UDEBUG_FORMAT_DEFERRED) {
+		udebug_fmt_out_str(&out, data, strnlen(data, it->len));
+		return out.len;
+	}
+
+	/* each appended block is a format string followed by its arguments */
+	while (data < end) {
+		const char *fmt = data, *p, *next;
+		struct udebug_fmt_spec spec;
+
+		p = memchr(data, 0, end - data);
+		if (!p)
+			return -1;
+
+		data = p + 1;
+		for (p = fmt; p; p = next) {
+			next = udebug_fmt_next(p, &spec);
+			if (!next) {
+				udebug_fmt_out_str(&out, p, strlen(p));
+				break;
+			}
+
+			udebug_fmt_out_str(&out, p, spec.start - p);
+			if (spec.type == UDEBUG_ARG_NONE)
+				udebug_fmt_out_str(&out, "%", 1);
+			else if (!udebug_fmt_arg(&out, &spec, &data, end))
+				return -1;
+		}
+	}
+
+	return out.len;
 }
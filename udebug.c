@@ -22,9 +22,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 #include "udebug-priv.h"
 #include "usock.h"
@@ -37,6 +40,9 @@
 
 #define UDEBUG_MIN_ALLOC_LEN	128
 static struct blob_buf b;
+static struct blob_attr empty_meta = {
+	.id_len = const_cpu_to_be32(sizeof(struct blob_attr)),
+};
 static unsigned int page_size;
 
 static void __randname(char *template)
@@ -308,10 +314,8 @@ udebug_send_msg(struct udebug *ctx, struct udebug_client_msg *msg,
 		{}
 	};
 
-	if (!meta) {
-		blob_buf_init(&b, 0);
-		meta = b.head;
-	}
+	if (!meta)
+		meta = &empty_meta;
 
 	iov[1].iov_base = meta;
 	iov[1].iov_len = blob_pad_len(meta);
@@ -447,14 +451,32 @@ int udebug_buf_open(struct udebug_buf *buf, int fd, uint32_t ring_size, uint32_t
 	return 0;
 }
 
-int udebug_buf_init(struct udebug_buf *buf, size_t entries, size_t size)
+static void
+udebug_buf_prefault(struct udebug_buf *buf)
+{
+	volatile uint8_t *data = buf->data;
+
+	/* touch both mappings of the data area, so that wrapping around
+	 * does not fault either. Done after madvise instead of mapping with
+	 * MAP_POPULATE, so that the hint applies to the faulted pages */
+	for (size_t i = 0; i < 2 * buf->data_size; i += page_size)
+		data[i] = data[i];
+}
+
+int udebug_buf_init_opts(struct udebug_buf *buf, const struct udebug_buf_opts *opts)
 {
 	char filename[] = "/udebug.XXXXXX";
+	size_t entries = opts->entries, size = opts->size;
 	unsigned int order = 12;
 	uint8_t ring_order = 5;
 	size_t head_size;
 	int fd;
 
+	if (!size && opts->rate)
+		size = (uint64_t)opts->rate * (opts->seconds ? opts->seconds : 1);
+	if (!entries && opts->rate)
+		entries = size / (opts->entry_len ? opts->entry_len : UDEBUG_MIN_ALLOC_LEN);
+
 	udebug_init_page_size();
 	INIT_LIST_HEAD(&buf->list);
 	if (size < page_size)
@@ -487,6 +509,15 @@ int udebug_buf_init(struct udebug_buf *buf, size_t entries, size_t size)
 	if (__udebug_buf_map(buf, fd))
 		goto err_close;
 
+#ifdef MADV_HUGEPAGE
+	/* best effort, only used where shmem has transparent huge pages */
+	if (opts->huge_pages)
+		madvise(buf->data, 2 * size, MADV_HUGEPAGE);
+#endif
+
+	if (opts->prefault)
+		udebug_buf_prefault(buf);
+
 	buf->fd = fd;
 	buf->hdr->ring_size = entries;
 	buf->hdr->data_size = size;
@@ -501,6 +532,16 @@ err_close:
 	return -1;
 }
 
+int udebug_buf_init(struct udebug_buf *buf, size_t entries, size_t size)
+{
+	struct udebug_buf_opts opts = {
+		.entries = entries,
+		.size = size,
+	};
+
+	return udebug_buf_init_opts(buf, &opts);
+}
+
 static void *udebug_buf_alloc(struct udebug_buf *buf, uint32_t ofs, uint32_t len)
 {
 	struct udebug_hdr *hdr = buf->hdr;
@@ -639,11 +680,306 @@ out:
 	return 0;
 }
 
+#define UDEBUG_DEFERRED_MAX_ARGS	32
+
+struct udebug_deferred_arg {
+	enum udebug_fmt_arg type;
+	uint32_t len;
+	union {
+		uint64_t val;
+		double dval;
+		const char *str;
+	};
+};
+
+const char *udebug_fmt_next(const char *fmt, struct udebug_fmt_spec *spec)
+{
+	enum udebug_fmt_arg type;
+	const char *p;
+	int lmod = 0;
+
+	p = strchr(fmt, '%');
+	if (!p)
+		return NULL;
+
+	spec->start = p++;
+	spec->width_arg = spec->prec_arg = false;
+
+	p += strspn(p, "-+ #0'I");
+	if (*p == '*') {
+		spec->width_arg = true;
+		p++;
+	} else {
+		p += strspn(p, "0123456789");
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->prec_arg = true;
+			p++;
+		} else {
+			p += strspn(p, "0123456789");
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+		p += 1 + (p[1] == 'h');
+		break;
+	case 'l':
+		lmod = p[1] == 'l' ? UDEBUG_ARG_LLONG : UDEBUG_ARG_LONG;
+		p += 1 + (p[1] == 'l');
+		break;
+	case 'q':
+	case 'L':
+		lmod = UDEBUG_ARG_LLONG;
+		p++;
+		break;
+	case 'j':
+		lmod = UDEBUG_ARG_INTMAX;
+		p++;
+		break;
+	case 'z':
+	case 'Z':
+		lmod = UDEBUG_ARG_SIZE;
+		p++;
+		break;
+	case 't':
+		lmod = UDEBUG_ARG_PTRDIFF;
+		p++;
+		break;
+	}
+
+	switch (*p) {
+	case '%':
+		type = UDEBUG_ARG_NONE;
+		break;
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		type = lmod ? lmod : UDEBUG_ARG_INT;
+		break;
+	case 'c':
+		type = lmod ? UDEBUG_ARG_INVALID : UDEBUG_ARG_INT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		type = lmod == UDEBUG_ARG_LLONG && p[-1] == 'L' ?
+		       UDEBUG_ARG_LDOUBLE : UDEBUG_ARG_DOUBLE;
+		break;
+	case 's':
+		type = lmod ? UDEBUG_ARG_INVALID : UDEBUG_ARG_STRING;
+		break;
+	case 'p':
+		type = UDEBUG_ARG_PTR;
+		break;
+	default:
+		/* %n, %m, wide characters and positional arguments */
+		type = UDEBUG_ARG_INVALID;
+		break;
+	}
+
+	if (*p)
+		p++;
+
+	spec->type = type;
+	spec->len = p - spec->start;
+
+	return p;
+}
+
+int udebug_entry_deferred_printf(struct udebug_buf *buf, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = udebug_entry_deferred_vprintf(buf, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+static uint32_t
+udebug_deferred_get_arg(struct udebug_deferred_arg *arg, enum udebug_fmt_arg type,
+			va_list *ap)
+{
+	arg->type = type;
+	arg->len = sizeof(arg->val);
+
+	switch (type) {
+	case UDEBUG_ARG_INT:
+		arg->val = va_arg(*ap, int);
+		break;
+	case UDEBUG_ARG_LONG:
+		arg->val = va_arg(*ap, long);
+		break;
+	case UDEBUG_ARG_LLONG:
+		arg->val = va_arg(*ap, long long);
+		break;
+	case UDEBUG_ARG_INTMAX:
+		arg->val = va_arg(*ap, intmax_t);
+		break;
+	case UDEBUG_ARG_SIZE:
+		arg->val = va_arg(*ap, size_t);
+		break;
+	case UDEBUG_ARG_PTRDIFF:
+		arg->val = va_arg(*ap, ptrdiff_t);
+		break;
+	case UDEBUG_ARG_PTR:
+		arg->val = (uintptr_t)va_arg(*ap, void *);
+		break;
+	case UDEBUG_ARG_DOUBLE:
+		arg->dval = va_arg(*ap, double);
+		break;
+	case UDEBUG_ARG_LDOUBLE:
+		arg->dval = va_arg(*ap, long double);
+		break;
+	case UDEBUG_ARG_STRING:
+		arg->str = va_arg(*ap, const char *);
+		if (!arg->str)
+			arg->str = "(null)";
+		arg->len = strlen(arg->str) + 1;
+		break;
+	default:
+		break;
+	}
+
+	return arg->len;
+}
+
+int udebug_entry_deferred_vprintf(struct udebug_buf *buf, const char *fmt, va_list ap)
+{
+	struct udebug_deferred_arg args[UDEBUG_DEFERRED_MAX_ARGS];
+	struct udebug_fmt_spec spec;
+	uint32_t fmt_len, len;
+	const char *p = fmt;
+	unsigned int n = 0;
+	uint8_t *data;
+	va_list ap2;
+
+	if (!buf->hdr)
+		return -1;
+
+	fmt_len = strlen(fmt) + 1;
+	len = fmt_len;
+
+	va_copy(ap2, ap);
+	while ((p = udebug_fmt_next(p, &spec)) != NULL) {
+		if (spec.type == UDEBUG_ARG_NONE)
+			continue;
+
+		if (spec.type == UDEBUG_ARG_INVALID ||
+		    n + 3 > ARRAY_SIZE(args))
+			goto fallback;
+
+		if (spec.width_arg)
+			len += udebug_deferred_get_arg(&args[n++], UDEBUG_ARG_INT, &ap2);
+		if (spec.prec_arg)
+			len += udebug_deferred_get_arg(&args[n++], UDEBUG_ARG_INT, &ap2);
+		len += udebug_deferred_get_arg(&args[n++], spec.type, &ap2);
+	}
+	va_end(ap2);
+
+	data = udebug_entry_append(buf, NULL, len);
+	if (!data)
+		return -1;
+
+	memcpy(data, fmt, fmt_len);
+	data += fmt_len;
+	for (unsigned int i = 0; i < n; i++) {
+		if (args[i].type == UDEBUG_ARG_STRING)
+			memcpy(data, args[i].str, args[i].len);
+		else
+			memcpy(data, &args[i].val, args[i].len);
+		data += args[i].len;
+	}
+
+	return 0;
+
+fallback:
+	va_end(ap2);
+
+	/* conversions that cannot be deferred are formatted right away */
+	if (!udebug_entry_append(buf, "%s", 3))
+		return -1;
+
+	return udebug_entry_vprintf(buf, fmt, ap);
+}
+
+static void udebug_buf_notify(struct udebug_buf *buf)
+{
+	struct udebug_hdr *hdr = buf->hdr;
+	uint32_t notify;
+
+	buf->notify_pending = 0;
+	uloop_timeout_cancel(&buf->notify_timer);
+
+	notify = __atomic_exchange_n(&hdr->notify, 0, __ATOMIC_RELAXED);
+	if (notify) {
+		struct udebug_client_msg msg = {
+			.type = CL_MSG_RING_NOTIFY,
+			.id = buf->id,
+			.notify_mask = notify,
+		};
+
+		udebug_send_msg(buf->ctx, &msg, NULL, -1);
+	}
+}
+
+static void udebug_buf_notify_timer_cb(struct uloop_timeout *t)
+{
+	struct udebug_buf *buf = container_of(t, struct udebug_buf, notify_timer);
+
+	udebug_buf_notify(buf);
+}
+
+void udebug_buf_set_notify(struct udebug_buf *buf, int interval,
+			   unsigned int max_entries)
+{
+	if (buf->notify_pending)
+		udebug_buf_notify(buf);
+
+	buf->notify_timer.cb = interval < 0 ? NULL : udebug_buf_notify_timer_cb;
+	buf->notify_interval = interval;
+	buf->notify_max_entries = max_entries;
+}
+
+static void udebug_buf_entry_notify(struct udebug_buf *buf, unsigned int entries)
+{
+	if (!__atomic_load_n(&buf->hdr->notify, __ATOMIC_RELAXED))
+		return;
+
+	if (!buf->notify_timer.cb) {
+		udebug_buf_notify(buf);
+		return;
+	}
+
+	buf->notify_pending += entries;
+	if (buf->notify_max_entries &&
+	    buf->notify_pending >= buf->notify_max_entries) {
+		udebug_buf_notify(buf);
+		return;
+	}
+
+	if (!buf->notify_timer.pending)
+		uloop_timeout_set(&buf->notify_timer, buf->notify_interval);
+}
+
 void udebug_entry_add(struct udebug_buf *buf)
 {
 	struct udebug_hdr *hdr = buf->hdr;
 	struct udebug_ptr *ptr;
-	uint32_t notify;
 	uint8_t *data;
 
 	if (!hdr)
@@ -666,18 +1002,297 @@ void udebug_entry_add(struct udebug_buf *buf)
 	/* ensure that head change is visible */
 	__sync_synchronize();
 
-	notify = __atomic_exchange_n(&hdr->notify, 0, __ATOMIC_RELAXED);
-	if (notify) {
-		struct udebug_client_msg msg = {
-			.type = CL_MSG_RING_NOTIFY,
-			.id = buf->id,
-			.notify_mask = notify,
-		};
-		blob_buf_init(&b, 0);
+	udebug_buf_entry_notify(buf, 1);
+}
 
-		udebug_send_msg(buf->ctx, &msg, b.head, -1);
+struct udebug_mp_slot {
+	struct udebug_ptr ptr;
+	uint32_t seq;
+};
+
+struct udebug_buf_mp {
+	struct udebug_buf *buf;
+
+	/* next ring index in the upper half, next data offset in the lower */
+	uint64_t reserve;
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+	int reserve_lock;
+#endif
+
+	/* next index to be published to the ring */
+	uint32_t head;
+	int publish_lock;
+
+	struct uloop_post_queue queue;
+	struct uloop_post post;
+	bool post_pending;
+	unsigned int published;
+
+	struct udebug_mp_slot slots[];
+};
+
+static inline struct udebug_mp_slot *
+udebug_mp_slot(struct udebug_buf_mp *mp, uint32_t idx)
+{
+	return &mp->slots[idx & (mp->buf->ring_size - 1)];
+}
+
+static void udebug_mp_post_cb(struct uloop_post *p)
+{
+	struct udebug_buf_mp *mp = container_of(p, struct udebug_buf_mp, post);
+
+	__atomic_store_n(&mp->post_pending, false, __ATOMIC_SEQ_CST);
+	udebug_buf_entry_notify(mp->buf,
+				__atomic_exchange_n(&mp->published, 0, __ATOMIC_RELAXED));
+}
+
+int udebug_buf_mp_init(struct udebug_buf *buf)
+{
+	struct udebug_hdr *hdr = buf->hdr;
+	struct udebug_buf_mp *mp;
+
+	if (!hdr)
+		return -1;
+
+	if (buf->mp)
+		return 0;
+
+	mp = calloc(1, sizeof(*mp) + buf->ring_size * sizeof(mp->slots[0]));
+	if (!mp)
+		return -1;
+
+	if (uloop_post_queue_init(&mp->queue) < 0) {
+		free(mp);
+		return -1;
+	}
+
+	mp->buf = buf;
+	mp->post.cb = udebug_mp_post_cb;
+	mp->head = hdr->head;
+	mp->reserve = ((uint64_t)hdr->head << 32) | hdr->data_head;
+
+	/* no slot may look committed before it has been reserved */
+	for (size_t i = 0; i < buf->ring_size; i++)
+		mp->slots[i].seq = mp->head;
+
+	buf->mp = mp;
+
+	return 0;
+}
+
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+static void udebug_mp_lock(int *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		;
+}
+#endif
+
+static bool udebug_mp_trylock(int *lock)
+{
+	return !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static void udebug_mp_unlock(int *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static bool
+udebug_mp_reserve(struct udebug_buf_mp *mp, uint32_t len, uint32_t *idx,
+		  uint32_t *ofs)
+{
+	uint32_t ring_size = mp->buf->ring_size;
+	uint64_t cur, next;
+
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+	cur = __atomic_load_n(&mp->reserve, __ATOMIC_RELAXED);
+	do {
+		*idx = cur >> 32;
+		*ofs = cur;
+		if (u32_sub(*idx, __atomic_load_n(&mp->head, __ATOMIC_ACQUIRE)) >= (int32_t)ring_size)
+			return false;
+
+		next = ((uint64_t)(*idx + 1) << 32) | (uint32_t)(*ofs + len + 1);
+	} while (!__atomic_compare_exchange_n(&mp->reserve, &cur, next, true,
+					      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+#else
+	udebug_mp_lock(&mp->reserve_lock);
+	cur = mp->reserve;
+	*idx = cur >> 32;
+	*ofs = cur;
+	if (u32_sub(*idx, __atomic_load_n(&mp->head, __ATOMIC_ACQUIRE)) >= (int32_t)ring_size) {
+		udebug_mp_unlock(&mp->reserve_lock);
+		return false;
 	}
+
+	next = ((uint64_t)(*idx + 1) << 32) | (uint32_t)(*ofs + len + 1);
+	mp->reserve = next;
+	udebug_mp_unlock(&mp->reserve_lock);
+#endif
+
+	return true;
+}
+
+void *udebug_mp_entry_reserve(struct udebug_buf *buf, struct udebug_mp_entry *e,
+			      uint64_t timestamp, uint32_t len)
+{
+	struct udebug_buf_mp *mp = buf->mp;
+	struct udebug_hdr *hdr = buf->hdr;
+	struct udebug_mp_slot *slot;
+	uint32_t idx, ofs, used, end;
+
+	if (!mp || len > buf->data_size / 2)
+		return NULL;
+
+	/* slot index and data offset are taken together, so that entry data
+	 * stays contiguous in ring order */
+	if (!udebug_mp_reserve(mp, len, &idx, &ofs))
+		return NULL;
+
+	end = ofs + len + 1;
+	used = __atomic_load_n(&hdr->data_used, __ATOMIC_RELAXED);
+	while (u32_sub(end, used) > 0 &&
+	       !__atomic_compare_exchange_n(&hdr->data_used, &used, end, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	/* ensure that data_used update is visible before clobbering data */
+	__sync_synchronize();
+
+	slot = udebug_mp_slot(mp, idx);
+	slot->ptr.start = ofs;
+	slot->ptr.len = len;
+	slot->ptr.timestamp = timestamp;
+
+	e->idx = idx;
+	e->len = len;
+	e->data = udebug_buf_ptr(buf, ofs);
+
+	return e->data;
 }
+
+static void udebug_mp_publish(struct udebug_buf *buf)
+{
+	struct udebug_buf_mp *mp = buf->mp;
+	struct udebug_hdr *hdr = buf->hdr;
+	struct udebug_mp_slot *slot;
+	bool published = false;
+	uint32_t head, prev;
+
+	do {
+		if (!udebug_mp_trylock(&mp->publish_lock))
+			return;
+
+		head = prev = mp->head;
+		while (1) {
+			slot = udebug_mp_slot(mp, head);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1)
+				break;
+
+			*udebug_ring_ptr(hdr, head) = slot->ptr;
+			hdr->data_head = slot->ptr.start + slot->ptr.len + 1;
+			head++;
+		}
+
+		if (head != prev) {
+			/* ensure that ring entries are visible before advancing head */
+			__sync_synchronize();
+
+			u32_set(&hdr->head, head);
+			if (u32_sub(head, prev) > 0 && head < prev)
+				u32_set(&hdr->head_hi, u32_get(&hdr->head_hi) + 1);
+
+			__atomic_store_n(&mp->head, head, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&mp->published, head - prev, __ATOMIC_RELAXED);
+			published = true;
+		}
+
+		udebug_mp_unlock(&mp->publish_lock);
+
+		/* an entry committed while the lock was held is published by
+		 * whoever sees it here */
+		slot = udebug_mp_slot(mp, head);
+	} while (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == head + 1);
+
+	if (!published)
+		return;
+
+	/* ensure that head change is visible */
+	__sync_synchronize();
+
+	if (__atomic_load_n(&hdr->notify, __ATOMIC_RELAXED) &&
+	    !__atomic_exchange_n(&mp->post_pending, true, __ATOMIC_SEQ_CST))
+		uloop_post(&mp->queue, &mp->post);
+}
+
+void udebug_mp_entry_commit(struct udebug_buf *buf, struct udebug_mp_entry *e)
+{
+	struct udebug_mp_slot *slot = udebug_mp_slot(buf->mp, e->idx);
+	uint8_t *data = e->data;
+
+	/* ensure strings are always 0-terminated */
+	if (e->len < slot->ptr.len)
+		slot->ptr.len = e->len;
+	data[slot->ptr.len] = 0;
+
+	__atomic_store_n(&slot->seq, e->idx + 1, __ATOMIC_SEQ_CST);
+	udebug_mp_publish(buf);
+}
+
+int udebug_mp_entry_add(struct udebug_buf *buf, uint64_t timestamp,
+			const void *data, uint32_t len)
+{
+	struct udebug_mp_entry e;
+
+	if (!udebug_mp_entry_reserve(buf, &e, timestamp, len))
+		return -1;
+
+	memcpy(e.data, data, len);
+	udebug_mp_entry_commit(buf, &e);
+
+	return 0;
+}
+
+int udebug_mp_entry_printf(struct udebug_buf *buf, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = udebug_mp_entry_vprintf(buf, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+int udebug_mp_entry_vprintf(struct udebug_buf *buf, const char *fmt, va_list ap)
+{
+	char str[UDEBUG_MIN_ALLOC_LEN];
+	struct udebug_mp_entry e;
+	uint64_t ts = udebug_timestamp();
+	va_list ap2;
+	int len;
+
+	va_copy(ap2, ap);
+	len = vsnprintf(str, sizeof(str), fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		return -1;
+
+	if (len < (int)sizeof(str))
+		return udebug_mp_entry_add(buf, ts, str, len);
+
+	/* the reservation includes room for the terminating 0 */
+	if (!udebug_mp_entry_reserve(buf, &e, ts, len))
+		return -1;
+
+	vsnprintf(e.data, len + 1, fmt, ap);
+	udebug_mp_entry_commit(buf, &e);
+
+	return 0;
+}
+
 void udebug_buf_free(struct udebug_buf *buf)
 {
 	struct udebug *ctx = buf->ctx;
@@ -685,6 +1300,12 @@ void udebug_buf_free(struct udebug_buf *buf)
 	if (!list_empty(&buf->list) && buf->list.prev)
 		list_del(&buf->list);
 
+	if (buf->mp) {
+		uloop_post_queue_done(&buf->mp->queue);
+		free(buf->mp);
+	}
+	uloop_timeout_cancel(&buf->notify_timer);
+
 	if (ctx && ctx->fd.fd >= 0)
 		udebug_buf_msg(buf, CL_MSG_RING_REMOVE);
 
@@ -19,6 +19,7 @@
 #define __UDEBUG_RINGBUF_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <stdarg.h>
 
@@ -32,6 +33,7 @@ enum udebug_format {
 	UDEBUG_FORMAT_PACKET,
 	UDEBUG_FORMAT_STRING,
 	UDEBUG_FORMAT_BLOBMSG,
+	UDEBUG_FORMAT_DEFERRED,
 };
 
 enum {
@@ -54,6 +56,8 @@ enum udebug_meta_type {
 
 struct udebug;
 struct udebug_hdr;
+struct udebug_buf_mp;
+struct ustream;
 
 struct udebug_buf_flag {
 	const char *name;
@@ -81,6 +85,24 @@ struct udebug_buf {
 	size_t head_size;
 	size_t ring_size;
 	int fd;
+
+	struct udebug_buf_mp *mp;
+
+	struct uloop_timeout notify_timer;
+	int notify_interval;
+	unsigned int notify_max_entries;
+	unsigned int notify_pending;
+};
+
+/*
+ * Handle for an entry reserved in multi-producer mode. The caller fills
+ * the data returned by udebug_mp_entry_reserve() and may shrink len
+ * before committing.
+ */
+struct udebug_mp_entry {
+	uint32_t idx;
+	uint32_t len;
+	void *data;
 };
 
 struct udebug_packet_info {
@@ -93,6 +115,10 @@ struct udebug_remote_buf {
 	bool poll;
 	uint32_t head;
 
+	/* incremental reader state */
+	uint32_t read_start;
+	uint32_t dropped;
+
 	/* provided by user */
 	uint32_t pcap_iface;
 	void *priv;
@@ -143,6 +169,12 @@ struct udebug_iter {
 	uint64_t timestamp;
 	void *data;
 	size_t len;
+	enum udebug_format format;
+
+	/* min-heap of snapshot indices, ordered by their next timestamp */
+	uint32_t *heap;
+	uint32_t heap_buf[8];
+	size_t heap_len;
 };
 
 uint64_t udebug_timestamp(void);
@@ -157,14 +189,71 @@ int udebug_entry_printf(struct udebug_buf *buf, const char *fmt, ...)
 	__attribute__ ((format (printf, 2, 3)));
 int udebug_entry_vprintf(struct udebug_buf *buf, const char *fmt, va_list ap)
 	__attribute__ ((format (printf, 2, 0)));
+/*
+ * Append to an entry of a UDEBUG_FORMAT_DEFERRED ring: the format string
+ * and the raw arguments are stored, and the text is only generated by
+ * the reader through udebug_iter_format().
+ */
+int udebug_entry_deferred_printf(struct udebug_buf *buf, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+int udebug_entry_deferred_vprintf(struct udebug_buf *buf, const char *fmt, va_list ap)
+	__attribute__ ((format (printf, 2, 0)));
 uint16_t udebug_entry_trim(struct udebug_buf *buf, uint16_t len);
 void udebug_entry_set_length(struct udebug_buf *buf, uint16_t len);
 void udebug_entry_add(struct udebug_buf *buf);
 
+/*
+ * Multi-producer mode: entries can be added from any thread without an
+ * external lock. Ring slots and data space are reserved atomically and
+ * entries become visible to readers in reservation order, once all
+ * earlier ones have been committed. Must be enabled from the thread
+ * running the uloop that sends ring notifications, and the single
+ * producer udebug_entry_* functions must not be used on the ring
+ * afterwards.
+ */
+int udebug_buf_mp_init(struct udebug_buf *buf);
+void *udebug_mp_entry_reserve(struct udebug_buf *buf, struct udebug_mp_entry *e,
+			      uint64_t timestamp, uint32_t len);
+void udebug_mp_entry_commit(struct udebug_buf *buf, struct udebug_mp_entry *e);
+int udebug_mp_entry_add(struct udebug_buf *buf, uint64_t timestamp,
+			const void *data, uint32_t len);
+int udebug_mp_entry_printf(struct udebug_buf *buf, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+int udebug_mp_entry_vprintf(struct udebug_buf *buf, const char *fmt, va_list ap)
+	__attribute__ ((format (printf, 2, 0)));
+
+/*
+ * Ring allocation options. Without an explicit size, the data area holds
+ * rate bytes per second for the given number of seconds, and the number
+ * of entries is derived from the average entry_len.
+ */
+struct udebug_buf_opts {
+	size_t entries;
+	size_t size;
+
+	uint32_t rate;
+	uint32_t seconds;
+	uint32_t entry_len;
+
+	/* fault in all pages up front instead of on the first writes */
+	bool prefault;
+	/* use transparent huge pages for the data area where supported */
+	bool huge_pages;
+};
+
 int udebug_buf_init(struct udebug_buf *buf, size_t entries, size_t size);
+int udebug_buf_init_opts(struct udebug_buf *buf, const struct udebug_buf_opts *opts);
 int udebug_buf_add(struct udebug *ctx, struct udebug_buf *buf,
 		   const struct udebug_buf_meta *meta);
 uint64_t udebug_buf_flags(struct udebug_buf *buf);
+/*
+ * Coalesce reader notifications: instead of one message per added entry,
+ * notify once after interval ms (0: on the next loop iteration), or as
+ * soon as max_entries entries are pending if non-zero. A negative interval
+ * restores the default of notifying immediately.
+ */
+void udebug_buf_set_notify(struct udebug_buf *buf, int interval,
+			   unsigned int max_entries);
 void udebug_buf_free(struct udebug_buf *buf);
 static inline bool udebug_buf_valid(struct udebug_buf *buf)
 {
@@ -179,11 +268,84 @@ void udebug_remote_buf_set_flags(struct udebug_remote_buf *rb, uint64_t mask, ui
 struct udebug_snapshot *udebug_remote_buf_snapshot(struct udebug_remote_buf *rb);
 bool udebug_snapshot_get_entry(struct udebug_snapshot *s, struct udebug_iter *it, unsigned int entry);
 
+/*
+ * Incremental in-place reading: each call returns the next entry after
+ * the cursor in rb->head, pointing directly into the mapped ring, and
+ * adds entries that were overwritten before they could be read to
+ * rb->dropped. Returns false when no new entries are available.
+ * The producer may clobber the data at any time, so it is only valid if
+ * udebug_remote_buf_read_valid() still returns true after it was used.
+ */
+bool udebug_remote_buf_read(struct udebug_remote_buf *rb, struct udebug_iter *it);
+bool udebug_remote_buf_read_valid(struct udebug_remote_buf *rb);
+
 void udebug_remote_buf_set_start_time(struct udebug_remote_buf *rb, uint64_t ts);
 void udebug_remote_buf_set_start_offset(struct udebug_remote_buf *rb, uint32_t idx);
 
+/*
+ * Merges the entries of several snapshots by timestamp. Iterating over
+ * more than 8 snapshots allocates memory, which is released when
+ * udebug_iter_next() returns false or by udebug_iter_free().
+ */
 void udebug_iter_start(struct udebug_iter *it, struct udebug_snapshot **s, size_t n);
 bool udebug_iter_next(struct udebug_iter *it);
+void udebug_iter_free(struct udebug_iter *it);
+int udebug_iter_format(struct udebug_iter *it, char *buf, size_t size);
+
+enum udebug_export_format {
+	UDEBUG_EXPORT_PCAPNG,
+	UDEBUG_EXPORT_BINARY,
+};
+
+#define UDEBUG_EXPORT_MAGIC	"UDBGEXP1"
+
+/*
+ * Record header of UDEBUG_EXPORT_BINARY streams, which start with
+ * UDEBUG_EXPORT_MAGIC. All fields are big endian, the record data of len
+ * bytes follows without padding. Deferred format entries are exported as
+ * formatted UDEBUG_FORMAT_STRING records.
+ */
+struct udebug_export_record {
+	uint32_t len;
+	uint32_t ring;
+	uint64_t timestamp;
+	uint32_t format;
+	uint32_t sub_format;
+} __attribute__((packed));
+
+#define UDEBUG_EXPORT_BATCH	64
+
+/*
+ * Streams entries taken from snapshots to a ustream. Entries are queued
+ * by reference and written in batches with one writev, so the snapshots
+ * must stay valid until udebug_export_flush() was called. PCAPNG streams
+ * only contain UDEBUG_FORMAT_PACKET entries, others are counted as skipped.
+ */
+struct udebug_export {
+	struct ustream *s;
+	enum udebug_export_format format;
+	bool started;
+	unsigned int skipped;
+
+	/* pcapng interface id of each exported ring */
+	uint32_t *ifaces;
+	unsigned int n_ifaces;
+
+	struct iovec iov[3 * UDEBUG_EXPORT_BATCH];
+	unsigned int n_iov;
+	uint8_t hdr[64 * UDEBUG_EXPORT_BATCH];
+	unsigned int hdr_len;
+
+	char *text;
+	size_t text_size, text_len;
+};
+
+void udebug_export_init(struct udebug_export *e, struct ustream *s,
+			enum udebug_export_format format);
+int udebug_export_entry(struct udebug_export *e, struct udebug_iter *it);
+int udebug_export_iter(struct udebug_export *e, struct udebug_iter *it);
+int udebug_export_flush(struct udebug_export *e);
+void udebug_export_free(struct udebug_export *e);
 
 void udebug_init(struct udebug *ctx);
 int udebug_connect(struct udebug *ctx, const char *path);
@@ -0,0 +1,295 @@
+/*
+ * udgram - batched datagram socket I/O
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "udgram.h"
+#include "utils.h"
+
+#define UDGRAM_SLOTS	16
+#define UDGRAM_SLOT_LEN	2048
+
+#ifdef __linux__
+#define udgram_hdr mmsghdr
+
+static int udgram_recv_batch(int fd, struct mmsghdr *hdr, int n)
+{
+	return recvmmsg(fd, hdr, n, MSG_DONTWAIT, NULL);
+}
+
+static int udgram_send_batch(int fd, struct mmsghdr *hdr, int n)
+{
+	return sendmmsg(fd, hdr, n, MSG_DONTWAIT);
+}
+#else
+struct udgram_hdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+static int udgram_recv_batch(int fd, struct udgram_hdr *hdr, int n)
+{
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		len = recvmsg(fd, &hdr[i].msg_hdr, MSG_DONTWAIT);
+		if (len < 0)
+			return i ? i : -1;
+
+		hdr[i].msg_len = len;
+	}
+
+	return n;
+}
+
+static int udgram_send_batch(int fd, struct udgram_hdr *hdr, int n)
+{
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		len = sendmsg(fd, &hdr[i].msg_hdr, MSG_DONTWAIT);
+		if (len < 0)
+			return i ? i : -1;
+
+		hdr[i].msg_len = len;
+	}
+
+	return n;
+}
+#endif
+
+struct udgram_ring {
+	int head;
+	int count;
+
+	struct udgram_msg *msg;
+	struct udgram_hdr *hdr;
+	struct iovec *iov;
+};
+
+static struct udgram_ring *udgram_ring_alloc(int slots, int slot_len)
+{
+	struct udgram_ring *r;
+	struct udgram_msg *msg;
+	struct udgram_hdr *hdr;
+	struct iovec *iov;
+	char *buf;
+	int i;
+
+	r = calloc_a(sizeof(*r),
+		     &msg, slots * sizeof(*msg),
+		     &hdr, slots * sizeof(*hdr),
+		     &iov, slots * sizeof(*iov),
+		     &buf, slots * slot_len);
+	if (!r)
+		return NULL;
+
+	r->msg = msg;
+	r->hdr = hdr;
+	r->iov = iov;
+	for (i = 0; i < slots; i++) {
+		msg[i].data = buf + i * slot_len;
+		hdr[i].msg_hdr.msg_iov = &iov[i];
+		hdr[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return r;
+}
+
+static void udgram_set_uloop(struct udgram *d)
+{
+	unsigned int flags = ULOOP_READ | ULOOP_ERROR_CB;
+
+	if (d->tx->count)
+		flags |= ULOOP_WRITE;
+
+	uloop_fd_add(&d->fd, flags);
+}
+
+static void udgram_read(struct udgram *d)
+{
+	struct udgram_ring *r = d->rx;
+	int i, n;
+
+	for (i = 0; i < d->slots; i++) {
+		struct msghdr *hdr = &r->hdr[i].msg_hdr;
+
+		r->iov[i].iov_base = r->msg[i].data;
+		r->iov[i].iov_len = d->slot_len;
+		hdr->msg_name = &r->msg[i].addr;
+		hdr->msg_namelen = sizeof(r->msg[i].addr);
+		hdr->msg_flags = 0;
+	}
+
+	do {
+		n = udgram_recv_batch(d->fd.fd, r->hdr, d->slots);
+	} while (n < 0 && errno == EINTR);
+
+	if (n <= 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		struct udgram_msg *msg = &r->msg[i];
+
+		msg->len = r->hdr[i].msg_len;
+		msg->truncated = !!(r->hdr[i].msg_hdr.msg_flags & MSG_TRUNC);
+		msg->addrlen = r->hdr[i].msg_hdr.msg_namelen;
+	}
+
+	d->recv(d, r->msg, n);
+}
+
+int udgram_flush(struct udgram *d)
+{
+	struct udgram_ring *r = d->tx;
+	int sent = 0;
+
+	while (r->count) {
+		int i, n, ret;
+
+		/* send up to the end of the ring, wrap around on the next pass */
+		n = r->count;
+		if (n > d->slots - r->head)
+			n = d->slots - r->head;
+
+		for (i = r->head; i < r->head + n; i++) {
+			struct msghdr *hdr = &r->hdr[i].msg_hdr;
+			struct udgram_msg *msg = &r->msg[i];
+
+			r->iov[i].iov_base = msg->data;
+			r->iov[i].iov_len = msg->len;
+			hdr->msg_name = msg->addrlen ? &msg->addr : NULL;
+			hdr->msg_namelen = msg->addrlen;
+			hdr->msg_flags = 0;
+		}
+
+		ret = udgram_send_batch(d->fd.fd, &r->hdr[r->head], n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				break;
+
+			/* drop the datagram that could not be sent */
+			ret = 1;
+		} else {
+			sent += ret;
+		}
+
+		r->head = (r->head + ret) % d->slots;
+		r->count -= ret;
+	}
+
+	udgram_set_uloop(d);
+
+	return sent;
+}
+
+int udgram_send(struct udgram *d, const void *data, int len,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct udgram_ring *r = d->tx;
+	struct udgram_msg *msg;
+
+	if (len > d->slot_len || addrlen > sizeof(msg->addr))
+		return -1;
+
+	if (r->count == d->slots)
+		udgram_flush(d);
+
+	if (r->count == d->slots)
+		return -1;
+
+	msg = &r->msg[(r->head + r->count) % d->slots];
+	memcpy(msg->data, data, len);
+	msg->len = len;
+	msg->addrlen = addr ? addrlen : 0;
+	if (msg->addrlen)
+		memcpy(&msg->addr, addr, addrlen);
+
+	if (!r->count++)
+		udgram_set_uloop(d);
+
+	return 0;
+}
+
+int udgram_pending(struct udgram *d)
+{
+	return d->tx->count;
+}
+
+static void udgram_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct udgram *d = container_of(fd, struct udgram, fd);
+
+	if (fd->error) {
+		socklen_t len = sizeof(int);
+		int err;
+
+		/* fetch and clear the pending socket error */
+		getsockopt(fd->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		fd->error = false;
+		if (d->notify_error) {
+			d->notify_error(d);
+			return;
+		}
+	}
+
+	if (events & ULOOP_WRITE)
+		udgram_flush(d);
+
+	/* last, the recv callback may free d */
+	if (events & ULOOP_READ)
+		udgram_read(d);
+}
+
+int udgram_init(struct udgram *d, int fd)
+{
+	if (!d->slots)
+		d->slots = UDGRAM_SLOTS;
+	if (!d->slot_len)
+		d->slot_len = UDGRAM_SLOT_LEN;
+
+	d->rx = udgram_ring_alloc(d->slots, d->slot_len);
+	d->tx = udgram_ring_alloc(d->slots, d->slot_len);
+	if (!d->rx || !d->tx) {
+		free(d->rx);
+		free(d->tx);
+		d->rx = d->tx = NULL;
+		return -1;
+	}
+
+	d->fd.fd = fd;
+	d->fd.cb = udgram_cb;
+	udgram_set_uloop(d);
+
+	return 0;
+}
+
+void udgram_free(struct udgram *d)
+{
+	uloop_fd_delete(&d->fd);
+	free(d->rx);
+	free(d->tx);
+	d->rx = d->tx = NULL;
+}
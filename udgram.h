@@ -0,0 +1,82 @@
+/*
+ * udgram - batched datagram socket I/O
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __UDGRAM_H
+#define __UDGRAM_H
+
+#include <sys/socket.h>
+#include "uloop.h"
+
+struct udgram;
+struct udgram_ring;
+
+struct udgram_msg {
+	char *data;
+	int len;
+	bool truncated;
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+struct udgram {
+	struct uloop_fd fd;
+
+	/*
+	 * recv: (required)
+	 * called with a batch of n received datagrams, the data is only
+	 * valid until the callback returns
+	 */
+	void (*recv)(struct udgram *d, struct udgram_msg *msg, int n);
+
+	/*
+	 * notify_error: (optional)
+	 * called when the socket reported an error
+	 */
+	void (*notify_error)(struct udgram *d);
+
+	/* number of datagrams per batch and maximum datagram size */
+	int slots;
+	int slot_len;
+
+	struct udgram_ring *rx, *tx;
+};
+
+/*
+ * udgram_init: set up preallocated receive and send slots for a
+ * non-blocking datagram socket and register it with uloop.
+ * Fields left at 0 use defaults.
+ */
+int udgram_init(struct udgram *d, int fd);
+
+/* udgram_free: unregister the socket and free all slots */
+void udgram_free(struct udgram *d);
+
+/*
+ * udgram_send: queue a datagram, addr may be NULL for connected sockets.
+ * Queued datagrams are sent in one batch once the socket is writable, or
+ * earlier when all slots are in use. Returns -1 if the datagram is too
+ * large or all slots are still busy.
+ */
+int udgram_send(struct udgram *d, const void *data, int len,
+		const struct sockaddr *addr, socklen_t addrlen);
+
+/* udgram_flush: try to send all queued datagrams now */
+int udgram_flush(struct udgram *d);
+
+/* udgram_pending: number of queued datagrams */
+int udgram_pending(struct udgram *d);
+
+#endif
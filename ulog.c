@@ -23,13 +23,82 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#define ULOG_ASYNC_MSG_LEN	1024
+#define ULOG_MSG_LEN		1024
+
+#define ULOG_RL_BITS		6
+#define ULOG_RL_SIZE		(1 << ULOG_RL_BITS)
+#define ULOG_RL_PROBE		4
+
+struct ulog_async_rec {
+	int priority;
+	unsigned int len;
+};
+
+struct ulog_async {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	pthread_t thread;
+	bool stop;
+	bool busy;
+
+	/* free running byte offsets into data, size is a power of two */
+	uint32_t head, tail;
+	uint32_t size;
+
+	unsigned int dropped;
+	unsigned int reported;
+
+	char data[];
+};
 
 static int _ulog_channels = -1;
 static int _ulog_facility = -1;
-static int _ulog_threshold = LOG_DEBUG;
+static int _ulog_thresholds[3] = { LOG_DEBUG, LOG_DEBUG, LOG_DEBUG };
 static int _ulog_initialized = 0;
 static const char *_ulog_ident = NULL;
-static struct udebug_buf *udb = NULL;
+static uint64_t _ulog_udebug_mask;
+
+int ulog_level = LOG_DEBUG;
+struct udebug_buf *ulog_udb = NULL;
+static struct ulog_async *async = NULL;
+
+struct ulog_rl_entry {
+	const char *fmt;
+	uint64_t last;
+	/* in units of 1/interval tokens */
+	uint64_t tokens;
+	unsigned int suppressed;
+	int priority;
+};
+
+static pthread_mutex_t ulog_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ulog_rl_entry ulog_rl[ULOG_RL_SIZE];
+static unsigned int ulog_rl_interval, ulog_rl_burst;
+
+static bool ulog_dedup_enabled;
+static char ulog_last_msg[ULOG_MSG_LEN];
+static const char *ulog_last_fmt;
+static int ulog_last_priority;
+static unsigned int ulog_repeated;
+
+static void ulog_update_level(void)
+{
+	int level = -1;
+
+	/* channels are not known before ulog_defaults(), assume all of them */
+	for (int i = 0; i < 3; i++)
+		if (_ulog_channels < 0 || (_ulog_channels & (1 << i)))
+			level = level > _ulog_thresholds[i] ? level : _ulog_thresholds[i];
+
+	ulog_level = level;
+}
 
 static const char *ulog_default_ident(void)
 {
@@ -85,6 +154,7 @@ static void ulog_defaults(void)
 	if (_ulog_channels & ULOG_SYSLOG)
 		openlog(_ulog_ident, 0, _ulog_facility);
 
+	ulog_update_level();
 	_ulog_initialized = 1;
 }
 
@@ -121,9 +191,403 @@ static void ulog_syslog(int priority, const char *fmt, va_list ap)
 	vsyslog(priority, fmt, ap);
 }
 
+__attribute__((format(printf, 2, 0)))
+static void ulog_vout(int priority, const char *fmt, va_list ap)
+{
+	va_list ap2;
+
+	if ((_ulog_channels & ULOG_KMSG) && priority <= _ulog_thresholds[0])
+	{
+		va_copy(ap2, ap);
+		ulog_kmsg(priority, fmt, ap2);
+		va_end(ap2);
+	}
+
+	if ((_ulog_channels & ULOG_STDIO) && priority <= _ulog_thresholds[2])
+	{
+		va_copy(ap2, ap);
+		ulog_stdio(priority, fmt, ap2);
+		va_end(ap2);
+	}
+
+	if ((_ulog_channels & ULOG_SYSLOG) && priority <= _ulog_thresholds[1])
+	{
+		va_copy(ap2, ap);
+		ulog_syslog(priority, fmt, ap2);
+		va_end(ap2);
+	}
+}
+
+__attribute__((format(printf, 2, 3)))
+static void ulog_out(int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	ulog_vout(priority, fmt, ap);
+	va_end(ap);
+}
+
+static void ulog_async_put(struct ulog_async *a, const void *ptr, uint32_t len)
+{
+	uint32_t ofs = a->head & (a->size - 1);
+	uint32_t part = a->size - ofs;
+
+	if (part > len)
+		part = len;
+
+	memcpy(a->data + ofs, ptr, part);
+	memcpy(a->data, (const char *)ptr + part, len - part);
+	a->head += len;
+}
+
+static void ulog_async_get(struct ulog_async *a, void *ptr, uint32_t len)
+{
+	uint32_t ofs = a->tail & (a->size - 1);
+	uint32_t part = a->size - ofs;
+
+	if (part > len)
+		part = len;
+
+	memcpy(ptr, a->data + ofs, part);
+	memcpy((char *)ptr + part, a->data, len - part);
+	a->tail += len;
+}
+
+static void *ulog_async_thread(void *arg)
+{
+	struct ulog_async *a = arg;
+	struct ulog_async_rec rec;
+	char msg[ULOG_ASYNC_MSG_LEN];
+	unsigned int dropped;
+
+	pthread_mutex_lock(&a->lock);
+	while (1) {
+		if (a->head != a->tail) {
+			ulog_async_get(a, &rec, sizeof(rec));
+			ulog_async_get(a, msg, rec.len);
+			msg[rec.len] = 0;
+
+			a->busy = true;
+			pthread_mutex_unlock(&a->lock);
+			ulog_out(rec.priority, "%s", msg);
+			pthread_mutex_lock(&a->lock);
+			continue;
+		}
+
+		/* report drops once the backlog has been written out */
+		if (a->dropped != a->reported) {
+			dropped = a->dropped - a->reported;
+			a->reported = a->dropped;
+
+			a->busy = true;
+			pthread_mutex_unlock(&a->lock);
+			ulog_out(LOG_WARNING, "%u log messages dropped\n", dropped);
+			pthread_mutex_lock(&a->lock);
+			continue;
+		}
+
+		a->busy = false;
+		pthread_cond_broadcast(&a->idle);
+		if (a->stop)
+			break;
+
+		pthread_cond_wait(&a->wake, &a->lock);
+	}
+	pthread_mutex_unlock(&a->lock);
+
+	return NULL;
+}
+
+__attribute__((format(printf, 2, 0)))
+static void ulog_async_queue(int priority, const char *fmt, va_list ap)
+{
+	struct ulog_async_rec rec = { .priority = priority };
+	struct ulog_async *a = async;
+	char msg[ULOG_ASYNC_MSG_LEN];
+	int len;
+
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
+	if (len < 0)
+		return;
+
+	if (len >= (int)sizeof(msg))
+		len = sizeof(msg) - 1;
+	rec.len = len;
+
+	pthread_mutex_lock(&a->lock);
+	if (a->size - (a->head - a->tail) < sizeof(rec) + len) {
+		a->dropped++;
+	} else {
+		if (a->head == a->tail)
+			pthread_cond_signal(&a->wake);
+		ulog_async_put(a, &rec, sizeof(rec));
+		ulog_async_put(a, msg, len);
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void ulog_async_child(void)
+{
+	/* the output thread is gone, fall back to writing synchronously */
+	async = NULL;
+}
+
+static void ulog_async_stop(void)
+{
+	struct ulog_async *a = async;
+
+	if (!a)
+		return;
+
+	pthread_mutex_lock(&a->lock);
+	a->stop = true;
+	pthread_cond_signal(&a->wake);
+	pthread_mutex_unlock(&a->lock);
+	pthread_join(a->thread, NULL);
+
+	async = NULL;
+	pthread_cond_destroy(&a->idle);
+	pthread_cond_destroy(&a->wake);
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+}
+
+int ulog_async(size_t size)
+{
+	static bool atfork_done;
+	struct ulog_async *a;
+	sigset_t set, oldset;
+	uint32_t ring_size = 4096;
+	int ret;
+
+	ulog_async_stop();
+	if (!size)
+		return 0;
+
+	if (size > (1U << 30))
+		return -1;
+
+	while (ring_size < size)
+		ring_size <<= 1;
+
+	a = calloc(1, sizeof(*a) + ring_size);
+	if (!a)
+		return -1;
+
+	a->size = ring_size;
+	pthread_mutex_init(&a->lock, NULL);
+	pthread_cond_init(&a->wake, NULL);
+	pthread_cond_init(&a->idle, NULL);
+
+	/* leave signal delivery to the threads of the application */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&a->thread, NULL, ulog_async_thread, a);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (ret) {
+		pthread_cond_destroy(&a->idle);
+		pthread_cond_destroy(&a->wake);
+		pthread_mutex_destroy(&a->lock);
+		free(a);
+		return -1;
+	}
+
+	if (!atfork_done) {
+		pthread_atfork(NULL, NULL, ulog_async_child);
+		atfork_done = true;
+	}
+
+	async = a;
+
+	return 0;
+}
+
+__attribute__((format(printf, 2, 0)))
+static void ulog_emit(int priority, const char *fmt, va_list ap)
+{
+	if (async)
+		ulog_async_queue(priority, fmt, ap);
+	else
+		ulog_vout(priority, fmt, ap);
+}
+
+__attribute__((format(printf, 2, 3)))
+static void ulog_emitf(int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	ulog_emit(priority, fmt, ap);
+	va_end(ap);
+}
+
+static uint64_t ulog_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void ulog_rl_report(struct ulog_rl_entry *e)
+{
+	if (!e->suppressed)
+		return;
+
+	ulog_emitf(e->priority, "%u similar messages suppressed\n", e->suppressed);
+	e->suppressed = 0;
+}
+
+static struct ulog_rl_entry *ulog_rl_get(const char *fmt, uint64_t now)
+{
+	uint32_t hash = ((uintptr_t)fmt * 0x9e3779b1U) >> (32 - ULOG_RL_BITS);
+	struct ulog_rl_entry *e, *old = NULL;
+
+	for (int i = 0; i < ULOG_RL_PROBE; i++) {
+		e = &ulog_rl[(hash + i) & (ULOG_RL_SIZE - 1)];
+		if (e->fmt == fmt)
+			return e;
+
+		if (!old || e->last < old->last)
+			old = e;
+	}
+
+	/* replace the least recently used call site in the probe window */
+	ulog_rl_report(old);
+	old->fmt = fmt;
+	old->last = now;
+	old->tokens = (uint64_t)ulog_rl_burst * ulog_rl_interval;
+
+	return old;
+}
+
+static bool ulog_rl_check(int priority, const char *fmt)
+{
+	uint64_t now = ulog_time_ms();
+	uint64_t max = (uint64_t)ulog_rl_burst * ulog_rl_interval;
+	struct ulog_rl_entry *e;
+
+	e = ulog_rl_get(fmt, now);
+	e->tokens += (now - e->last) * ulog_rl_burst;
+	if (e->tokens > max)
+		e->tokens = max;
+	e->last = now;
+	e->priority = priority;
+
+	if (e->tokens < ulog_rl_interval) {
+		e->suppressed++;
+		return false;
+	}
+
+	e->tokens -= ulog_rl_interval;
+	ulog_rl_report(e);
+
+	return true;
+}
+
+static void ulog_dedup_report(void)
+{
+	if (ulog_repeated)
+		ulog_emitf(ulog_last_priority, "last message repeated %u times\n",
+			   ulog_repeated);
+
+	ulog_repeated = 0;
+}
+
+static bool ulog_dedup_check(int priority, const char *fmt, const char *msg)
+{
+	/* without conversions the format pointer identifies the message */
+	if (ulog_last_fmt == fmt && priority == ulog_last_priority &&
+	    (msg ? !strcmp(msg, ulog_last_msg) : !strchr(fmt, '%'))) {
+		ulog_repeated++;
+		return false;
+	}
+
+	ulog_dedup_report();
+	ulog_last_fmt = fmt;
+	ulog_last_priority = priority;
+	if (msg)
+		strcpy(ulog_last_msg, msg);
+
+	return true;
+}
+
+void ulog_ratelimit(unsigned int interval, unsigned int burst)
+{
+	pthread_mutex_lock(&ulog_lock);
+	for (int i = 0; i < ULOG_RL_SIZE; i++)
+		ulog_rl_report(&ulog_rl[i]);
+	memset(ulog_rl, 0, sizeof(ulog_rl));
+
+	ulog_rl_interval = burst ? interval : 0;
+	ulog_rl_burst = interval ? burst : 0;
+	pthread_mutex_unlock(&ulog_lock);
+}
+
+void ulog_dedup(bool enable)
+{
+	pthread_mutex_lock(&ulog_lock);
+	ulog_dedup_report();
+	ulog_dedup_enabled = enable;
+	ulog_last_fmt = NULL;
+	pthread_mutex_unlock(&ulog_lock);
+}
+
+void ulog_flush(void)
+{
+	struct ulog_async *a = async;
+
+	if (ulog_dedup_enabled) {
+		pthread_mutex_lock(&ulog_lock);
+		ulog_dedup_report();
+		pthread_mutex_unlock(&ulog_lock);
+	}
+
+	if (!a)
+		return;
+
+	pthread_mutex_lock(&a->lock);
+	while (a->head != a->tail || a->dropped != a->reported || a->busy)
+		pthread_cond_wait(&a->idle, &a->lock);
+	pthread_mutex_unlock(&a->lock);
+}
+
+unsigned int ulog_dropped(void)
+{
+	struct ulog_async *a = async;
+	unsigned int ret;
+
+	if (!a)
+		return 0;
+
+	pthread_mutex_lock(&a->lock);
+	ret = a->dropped;
+	pthread_mutex_unlock(&a->lock);
+
+	return ret;
+}
+
 void ulog_udebug(struct udebug_buf *_udb)
 {
-	udb = _udb;
+	ulog_udb = _udb;
+}
+
+void ulog_udebug_flags(uint64_t mask)
+{
+	_ulog_udebug_mask = mask;
+}
+
+bool ulog_udebug_enabled(void)
+{
+	struct udebug_buf *udb = ulog_udb;
+
+	if (!udb || !udebug_buf_valid(udb))
+		return false;
+
+	return !_ulog_udebug_mask || (udebug_buf_flags(udb) & _ulog_udebug_mask);
 }
 
 void ulog_open(int channels, int facility, const char *ident)
@@ -133,6 +597,7 @@ void ulog_open(int channels, int facility, const char *ident)
 	_ulog_channels = channels;
 	_ulog_facility = facility;
 	_ulog_ident = ident;
+	ulog_update_level();
 }
 
 void ulog_close(void)
@@ -140,6 +605,8 @@ void ulog_close(void)
 	if (!_ulog_initialized)
 		return;
 
+	ulog_flush();
+
 	if (_ulog_channels & ULOG_SYSLOG)
 		closelog();
 
@@ -148,44 +615,72 @@ void ulog_close(void)
 
 void ulog_threshold(int threshold)
 {
-	_ulog_threshold = threshold;
+	ulog_channel_threshold(ULOG_KMSG | ULOG_SYSLOG | ULOG_STDIO, threshold);
+}
+
+void ulog_channel_threshold(int channels, int threshold)
+{
+	for (int i = 0; i < 3; i++)
+		if (channels & (1 << i))
+			_ulog_thresholds[i] = threshold;
+
+	ulog_update_level();
 }
 
 void ulog(int priority, const char *fmt, ...)
 {
+	char msg[ULOG_MSG_LEN];
 	va_list ap;
 
-	if (udb) {
+	if (ulog_udebug_enabled()) {
+		struct udebug_buf *udb = ulog_udb;
+
 		va_start(ap, fmt);
 		udebug_entry_init(udb);
-		udebug_entry_vprintf(udb, fmt, ap);
+		if (udb->meta && udb->meta->format == UDEBUG_FORMAT_DEFERRED)
+			udebug_entry_deferred_vprintf(udb, fmt, ap);
+		else
+			udebug_entry_vprintf(udb, fmt, ap);
 		udebug_entry_add(udb);
 		va_end(ap);
 	}
 
-	if (priority > _ulog_threshold)
+	if (priority > ulog_level)
 		return;
 
 	ulog_defaults();
 
-	if (_ulog_channels & ULOG_KMSG)
-	{
+	if (!ulog_rl_burst && !ulog_dedup_enabled) {
 		va_start(ap, fmt);
-		ulog_kmsg(priority, fmt, ap);
+		ulog_emit(priority, fmt, ap);
 		va_end(ap);
+		return;
 	}
 
-	if (_ulog_channels & ULOG_STDIO)
-	{
+	pthread_mutex_lock(&ulog_lock);
+	if (ulog_rl_burst && !ulog_rl_check(priority, fmt))
+		goto out;
+
+	if (!ulog_dedup_enabled) {
 		va_start(ap, fmt);
-		ulog_stdio(priority, fmt, ap);
+		ulog_emit(priority, fmt, ap);
 		va_end(ap);
+		goto out;
 	}
 
-	if (_ulog_channels & ULOG_SYSLOG)
-	{
-		va_start(ap, fmt);
-		ulog_syslog(priority, fmt, ap);
-		va_end(ap);
+	if (!strchr(fmt, '%')) {
+		if (ulog_dedup_check(priority, fmt, NULL))
+			ulog_emitf(priority, "%s", fmt);
+		goto out;
 	}
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (ulog_dedup_check(priority, fmt, msg))
+		ulog_emitf(priority, "%s", msg);
+
+out:
+	pthread_mutex_unlock(&ulog_lock);
 }
@@ -29,18 +29,64 @@ enum {
 	ULOG_STDIO  = (1 << 2)
 };
 
+extern int ulog_level;
+extern struct udebug_buf *ulog_udb;
+
 void ulog_open(int channels, int facility, const char *ident);
 void ulog_udebug(struct udebug_buf *udb);
+/* only log to the udebug buffer while one of the flags in mask is set */
+void ulog_udebug_flags(uint64_t mask);
+bool ulog_udebug_enabled(void);
 void ulog_close(void);
 
 void ulog_threshold(int threshold);
+void ulog_channel_threshold(int channels, int threshold);
+
+/*
+ * Cheap check whether any output channel or the udebug buffer would take a
+ * message of the given priority, to skip building expensive arguments.
+ */
+static inline bool ulog_enabled(int priority)
+{
+	if (priority <= ulog_level)
+		return true;
+
+	return ulog_udb && ulog_udebug_enabled();
+}
+
+/*
+ * Queue log messages in a ring of the given size and write them to the
+ * kmsg, stdio and syslog channels from a background thread, so that a slow
+ * consumer cannot stall the caller. Messages that do not fit are dropped and
+ * counted. A size of 0 drains the ring and returns to synchronous output.
+ */
+int ulog_async(size_t size);
+void ulog_flush(void);
+unsigned int ulog_dropped(void);
+
+/*
+ * Allow each call site, identified by its format string, to emit burst
+ * messages per interval (in ms) to the output channels. Messages beyond that
+ * are only counted, without being formatted. An interval or burst of 0
+ * disables rate limiting.
+ */
+void ulog_ratelimit(unsigned int interval, unsigned int burst);
+
+/* Collapse consecutive identical messages into "last message repeated" */
+void ulog_dedup(bool enable);
 
 void ulog(int priority, const char *fmt, ...)
 	__attribute__ ((format (printf, 2, 3)));
 
-#define ULOG_INFO(fmt, ...) ulog(LOG_INFO, fmt, ## __VA_ARGS__)
-#define ULOG_NOTE(fmt, ...) ulog(LOG_NOTICE, fmt, ## __VA_ARGS__)
-#define ULOG_WARN(fmt, ...) ulog(LOG_WARNING, fmt, ## __VA_ARGS__)
-#define ULOG_ERR(fmt, ...) ulog(LOG_ERR, fmt, ## __VA_ARGS__)
+/* arguments are only evaluated if the message is going to be logged */
+#define ULOG(priority, fmt, ...) do { \
+	if (ulog_enabled(priority)) \
+		ulog(priority, fmt, ## __VA_ARGS__); \
+} while (0)
+
+#define ULOG_INFO(fmt, ...) ULOG(LOG_INFO, fmt, ## __VA_ARGS__)
+#define ULOG_NOTE(fmt, ...) ULOG(LOG_NOTICE, fmt, ## __VA_ARGS__)
+#define ULOG_WARN(fmt, ...) ULOG(LOG_WARNING, fmt, ## __VA_ARGS__)
+#define ULOG_ERR(fmt, ...) ULOG(LOG_ERR, fmt, ## __VA_ARGS__)
 
 #endif
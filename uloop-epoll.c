@@ -23,11 +23,20 @@
 #define EPOLLRDHUP 0x2000
 #endif
 
+#ifdef USE_IO_URING
+#include "uloop-io_uring.c"
+#endif
+
 static int uloop_init_pollfd(void)
 {
 	if (poll_fd >= 0)
 		return 0;
 
+#ifdef USE_IO_URING
+	if (backend == ULOOP_BACKEND_IO_URING && !uring_init())
+		return 0;
+#endif
+
 	poll_fd = epoll_create(32);
 	if (poll_fd < 0)
 		return -1;
@@ -36,10 +45,44 @@ static int uloop_init_pollfd(void)
 	return 0;
 }
 
-static int register_poll(struct uloop_fd *fd, unsigned int flags)
+struct uloop_fd_mod {
+	struct uloop_fd *fd;
+	unsigned int flags;
+};
+
+static __thread struct uloop_fd_mod *mod_fds;
+static __thread unsigned int n_mod_fds, max_mod_fds;
+
+#define ULOOP_POLL_MASK	(ULOOP_EVENT_MASK | ULOOP_EDGE_TRIGGER)
+
+static void uloop_close_pollfd(void)
+{
+#ifdef USE_IO_URING
+	if (uring_active)
+		uring_done();
+#endif
+
+	free(mod_fds);
+	mod_fds = NULL;
+	n_mod_fds = max_mod_fds = 0;
+
+	close(poll_fd);
+	poll_fd = -1;
+}
+
+static enum uloop_backend uloop_cur_backend(void)
+{
+#ifdef USE_IO_URING
+	if (uring_active)
+		return ULOOP_BACKEND_IO_URING;
+#endif
+
+	return ULOOP_BACKEND_EPOLL;
+}
+
+static int __register_poll(struct uloop_fd *fd, unsigned int flags, int op)
 {
 	struct epoll_event ev;
-	int op = fd->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
 
@@ -57,10 +100,100 @@ static int register_poll(struct uloop_fd *fd, unsigned int flags)
 	return epoll_ctl(poll_fd, op, fd->fd, &ev);
 }
 
-static struct epoll_event events[ULOOP_MAX_EVENTS];
+/*
+ * Flag changes of registered fds are queued and applied right before the
+ * next epoll_wait(), so toggling ULOOP_WRITE on and off again within one
+ * loop iteration does not cost any syscall, and repeated changes of the
+ * same fd are merged into a single EPOLL_CTL_MOD.
+ */
+static int register_poll_defer(struct uloop_fd *fd)
+{
+	struct uloop_fd_mod *mod;
+
+	if (n_mod_fds == max_mod_fds) {
+		unsigned int n = max_mod_fds ? max_mod_fds * 2 : 16;
+
+		mod = realloc(mod_fds, n * sizeof(*mod_fds));
+		if (!mod)
+			return -1;
+
+		mod_fds = mod;
+		max_mod_fds = n;
+	}
+
+	mod = &mod_fds[n_mod_fds++];
+	mod->fd = fd;
+	mod->flags = fd->flags;
+	fd->flags |= ULOOP_EVENT_DEFERRED;
+
+	return 0;
+}
+
+static void register_poll_flush(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_mod_fds; i++) {
+		struct uloop_fd_mod *mod = &mod_fds[i];
+		struct uloop_fd *fd = mod->fd;
+
+		if (!fd)
+			continue;
+
+		fd->flags &= ~ULOOP_EVENT_DEFERRED;
+		if ((fd->flags ^ mod->flags) & ULOOP_POLL_MASK)
+			__register_poll(fd, fd->flags, EPOLL_CTL_MOD);
+	}
+
+	n_mod_fds = 0;
+}
+
+static void register_poll_cancel(struct uloop_fd *fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_mod_fds; i++)
+		if (mod_fds[i].fd == fd)
+			mod_fds[i].fd = NULL;
+
+	fd->flags &= ~ULOOP_EVENT_DEFERRED;
+}
+
+static int register_poll(struct uloop_fd *fd, unsigned int flags)
+{
+#ifdef USE_IO_URING
+	if (uring_active)
+		return uring_register_poll(fd, flags);
+#endif
+
+	/* adding an fd is done immediately to report errors to the caller */
+	if (!fd->registered)
+		return __register_poll(fd, flags, EPOLL_CTL_ADD);
+
+	if (!((fd->flags ^ flags) & ULOOP_POLL_MASK))
+		return 0;
+
+	if (fd->flags & ULOOP_EVENT_DEFERRED)
+		return 0;
+
+	if (register_poll_defer(fd) < 0)
+		return __register_poll(fd, flags, EPOLL_CTL_MOD);
+
+	return 0;
+}
+
+static __thread struct epoll_event *events;
 
 static int __uloop_fd_delete(struct uloop_fd *sock)
 {
+#ifdef USE_IO_URING
+	if (uring_active)
+		return uring_fd_delete(sock);
+#endif
+
+	if (sock->flags & ULOOP_EVENT_DEFERRED)
+		register_poll_cancel(sock);
+
 	sock->flags = 0;
 	return epoll_ctl(poll_fd, EPOLL_CTL_DEL, sock->fd, 0);
 }
@@ -69,7 +202,14 @@ static int uloop_fetch_events(int timeout)
 {
 	int n, nfds;
 
-	nfds = epoll_wait(poll_fd, events, ARRAY_SIZE(events), timeout);
+#ifdef USE_IO_URING
+	if (uring_active)
+		return uring_fetch_events(timeout);
+#endif
+
+	register_poll_flush();
+
+	nfds = epoll_wait(poll_fd, events, cur_max_events, timeout);
 	for (n = 0; n < nfds; ++n) {
 		struct uloop_fd_event *cur = &cur_fds[n];
 		struct uloop_fd *u = events[n].data.ptr;
@@ -0,0 +1,419 @@
+/*
+ * uloop - event loop implementation
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * io_uring poll backend, included by uloop-epoll.c.
+ *
+ * Poll requests are queued on the submission ring and only submitted with
+ * the io_uring_enter() call that waits for events, so registering fds or
+ * changing their flags does not cost a syscall of its own.
+ *
+ * Edge triggered fds use multishot polls. Level triggered fds use oneshot
+ * polls that are re-armed after each completion; arming a poll checks the
+ * current fd state, which gives the same semantics as level triggered
+ * epoll.
+ *
+ * Requests are identified by fd number and a generation counter, so that
+ * completions arriving after an fd has been deleted are dropped without
+ * touching the (possibly freed) struct uloop_fd.
+ */
+
+#define URING_ENTRIES		256
+#define URING_UD_IGNORE		UINT64_MAX
+
+struct uring_slot {
+	struct uloop_fd *fd;
+	uint32_t gen;
+	uint32_t events;
+	bool multishot;
+	bool armed;
+};
+
+struct uring_ring {
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned int sq_entries;
+	unsigned int pending;
+};
+
+static __thread bool uring_active;
+static __thread struct uring_ring ring;
+static __thread struct uring_slot *slots;
+static __thread int n_slots;
+
+static int uring_enter(unsigned int to_submit, unsigned int min_complete,
+		       unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, poll_fd, to_submit, min_complete,
+		       flags, arg, argsz);
+}
+
+static int uring_init(void)
+{
+	struct io_uring_params p = {};
+	unsigned int features = IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+	int fd;
+
+	fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd < 0)
+		return -1;
+
+	/* multishot poll needs Linux 5.13, which added IORING_FEAT_RSRC_TAGS */
+	if ((p.features & features) != features)
+		goto error;
+
+	ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_len > ring.sq_len)
+			ring.sq_len = ring.cq_len;
+		ring.cq_len = 0;
+	}
+
+	ring.sq_ptr = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ptr == MAP_FAILED)
+		goto error;
+
+	if (ring.cq_len) {
+		ring.cq_ptr = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring.cq_ptr == MAP_FAILED)
+			goto error_sq;
+	} else {
+		ring.cq_ptr = ring.sq_ptr;
+	}
+
+	ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto error_cq;
+
+	ring.sq_head = ring.sq_ptr + p.sq_off.head;
+	ring.sq_tail = ring.sq_ptr + p.sq_off.tail;
+	ring.sq_mask = ring.sq_ptr + p.sq_off.ring_mask;
+	ring.sq_array = ring.sq_ptr + p.sq_off.array;
+	ring.cq_head = ring.cq_ptr + p.cq_off.head;
+	ring.cq_tail = ring.cq_ptr + p.cq_off.tail;
+	ring.cq_mask = ring.cq_ptr + p.cq_off.ring_mask;
+	ring.cqes = ring.cq_ptr + p.cq_off.cqes;
+	ring.sq_entries = p.sq_entries;
+	ring.pending = 0;
+
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	poll_fd = fd;
+	uring_active = true;
+
+	return 0;
+
+error_cq:
+	if (ring.cq_len)
+		munmap(ring.cq_ptr, ring.cq_len);
+error_sq:
+	munmap(ring.sq_ptr, ring.sq_len);
+error:
+	close(fd);
+	return -1;
+}
+
+static void uring_done(void)
+{
+	munmap(ring.sqes, ring.sqes_len);
+	if (ring.cq_len)
+		munmap(ring.cq_ptr, ring.cq_len);
+	munmap(ring.sq_ptr, ring.sq_len);
+	memset(&ring, 0, sizeof(ring));
+
+	free(slots);
+	slots = NULL;
+	n_slots = 0;
+
+	uring_active = false;
+}
+
+static int uring_submit(void)
+{
+	int ret;
+
+	if (!ring.pending)
+		return 0;
+
+	ret = uring_enter(ring.pending, 0, 0, NULL, 0);
+	if (ret < 0)
+		return -1;
+
+	ring.pending -= ret;
+
+	return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ring.sq_tail;
+	head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= ring.sq_entries) {
+		if (uring_submit() < 0)
+			return NULL;
+
+		head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head >= ring.sq_entries)
+			return NULL;
+	}
+
+	idx = tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[idx] = idx;
+
+	return sqe;
+}
+
+static void uring_commit_sqe(void)
+{
+	__atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+	ring.pending++;
+}
+
+static uint64_t uring_user_data(int fd)
+{
+	return ((uint64_t)slots[fd].gen << 32) | (uint32_t)fd;
+}
+
+static int uring_poll_add(int fd)
+{
+	struct uring_slot *slot = &slots[fd];
+	struct io_uring_sqe *sqe;
+	uint32_t events = slot->events;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return -1;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->len = slot->multishot ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = uring_user_data(fd);
+	uring_commit_sqe();
+
+	slot->armed = true;
+
+	return 0;
+}
+
+static int uring_poll_remove(int fd)
+{
+	struct uring_slot *slot = &slots[fd];
+	struct io_uring_sqe *sqe;
+
+	if (!slot->armed)
+		return 0;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return -1;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_user_data(fd);
+	sqe->user_data = URING_UD_IGNORE;
+	uring_commit_sqe();
+
+	slot->armed = false;
+
+	return 0;
+}
+
+static int uring_slots_resize(int fd)
+{
+	struct uring_slot *new_slots;
+	int n = n_slots ? n_slots : 64;
+
+	while (n <= fd)
+		n *= 2;
+
+	new_slots = realloc(slots, n * sizeof(*slots));
+	if (!new_slots)
+		return -1;
+
+	memset(new_slots + n_slots, 0, (n - n_slots) * sizeof(*slots));
+	slots = new_slots;
+	n_slots = n;
+
+	return 0;
+}
+
+static int uring_register_poll(struct uloop_fd *fd, unsigned int flags)
+{
+	struct uring_slot *slot;
+	uint32_t events = 0;
+	bool multishot = !!(flags & ULOOP_EDGE_TRIGGER);
+
+	if (fd->fd < 0)
+		return -1;
+
+	if (fd->fd >= n_slots && uring_slots_resize(fd->fd) < 0)
+		return -1;
+
+	if (flags & ULOOP_READ)
+		events |= EPOLLIN | EPOLLRDHUP;
+
+	if (flags & ULOOP_WRITE)
+		events |= EPOLLOUT;
+
+	slot = &slots[fd->fd];
+	if (slot->fd == fd && slot->events == events &&
+	    slot->multishot == multishot)
+		return 0;
+
+	if (slot->fd && uring_poll_remove(fd->fd) < 0)
+		return -1;
+
+	slot->fd = fd;
+	slot->gen++;
+	slot->events = events;
+	slot->multishot = multishot;
+
+	return uring_poll_add(fd->fd);
+}
+
+static int uring_fd_delete(struct uloop_fd *fd)
+{
+	struct uring_slot *slot;
+	int ret;
+
+	if (fd->fd < 0 || fd->fd >= n_slots)
+		return 0;
+
+	slot = &slots[fd->fd];
+	if (slot->fd != fd)
+		return 0;
+
+	ret = uring_poll_remove(fd->fd);
+	slot->fd = NULL;
+	slot->gen++;
+	fd->flags = 0;
+
+	return ret;
+}
+
+static int uring_fetch_events(int timeout)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg = {};
+	unsigned int head, tail;
+	int nfds = 0;
+	int ret;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.ts = (uintptr_t)&ts;
+	}
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	ret = uring_enter(ring.pending, head == tail ? 1 : 0,
+			  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			  &arg, sizeof(arg));
+	if (ret > 0)
+		ring.pending -= ret;
+	else if (ret < 0 && errno != ETIME && errno != EINTR)
+		return -1;
+
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && (unsigned int)nfds < cur_max_events) {
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+		struct uloop_fd_event *cur;
+		struct uring_slot *slot;
+		struct uloop_fd *u;
+		uint64_t ud = cqe->user_data;
+		uint32_t revents;
+		unsigned int ev = 0;
+		int fd = (uint32_t)ud;
+
+		head++;
+
+		if (ud == URING_UD_IGNORE || fd >= n_slots)
+			continue;
+
+		slot = &slots[fd];
+		u = slot->fd;
+		if (!u || slot->gen != (uint32_t)(ud >> 32))
+			continue;
+
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			slot->armed = false;
+
+		if (cqe->res < 0)
+			revents = EPOLLERR;
+		else
+			revents = cqe->res;
+
+		cur = &cur_fds[nfds++];
+		cur->fd = u;
+
+		/*
+		 * like with epoll, errors and hangups are reported until the fd
+		 * is deleted when ULOOP_ERROR_CB is set. A failed poll request
+		 * can't be re-armed, so its fd is always deleted.
+		 */
+		if (revents & (EPOLLERR | EPOLLHUP)) {
+			u->error = true;
+			if (cqe->res < 0 || !(u->flags & ULOOP_ERROR_CB))
+				uloop_fd_delete(u);
+		}
+
+		/* re-arm oneshot polls and multishot polls ended by the kernel */
+		if (!slot->armed && slot->fd == u)
+			uring_poll_add(fd);
+
+		if (!(revents & (EPOLLRDHUP | EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+			cur->fd = NULL;
+			continue;
+		}
+
+		if (revents & EPOLLRDHUP)
+			u->eof = true;
+
+		if (revents & EPOLLIN)
+			ev |= ULOOP_READ;
+
+		if (revents & EPOLLOUT)
+			ev |= ULOOP_WRITE;
+
+		cur->events = ev;
+	}
+
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	return nfds;
+}
@@ -33,6 +33,16 @@ static int uloop_init_pollfd(void)
 	return 0;
 }
 
+static void uloop_close_pollfd(void)
+{
+	close(poll_fd);
+	poll_fd = -1;
+}
+
+static enum uloop_backend uloop_cur_backend(void)
+{
+	return ULOOP_BACKEND_KQUEUE;
+}
 
 static uint16_t get_flags(unsigned int flags, unsigned int mask)
 {
@@ -48,7 +58,7 @@ static uint16_t get_flags(unsigned int flags, unsigned int mask)
 	return kflags;
 }
 
-static struct kevent events[ULOOP_MAX_EVENTS];
+static __thread struct kevent *events;
 
 static int register_kevent(struct uloop_fd *fd, unsigned int flags)
 {
@@ -130,7 +140,7 @@ static int uloop_fetch_events(int timeout)
 		ts.tv_nsec = (timeout % 1000) * 1000000;
 	}
 
-	nfds = kevent(poll_fd, NULL, 0, events, ARRAY_SIZE(events), timeout >= 0 ? &ts : NULL);
+	nfds = kevent(poll_fd, NULL, 0, events, cur_max_events, timeout >= 0 ? &ts : NULL);
 	for (n = 0; n < nfds; n++) {
 		if (events[n].filter == EVFILT_TIMER) {
 			struct uloop_interval *tm = events[n].udata;
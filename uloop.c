@@ -27,16 +27,27 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <spawn.h>
 
 #include "uloop.h"
 #include "utils.h"
+#include "avl-cmp.h"
+#include "udebug.h"
 
 #ifdef USE_KQUEUE
 #include <sys/event.h>
 #endif
 #ifdef USE_EPOLL
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 #endif
 #include <sys/wait.h>
 
@@ -51,23 +62,63 @@ struct uloop_fd_stack {
 	unsigned int events;
 };
 
-static struct uloop_fd_stack *fd_stack = NULL;
+/*
+ * Event loop state is kept per thread, so that every thread calling
+ * uloop_init() runs its own loop with its own poll fd and timeouts.
+ * Signals and child processes are process wide and are handled by the
+ * loop that was initialized first.
+ */
+static __thread struct uloop_fd_stack *fd_stack = NULL;
 
 #define ULOOP_MAX_EVENTS 10
 
-static struct list_head timeouts = LIST_HEAD_INIT(timeouts);
-static struct list_head processes = LIST_HEAD_INIT(processes);
+static int uloop_timeout_cmp(const void *k1, const void *k2, void *ptr);
+
+static __thread struct avl_tree timeouts;
+static __thread uint64_t timeout_seq;
+/* earliest deadline (time plus slack) of all pending timeouts */
+static __thread struct timeval timeout_wakeup;
+static __thread bool timeout_wakeup_valid;
+/* indexed by pid, so reaping a child does not walk all of them */
+static AVL_TREE(processes, avl_intcmp, true, NULL);
 static struct list_head signals = LIST_HEAD_INIT(signals);
 
-static int poll_fd = -1;
+static __thread int poll_fd = -1;
 bool uloop_cancelled = false;
+static __thread bool thread_cancelled;
 bool uloop_handle_sigchld = true;
-static int uloop_status = 0;
+bool uloop_use_signalfd = false;
+static __thread int uloop_status = 0;
 static bool do_sigchld = false;
 
-static struct uloop_fd_event cur_fds[ULOOP_MAX_EVENTS];
-static int cur_fd, cur_nfds;
-static int uloop_run_depth = 0;
+static bool signals_owned;
+static __thread bool signals_owner;
+
+/*
+ * The signal owning loop keeps using the global uloop_cancelled, which
+ * applications may check and set directly. All other loops have a flag
+ * of their own.
+ */
+static inline bool *uloop_cancel_flag(void)
+{
+	return signals_owner ? &uloop_cancelled : &thread_cancelled;
+}
+static bool *signal_cancelled;
+static int *signal_status;
+
+static __thread struct uloop_fd_event *cur_fds;
+static __thread int cur_fd, cur_nfds;
+static __thread unsigned int cur_fds_size;
+static __thread unsigned int cur_max_events;
+static __thread struct uloop_fd_event *requeue_fds;
+static __thread unsigned int n_requeue, max_requeue;
+static __thread unsigned int max_events = ULOOP_MAX_EVENTS;
+static __thread bool batch_dispatch = false;
+static __thread enum uloop_backend backend = ULOOP_BACKEND_DEFAULT;
+static __thread int uloop_run_depth = 0;
+static __thread struct timeval loop_time;
+static __thread bool stats_enabled;
+static __thread struct uloop_stats stats;
 
 uloop_fd_handler uloop_fd_set_cb = NULL;
 
@@ -81,15 +132,94 @@ int uloop_fd_add(struct uloop_fd *sock, unsigned int flags);
 #include "uloop-epoll.c"
 #endif
 
+static int uloop_events_resize(unsigned int n)
+{
+	struct uloop_fd_event *fds;
+	void *ev;
+
+	fds = realloc(cur_fds, n * sizeof(*cur_fds));
+	if (!fds)
+		return -1;
+
+	cur_fds = fds;
+	cur_fds_size = n;
+
+	ev = realloc(events, n * sizeof(*events));
+	if (!ev)
+		return -1;
+
+	events = ev;
+	cur_max_events = n;
+
+	return 0;
+}
+
+static void uloop_events_free(void)
+{
+	free(cur_fds);
+	free(events);
+	free(requeue_fds);
+	cur_fds = NULL;
+	events = NULL;
+	requeue_fds = NULL;
+	cur_fds_size = 0;
+	cur_max_events = 0;
+	cur_nfds = 0;
+	n_requeue = max_requeue = 0;
+}
+
+int uloop_set_max_events(unsigned int n)
+{
+	if (!n)
+		return -1;
+
+	max_events = n;
+
+	return 0;
+}
+
+void uloop_set_batch_dispatch(bool batch)
+{
+	batch_dispatch = batch;
+}
+
+int uloop_set_backend(enum uloop_backend b)
+{
+	switch (b) {
+	case ULOOP_BACKEND_DEFAULT:
+#ifdef USE_EPOLL
+	case ULOOP_BACKEND_EPOLL:
+#endif
+#ifdef USE_KQUEUE
+	case ULOOP_BACKEND_KQUEUE:
+#endif
+#ifdef USE_IO_URING
+	case ULOOP_BACKEND_IO_URING:
+#endif
+		backend = b;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+enum uloop_backend uloop_get_backend(void)
+{
+	if (poll_fd < 0)
+		return ULOOP_BACKEND_DEFAULT;
+
+	return uloop_cur_backend();
+}
+
 static void set_signo(uint64_t *signums, int signo)
 {
 	if (signo >= 1 && signo <= 64)
-		*signums |= (1u << (signo - 1));
+		*signums |= (1ULL << (signo - 1));
 }
 
 static bool get_signo(uint64_t signums, int signo)
 {
-	return (signo >= 1) && (signo <= 64) && (signums & (1u << (signo - 1)));
+	return (signo >= 1) && (signo <= 64) && (signums & (1ULL << (signo - 1)));
 }
 
 static void signal_consume(struct uloop_fd *fd, unsigned int events)
@@ -145,14 +275,284 @@ static int waker_init(void)
 	return 0;
 }
 
+#ifdef USE_EPOLL
+/*
+ * With uloop_use_signalfd, handled signals are blocked and read from a
+ * signalfd instead of interrupting the process, so callbacks are run
+ * without a signal handler, waker pipe or EINTR in between.
+ */
+static sigset_t sigfd_mask, sigfd_internal, sigfd_orig;
+static bool sigfd_atfork;
+
+static void signalfd_consume(struct uloop_fd *fd, unsigned int events);
+
+static struct uloop_fd sigfd = {
+	.fd = -1,
+	.cb = signalfd_consume,
+};
+
+static bool uloop_signal_listed(int signo)
+{
+	struct uloop_signal *usig;
+
+	list_for_each_entry(usig, &signals, list)
+		if (usig->signo == signo)
+			return true;
+
+	return false;
+}
+
+static void signalfd_consume(struct uloop_fd *fd, unsigned int events)
+{
+	struct uloop_signal *usig, *usig_next;
+	struct signalfd_siginfo info[16];
+	uint64_t signums = 0;
+	ssize_t len;
+
+	while ((len = read(fd->fd, info, sizeof(info))) > 0) {
+		for (size_t i = 0; i < len / sizeof(*info); i++) {
+			int signo = info[i].ssi_signo;
+
+			if (signo == SIGCHLD)
+				do_sigchld = true;
+
+			/* SIGINT and SIGTERM end the loop unless taken over */
+			if (sigismember(&sigfd_internal, signo) == 1 &&
+			    signo != SIGCHLD && !uloop_signal_listed(signo) &&
+			    signal_cancelled) {
+				*signal_status = signo;
+				*signal_cancelled = true;
+			}
+
+			set_signo(&signums, signo);
+		}
+	}
+
+	list_for_each_entry_safe(usig, usig_next, &signals, list)
+		if (get_signo(signums, usig->signo))
+			usig->cb(usig);
+}
+
+static void uloop_sigfd_refresh(void)
+{
+	struct uloop_signal *usig;
+	sigset_t mask = sigfd_internal, block, unblock;
+
+	list_for_each_entry(usig, &signals, list)
+		sigaddset(&mask, usig->signo);
+
+	sigemptyset(&block);
+	sigemptyset(&unblock);
+	for (int signo = 1; signo < NSIG; signo++) {
+		bool cur = sigismember(&sigfd_mask, signo) == 1;
+		bool new = sigismember(&mask, signo) == 1;
+
+		if (new && !cur)
+			sigaddset(&block, signo);
+		else if (cur && !new && sigismember(&sigfd_orig, signo) != 1)
+			sigaddset(&unblock, signo);
+	}
+
+	/* block new signals before they are read, unblock old ones after */
+	pthread_sigmask(SIG_BLOCK, &block, NULL);
+	signalfd(sigfd.fd, &mask, 0);
+	pthread_sigmask(SIG_UNBLOCK, &unblock, NULL);
+	sigfd_mask = mask;
+}
+
+static void uloop_sigfd_internal(int signo, bool add)
+{
+	struct sigaction s;
+
+	if (!add) {
+		sigdelset(&sigfd_internal, signo);
+		return;
+	}
+
+	/* like the signal handlers, do not take over custom handlers */
+	sigaction(signo, NULL, &s);
+	if (s.sa_handler == SIG_DFL)
+		sigaddset(&sigfd_internal, signo);
+}
+
+/* processes forked by the loop do not inherit the blocked signals */
+static void uloop_sigfd_child(void)
+{
+	if (sigfd.fd >= 0)
+		pthread_sigmask(SIG_SETMASK, &sigfd_orig, NULL);
+}
+
+static int uloop_sigfd_init(void)
+{
+	if (sigfd.fd >= 0)
+		return 0;
+
+	sigemptyset(&sigfd_mask);
+	sigemptyset(&sigfd_internal);
+	sigfd.fd = signalfd(-1, &sigfd_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sigfd.fd < 0)
+		return -1;
+
+	pthread_sigmask(SIG_BLOCK, NULL, &sigfd_orig);
+	if (!sigfd_atfork)
+		sigfd_atfork = !pthread_atfork(NULL, NULL, uloop_sigfd_child);
+
+	if (uloop_fd_add(&sigfd, ULOOP_READ) < 0) {
+		close(sigfd.fd);
+		sigfd.fd = -1;
+		return -1;
+	}
+
+	uloop_sigfd_refresh();
+
+	return 0;
+}
+
+static void uloop_sigfd_done(void)
+{
+	if (sigfd.fd < 0)
+		return;
+
+	sigemptyset(&sigfd_internal);
+	uloop_sigfd_refresh();
+	uloop_fd_delete(&sigfd);
+	close(sigfd.fd);
+	sigfd.fd = -1;
+}
+
+static bool uloop_sigfd_active(void)
+{
+	return sigfd.fd >= 0;
+}
+#else
+static int uloop_sigfd_init(void)
+{
+	return -1;
+}
+
+static void uloop_sigfd_done(void)
+{
+}
+#endif
+
+static void uloop_post_dispatch(struct uloop_post_queue *q)
+{
+	struct uloop_post *p, *next, *list = NULL;
+
+	p = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+
+	/* posts are pushed in LIFO order, restore the posting order */
+	while (p) {
+		next = p->next;
+		p->next = list;
+		list = p;
+		p = next;
+	}
+
+	for (p = list; p; p = next) {
+		next = p->next;
+		p->cb(p);
+	}
+}
+
+static void uloop_post_consume(struct uloop_fd *fd, unsigned int events)
+{
+	struct uloop_post_queue *q = container_of(fd, struct uloop_post_queue, fd);
+	uint64_t val;
+
+	/* clear the wakeup before taking the list, so no post is missed */
+	while (read(fd->fd, &val, sizeof(val)) > 0)
+		;
+
+	uloop_post_dispatch(q);
+}
+
+int uloop_post_queue_init(struct uloop_post_queue *q)
+{
+#ifdef USE_EPOLL
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (fd < 0)
+		return -1;
+
+	q->fd.fd = q->wake_fd = fd;
+#else
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	waker_init_fd(fds[0]);
+	waker_init_fd(fds[1]);
+	q->fd.fd = fds[0];
+	q->wake_fd = fds[1];
+#endif
+
+	q->head = NULL;
+	q->fd.cb = uloop_post_consume;
+	if (uloop_fd_add(&q->fd, ULOOP_READ) < 0) {
+		uloop_post_queue_done(q);
+		return -1;
+	}
+
+	return 0;
+}
+
+void uloop_post_queue_done(struct uloop_post_queue *q)
+{
+	uloop_fd_delete(&q->fd);
+	if (q->wake_fd != q->fd.fd)
+		close(q->wake_fd);
+	close(q->fd.fd);
+	q->fd.fd = q->wake_fd = -1;
+
+	uloop_post_dispatch(q);
+}
+
+int uloop_post(struct uloop_post_queue *q, struct uloop_post *p)
+{
+	struct uloop_post *head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	uint64_t val = 1;
+
+	do {
+		p->next = head;
+	} while (!__atomic_compare_exchange_n(&q->head, &head, p, true,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* only the post that finds the queue empty needs to wake the loop */
+	if (head)
+		return 0;
+
+#ifdef USE_EPOLL
+	if (write(q->wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+#else
+	if (write(q->wake_fd, &val, 1) < 0 && errno != EAGAIN)
+#endif
+		return -1;
+
+	return 0;
+}
+
 static void uloop_setup_signals(bool add);
 
 int uloop_init(void)
 {
+	bool owned = false;
+
 	if (uloop_init_pollfd() < 0)
 		return -1;
 
-	if (waker_init() < 0) {
+	if (!signals_owner &&
+	    !__atomic_compare_exchange_n(&signals_owned, &owned, true, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return 0;
+
+	signals_owner = true;
+	signal_cancelled = &uloop_cancelled;
+	signal_status = &uloop_status;
+
+	if ((!uloop_use_signalfd || uloop_sigfd_init() < 0) &&
+	    waker_init() < 0) {
 		uloop_done();
 		return -1;
 	}
@@ -162,6 +562,81 @@ int uloop_init(void)
 	return 0;
 }
 
+static uint64_t uloop_stats_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void uloop_stats_hist(uint32_t *hist, uint64_t usec)
+{
+	int n = usec ? 64 - __builtin_clzll(usec) : 0;
+
+	if (n >= ULOOP_STATS_BUCKETS)
+		n = ULOOP_STATS_BUCKETS - 1;
+
+	hist[n]++;
+}
+
+static void uloop_stats_cb(void *cb, uint64_t start, uint64_t *total)
+{
+	uint64_t usec = uloop_stats_time() - start;
+
+	*total += usec;
+	uloop_stats_hist(stats.cb_latency, usec);
+	if (usec >= stats.slowest_usec) {
+		stats.slowest_usec = usec;
+		stats.slowest_cb = cb;
+	}
+}
+
+void uloop_stats_enable(bool enable)
+{
+	stats_enabled = enable;
+}
+
+void uloop_stats_get(struct uloop_stats *st, bool reset)
+{
+	*st = stats;
+	if (reset)
+		memset(&stats, 0, sizeof(stats));
+}
+
+static void uloop_stats_log_hist(struct udebug_buf *buf, const char *name,
+				 const uint32_t *hist)
+{
+	int i;
+
+	udebug_entry_printf(buf, ", %s", name);
+	for (i = 0; i < ULOOP_STATS_BUCKETS; i++)
+		udebug_entry_printf(buf, " %u", hist[i]);
+}
+
+void uloop_stats_log(struct udebug_buf *buf, const struct uloop_stats *st)
+{
+	if (!udebug_buf_valid(buf))
+		return;
+
+	udebug_entry_init(buf);
+	udebug_entry_printf(buf, "uloop: %llu iterations, poll %llu us, "
+			    "%llu fd callbacks %llu us, %llu timeouts %llu us, "
+			    "slowest %p %llu us",
+			    (unsigned long long) st->iterations,
+			    (unsigned long long) st->poll_usec,
+			    (unsigned long long) st->fd_calls,
+			    (unsigned long long) st->fd_cb_usec,
+			    (unsigned long long) st->timeout_calls,
+			    (unsigned long long) st->timeout_cb_usec,
+			    st->slowest_cb,
+			    (unsigned long long) st->slowest_usec);
+	uloop_stats_log_hist(buf, "latency", st->cb_latency);
+	uloop_stats_log_hist(buf, "lateness", st->timer_lateness);
+	udebug_entry_add(buf);
+}
+
 static bool uloop_fd_stack_event(struct uloop_fd *fd, int events)
 {
 	struct uloop_fd_stack *cur;
@@ -188,21 +663,130 @@ static bool uloop_fd_stack_event(struct uloop_fd *fd, int events)
 	return false;
 }
 
+int uloop_fd_requeue(struct uloop_fd *fd, unsigned int events)
+{
+	struct uloop_fd_event *cur;
+	unsigned int i;
+
+	if (!fd->registered)
+		return -1;
+
+	for (i = 0; i < n_requeue; i++) {
+		if (requeue_fds[i].fd != fd)
+			continue;
+
+		requeue_fds[i].events |= events;
+		return 0;
+	}
+
+	if (n_requeue == max_requeue) {
+		unsigned int n = max_requeue ? max_requeue * 2 : 8;
+
+		cur = realloc(requeue_fds, n * sizeof(*requeue_fds));
+		if (!cur)
+			return -1;
+
+		requeue_fds = cur;
+		max_requeue = n;
+	}
+
+	cur = &requeue_fds[n_requeue++];
+	cur->fd = fd;
+	cur->events = events | ULOOP_EVENT_BUFFERED;
+
+	return 0;
+}
+
+/*
+ * Requeued fds are handled after all fds returned by the poll, which did
+ * not wait while they were pending. An fd reported by the poll again is
+ * only called once for both.
+ */
+static void uloop_requeue_flush(void)
+{
+	unsigned int i, n = cur_nfds + n_requeue;
+	int j;
+
+	if (n > cur_fds_size) {
+		struct uloop_fd_event *fds;
+
+		fds = realloc(cur_fds, n * sizeof(*cur_fds));
+		if (!fds)
+			return;
+
+		cur_fds = fds;
+		cur_fds_size = n;
+	}
+
+	for (i = 0; i < n_requeue; i++) {
+		struct uloop_fd_event *req = &requeue_fds[i];
+
+		if (!req->fd)
+			continue;
+
+		for (j = 0; j < cur_nfds; j++)
+			if (cur_fds[j].fd == req->fd)
+				break;
+
+		if (j < cur_nfds)
+			cur_fds[j].events |= req->events;
+		else
+			cur_fds[cur_nfds++] = *req;
+	}
+
+	n_requeue = 0;
+}
+
 static void uloop_run_events(int64_t timeout)
 {
 	struct uloop_fd_event *cur;
 	struct uloop_fd *fd;
 
 	if (!cur_nfds) {
+		/*
+		 * Start with a small batch and double it whenever the poll
+		 * returns a full one, up to the configured maximum.
+		 */
+		if (!cur_max_events || cur_max_events > max_events) {
+			unsigned int n = max_events;
+
+			if (n > ULOOP_MAX_EVENTS)
+				n = ULOOP_MAX_EVENTS;
+
+			if (uloop_events_resize(n) < 0 && !cur_max_events)
+				return;
+		}
+
 		cur_fd = 0;
-		cur_nfds = uloop_fetch_events(timeout);
+		if (n_requeue)
+			timeout = 0;
+
+		if (stats_enabled) {
+			uint64_t start = uloop_stats_time();
+
+			cur_nfds = uloop_fetch_events(timeout);
+			stats.poll_usec += uloop_stats_time() - start;
+			stats.iterations++;
+		} else {
+			cur_nfds = uloop_fetch_events(timeout);
+		}
+		uloop_time_update();
 		if (cur_nfds < 0)
 			cur_nfds = 0;
+		else if ((unsigned int)cur_nfds == cur_max_events &&
+			 cur_max_events < max_events)
+			uloop_events_resize(cur_max_events * 2 < max_events ?
+					    cur_max_events * 2 : max_events);
+
+		if (n_requeue)
+			uloop_requeue_flush();
 	}
 
 	while (cur_nfds > 0) {
 		struct uloop_fd_stack stack_cur;
 		unsigned int events;
+		uint64_t start = 0;
+		void *cb;
 
 		cur = &cur_fds[cur_fd++];
 		cur_nfds--;
@@ -218,6 +802,11 @@ static void uloop_run_events(int64_t timeout)
 		if (uloop_fd_stack_event(fd, cur->events))
 			continue;
 
+		events &= ULOOP_EVENT_MASK;
+		cb = fd->cb;
+		if (stats_enabled)
+			start = uloop_stats_time();
+
 		stack_cur.next = fd_stack;
 		stack_cur.fd = fd;
 		fd_stack = &stack_cur;
@@ -228,7 +817,13 @@ static void uloop_run_events(int64_t timeout)
 		} while (stack_cur.fd && events);
 		fd_stack = stack_cur.next;
 
-		return;
+		if (stats_enabled) {
+			stats.fd_calls++;
+			uloop_stats_cb(cb, start, &stats.fd_cb_usec);
+		}
+
+		if (!batch_dispatch || *uloop_cancel_flag())
+			return;
 	}
 }
 
@@ -253,7 +848,7 @@ int uloop_fd_add(struct uloop_fd *sock, unsigned int flags)
 	if (uloop_fd_set_cb)
 		uloop_fd_set_cb(sock, flags);
 
-	sock->flags = flags;
+	sock->flags = flags | (sock->flags & ULOOP_EVENT_DEFERRED);
 	sock->registered = true;
 	sock->eof = false;
 	sock->error = false;
@@ -274,6 +869,11 @@ int uloop_fd_delete(struct uloop_fd *fd)
 		cur_fds[cur_fd + i].fd = NULL;
 	}
 
+	for (i = 0; i < (int) n_requeue; i++) {
+		if (requeue_fds[i].fd == fd)
+			requeue_fds[i].fd = NULL;
+	}
+
 	if (!fd->registered)
 		return 0;
 
@@ -295,24 +895,69 @@ static int64_t tv_diff(struct timeval *t1, struct timeval *t2)
 		(t1->tv_usec - t2->tv_usec) / 1000;
 }
 
+/*
+ * Timeouts are kept in an AVL tree ordered by expiry time, which makes
+ * insert and cancel O(log n) while the next timeout to fire is always
+ * the first element. Timeouts expiring at the same time are ordered by
+ * their insertion sequence number, so they fire in the order they were
+ * added.
+ */
+static int uloop_timeout_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const struct uloop_timeout *t1 = k1, *t2 = k2;
+
+	if (t1->time.tv_sec != t2->time.tv_sec)
+		return t1->time.tv_sec > t2->time.tv_sec ? 1 : -1;
+
+	if (t1->time.tv_usec != t2->time.tv_usec)
+		return t1->time.tv_usec > t2->time.tv_usec ? 1 : -1;
+
+	if (t1->seq != t2->seq)
+		return t1->seq > t2->seq ? 1 : -1;
+
+	return 0;
+}
+
+static void uloop_timeout_deadline(struct uloop_timeout *t, struct timeval *tv)
+{
+	struct timeval slack = {
+		.tv_sec = t->slack / 1000,
+		.tv_usec = (t->slack % 1000) * 1000,
+	};
+
+	timeradd(&t->time, &slack, tv);
+}
+
 int uloop_timeout_add(struct uloop_timeout *timeout)
 {
-	struct uloop_timeout *tmp;
-	struct list_head *h = &timeouts;
+	struct timeval deadline;
 
 	if (timeout->pending)
 		return -1;
 
-	list_for_each_entry(tmp, &timeouts, list) {
-		if (tv_diff(&tmp->time, &timeout->time) > 0) {
-			h = &tmp->list;
-			break;
-		}
-	}
+	if (!timeouts.comp)
+		avl_init(&timeouts, uloop_timeout_cmp, false, NULL);
+
+	timeout->seq = timeout_seq++;
+	timeout->avl.key = timeout;
+	if (avl_insert(&timeouts, &timeout->avl))
+		return -1;
 
-	list_add_tail(&timeout->list, h);
 	timeout->pending = true;
 
+	/*
+	 * the cached wakeup is the minimum over all pending deadlines, so
+	 * adding a timeout can only move it earlier
+	 */
+	if (timeout_wakeup_valid) {
+		uloop_timeout_deadline(timeout, &deadline);
+		if (timercmp(&deadline, &timeout_wakeup, <))
+			timeout_wakeup = deadline;
+	} else if (timeouts.count == 1) {
+		uloop_timeout_deadline(timeout, &timeout_wakeup);
+		timeout_wakeup_valid = true;
+	}
+
 	return 0;
 }
 
@@ -325,6 +970,26 @@ static void uloop_gettime(struct timeval *tv)
 	tv->tv_usec = ts.tv_nsec / 1000;
 }
 
+void uloop_time_update(void)
+{
+	uloop_gettime(&loop_time);
+}
+
+/*
+ * While the loop is running, timeouts are computed relative to the loop
+ * time, which is refreshed once per iteration and after each poll,
+ * instead of reading the clock for every timeout that gets armed.
+ */
+static void uloop_loop_time(struct timeval *tv)
+{
+	if (!uloop_run_depth) {
+		uloop_gettime(tv);
+		return;
+	}
+
+	*tv = loop_time;
+}
+
 int uloop_timeout_set(struct uloop_timeout *timeout, int msecs)
 {
 	struct timeval *time = &timeout->time;
@@ -332,12 +997,12 @@ int uloop_timeout_set(struct uloop_timeout *timeout, int msecs)
 	if (timeout->pending)
 		uloop_timeout_cancel(timeout);
 
-	uloop_gettime(time);
+	uloop_loop_time(time);
 
 	time->tv_sec += msecs / 1000;
 	time->tv_usec += (msecs % 1000) * 1000;
 
-	if (time->tv_usec > 1000000) {
+	if (time->tv_usec >= 1000000) {
 		time->tv_sec++;
 		time->tv_usec -= 1000000;
 	}
@@ -347,12 +1012,21 @@ int uloop_timeout_set(struct uloop_timeout *timeout, int msecs)
 
 int uloop_timeout_cancel(struct uloop_timeout *timeout)
 {
+	struct timeval deadline;
+
 	if (!timeout->pending)
 		return -1;
 
-	list_del(&timeout->list);
+	avl_delete(&timeouts, &timeout->avl);
 	timeout->pending = false;
 
+	/* only the timeout defining the wakeup can move it later */
+	if (timeout_wakeup_valid) {
+		uloop_timeout_deadline(timeout, &deadline);
+		if (!timercmp(&deadline, &timeout_wakeup, >))
+			timeout_wakeup_valid = false;
+	}
+
 	return 0;
 }
 
@@ -390,20 +1064,11 @@ int64_t uloop_timeout_remaining64(struct uloop_timeout *timeout)
 
 int uloop_process_add(struct uloop_process *p)
 {
-	struct uloop_process *tmp;
-	struct list_head *h = &processes;
-
 	if (p->pending)
 		return -1;
 
-	list_for_each_entry(tmp, &processes, list) {
-		if (tmp->pid > p->pid) {
-			h = &tmp->list;
-			break;
-		}
-	}
-
-	list_add_tail(&p->list, h);
+	p->avl.key = &p->pid;
+	avl_insert(&processes, &p->avl);
 	p->pending = true;
 
 	return 0;
@@ -414,15 +1079,105 @@ int uloop_process_delete(struct uloop_process *p)
 	if (!p->pending)
 		return -1;
 
-	list_del(&p->list);
+	avl_delete(&processes, &p->avl);
 	p->pending = false;
 
 	return 0;
 }
 
+extern char **environ;
+
+static int uloop_spawn_fds(posix_spawn_file_actions_t *fa,
+			   const struct uloop_spawn_attr *attr, int *tmp)
+{
+	int i, fd, ret;
+
+	for (i = 0; i < attr->n_fds; i++) {
+		fd = attr->fds[i];
+
+		/* move sources out of the way of the targets first */
+		if (fd >= 0 && fd < attr->n_fds && fd != i) {
+			tmp[i] = fcntl(fd, F_DUPFD_CLOEXEC, attr->n_fds);
+			if (tmp[i] < 0)
+				return errno;
+
+			fd = tmp[i];
+		}
+
+		if (fd < 0)
+			ret = posix_spawn_file_actions_addopen(fa, i, "/dev/null", O_RDWR, 0);
+		else
+			ret = posix_spawn_file_actions_adddup2(fa, fd, i);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+int uloop_process_spawn(struct uloop_process *p, char *const argv[],
+			const struct uloop_spawn_attr *attr)
+{
+	static const struct uloop_spawn_attr attr_default;
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t sa;
+	sigset_t mask;
+	int *tmp = NULL;
+	int i, ret;
+	pid_t pid;
+
+	if (p->pending)
+		return -1;
+
+	if (!attr)
+		attr = &attr_default;
+
+	if (attr->n_fds > 0) {
+		tmp = malloc(attr->n_fds * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+
+		for (i = 0; i < attr->n_fds; i++)
+			tmp[i] = -1;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&sa);
+
+	/* undo SIGPIPE being ignored and signals blocked for signalfd */
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&sa, &mask);
+	sigfillset(&mask);
+	posix_spawnattr_setsigdefault(&sa, &mask);
+	posix_spawnattr_setflags(&sa, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	ret = uloop_spawn_fds(&fa, attr, tmp);
+	if (!ret)
+		ret = posix_spawnp(&pid, argv[0], &fa, &sa, argv,
+				   attr->envp ? attr->envp : environ);
+
+	for (i = 0; i < attr->n_fds; i++)
+		if (tmp[i] >= 0)
+			close(tmp[i]);
+
+	free(tmp);
+	posix_spawnattr_destroy(&sa);
+	posix_spawn_file_actions_destroy(&fa);
+
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+
+	/* exits are only collected by the loop, so this can not miss it */
+	p->pid = pid;
+
+	return uloop_process_add(p);
+}
+
 static void uloop_handle_processes(void)
 {
-	struct uloop_process *p, *tmp;
+	struct uloop_process *p;
 	pid_t pid;
 	int ret;
 
@@ -436,13 +1191,8 @@ static void uloop_handle_processes(void)
 		if (pid <= 0)
 			return;
 
-		list_for_each_entry_safe(p, tmp, &processes, list) {
-			if (p->pid < pid)
-				continue;
-
-			if (p->pid > pid)
-				break;
-
+		/* callbacks may modify the tree, look up every entry again */
+		while ((p = avl_find_element(&processes, &pid, p, avl)) != NULL) {
 			uloop_process_delete(p);
 			p->cb(p, ret);
 		}
@@ -483,8 +1233,10 @@ static void uloop_signal_wake(int signo)
 
 static void uloop_handle_sigint(int signo)
 {
-	uloop_status = signo;
-	uloop_cancelled = true;
+	if (signal_cancelled) {
+		*signal_status = signo;
+		*signal_cancelled = true;
+	}
 	uloop_signal_wake(signo);
 }
 
@@ -538,6 +1290,18 @@ static void uloop_setup_signals(bool add)
 {
 	static struct sigaction old_sigint, old_sigchld, old_sigterm;
 
+#ifdef USE_EPOLL
+	if (uloop_sigfd_active()) {
+		uloop_sigfd_internal(SIGINT, add);
+		uloop_sigfd_internal(SIGTERM, add);
+		if (uloop_handle_sigchld)
+			uloop_sigfd_internal(SIGCHLD, add);
+		uloop_sigfd_refresh();
+		uloop_ignore_signal(SIGPIPE, add);
+		return;
+	}
+#endif
+
 	uloop_install_handler(SIGINT, uloop_handle_sigint, &old_sigint, add);
 	uloop_install_handler(SIGTERM, uloop_handle_sigint, &old_sigterm, add);
 
@@ -568,6 +1332,13 @@ int uloop_signal_add(struct uloop_signal *s)
 
 	sigaction(s->signo, NULL, &s->orig);
 
+#ifdef USE_EPOLL
+	if (uloop_sigfd_active()) {
+		uloop_sigfd_refresh();
+		return 0;
+	}
+#endif
+
 	if (s->orig.sa_handler != uloop_signal_wake) {
 		sa.sa_handler = uloop_signal_wake;
 		sa.sa_flags = 0;
@@ -586,25 +1357,63 @@ int uloop_signal_delete(struct uloop_signal *s)
 	list_del(&s->list);
 	s->pending = false;
 
+#ifdef USE_EPOLL
+	if (uloop_sigfd_active()) {
+		uloop_sigfd_refresh();
+		return 0;
+	}
+#endif
+
 	if (s->orig.sa_handler != uloop_signal_wake)
 		sigaction(s->signo, &s->orig, NULL);
 
 	return 0;
 }
 
-int uloop_get_next_timeout(void)
+static void uloop_timeout_update_wakeup(void)
 {
 	struct uloop_timeout *timeout;
+	struct timeval cur;
+
+	timeout = avl_first_element(&timeouts, timeout, avl);
+	uloop_timeout_deadline(timeout, &timeout_wakeup);
+	avl_for_each_element(&timeouts, timeout, avl) {
+		if (timercmp(&timeout->time, &timeout_wakeup, >))
+			break;
+
+		uloop_timeout_deadline(timeout, &cur);
+		if (timercmp(&cur, &timeout_wakeup, <))
+			timeout_wakeup = cur;
+	}
+
+	timeout_wakeup_valid = true;
+}
+
+/*
+ * Wake up at the earliest deadline (expiry time plus slack) of all
+ * pending timeouts. Every timeout expiring before that is due by then and
+ * fires in the same pass of uloop_process_timeouts(). The deadline is
+ * cached as timeouts are added and only rescanned after the timeout
+ * defining it was cancelled or has fired.
+ */
+int uloop_get_next_timeout(void)
+{
 	struct timeval tv;
 	int64_t diff;
 
-	if (list_empty(&timeouts))
+	if (avl_is_empty(&timeouts))
 		return -1;
 
+	if (!timeout_wakeup_valid)
+		uloop_timeout_update_wakeup();
+
+	/*
+	 * read the clock here rather than using the loop time, callbacks
+	 * run since the last refresh would otherwise delay the next timer
+	 */
 	uloop_gettime(&tv);
 
-	timeout = list_first_entry(&timeouts, struct uloop_timeout, list);
-	diff = tv_diff(&timeout->time, &tv);
+	diff = tv_diff(&timeout_wakeup, &tv);
 	if (diff < 0)
 		return 0;
 	if (diff > INT_MAX)
@@ -618,19 +1427,34 @@ static void uloop_process_timeouts(void)
 	struct uloop_timeout *t;
 	struct timeval tv;
 
-	if (list_empty(&timeouts))
+	if (avl_is_empty(&timeouts))
 		return;
 
-	uloop_gettime(&tv);
-	while (!list_empty(&timeouts)) {
-		t = list_first_entry(&timeouts, struct uloop_timeout, list);
+	uloop_loop_time(&tv);
+	while (!avl_is_empty(&timeouts)) {
+		t = avl_first_element(&timeouts, t, avl);
 
 		if (tv_diff(&t->time, &tv) > 0)
 			break;
 
 		uloop_timeout_cancel(t);
-		if (t->cb)
+		if (!t->cb)
+			continue;
+
+		if (stats_enabled) {
+			uloop_timeout_handler cb = t->cb;
+			uint64_t start = uloop_stats_time();
+			int64_t late;
+
+			late = (int64_t) start - ((int64_t) t->time.tv_sec * 1000000 +
+						  t->time.tv_usec);
+			uloop_stats_hist(stats.timer_lateness, late > 0 ? late : 0);
+			cb(t);
+			stats.timeout_calls++;
+			uloop_stats_cb(cb, start, &stats.timeout_cb_usec);
+		} else {
 			t->cb(t);
+		}
 	}
 }
 
@@ -638,7 +1462,10 @@ static void uloop_clear_timeouts(void)
 {
 	struct uloop_timeout *t, *tmp;
 
-	list_for_each_entry_safe(t, tmp, &timeouts, list)
+	if (avl_is_empty(&timeouts))
+		return;
+
+	avl_for_each_element_safe(&timeouts, t, avl, tmp)
 		uloop_timeout_cancel(t);
 }
 
@@ -646,13 +1473,18 @@ static void uloop_clear_processes(void)
 {
 	struct uloop_process *p, *tmp;
 
-	list_for_each_entry_safe(p, tmp, &processes, list)
+	avl_for_each_element_safe(&processes, p, avl, tmp)
 		uloop_process_delete(p);
 }
 
+void uloop_end(void)
+{
+	*uloop_cancel_flag() = true;
+}
+
 bool uloop_cancelling(void)
 {
-	return uloop_run_depth > 0 && uloop_cancelled;
+	return uloop_run_depth > 0 && *uloop_cancel_flag();
 }
 
 int uloop_run_timeout(int timeout)
@@ -662,21 +1494,22 @@ int uloop_run_timeout(int timeout)
 	uloop_run_depth++;
 
 	uloop_status = 0;
-	uloop_cancelled = false;
+	*uloop_cancel_flag() = false;
 	do {
+		uloop_time_update();
 		uloop_process_timeouts();
 
-		if (do_sigchld)
+		if (signals_owner && do_sigchld)
 			uloop_handle_processes();
 
-		if (uloop_cancelled)
+		if (*uloop_cancel_flag())
 			break;
 
 		next_time = uloop_get_next_timeout();
 		if (timeout >= 0 && (next_time < 0 || timeout < next_time))
 				next_time = timeout;
 		uloop_run_events(next_time);
-	} while (!uloop_cancelled && timeout < 0);
+	} while (!*uloop_cancel_flag() && timeout < 0);
 
 	--uloop_run_depth;
 
@@ -685,20 +1518,29 @@ int uloop_run_timeout(int timeout)
 
 void uloop_done(void)
 {
-	uloop_setup_signals(false);
+	if (signals_owner)
+		uloop_setup_signals(false);
+
+	if (poll_fd >= 0)
+		uloop_close_pollfd();
+
+	if (signals_owner) {
+		uloop_sigfd_done();
+		if (waker_pipe >= 0) {
+			uloop_fd_delete(&waker_fd);
+			close(waker_pipe);
+			close(waker_fd.fd);
+			waker_pipe = -1;
+		}
 
-	if (poll_fd >= 0) {
-		close(poll_fd);
-		poll_fd = -1;
-	}
+		uloop_clear_processes();
 
-	if (waker_pipe >= 0) {
-		uloop_fd_delete(&waker_fd);
-		close(waker_pipe);
-		close(waker_fd.fd);
-		waker_pipe = -1;
+		signal_cancelled = NULL;
+		signal_status = NULL;
+		signals_owner = false;
+		__atomic_store_n(&signals_owned, false, __ATOMIC_RELEASE);
 	}
 
 	uloop_clear_timeouts();
-	uloop_clear_processes();
+	uloop_events_free();
 }
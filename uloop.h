@@ -31,18 +31,21 @@
 #endif
 
 #include "list.h"
+#include "avl.h"
 
 struct uloop_fd;
 struct uloop_timeout;
 struct uloop_process;
 struct uloop_interval;
 struct uloop_signal;
+struct uloop_post;
 
 typedef void (*uloop_fd_handler)(struct uloop_fd *u, unsigned int events);
 typedef void (*uloop_timeout_handler)(struct uloop_timeout *t);
 typedef void (*uloop_process_handler)(struct uloop_process *c, int ret);
 typedef void (*uloop_interval_handler)(struct uloop_interval *t);
 typedef void (*uloop_signal_handler)(struct uloop_signal *s);
+typedef void (*uloop_post_handler)(struct uloop_post *p);
 
 #define ULOOP_READ		(1 << 0)
 #define ULOOP_WRITE		(1 << 1)
@@ -58,6 +61,14 @@ typedef void (*uloop_signal_handler)(struct uloop_signal *s);
 #endif
 
 #define ULOOP_ERROR_CB		(1 << 6)
+#define ULOOP_EVENT_DEFERRED	(1 << 7)
+
+enum uloop_backend {
+	ULOOP_BACKEND_DEFAULT,
+	ULOOP_BACKEND_EPOLL,
+	ULOOP_BACKEND_KQUEUE,
+	ULOOP_BACKEND_IO_URING,
+};
 
 struct uloop_fd
 {
@@ -71,16 +82,24 @@ struct uloop_fd
 
 struct uloop_timeout
 {
-	struct list_head list;
+	struct avl_node avl;
 	bool pending;
 
 	uloop_timeout_handler cb;
 	struct timeval time;
+	uint64_t seq;
+
+	/*
+	 * slack: (optional)
+	 * msecs the timeout may fire late, so that the loop can wake up
+	 * once for several timeouts, only read when the timeout is added
+	 */
+	unsigned int slack;
 };
 
 struct uloop_process
 {
-	struct list_head list;
+	struct avl_node avl;
 	bool pending;
 
 	uloop_process_handler cb;
@@ -111,13 +130,52 @@ struct uloop_signal
 	int signo;
 };
 
+struct uloop_post
+{
+	struct uloop_post *next;
+
+	uloop_post_handler cb;
+};
+
+struct uloop_post_queue
+{
+	struct uloop_fd fd;
+	int wake_fd;
+
+	struct uloop_post *head;
+};
+
+/*
+ * uloop_cancelled: set by uloop_end() in the loop that handles signals.
+ * Other loops keep their flag private, use uloop_cancelling() to check it.
+ */
 extern bool uloop_cancelled;
 extern bool uloop_handle_sigchld;
+
+/*
+ * Set before uloop_init() to receive signals through a signalfd on Linux
+ * instead of signal handlers. The signals are blocked in the thread
+ * calling uloop_init() and in threads it creates afterwards, forked
+ * children get the previous signal mask back. Threads of the library
+ * block all signals. Application threads that already exist keep their
+ * mask and may still receive the signals, so either call uloop_init()
+ * before creating them or block SIGINT, SIGTERM and SIGCHLD there. The
+ * same applies to signals passed to uloop_signal_add() later, they are
+ * only blocked in the calling thread.
+ */
+extern bool uloop_use_signalfd;
 extern uloop_fd_handler uloop_fd_set_cb;
 
 int uloop_fd_add(struct uloop_fd *sock, unsigned int flags);
 int uloop_fd_delete(struct uloop_fd *sock);
 
+/*
+ * uloop_fd_requeue: call the fd callback with events again once the other
+ * ready fds had their turn, without waiting for the poll. Lets edge
+ * triggered handlers stop before an fd is drained.
+ */
+int uloop_fd_requeue(struct uloop_fd *sock, unsigned int events);
+
 int uloop_get_next_timeout(void);
 int uloop_timeout_add(struct uloop_timeout *timeout);
 int uloop_timeout_set(struct uloop_timeout *timeout, int msecs);
@@ -125,9 +183,38 @@ int uloop_timeout_cancel(struct uloop_timeout *timeout);
 int uloop_timeout_remaining(struct uloop_timeout *timeout) __attribute__((deprecated("use uloop_timeout_remaining64")));
 int64_t uloop_timeout_remaining64(struct uloop_timeout *timeout);
 
+/*
+ * Refresh the cached loop time used as the base for uloop_timeout_set()
+ * while the loop is running. Only needed by callbacks that spend a long
+ * time before arming a timeout that must be exact.
+ */
+void uloop_time_update(void);
+
 int uloop_process_add(struct uloop_process *p);
 int uloop_process_delete(struct uloop_process *p);
 
+struct uloop_spawn_attr {
+	/*
+	 * fds[i] becomes fd i of the child, -1 connects it to /dev/null.
+	 * fds above n_fds are inherited unless they are close-on-exec.
+	 */
+	const int *fds;
+	int n_fds;
+
+	/* environment of the child, NULL to pass on the current one */
+	char *const *envp;
+};
+
+/*
+ * uloop_process_spawn: run argv[0] (looked up in PATH unless it contains
+ * a '/') in a new process and register it as p before returning. Uses
+ * posix_spawn, which does not copy the page tables of the caller. The
+ * child starts with an empty signal mask and default signal handling.
+ * attr is optional. Returns -1 and sets errno on failure.
+ */
+int uloop_process_spawn(struct uloop_process *p, char *const argv[],
+			const struct uloop_spawn_attr *attr);
+
 int uloop_interval_set(struct uloop_interval *timer, unsigned int msecs);
 int uloop_interval_cancel(struct uloop_interval *timer);
 int64_t uloop_interval_remaining(struct uloop_interval *timer);
@@ -135,14 +222,92 @@ int64_t uloop_interval_remaining(struct uloop_interval *timer);
 int uloop_signal_add(struct uloop_signal *s);
 int uloop_signal_delete(struct uloop_signal *s);
 
+/*
+ * Post queues hand work from other threads to the loop thread that
+ * initialized the queue. uloop_post() may be called from any thread; the
+ * callbacks run on the loop thread in the order they were posted, and a
+ * burst of posts is delivered with a single wakeup.
+ */
+int uloop_post_queue_init(struct uloop_post_queue *q);
+void uloop_post_queue_done(struct uloop_post_queue *q);
+int uloop_post(struct uloop_post_queue *q, struct uloop_post *p);
+
 bool uloop_cancelling(void);
 
-static inline void uloop_end(void)
-{
-	uloop_cancelled = true;
-}
+/* uloop_end: make uloop_run() of the calling thread return */
+void uloop_end(void);
 
+/*
+ * Each thread calling uloop_init() gets its own event loop: fds, timeouts
+ * and intervals are bound to the loop of the thread that adds them.
+ * Processes and signals are handled by the loop initialized first.
+ */
 int uloop_init(void);
+
+/*
+ * Maximum number of events fetched from the kernel per poll call. The
+ * batch starts small and grows up to this limit while polls keep
+ * returning full batches.
+ */
+int uloop_set_max_events(unsigned int max_events);
+
+/*
+ * Dispatch all events of a batch before processing timeouts again,
+ * instead of returning to the main loop after each fd callback.
+ */
+void uloop_set_batch_dispatch(bool batch);
+
+/*
+ * Select the polling backend used by the next uloop_init() of the calling
+ * thread. Returns -1 if the backend was not built in. If the io_uring
+ * backend is not supported by the running kernel, uloop_init() falls back
+ * to epoll; uloop_get_backend() returns the backend actually in use.
+ */
+int uloop_set_backend(enum uloop_backend backend);
+enum uloop_backend uloop_get_backend(void);
+
+#define ULOOP_STATS_BUCKETS	24
+
+struct uloop_stats {
+	uint64_t iterations;
+
+	/* time spent waiting for events and in callbacks, in microseconds */
+	uint64_t poll_usec;
+	uint64_t fd_cb_usec;
+	uint64_t timeout_cb_usec;
+
+	uint64_t fd_calls;
+	uint64_t timeout_calls;
+
+	/*
+	 * log2 histograms in microseconds, bucket n counts values below 2^n
+	 * (the last bucket also counts everything above)
+	 */
+	uint32_t cb_latency[ULOOP_STATS_BUCKETS];
+	uint32_t timer_lateness[ULOOP_STATS_BUCKETS];
+
+	/* slowest fd or timeout callback */
+	void *slowest_cb;
+	uint64_t slowest_usec;
+};
+
+struct udebug_buf;
+
+/*
+ * Enable callback profiling for the loop of the calling thread. Costs two
+ * clock reads per dispatched callback while enabled.
+ */
+void uloop_stats_enable(bool enable);
+
+/*
+ * Copy the statistics collected since the last reset, optionally starting
+ * a new interval.
+ */
+void uloop_stats_get(struct uloop_stats *st, bool reset);
+
+/* Add a text summary of the statistics to a udebug buffer */
+void uloop_stats_log(struct udebug_buf *buf, const struct uloop_stats *st);
+
 int uloop_run_timeout(int timeout);
 static inline int uloop_run(void)
 {
@@ -16,9 +16,12 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <poll.h>
 #include <stdlib.h>
@@ -29,8 +32,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "usock.h"
+#include "uloop.h"
 #include "utils.h"
 
 static void usock_set_flags(int sock, unsigned int type)
@@ -55,6 +61,11 @@ static int usock_connect(int type, struct sockaddr *sa, int sa_len, int family,
 	if (server) {
 		const int one = 1;
 		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+		if ((type & USOCK_REUSEPORT) &&
+		    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)))
+			goto error;
+#endif
 
 		if (!bind(sock, sa, sa_len) &&
 		    (socktype != SOCK_STREAM || !listen(sock, SOMAXCONN)))
@@ -64,6 +75,9 @@ static int usock_connect(int type, struct sockaddr *sa, int sa_len, int family,
 			return sock;
 	}
 
+#ifdef SO_REUSEPORT
+error:
+#endif
 	close(sock);
 	return -1;
 }
@@ -237,6 +251,178 @@ free_addrinfo:
 	return sock;
 }
 
+static void usock_listen_setup(int sock, const struct usock_listen_opts *opts)
+{
+	if (!opts)
+		return;
+
+	if (opts->backlog > 0)
+		listen(sock, opts->backlog);
+#ifdef TCP_DEFER_ACCEPT
+	if (opts->defer_accept > 0)
+		setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			   &opts->defer_accept, sizeof(opts->defer_accept));
+#endif
+#ifdef TCP_FASTOPEN
+	if (opts->fastopen > 0)
+		setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN,
+			   &opts->fastopen, sizeof(opts->fastopen));
+#endif
+}
+
+int usock_listen(int type, const char *host, const char *service,
+		 const struct usock_listen_opts *opts)
+{
+	int sock;
+
+	sock = usock(type | USOCK_SERVER, host, service);
+	if (sock >= 0 && (type & 0xff) == USOCK_TCP)
+		usock_listen_setup(sock, opts);
+
+	return sock;
+}
+
+int usock_listen_shards(int type, const char *host, const char *service,
+			const struct usock_listen_opts *opts, int *fds, int n)
+{
+	int socktype = ((type & 0xff) == USOCK_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	int i;
+
+	if (n < 1 || (type & USOCK_UNIX))
+		return -1;
+
+	type |= USOCK_SERVER | USOCK_REUSEPORT;
+	fds[0] = usock_inet(type, host, service, NULL);
+	if (fds[0] < 0)
+		return -1;
+
+	/* bind the other shards to the address the first one ended up with */
+	if (getsockname(fds[0], (struct sockaddr *) &addr, &len)) {
+		close(fds[0]);
+		return -1;
+	}
+
+	for (i = 1; i < n; i++) {
+		fds[i] = usock_connect(type, (struct sockaddr *) &addr, len,
+				       addr.ss_family, socktype, true);
+		if (fds[i] < 0)
+			break;
+	}
+
+	if (socktype == SOCK_STREAM)
+		for (n = 0; n < i; n++)
+			usock_listen_setup(fds[n], opts);
+
+	return i;
+}
+
+static int usock_accept_one(int fd, struct sockaddr_storage *addr)
+{
+	socklen_t len;
+	int sock;
+
+	do {
+		len = sizeof(*addr);
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+		sock = accept4(fd, (struct sockaddr *) addr, &len,
+			       SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		sock = accept(fd, (struct sockaddr *) addr, &len);
+		if (sock >= 0)
+			usock_set_flags(sock, USOCK_NONBLOCK);
+#endif
+	} while (sock < 0 && (errno == EINTR || errno == ECONNABORTED));
+
+	return sock;
+}
+
+int usock_accept_batch(int fd, int max,
+		       void (*cb)(int fd, struct sockaddr_storage *addr, void *priv),
+		       void *priv)
+{
+	struct sockaddr_storage addr;
+	int n = 0;
+	int sock;
+
+	while (!max || n < max) {
+		sock = usock_accept_one(fd, &addr);
+		if (sock < 0)
+			break;
+
+		n++;
+		cb(sock, &addr, priv);
+	}
+
+	return n;
+}
+
+static void usock_listener_accept(struct usock_listener *l)
+{
+	struct sockaddr_storage addr;
+	bool deleted = false;
+	int sock;
+
+	/* accept_cb may delete the listener, see usock_listener_delete */
+	l->deleted = &deleted;
+	do {
+		sock = usock_accept_one(l->fd.fd, &addr);
+		if (sock < 0)
+			break;
+
+		l->accept_cb(l, sock, &addr);
+	} while (!deleted);
+
+	if (deleted)
+		return;
+
+	l->deleted = NULL;
+
+	/*
+	 * Running out of fds or memory leaves the backlog pending, and no new
+	 * edge is coming for it. Try again later instead of stalling.
+	 */
+	if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+	    errno == ENOMEM)
+		uloop_timeout_set(&l->retry, USOCK_ACCEPT_RETRY_MS);
+}
+
+static void usock_listener_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct usock_listener *l = container_of(fd, struct usock_listener, fd);
+
+	/* edge triggered, so the queue has to be drained completely */
+	usock_listener_accept(l);
+}
+
+static void usock_listener_retry(struct uloop_timeout *t)
+{
+	struct usock_listener *l = container_of(t, struct usock_listener, retry);
+
+	usock_listener_accept(l);
+}
+
+int usock_listener_add(struct usock_listener *l, int fd)
+{
+	l->fd.fd = fd;
+	l->fd.cb = usock_listener_cb;
+	l->retry.cb = usock_listener_retry;
+	l->deleted = NULL;
+
+	return uloop_fd_add(&l->fd, ULOOP_READ | ULOOP_EDGE_TRIGGER);
+}
+
+void usock_listener_delete(struct usock_listener *l)
+{
+	if (l->deleted)
+		*l->deleted = true;
+	l->deleted = NULL;
+
+	uloop_timeout_cancel(&l->retry);
+	uloop_fd_delete(&l->fd);
+}
+
 const char *usock_port(int port)
 {
 	static char buffer[sizeof("65535\0")];
@@ -288,3 +474,340 @@ int usock_wait_ready(int fd, int msecs) {
 
 	return 0;
 }
+
+#define USOCK_ASYNC_DELAY	250
+
+struct usock_attempt {
+	struct uloop_fd fd;
+	struct usock_async_ctx *ctx;
+	struct addrinfo *ai;
+};
+
+struct usock_async_ctx {
+	struct usock_async *req;
+	int refcount;
+	int type;
+
+	/* resolving, the helper thread only touches these */
+	char *host, *service;
+	struct addrinfo hints;
+	struct addrinfo *result;
+	int gai_ret;
+	struct uloop_post_queue queue;
+	struct uloop_post post;
+	bool resolving;
+
+	/* connecting */
+	struct uloop_timeout timeout;
+	struct uloop_timeout delay;
+	struct addrinfo **cand;
+	struct usock_attempt *attempts;
+	int n_cand, next_cand, n_active;
+	int error;
+};
+
+static void usock_async_put(struct usock_async_ctx *ctx)
+{
+	if (__atomic_sub_fetch(&ctx->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (ctx->result)
+		freeaddrinfo(ctx->result);
+	free(ctx->cand);
+	free(ctx->attempts);
+	free(ctx->host);
+	free(ctx->service);
+	free(ctx);
+}
+
+static void usock_async_close(struct usock_async_ctx *ctx, int keep_fd)
+{
+	int i;
+
+	uloop_timeout_cancel(&ctx->timeout);
+	uloop_timeout_cancel(&ctx->delay);
+
+	for (i = 0; i < ctx->next_cand; i++) {
+		struct uloop_fd *fd = &ctx->attempts[i].fd;
+
+		if (fd->fd < 0)
+			continue;
+
+		uloop_fd_delete(fd);
+		if (fd->fd != keep_fd)
+			close(fd->fd);
+		fd->fd = -1;
+	}
+	ctx->n_active = 0;
+}
+
+static void usock_async_finish(struct usock_async_ctx *ctx, int fd, int error)
+{
+	struct usock_async *a = ctx->req;
+
+	usock_async_close(ctx, fd);
+	a->ctx = NULL;
+	a->error = error;
+	ctx->req = NULL;
+
+	/* the resolver result still arrives and drops the last reference */
+	if (!ctx->resolving)
+		usock_async_put(ctx);
+
+	a->cb(a, fd);
+}
+
+static void usock_async_start_next(struct usock_async_ctx *ctx);
+
+static void usock_async_fd_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct usock_attempt *att = container_of(fd, struct usock_attempt, fd);
+	struct usock_async_ctx *ctx = att->ctx;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(fd->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+		err = errno;
+
+	if (!err) {
+		memcpy(&ctx->req->addr, att->ai->ai_addr, att->ai->ai_addrlen);
+		usock_async_finish(ctx, fd->fd, 0);
+		return;
+	}
+
+	uloop_fd_delete(fd);
+	close(fd->fd);
+	fd->fd = -1;
+	ctx->n_active--;
+	ctx->error = err;
+
+	/* don't wait for the delay once an attempt has failed */
+	usock_async_start_next(ctx);
+}
+
+static void usock_async_start_next(struct usock_async_ctx *ctx)
+{
+	int socktype = ((ctx->type & 0xff) == USOCK_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+	struct usock_attempt *att;
+	struct addrinfo *ai;
+	int sock;
+
+	while (ctx->next_cand < ctx->n_cand) {
+		att = &ctx->attempts[ctx->next_cand];
+		ai = ctx->cand[ctx->next_cand++];
+
+		sock = usock_connect(ctx->type | USOCK_NONBLOCK, ai->ai_addr,
+				     ai->ai_addrlen, ai->ai_family, socktype, false);
+		if (sock < 0) {
+			ctx->error = errno;
+			continue;
+		}
+
+		att->ctx = ctx;
+		att->ai = ai;
+		att->fd.fd = sock;
+		att->fd.cb = usock_async_fd_cb;
+		uloop_fd_add(&att->fd, ULOOP_WRITE);
+		ctx->n_active++;
+
+		if (socktype != SOCK_STREAM) {
+			memcpy(&ctx->req->addr, ai->ai_addr, ai->ai_addrlen);
+			usock_async_finish(ctx, sock, 0);
+			return;
+		}
+
+		if (ctx->next_cand < ctx->n_cand)
+			uloop_timeout_set(&ctx->delay, USOCK_ASYNC_DELAY);
+		return;
+	}
+
+	if (!ctx->n_active)
+		usock_async_finish(ctx, -1, ctx->error);
+}
+
+static void usock_async_delay_cb(struct uloop_timeout *t)
+{
+	usock_async_start_next(container_of(t, struct usock_async_ctx, delay));
+}
+
+static void usock_async_timeout_cb(struct uloop_timeout *t)
+{
+	usock_async_finish(container_of(t, struct usock_async_ctx, timeout),
+			   -1, ETIMEDOUT);
+}
+
+/* interleave address families, starting with the first one returned */
+static int usock_async_sort(struct usock_async_ctx *ctx)
+{
+	struct addrinfo *rp, *fam[2] = { ctx->result, NULL };
+	int n = 0, i = 0;
+
+	for (rp = ctx->result; rp; rp = rp->ai_next)
+		n++;
+
+	ctx->cand = calloc(n, sizeof(*ctx->cand));
+	ctx->attempts = calloc(n, sizeof(*ctx->attempts));
+	if (!ctx->cand || !ctx->attempts)
+		return -1;
+
+	for (rp = ctx->result; rp; rp = rp->ai_next) {
+		if (rp->ai_family != ctx->result->ai_family) {
+			fam[1] = rp;
+			break;
+		}
+	}
+
+	while (fam[0] || fam[1]) {
+		rp = fam[i];
+		if (rp) {
+			ctx->cand[ctx->n_cand++] = rp;
+			for (rp = rp->ai_next; rp; rp = rp->ai_next)
+				if ((rp->ai_family == ctx->result->ai_family) == !i)
+					break;
+			fam[i] = rp;
+		}
+		i = !i;
+	}
+
+	for (i = 0; i < n; i++)
+		ctx->attempts[i].fd.fd = -1;
+
+	return 0;
+}
+
+static void usock_async_resolved(struct uloop_post *p)
+{
+	struct usock_async_ctx *ctx = container_of(p, struct usock_async_ctx, post);
+
+	uloop_post_queue_done(&ctx->queue);
+	ctx->resolving = false;
+
+	if (!ctx->req) {
+		usock_async_put(ctx);
+		return;
+	}
+
+	if (ctx->gai_ret) {
+		usock_async_finish(ctx, -1, ctx->gai_ret);
+		return;
+	}
+
+	if (usock_async_sort(ctx)) {
+		usock_async_finish(ctx, -1, ENOMEM);
+		return;
+	}
+
+	ctx->error = EHOSTUNREACH;
+	usock_async_start_next(ctx);
+}
+
+static void usock_async_resolve(struct usock_async_ctx *ctx)
+{
+	ctx->gai_ret = getaddrinfo(ctx->host, ctx->service, &ctx->hints,
+				   &ctx->result);
+	/* EAI_SYSTEM is reported as the errno value behind it */
+	if (ctx->gai_ret == EAI_SYSTEM && errno > 0)
+		ctx->gai_ret = errno;
+	uloop_post(&ctx->queue, &ctx->post);
+}
+
+static void *usock_async_thread(void *arg)
+{
+	struct usock_async_ctx *ctx = arg;
+
+	usock_async_resolve(ctx);
+	usock_async_put(ctx);
+
+	return NULL;
+}
+
+int usock_inet_async(struct usock_async *a, int type, const char *host,
+		     const char *service)
+{
+	struct usock_async_ctx *ctx;
+	sigset_t set, oldset;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int ret;
+
+	if (type & (USOCK_SERVER | USOCK_UNIX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->req = a;
+	ctx->refcount = 1;
+	ctx->type = type;
+	ctx->host = host ? strdup(host) : NULL;
+	ctx->service = service ? strdup(service) : NULL;
+	ctx->hints.ai_family = (type & USOCK_IPV6ONLY) ? AF_INET6 :
+		(type & USOCK_IPV4ONLY) ? AF_INET : AF_UNSPEC;
+	ctx->hints.ai_socktype = ((type & 0xff) == USOCK_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+	ctx->hints.ai_flags = AI_ADDRCONFIG |
+		((type & USOCK_NUMERIC) ? AI_NUMERICHOST : 0);
+	ctx->post.cb = usock_async_resolved;
+
+	if ((host && !ctx->host) || (service && !ctx->service))
+		goto error;
+
+	if (uloop_post_queue_init(&ctx->queue))
+		goto error;
+
+	ctx->resolving = true;
+	a->ctx = ctx;
+
+	/* the timeout covers name resolution as well */
+	ctx->timeout.cb = usock_async_timeout_cb;
+	ctx->delay.cb = usock_async_delay_cb;
+	if (a->timeout > 0)
+		uloop_timeout_set(&ctx->timeout, a->timeout);
+
+	/* numeric hosts can't block, resolve them right away */
+	if (type & USOCK_NUMERIC) {
+		usock_async_resolve(ctx);
+		return 0;
+	}
+
+	ctx->refcount++;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	/* leave signal delivery to the threads of the application */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&thread, &attr, usock_async_thread, ctx);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	pthread_attr_destroy(&attr);
+	if (!ret)
+		return 0;
+
+	ctx->refcount--;
+	uloop_timeout_cancel(&ctx->timeout);
+	uloop_post_queue_done(&ctx->queue);
+	a->ctx = NULL;
+	errno = ret;
+error:
+	usock_async_put(ctx);
+	return -1;
+}
+
+void usock_async_cancel(struct usock_async *a)
+{
+	struct usock_async_ctx *ctx = a->ctx;
+
+	if (!ctx)
+		return;
+
+	a->ctx = NULL;
+	ctx->req = NULL;
+
+	/* the resolver result still arrives and drops the last reference */
+	if (ctx->resolving)
+		return;
+
+	usock_async_close(ctx, -1);
+	usock_async_put(ctx);
+}
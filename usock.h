@@ -19,6 +19,10 @@
 #ifndef USOCK_H_
 #define USOCK_H_
 
+#include <sys/socket.h>
+
+#include "uloop.h"
+
 #define USOCK_TCP 0
 #define USOCK_UDP 1
 
@@ -26,6 +30,7 @@
 #define USOCK_NOCLOEXEC		0x0200
 #define USOCK_NONBLOCK		0x0400
 #define USOCK_NUMERIC		0x0800
+#define USOCK_REUSEPORT		0x1000
 #define USOCK_IPV6ONLY		0x2000
 #define USOCK_IPV4ONLY		0x4000
 #define USOCK_UNIX		0x8000
@@ -40,6 +45,98 @@ usock_inet(int type, const char *host, const char *service, void *addr)
     return usock_inet_timeout(type, host, service, addr, -1);
 }
 
+struct usock_async_ctx;
+
+struct usock_async {
+	/*
+	 * called on the loop thread once the connection attempt is done, with
+	 * a connected non-blocking socket or -1. On failure, error is an errno
+	 * value, or a negative EAI_* code if resolving the host failed.
+	 */
+	void (*cb)(struct usock_async *a, int fd);
+
+	/* overall timeout in milliseconds, including name resolution, <= 0 for none */
+	int timeout;
+
+	/* filled in before cb is called */
+	struct sockaddr_storage addr;
+	int error;
+
+	/* internal */
+	struct usock_async_ctx *ctx;
+};
+
+/**
+ * Resolve and connect without blocking the uloop.
+ *
+ * The host is resolved on a helper thread (or inline with USOCK_NUMERIC),
+ * then the addresses are tried Happy-Eyeballs style: alternating between
+ * address families, each new attempt started when the previous one failed
+ * or after 250ms, whichever is first, and the first to connect wins.
+ *
+ * USOCK_SERVER and USOCK_UNIX are not supported.
+ *
+ * @return 0 if the request was started, -1 otherwise. Once started, cb is
+ *   always called from the loop unless usock_async_cancel() is used.
+ */
+int usock_inet_async(struct usock_async *a, int type, const char *host,
+		     const char *service);
+void usock_async_cancel(struct usock_async *a);
+
+/*
+ * Options for listening sockets, zero values keep the defaults.
+ * defer_accept is in seconds (TCP_DEFER_ACCEPT), fastopen is the queue
+ * length for TCP_FASTOPEN. Options not supported by the system are ignored.
+ */
+struct usock_listen_opts {
+	int backlog;
+	int defer_accept;
+	int fastopen;
+};
+
+int usock_listen(int type, const char *host, const char *service,
+		 const struct usock_listen_opts *opts);
+
+/**
+ * Open n listeners sharing one address with SO_REUSEPORT, e.g. one per
+ * loop thread. The kernel spreads incoming connections across them. With
+ * port 0, all shards use the port picked for the first one.
+ *
+ * @return number of sockets stored in fds, -1 if none could be opened
+ */
+int usock_listen_shards(int type, const char *host, const char *service,
+			const struct usock_listen_opts *opts, int *fds, int n);
+
+/**
+ * Accept up to max (0: no limit) pending connections as non-blocking,
+ * close-on-exec sockets, calling cb for each of them.
+ *
+ * @return number of accepted connections
+ */
+int usock_accept_batch(int fd, int max,
+		       void (*cb)(int fd, struct sockaddr_storage *addr, void *priv),
+		       void *priv);
+
+#define USOCK_ACCEPT_RETRY_MS	100
+
+/*
+ * An edge triggered listener that drains the accept queue on every wakeup.
+ * If accepting fails for lack of fds or memory, it retries after
+ * USOCK_ACCEPT_RETRY_MS. accept_cb may delete (and free) the listener.
+ */
+struct usock_listener {
+	struct uloop_fd fd;
+	void (*accept_cb)(struct usock_listener *l, int fd,
+			  struct sockaddr_storage *addr);
+
+	/* internal */
+	struct uloop_timeout retry;
+	bool *deleted;
+};
+
+int usock_listener_add(struct usock_listener *l, int fd);
+void usock_listener_delete(struct usock_listener *l);
+
 /**
  * Wait for a socket to become ready.
  *
@@ -15,11 +15,21 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
-
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "ustream.h"
+#include "utils.h"
 
 static void ustream_fd_set_uloop(struct ustream *s, bool write)
 {
@@ -31,7 +41,8 @@ static void ustream_fd_set_uloop(struct ustream *s, bool write)
 		flags |= ULOOP_READ;
 
 	buf = s->w.head;
-	if (write || (buf && s->w.data_bytes && !s->write_error))
+	if (write || (buf && s->w.data_bytes && !s->write_error) ||
+	    (s->forward_in && s->forward_in->pipe_bytes))
 		flags |= ULOOP_WRITE;
 
 	uloop_fd_add(&sf->fd, flags);
@@ -42,28 +53,48 @@ static void ustream_fd_set_read_blocked(struct ustream *s)
 	ustream_fd_set_uloop(s, false);
 }
 
+static bool ustream_fd_budget_used(struct ustream_fd *sf, int *total, int len)
+{
+	if (sf->read_budget <= 0)
+		return false;
+
+	*total += len;
+	if (*total < sf->read_budget)
+		return false;
+
+	uloop_fd_requeue(&sf->fd, ULOOP_READ);
+	return true;
+}
+
 static void ustream_fd_read_pending(struct ustream_fd *sf, bool *more)
 {
 	struct ustream *s = &sf->stream;
-	int buflen = 0;
+	struct iovec iov[2];
+	int n, total = 0;
 	ssize_t len;
-	char *buf;
 
 	do {
 		if (s->read_blocked)
 			break;
 
-		buf = ustream_reserve(s, 1, &buflen);
-		if (!buf)
+		/* avoid tiny reads into the end of a nearly full buffer */
+		n = ustream_reserve_iov(s, s->r.buffer_len / 4, iov, ARRAY_SIZE(iov));
+		if (!n)
 			break;
 
-		len = read(sf->fd.fd, buf, buflen);
+		if (n > 1)
+			len = readv(sf->fd.fd, iov, n);
+		else
+			len = read(sf->fd.fd, iov[0].iov_base, iov[0].iov_len);
+		ustream_stat_add(s, read_calls, 1);
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
 
-			if (errno == EAGAIN || errno == ENOTCONN)
+			if (errno == EAGAIN || errno == ENOTCONN) {
+				ustream_stat_add(s, read_again, 1);
 				return;
+			}
 
 			len = 0;
 		}
@@ -76,8 +107,12 @@ static void ustream_fd_read_pending(struct ustream_fd *sf, bool *more)
 			return;
 		}
 
+		ustream_stat_add(s, read_bytes, len);
 		ustream_fill_read(s, len);
 		*more = true;
+
+		if (ustream_fd_budget_used(sf, &total, len))
+			return;
 	} while (1);
 }
 
@@ -91,17 +126,21 @@ static int ustream_fd_write(struct ustream *s, const char *buf, int buflen, bool
 
 	while (buflen) {
 		len = write(sf->fd.fd, buf, buflen);
+		ustream_stat_add(s, write_calls, 1);
 
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
 
-			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN) {
+				ustream_stat_add(s, write_again, 1);
 				break;
+			}
 
 			return -1;
 		}
 
+		ustream_stat_add(s, write_bytes, len);
 		ret += len;
 		buf += len;
 		buflen -= len;
@@ -113,17 +152,340 @@ static int ustream_fd_write(struct ustream *s, const char *buf, int buflen, bool
 	return ret;
 }
 
+static int ustream_fd_write_iov(struct ustream *s, const struct iovec *iov, int iovcnt, bool more)
+{
+	struct ustream_fd *sf = container_of(s, struct ustream_fd, stream);
+	ssize_t len;
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	if (!total)
+		return 0;
+
+	do {
+		len = writev(sf->fd.fd, iov, iovcnt);
+		ustream_stat_add(s, write_calls, 1);
+	} while (len < 0 && errno == EINTR);
+
+	if (len < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN)
+			return -1;
+
+		ustream_stat_add(s, write_again, 1);
+		len = 0;
+	}
+
+	ustream_stat_add(s, write_bytes, len);
+
+	if ((size_t)len < total)
+		ustream_fd_set_uloop(s, true);
+
+	return len;
+}
+
+struct ustream_fd_map {
+	void *addr;
+	size_t len;
+};
+
+static void ustream_fd_unmap(struct ustream *s, void *priv)
+{
+	struct ustream_fd_map *map = priv;
+
+	munmap(map->addr, map->len);
+	free(map);
+}
+
+/* bounds the address space used by each mapping of ustream_fd_sendfile */
+#define USTREAM_FD_MAP_WINDOW	(1024 * 1024)
+
+/*
+ * Mappings are only read when the data is written out, which raises SIGBUS
+ * if the file was truncated in between. Only files on read-only mounts are
+ * safe from that, other files are copied into the write buffer.
+ */
+static bool ustream_fd_can_map(int fd)
+{
+	struct statvfs vfs;
+
+	return !fstatvfs(fd, &vfs) && (vfs.f_flag & ST_RDONLY);
+}
+
+static ssize_t ustream_fd_send_mapped(struct ustream *s, int fd, off_t offset, size_t len)
+{
+	struct ustream_fd_map *map;
+	ssize_t ret = 0;
+	long pagesize;
+	off_t start;
+	int wr;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	while (len) {
+		size_t cur = len;
+
+		start = offset & ~((off_t) pagesize - 1);
+		if (cur > USTREAM_FD_MAP_WINDOW - (size_t)(offset - start))
+			cur = USTREAM_FD_MAP_WINDOW - (size_t)(offset - start);
+
+		map = calloc(1, sizeof(*map));
+		if (!map)
+			break;
+
+		map->len = offset - start + cur;
+		map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, start);
+		if (map->addr == MAP_FAILED) {
+			free(map);
+			break;
+		}
+
+		wr = ustream_write_ext(s, (char *) map->addr + (offset - start), cur,
+				       false, ustream_fd_unmap, map);
+		if (wr > 0)
+			ret += wr;
+		if (wr < (int) cur)
+			break;
+
+		offset += cur;
+		len -= cur;
+	}
+
+	return ret;
+}
+
+static ssize_t ustream_fd_send_read(struct ustream *s, int fd, off_t offset, size_t len)
+{
+	char buf[4096];
+	ssize_t ret = 0, cur;
+	int wr;
+
+	while (len) {
+		cur = pread(fd, buf, len < sizeof(buf) ? len : sizeof(buf), offset);
+		if (cur < 0 && errno == EINTR)
+			continue;
+
+		if (cur <= 0)
+			break;
+
+		wr = ustream_write(s, buf, cur, false);
+		if (wr > 0)
+			ret += wr;
+		if (wr < cur)
+			break;
+
+		offset += cur;
+		len -= cur;
+	}
+
+	return ret;
+}
+
+ssize_t ustream_fd_sendfile(struct ustream_fd *sf, int fd, off_t offset, size_t len)
+{
+	struct ustream *s = &sf->stream;
+	struct stat st;
+	ssize_t ret = 0, cur;
+	bool map = false;
+
+	if (s->write_error)
+		return 0;
+
+	/* never map past the end of the file, touching that raises SIGBUS */
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+		if (offset >= st.st_size)
+			return 0;
+		if (len > (size_t)(st.st_size - offset))
+			len = st.st_size - offset;
+		map = ustream_fd_can_map(fd);
+	}
+
+#ifdef __linux__
+	/* let the kernel copy directly while nothing else is queued */
+	while (len && !s->w.data_bytes) {
+		cur = sendfile(sf->fd.fd, fd, &offset, len);
+
+		ustream_stat_add(s, write_calls, 1);
+		if (cur < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN) {
+				ustream_stat_add(s, write_again, 1);
+				break;
+			}
+
+			/* not supported for this pair of fds, map or copy it */
+			if (errno == EINVAL || errno == ENOSYS)
+				break;
+
+			if (!s->write_error)
+				ustream_state_change(s);
+			s->write_error = true;
+			return ret ? ret : -1;
+		}
+
+		if (!cur)
+			return ret;
+
+		ustream_stat_add(s, write_bytes, cur);
+		ret += cur;
+		len -= cur;
+	}
+#endif
+
+	if (map)
+		cur = ustream_fd_send_mapped(s, fd, offset, len);
+	else
+		cur = ustream_fd_send_read(s, fd, offset, len);
+
+	ret += cur;
+	len -= cur;
+
+	if (len && !ret)
+		return -1;
+
+	return ret;
+}
+
+#ifdef __linux__
+/*
+ * Move data from the source fd to the sink fd through the pipe. Returns
+ * false if it has to be copied through the stream buffers instead, which
+ * keeps the order of data buffered before or after splicing.
+ */
+static bool ustream_fd_splice(struct ustream_forward *f, bool *more)
+{
+	struct ustream_fd *src = container_of(f->src, struct ustream_fd, stream);
+	struct ustream_fd *dst = container_of(f->dst, struct ustream_fd, stream);
+	struct ustream *s = &src->stream, *d = &dst->stream;
+	int total = 0;
+	ssize_t len;
+
+	if (f->pipe[0] < 0)
+		return false;
+
+	while (!d->write_error) {
+		while (f->pipe_bytes) {
+			len = splice(f->pipe[0], NULL, dst->fd.fd, NULL, f->pipe_bytes,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			ustream_stat_add(d, write_calls, 1);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					ustream_stat_add(d, write_again, 1);
+					ustream_forward_set_blocked(f, true);
+					ustream_fd_set_uloop(d, false);
+					return true;
+				}
+
+				if (!d->write_error)
+					ustream_state_change(d);
+				d->write_error = true;
+				ustream_forward_set_blocked(f, true);
+				break;
+			}
+
+			ustream_stat_add(d, write_bytes, len);
+			f->pipe_bytes -= len;
+			f->bytes += len;
+		}
+
+		if (d->write_error || s->eof ||
+		    ustream_fd_budget_used(src, &total, 0))
+			break;
+
+		/* the pipe is empty again */
+		ustream_forward_set_blocked(f, false);
+
+		if (s->r.data_bytes || d->w.data_bytes)
+			return false;
+
+		if (ustream_read_blocked(s))
+			break;
+
+		len = splice(src->fd.fd, NULL, f->pipe[1], NULL, 64 * 1024,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		ustream_stat_add(s, read_calls, 1);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN) {
+				ustream_stat_add(s, read_again, 1);
+				return true;
+			}
+
+			/* not supported for this pair of fds, copy instead */
+			if (errno == EINVAL) {
+				close(f->pipe[0]);
+				close(f->pipe[1]);
+				f->pipe[0] = f->pipe[1] = -1;
+				return false;
+			}
+
+			len = 0;
+		}
+
+		if (!len) {
+			if (!s->eof)
+				ustream_state_change(s);
+			s->eof = true;
+			ustream_fd_set_uloop(s, false);
+			break;
+		}
+
+		ustream_stat_add(s, read_bytes, len);
+		f->pipe_bytes = len;
+		total += len;
+		*more = true;
+	}
+
+	ustream_fd_set_uloop(d, false);
+	return true;
+}
+#else
+static bool ustream_fd_splice(struct ustream_forward *f, bool *more)
+{
+	return false;
+}
+#endif
+
+bool ustream_fd_forward_init(struct ustream_forward *f, struct ustream_fd *src,
+			     struct ustream_fd *dst, int max_pending)
+{
+	ustream_forward_init(f, &src->stream, &dst->stream, max_pending);
+
+#ifdef __linux__
+	if (!pipe2(f->pipe, O_NONBLOCK | O_CLOEXEC))
+		return true;
+
+	f->pipe[0] = f->pipe[1] = -1;
+#endif
+
+	return false;
+}
+
 static bool __ustream_fd_poll(struct ustream_fd *sf, unsigned int events)
 {
 	struct ustream *s = &sf->stream;
 	bool more = false;
 
-	if (events & ULOOP_READ)
-		ustream_fd_read_pending(sf, &more);
+	if (events & ULOOP_READ) {
+		if (!s->forward_out || !ustream_fd_splice(s->forward_out, &more))
+			ustream_fd_read_pending(sf, &more);
+	}
 
 	if (events & ULOOP_WRITE) {
 		bool no_more = ustream_write_pending(s);
-		if (no_more)
+		bool spliced;
+
+		if (s->forward_in && s->forward_in->pipe_bytes)
+			ustream_fd_splice(s->forward_in, &spliced);
+		else if (no_more)
 			ustream_fd_set_uloop(s, false);
 	}
 
@@ -167,6 +529,7 @@ void ustream_fd_init(struct ustream_fd *sf, int fd)
 	sf->fd.cb = ustream_uloop_cb;
 	s->set_read_blocked = ustream_fd_set_read_blocked;
 	s->write = ustream_fd_write;
+	s->write_iov = ustream_fd_write_iov;
 	s->free = ustream_fd_free;
 	s->poll = ustream_fd_poll;
 	ustream_fd_set_uloop(s, false);
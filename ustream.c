@@ -16,13 +16,17 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "ustream.h"
+#include "udebug.h"
+#include "utils.h"
 
 #define CB_PENDING_READ	(1 << 0)
 
@@ -76,6 +80,159 @@ static int ustream_alloc_default(struct ustream *s, struct ustream_buf_list *l)
 	return 0;
 }
 
+void ustream_buf_pool_init(struct ustream_buf_pool *p, int buffer_len, int max_buffers)
+{
+	memset(p, 0, sizeof(*p));
+	p->buffer_len = buffer_len;
+	p->max_buffers = max_buffers;
+}
+
+void ustream_buf_pool_done(struct ustream_buf_pool *p)
+{
+	struct ustream_buf *buf;
+
+	while ((buf = p->head) != NULL) {
+		p->head = buf->next;
+		free(buf);
+	}
+	p->buffers = 0;
+}
+
+int ustream_buf_pool_alloc(struct ustream *s, struct ustream_buf_list *l)
+{
+	struct ustream_buf_pool *p = l->pool;
+	struct ustream_buf *buf;
+
+	if (!ustream_can_alloc(l))
+		return -1;
+
+	buf = p->head;
+	if (buf) {
+		p->head = buf->next;
+		p->buffers--;
+		p->hits++;
+	} else {
+		/* always allocate room for string data, any stream may use the buffer */
+		buf = malloc(sizeof(*buf) + p->buffer_len + 1);
+		if (!buf)
+			return -1;
+		p->misses++;
+	}
+
+	ustream_init_buf(buf, p->buffer_len);
+	ustream_add_buf(l, buf);
+
+	return 0;
+}
+
+void ustream_set_buf_pool(struct ustream *s, struct ustream_buf_pool *p)
+{
+	s->r.pool = s->w.pool = p;
+	s->r.alloc = s->w.alloc = ustream_buf_pool_alloc;
+	s->r.buffer_len = s->w.buffer_len = p->buffer_len;
+}
+
+struct ustream_cbuf {
+	char *base;
+	unsigned int order;
+	int size;
+};
+
+static void ustream_cbuf_free(struct ustream_buf *buf)
+{
+	struct ustream_cbuf *cb = (struct ustream_cbuf *) buf->head;
+
+	cbuf_free(cb->base, cb->order);
+	free(buf);
+}
+
+static int ustream_cbuf_alloc(struct ustream *s, struct ustream_buf_list *l)
+{
+	struct ustream_cbuf *cb;
+	struct ustream_buf *buf;
+
+	if (!ustream_can_alloc(l))
+		return -1;
+
+	buf = calloc(1, sizeof(*buf) + sizeof(*cb));
+	if (!buf)
+		return -1;
+
+	cb = (struct ustream_cbuf *) buf->head;
+	cb->order = cbuf_order(l->buffer_len);
+	cb->size = cbuf_size(cb->order);
+	cb->base = cbuf_alloc(cb->order);
+	if (!cb->base) {
+		free(buf);
+		return -1;
+	}
+
+	/*
+	 * The pages are mapped twice, so the span between data and end is
+	 * always contiguous. end - data stays constant while data moves,
+	 * leaving room for the string terminator
+	 */
+	buf->data = buf->tail = cb->base;
+	buf->end = cb->base + cb->size - s->string_data;
+	buf->free = ustream_cbuf_free;
+	*buf->data = 0;
+	ustream_add_buf(l, buf);
+
+	return 0;
+}
+
+static bool ustream_is_cbuf(struct ustream_buf *buf)
+{
+	return buf->free == ustream_cbuf_free;
+}
+
+static void ustream_cbuf_consume(struct ustream_buf *buf, int len)
+{
+	struct ustream_cbuf *cb = (struct ustream_cbuf *) buf->head;
+
+	buf->data += len;
+	buf->end += len;
+	if (buf->data < cb->base + cb->size)
+		return;
+
+	buf->data -= cb->size;
+	buf->tail -= cb->size;
+	buf->end -= cb->size;
+}
+
+void ustream_set_read_cbuf(struct ustream *s, int size)
+{
+	s->r.alloc = ustream_cbuf_alloc;
+	s->r.buffer_len = cbuf_size(cbuf_order(size));
+	s->r.min_buffers = s->r.max_buffers = 1;
+}
+
+static void ustream_release_buf(struct ustream_buf_list *l, struct ustream_buf *buf)
+{
+	struct ustream_buf_pool *p = l->pool;
+
+	if (buf->free) {
+		buf->free(buf);
+		return;
+	}
+
+	if (!p || p->buffers >= p->max_buffers ||
+	    buf->end - buf->head != p->buffer_len) {
+		free(buf);
+		return;
+	}
+
+	buf->next = p->head;
+	p->head = buf;
+	p->buffers++;
+}
+
+struct ustream_ext_buf {
+	struct ustream *s;
+	void (*done)(struct ustream *s, void *priv);
+	void *priv;
+};
+
 static void ustream_free_buffers(struct ustream_buf_list *l)
 {
 	struct ustream_buf *buf = l->head;
@@ -83,7 +240,7 @@ static void ustream_free_buffers(struct ustream_buf_list *l)
 	while (buf) {
 		struct ustream_buf *next = buf->next;
 
-		free(buf);
+		ustream_release_buf(l, buf);
 		buf = next;
 	}
 	l->head = NULL;
@@ -150,7 +307,7 @@ static bool ustream_should_move(struct ustream_buf_list *l, struct ustream_buf *
 	int offset;
 
 	/* nothing to squeeze */
-	if (buf->data == buf->head)
+	if (buf->data == buf->head || buf->free)
 		return false;
 
 	maxlen = buf->end - buf->head;
@@ -174,6 +331,16 @@ static bool ustream_should_move(struct ustream_buf_list *l, struct ustream_buf *
 
 static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf)
 {
+	/* the ring buffer is only rewound, it stays in place until freed */
+	if (ustream_is_cbuf(buf)) {
+		struct ustream_cbuf *cb = (struct ustream_cbuf *) buf->head;
+
+		buf->end = cb->base + (buf->end - buf->data);
+		buf->data = buf->tail = cb->base;
+		*buf->data = 0;
+		return;
+	}
+
 	if (buf == l->head)
 		l->head = buf->next;
 
@@ -183,8 +350,14 @@ static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf
 	if (buf == l->tail)
 		l->tail = NULL;
 
+	/* external buffers are not accounted in l->buffers */
+	if (buf->free) {
+		buf->free(buf);
+		return;
+	}
+
 	if (--l->buffers >= l->min_buffers) {
-		free(buf);
+		ustream_release_buf(l, buf);
 		return;
 	}
 
@@ -193,13 +366,83 @@ static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf
 	ustream_add_buf(l, buf);
 }
 
+static __thread struct ustream_stats loop_stats;
+
+static uint64_t ustream_stats_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct ustream_stats *ustream_loop_stats(void)
+{
+	return &loop_stats;
+}
+
+void ustream_set_stats(struct ustream *s, struct ustream_stats *st)
+{
+	s->stats = st;
+	if (!st)
+		return;
+
+	if (st != &loop_stats)
+		st->parent = &loop_stats;
+
+	if (s->read_blocked)
+		st->read_blocked_since = ustream_stats_time();
+}
+
+void ustream_stats_log(struct udebug_buf *buf, const char *name,
+		       const struct ustream_stats *st)
+{
+	if (!udebug_buf_valid(buf))
+		return;
+
+	udebug_entry_init(buf);
+	udebug_entry_printf(buf, "%s: read %llu bytes/%llu calls (%llu again), "
+			    "write %llu bytes/%llu calls (%llu again), "
+			    "%llu buffer allocs, read blocked %llu us, "
+			    "max buffered %d read/%d write", name,
+			    (unsigned long long) st->read_bytes,
+			    (unsigned long long) st->read_calls,
+			    (unsigned long long) st->read_again,
+			    (unsigned long long) st->write_bytes,
+			    (unsigned long long) st->write_calls,
+			    (unsigned long long) st->write_again,
+			    (unsigned long long) st->buf_allocs,
+			    (unsigned long long) st->read_blocked_usec,
+			    st->max_read_buffered, st->max_write_buffered);
+	udebug_entry_add(buf);
+}
+
+static void ustream_stats_read_blocked(struct ustream *s, bool blocked)
+{
+	struct ustream_stats *st = s->stats;
+	uint64_t now = ustream_stats_time();
+
+	if (blocked) {
+		st->read_blocked_since = now;
+	} else if (st->read_blocked_since) {
+		ustream_stat_add(s, read_blocked_usec, now - st->read_blocked_since);
+		st->read_blocked_since = 0;
+	}
+}
+
 static void __ustream_set_read_blocked(struct ustream *s, unsigned char val)
 {
 	bool changed = !!s->read_blocked != !!val;
 
 	s->read_blocked = val;
-	if (changed)
-		s->set_read_blocked(s);
+	if (!changed)
+		return;
+
+	if (s->stats)
+		ustream_stats_read_blocked(s, !!val);
+
+	s->set_read_blocked(s);
 }
 
 void ustream_set_read_blocked(struct ustream *s, bool set)
@@ -212,6 +455,17 @@ void ustream_set_read_blocked(struct ustream *s, bool set)
 	__ustream_set_read_blocked(s, val);
 }
 
+void ustream_forward_set_blocked(struct ustream_forward *f, bool set)
+{
+	struct ustream *s = f->src;
+	unsigned char val = s->read_blocked & ~READ_BLOCKED_FORWARD;
+
+	if (set)
+		val |= READ_BLOCKED_FORWARD;
+
+	__ustream_set_read_blocked(s, val);
+}
+
 void ustream_consume(struct ustream *s, int len)
 {
 	struct ustream_buf *buf = s->r.head;
@@ -228,7 +482,10 @@ void ustream_consume(struct ustream *s, int len)
 		int buf_len = buf->tail - buf->data;
 
 		if (len < buf_len) {
-			buf->data += len;
+			if (ustream_is_cbuf(buf))
+				ustream_cbuf_consume(buf, len);
+			else
+				buf->data += len;
 			break;
 		}
 
@@ -280,6 +537,8 @@ static bool ustream_prepare_buf(struct ustream *s, struct ustream_buf_list *l, i
 	if (l->alloc(s, l) < 0)
 		return false;
 
+	ustream_stat_add(s, buf_allocs, 1);
+
 	l->data_tail = l->tail;
 	return true;
 }
@@ -299,12 +558,42 @@ char *ustream_reserve(struct ustream *s, int len, int *maxlen)
 	return buf->tail;
 }
 
+int ustream_reserve_iov(struct ustream *s, int len, struct iovec *iov, int n)
+{
+	struct ustream_buf_list *l = &s->r;
+	struct ustream_buf *buf;
+	int i, maxlen;
+
+	iov[0].iov_base = ustream_reserve(s, len, &maxlen);
+	if (!iov[0].iov_base)
+		return 0;
+
+	iov[0].iov_len = maxlen;
+	buf = l->data_tail;
+	for (i = 1; i < n && maxlen < len; i++) {
+		if (!buf->next) {
+			if (!ustream_can_alloc(l) || l->alloc(s, l) < 0)
+				break;
+
+			ustream_stat_add(s, buf_allocs, 1);
+		}
+
+		buf = buf->next;
+		iov[i].iov_base = buf->tail;
+		iov[i].iov_len = buf->end - buf->tail;
+		maxlen += iov[i].iov_len;
+	}
+
+	return i;
+}
+
 void ustream_fill_read(struct ustream *s, int len)
 {
 	struct ustream_buf *buf = s->r.data_tail;
 	int maxlen;
 
 	s->r.data_bytes += len;
+	ustream_stat_max(s, max_read_buffered, s->r.data_bytes);
 	do {
 		if (!buf)
 			abort();
@@ -375,13 +664,69 @@ static void ustream_write_error(struct ustream *s)
 	s->write_error = true;
 }
 
-bool ustream_write_pending(struct ustream *s)
+#define USTREAM_MAX_IOV	32
+
+static int ustream_write_pending_iov(struct ustream *s)
 {
+	struct iovec iov[USTREAM_MAX_IOV];
 	struct ustream_buf *buf = s->w.head;
-	int wr = 0, len;
+	int wr = 0, len, total;
+	int n, written;
 
-	if (s->write_error)
-		return false;
+	while (buf && s->w.data_bytes) {
+		struct ustream_buf *cur;
+
+		total = 0;
+		for (n = 0, cur = buf; cur && n < USTREAM_MAX_IOV &&
+		     total < s->w.data_bytes; cur = cur->next) {
+			int maxlen = cur->tail - cur->data;
+
+			if (!maxlen)
+				continue;
+
+			iov[n].iov_base = cur->data;
+			iov[n].iov_len = maxlen;
+			total += maxlen;
+			n++;
+		}
+
+		len = s->write_iov(s, iov, n, total < s->w.data_bytes);
+		if (len < 0) {
+			ustream_write_error(s);
+			break;
+		}
+
+		if (len == 0)
+			break;
+
+		written = len;
+		wr += len;
+		s->w.data_bytes -= len;
+		while (buf && len) {
+			struct ustream_buf *next = buf->next;
+			int maxlen = buf->tail - buf->data;
+
+			if (len < maxlen) {
+				buf->data += len;
+				break;
+			}
+
+			len -= maxlen;
+			ustream_free_buf(&s->w, buf);
+			buf = next;
+		}
+
+		if (written < total)
+			break;
+	}
+
+	return wr;
+}
+
+static int ustream_write_pending_buf(struct ustream *s)
+{
+	struct ustream_buf *buf = s->w.head;
+	int wr = 0, len;
 
 	while (buf && s->w.data_bytes) {
 		struct ustream_buf *next = buf->next;
@@ -407,6 +752,21 @@ bool ustream_write_pending(struct ustream *s)
 		buf = next;
 	}
 
+	return wr;
+}
+
+bool ustream_write_pending(struct ustream *s)
+{
+	int wr;
+
+	if (s->write_error)
+		return false;
+
+	if (s->write_iov)
+		wr = ustream_write_pending_iov(s);
+	else
+		wr = ustream_write_pending_buf(s);
+
 	if (s->notify_write)
 		s->notify_write(s, wr);
 
@@ -440,6 +800,8 @@ static int ustream_write_buffered(struct ustream *s, const char *data, int len,
 		l->data_bytes += maxlen;
 	}
 
+	ustream_stat_max(s, max_write_buffered, l->data_bytes);
+
 	return wr;
 }
 
@@ -468,8 +830,363 @@ int ustream_write(struct ustream *s, const char *data, int len, bool more)
 	return ustream_write_buffered(s, data, len, wr);
 }
 
+int ustream_writev(struct ustream *s, const struct iovec *iov, int iovcnt, bool more)
+{
+	int wr = 0, skip = 0;
+
+	if (s->write_error)
+		return 0;
+
+	if (!s->w.data_bytes && !s->write_iov) {
+		for (int i = 0; i < iovcnt; i++) {
+			int len = ustream_write(s, iov[i].iov_base, iov[i].iov_len,
+						more || i < iovcnt - 1);
+
+			if (len < 0)
+				return len;
+
+			wr += len;
+		}
+
+		return wr;
+	}
+
+	if (!s->w.data_bytes) {
+		skip = s->write_iov(s, iov, iovcnt, more);
+		if (skip < 0) {
+			ustream_write_error(s);
+			return skip;
+		}
+	}
+
+	/* buffer everything the stream did not accept right away */
+	wr = skip;
+	for (int i = 0; i < iovcnt; i++) {
+		int len = iov[i].iov_len;
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+
+		wr = ustream_write_buffered(s, (char *)iov[i].iov_base + skip,
+					    len - skip, wr);
+		skip = 0;
+	}
+
+	return wr;
+}
+
+static void ustream_ext_buf_free(struct ustream_buf *buf)
+{
+	struct ustream_ext_buf *ext = (struct ustream_ext_buf *) buf->head;
+
+	ext->done(ext->s, ext->priv);
+	free(buf);
+}
+
+static void ustream_add_ext_buf(struct ustream_buf_list *l, struct ustream_buf *buf)
+{
+	/*
+	 * Insert right after the last buffer containing data, spare empty
+	 * buffers behind it are used for data written afterwards.
+	 */
+	if (!l->data_bytes || !l->data_tail) {
+		buf->next = l->head;
+		l->head = buf;
+	} else {
+		buf->next = l->data_tail->next;
+		l->data_tail->next = buf;
+	}
+
+	if (!buf->next)
+		l->tail = buf;
+
+	l->data_tail = buf;
+	l->data_bytes += buf->tail - buf->data;
+}
+
+int ustream_write_ext(struct ustream *s, const char *data, int len, bool more,
+		      void (*done)(struct ustream *s, void *priv), void *priv)
+{
+	struct ustream_buf_list *l = &s->w;
+	struct ustream_ext_buf *ext;
+	struct ustream_buf *buf;
+	int wr = 0;
+
+	if (s->write_error || len <= 0)
+		goto out;
+
+	if (!l->data_bytes) {
+		wr = s->write(s, data, len, more);
+		if (wr < 0) {
+			ustream_write_error(s);
+			goto out;
+		}
+
+		if (wr == len)
+			goto out;
+	}
+
+	buf = calloc(1, sizeof(*buf) + sizeof(*ext));
+	if (!buf)
+		goto out;
+
+	ext = (struct ustream_ext_buf *) buf->head;
+	ext->s = s;
+	ext->done = done;
+	ext->priv = priv;
+
+	buf->data = (char *) data + wr;
+	buf->tail = buf->end = (char *) data + len;
+	buf->free = ustream_ext_buf_free;
+	ustream_add_ext_buf(l, buf);
+	ustream_stat_max(s, max_write_buffered, l->data_bytes);
+
+	return len;
+
+out:
+	done(s, priv);
+	return wr;
+}
+
 #define MAX_STACK_BUFLEN	256
 
+static void ustream_forward_update(struct ustream_forward *f)
+{
+	struct ustream *dst = f->dst;
+	bool blocked;
+
+	blocked = dst->write_error || f->pipe_bytes || f->dst_full ||
+		  dst->w.data_bytes > f->max_pending;
+	ustream_forward_set_blocked(f, blocked);
+}
+
+static void ustream_forward_notify_read(struct ustream *s, int bytes)
+{
+	struct ustream_forward *f = s->forward_out;
+	struct ustream *dst = f->dst;
+	char *buf;
+	int len, wr;
+
+	while (!dst->write_error && !f->pipe_bytes && !f->dst_full &&
+	       dst->w.data_bytes <= f->max_pending &&
+	       (buf = ustream_get_read_buf(s, &len)) != NULL) {
+		wr = ustream_write(dst, buf, len, false);
+		if (wr > 0) {
+			ustream_consume(s, wr);
+			f->bytes += wr;
+		}
+
+		/* the write buffers of dst are full, wait for notify_write */
+		if (wr < len) {
+			f->dst_full = true;
+			break;
+		}
+	}
+
+	ustream_forward_update(f);
+}
+
+static void ustream_forward_notify_write(struct ustream *s, int bytes)
+{
+	struct ustream_forward *f = s->forward_in;
+
+	f->dst_full = false;
+
+	/* data left over from before reading was blocked */
+	if (f->src->r.data_bytes)
+		ustream_forward_notify_read(f->src, 0);
+	else
+		ustream_forward_update(f);
+}
+
+void ustream_forward_init(struct ustream_forward *f, struct ustream *src,
+			  struct ustream *dst, int max_pending)
+{
+	memset(f, 0, sizeof(*f));
+	f->src = src;
+	f->dst = dst;
+	f->max_pending = max_pending;
+	f->pipe[0] = f->pipe[1] = -1;
+
+	f->notify_read = src->notify_read;
+	f->notify_write = dst->notify_write;
+	src->forward_out = f;
+	dst->forward_in = f;
+	src->notify_read = ustream_forward_notify_read;
+	dst->notify_write = ustream_forward_notify_write;
+
+	ustream_forward_notify_read(src, 0);
+}
+
+void ustream_forward_done(struct ustream_forward *f)
+{
+	struct ustream *src = f->src, *dst = f->dst;
+	int max_buffers = dst->w.max_buffers;
+	char buf[4096];
+
+	/*
+	 * bytes read from the pipe cannot be put back, so the write buffer
+	 * limit of dst is lifted while moving the pipe contents there
+	 */
+	dst->w.max_buffers = -1;
+	while (f->pipe_bytes > 0 && !dst->write_error) {
+		int len = f->pipe_bytes;
+		int wr;
+
+		if (len > (int) sizeof(buf))
+			len = sizeof(buf);
+
+		len = read(f->pipe[0], buf, len);
+		if (len <= 0)
+			break;
+
+		wr = ustream_write(dst, buf, len, false);
+		if (wr > 0) {
+			f->pipe_bytes -= wr;
+			f->bytes += wr;
+		}
+		if (wr < len)
+			break;
+	}
+	dst->w.max_buffers = max_buffers;
+
+	if (f->pipe[0] >= 0) {
+		close(f->pipe[0]);
+		close(f->pipe[1]);
+		f->pipe[0] = f->pipe[1] = -1;
+	}
+
+	src->notify_read = f->notify_read;
+	dst->notify_write = f->notify_write;
+	src->forward_out = NULL;
+	dst->forward_in = NULL;
+	ustream_forward_set_blocked(f, false);
+}
+
+static bool ustream_blob_grow(struct blob_buf *buf, int minlen)
+{
+	struct ustream_blob_buf *ub = container_of(buf, struct ustream_blob_buf, buf);
+	struct ustream_buf *ubuf;
+	int len = buf->buflen + ((minlen / 256) + 1) * 256;
+
+	if (len < 2 * buf->buflen)
+		len = 2 * buf->buflen;
+
+	if (ub->ubuf) {
+		ubuf = realloc(ub->ubuf, sizeof(*ubuf) + len);
+		if (!ubuf)
+			return false;
+	} else {
+		/* leaving the stream buffer, this is the only copy */
+		ubuf = malloc(sizeof(*ubuf) + len);
+		if (!ubuf)
+			return false;
+
+		if (buf->buflen)
+			memcpy(ubuf->head, buf->buf, buf->buflen);
+	}
+
+	memset(ubuf->head + buf->buflen, 0, len - buf->buflen);
+	ub->ubuf = ubuf;
+	buf->buf = ubuf->head;
+	buf->buflen = len;
+
+	return true;
+}
+
+int ustream_blob_buf_init(struct ustream_blob_buf *ub, struct ustream *s, int id)
+{
+	struct ustream_buf_list *l = &s->w;
+	struct ustream_buf *buf;
+
+	memset(ub, 0, sizeof(*ub));
+	ub->s = s;
+	ub->buf.grow = ustream_blob_grow;
+
+	/* use the free space of the write buffer, if attributes can be aligned */
+	if (!s->write_error && ustream_prepare_buf(s, l, 0)) {
+		buf = l->data_tail;
+		if (!((uintptr_t) buf->tail & (BLOB_ATTR_ALIGN - 1))) {
+			ub->buf.buf = buf->tail;
+			ub->buf.buflen = buf->end - buf->tail;
+		}
+	}
+
+	return blob_buf_init(&ub->buf, id);
+}
+
+static void ustream_blob_ubuf_free(struct ustream_buf *buf)
+{
+	free(buf);
+}
+
+int ustream_blob_buf_write(struct ustream_blob_buf *ub, bool more)
+{
+	struct ustream *s = ub->s;
+	struct ustream_buf_list *l = &s->w;
+	struct ustream_buf *buf = ub->ubuf;
+	int len = blob_raw_len(ub->buf.head);
+	int wr = 0;
+
+	if (s->write_error) {
+		len = 0;
+		goto out;
+	}
+
+	if (!buf) {
+		/* built in place, the data only needs to be accounted for */
+		buf = l->data_tail;
+		if (!l->data_bytes) {
+			wr = s->write(s, buf->tail, len, more);
+			if (wr < 0) {
+				ustream_write_error(s);
+				len = wr;
+				goto out;
+			}
+			buf->data = buf->tail + wr;
+		}
+		buf->tail += len;
+		l->data_bytes += len - wr;
+		goto out_stat;
+	}
+
+	if (!l->data_bytes) {
+		wr = s->write(s, buf->head, len, more);
+		if (wr < 0) {
+			ustream_write_error(s);
+			len = wr;
+			goto out;
+		}
+
+		if (wr == len)
+			goto out;
+	}
+
+	buf->data = buf->head + wr;
+	buf->tail = buf->head + len;
+	buf->end = buf->head + ub->buf.buflen;
+	buf->free = ustream_blob_ubuf_free;
+	ustream_add_ext_buf(l, buf);
+	ub->ubuf = NULL;
+
+out_stat:
+	ustream_stat_max(s, max_write_buffered, l->data_bytes);
+out:
+	ustream_blob_buf_free(ub);
+	return len;
+}
+
+void ustream_blob_buf_free(struct ustream_blob_buf *ub)
+{
+	free(ub->ubuf);
+	ub->ubuf = NULL;
+	ub->buf.buf = NULL;
+	ub->buf.head = NULL;
+	ub->buf.buflen = 0;
+}
+
 int ustream_vprintf(struct ustream *s, const char *format, va_list arg)
 {
 	struct ustream_buf_list *l = &s->w;
@@ -524,8 +1241,10 @@ int ustream_vprintf(struct ustream *s, const char *format, va_list arg)
 
 	l->data_tail->tail += wr;
 	l->data_bytes += wr;
-	if (maxlen < buflen)
+	if (maxlen < buflen) {
+		ustream_stat_max(s, max_write_buffered, l->data_bytes);
 		return wr;
+	}
 
 	buf = malloc(maxlen + 1);
 	if (!buf)
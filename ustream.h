@@ -20,14 +20,30 @@
 #define __USTREAM_H
 
 #include <stdarg.h>
+#include <sys/uio.h>
 #include "uloop.h"
+#include "blob.h"
 
 struct ustream;
 struct ustream_buf;
+struct ustream_forward;
+struct udebug_buf;
 
 enum read_blocked_reason {
 	READ_BLOCKED_USER = (1 << 0),
 	READ_BLOCKED_FULL = (1 << 1),
+	READ_BLOCKED_FORWARD = (1 << 2),
+};
+
+struct ustream_buf_pool {
+	struct ustream_buf *head;
+
+	int buffer_len;
+	int max_buffers;
+	int buffers;
+
+	unsigned long hits;
+	unsigned long misses;
 };
 
 struct ustream_buf_list {
@@ -44,6 +60,29 @@ struct ustream_buf_list {
 	int buffer_len;
 
 	int buffers;
+
+	/* optional, shared buffer pool, see ustream_buf_pool_init */
+	struct ustream_buf_pool *pool;
+};
+
+struct ustream_stats {
+	/* optional aggregate, e.g. the per-loop view from ustream_loop_stats */
+	struct ustream_stats *parent;
+
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t read_again;
+	uint64_t write_again;
+	uint64_t buf_allocs;
+	uint64_t read_blocked_usec;
+
+	int max_read_buffered;
+	int max_write_buffered;
+
+	/* internal, start of the current read blocked period */
+	uint64_t read_blocked_since;
 };
 
 struct ustream {
@@ -118,11 +157,33 @@ struct ustream {
 	uint8_t pending_cb;
 
 	enum read_blocked_reason read_blocked;
+
+	/* optional I/O statistics, see ustream_set_stats */
+	struct ustream_stats *stats;
+
+	/* set while the stream is the source or sink of a ustream_forward */
+	struct ustream_forward *forward_out;
+	struct ustream_forward *forward_in;
+
+	/*
+	 * write_iov: (optional)
+	 * defined by ustream implementation, accepts buffered write data
+	 * spread over several buffers at once.
+	 * returns the number of bytes accepted, or -1 on link error
+	 */
+	int (*write_iov)(struct ustream *s, const struct iovec *iov, int iovcnt, bool more);
 };
 
 struct ustream_fd {
 	struct ustream stream;
 	struct uloop_fd fd;
+
+	/*
+	 * read_budget: (optional)
+	 * maximum number of bytes read per event, the rest is read after
+	 * the other ready fds had their turn
+	 */
+	int read_budget;
 };
 
 struct ustream_buf {
@@ -132,12 +193,84 @@ struct ustream_buf {
 	char *tail;
 	char *end;
 
+	/* set for buffers referencing external data, see ustream_write_ext */
+	void (*free)(struct ustream_buf *buf);
+
 	char head[];
 };
 
+/*
+ * ustream_forward: passes all data read from src on to dst. Reading from
+ * src is blocked while more than max_pending bytes are waiting in the
+ * write buffer of dst, or dst has a write error. EOF and errors are still
+ * reported through notify_state of both streams.
+ */
+struct ustream_forward {
+	struct ustream *src, *dst;
+	int max_pending;
+
+	/* number of bytes forwarded so far */
+	uint64_t bytes;
+
+	/* internal */
+	void (*notify_read)(struct ustream *s, int bytes_new);
+	void (*notify_write)(struct ustream *s, int bytes);
+	int pipe[2];
+	int pipe_bytes;
+	bool dst_full;
+};
+
 /* ustream_fd_init: create a file descriptor ustream (uses uloop) */
 void ustream_fd_init(struct ustream_fd *s, int fd);
 
+/*
+ * ustream_fd_sendfile: write len bytes of the file fd starting at offset.
+ * Uses sendfile() while no other data is pending. The remaining part is
+ * mapped in bounded windows and queued without copying if the file is on a
+ * read-only mount, where it cannot be truncated, and copied into the write
+ * buffer otherwise. fd can be closed after the call. Returns the number of bytes sent or queued, which is
+ * less than len if the file ends early or an error stopped it, or -1 if
+ * nothing could be written.
+ */
+ssize_t ustream_fd_sendfile(struct ustream_fd *s, int fd, off_t offset, size_t len);
+
+/*
+ * ustream_fd_forward_init: like ustream_forward_init, but moves the data
+ * with splice() through a pipe while the write buffer of dst is empty, so
+ * it is not copied to user space. Returns false if splicing is not
+ * available, the data is then copied through the stream buffers.
+ */
+bool ustream_fd_forward_init(struct ustream_forward *f, struct ustream_fd *src,
+			     struct ustream_fd *dst, int max_pending);
+
+/*
+ * ustream_buf_pool_init: set up a freelist of buffer_len sized buffers,
+ * keeping at most max_buffers unused buffers around. A pool can be shared
+ * by all streams of one loop thread, it must outlive them.
+ */
+void ustream_buf_pool_init(struct ustream_buf_pool *p, int buffer_len, int max_buffers);
+
+/* ustream_buf_pool_done: free all buffers cached in the pool */
+void ustream_buf_pool_done(struct ustream_buf_pool *p);
+
+/* ustream_buf_pool_alloc: ustream_buf_list alloc callback using l->pool */
+int ustream_buf_pool_alloc(struct ustream *s, struct ustream_buf_list *l);
+
+/*
+ * ustream_set_buf_pool: allocate read and write buffers of a stream from
+ * the pool, call before initializing the stream
+ */
+void ustream_set_buf_pool(struct ustream *s, struct ustream_buf_pool *p);
+
+/*
+ * ustream_set_read_cbuf: keep the read data of a stream in a single ring
+ * buffer of at least size bytes (rounded up to a power of two and the page
+ * size), mapped twice so that ustream_get_read_buf always returns all
+ * pending data in one span without moving it. Call before the stream has
+ * read any data.
+ */
+void ustream_set_read_cbuf(struct ustream *s, int size);
+
 /* ustream_free: free all buffers and data associated with a ustream */
 void ustream_free(struct ustream *s);
 
@@ -151,6 +284,67 @@ void ustream_consume(struct ustream *s, int len);
 int ustream_read(struct ustream *s, char *buf, int buflen);
 /* ustream_write: add data to the write buffer */
 int ustream_write(struct ustream *s, const char *buf, int len, bool more);
+/*
+ * ustream_writev: add data spread over several buffers, handed to the
+ * stream with a single write_iov call when nothing is queued.
+ */
+int ustream_writev(struct ustream *s, const struct iovec *iov, int iovcnt, bool more);
+/*
+ * ustream_write_ext: add caller owned data to the write buffer without
+ * copying it. The data must stay valid until done is called, which
+ * happens exactly once: after the data has been written, or when it is
+ * dropped because of a write error or ustream_free().
+ */
+int ustream_write_ext(struct ustream *s, const char *buf, int len, bool more,
+		      void (*done)(struct ustream *s, void *priv), void *priv);
+
+/*
+ * ustream_forward_init: start forwarding from src to dst. Takes over
+ * notify_read of src and notify_write of dst until ustream_forward_done.
+ * Nothing else may be written to dst in between.
+ */
+void ustream_forward_init(struct ustream_forward *f, struct ustream *src,
+			  struct ustream *dst, int max_pending);
+
+/*
+ * ustream_forward_done: stop forwarding, data still in flight is queued
+ * on dst first. Must be called before either stream is freed.
+ * If dst fails while doing so, pipe_bytes is left at the number of bytes
+ * that could not be delivered.
+ */
+void ustream_forward_done(struct ustream_forward *f);
+
+/*
+ * ustream_forward_set_blocked: block reads of the source while dst cannot
+ * take more data. Kept apart from ustream_set_read_blocked, for use by
+ * stream implementations that move the data themselves.
+ */
+void ustream_forward_set_blocked(struct ustream_forward *f, bool set);
+
+/*
+ * ustream_blob_buf: blob_buf building its message directly in the write
+ * buffer of a stream. Messages that outgrow the free buffer space move to
+ * a private buffer once, which is then queued without another copy.
+ */
+struct ustream_blob_buf {
+	struct blob_buf buf;
+	struct ustream *s;
+	struct ustream_buf *ubuf;
+};
+
+/*
+ * ustream_blob_buf_init: start a message in the write buffer of s.
+ * Nothing else may be written to s until the message is written or
+ * dropped, and control must not return to uloop in between.
+ */
+int ustream_blob_buf_init(struct ustream_blob_buf *ub, struct ustream *s, int id);
+
+/* ustream_blob_buf_write: queue the finished message, returns its length */
+int ustream_blob_buf_write(struct ustream_blob_buf *ub, bool more);
+
+/* ustream_blob_buf_free: drop an unfinished message */
+void ustream_blob_buf_free(struct ustream_blob_buf *ub);
+
 int ustream_printf(struct ustream *s, const char *format, ...)
 	__attribute__ ((format (printf, 2, 3)));
 int ustream_vprintf(struct ustream *s, const char *format, va_list arg)
@@ -180,12 +374,45 @@ static inline int ustream_pending_data(struct ustream *s, bool write)
 static inline bool ustream_read_buf_full(struct ustream *s)
 {
 	struct ustream_buf *buf = s->r.data_tail;
-	return buf && buf->data == buf->head && buf->tail == buf->end &&
-	       s->r.buffers == s->r.max_buffers;
+
+	/* ring buffers (buf->free set) never make room by moving data */
+	return buf && (buf->data == buf->head || buf->free) &&
+	       buf->tail == buf->end && s->r.buffers == s->r.max_buffers;
 }
 
+/*
+ * ustream_set_stats: start collecting I/O statistics of a stream in st,
+ * which are also added to the calling thread's ustream_loop_stats.
+ * st must stay valid until the stream is freed or stats are reset to NULL.
+ */
+void ustream_set_stats(struct ustream *s, struct ustream_stats *st);
+
+/* ustream_loop_stats: aggregate statistics of the streams of this thread */
+struct ustream_stats *ustream_loop_stats(void);
+
+/* ustream_stats_log: add a text summary of st to a udebug buffer */
+void ustream_stats_log(struct udebug_buf *buf, const char *name,
+		       const struct ustream_stats *st);
+
 /*** --- functions only used by ustream implementations --- ***/
 
+/* ustream_stat_add: add val to a statistics counter of a stream */
+#define ustream_stat_add(s, field, val)					\
+	do {								\
+		struct ustream_stats *__st;				\
+		for (__st = (s)->stats; __st; __st = __st->parent)	\
+			__st->field += (val);				\
+	} while (0)
+
+/* ustream_stat_max: update a statistics peak value of a stream */
+#define ustream_stat_max(s, field, val)					\
+	do {								\
+		struct ustream_stats *__st;				\
+		for (__st = (s)->stats; __st; __st = __st->parent)	\
+			if (__st->field < (val))			\
+				__st->field = (val);			\
+	} while (0)
+
 /* ustream_init_defaults: fill default callbacks and options */
 void ustream_init_defaults(struct ustream *s);
 
@@ -197,6 +424,15 @@ void ustream_init_defaults(struct ustream *s);
  */
 char *ustream_reserve(struct ustream *s, int len, int *maxlen);
 
+/*
+ * ustream_reserve_iov: allocate rx buffer space for a scattered read
+ *
+ * Like ustream_reserve, but if less than len bytes are available in the
+ * current buffer, the space of up to n - 1 following buffers is added.
+ * Returns the number of iov entries filled in, 0 if no space is available.
+ */
+int ustream_reserve_iov(struct ustream *s, int len, struct iovec *iov, int n);
+
 /* ustream_fill_read: mark rx buffer space as filled */
 void ustream_fill_read(struct ustream *s, int len);
 
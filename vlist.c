@@ -13,12 +13,15 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <stdlib.h>
+
 #include "vlist.h"
 
 void
 vlist_init(struct vlist_tree *tree, avl_tree_comp cmp, vlist_update_cb update)
 {
 	tree->update = update;
+	tree->equal = NULL;
 	tree->version = 1;
 
 	avl_init(&tree->avl, cmp, 0, tree);
@@ -49,7 +52,8 @@ vlist_add(struct vlist_tree *tree, struct vlist_node *node, const void *key)
 			goto update_only;
 		}
 
-		avl_delete(&tree->avl, anode);
+		avl_replace(&tree->avl, anode, &node->avl);
+		goto update_only;
 	}
 
 	avl_insert(&tree->avl, &node->avl);
@@ -80,3 +84,108 @@ vlist_flush_all(struct vlist_tree *tree)
 }
 
 
+
+static void
+vlist_bulk_replace(struct vlist_tree *tree, struct vlist_node **slot,
+		   struct vlist_node *old_node)
+{
+	struct vlist_node *node = *slot;
+
+	node->version = tree->version;
+
+	if (tree->equal && tree->equal(tree, node, old_node)) {
+		old_node->version = tree->version;
+		return;
+	}
+
+	if (tree->keep_old || tree->no_delete)
+		old_node->version = tree->version;
+	else
+		avl_replace(&tree->avl, &old_node->avl, &node->avl);
+
+	*slot = NULL;
+	tree->update(tree, node, old_node);
+}
+
+static int
+vlist_bulk_build(struct vlist_tree *tree, struct vlist_node **nodes,
+		 size_t n_nodes)
+{
+	struct avl_node **anodes;
+	size_t i;
+
+	anodes = malloc(n_nodes * sizeof(*anodes));
+	if (!anodes)
+		return -1;
+
+	for (i = 0; i < n_nodes; i++) {
+		nodes[i]->version = tree->version;
+		anodes[i] = &nodes[i]->avl;
+	}
+
+	avl_build_from_sorted(&tree->avl, anodes, n_nodes);
+	free(anodes);
+
+	for (i = 0; i < n_nodes; i++) {
+		tree->update(tree, nodes[i], NULL);
+		nodes[i] = NULL;
+	}
+
+	return 0;
+}
+
+int
+vlist_bulk_update(struct vlist_tree *tree, struct vlist_node **nodes,
+		  size_t n_nodes)
+{
+	struct avl_tree *avl = &tree->avl;
+	struct vlist_node *node, *next;
+	size_t i;
+	int ret;
+
+	for (i = 1; i < n_nodes; i++)
+		if (avl->comp(nodes[i - 1]->avl.key, nodes[i]->avl.key,
+			      avl->cmp_ptr) >= 0)
+			return -1;
+
+	vlist_update(tree);
+
+	/* loading an empty tree does not need any merging */
+	if (avl_is_empty(avl) && n_nodes > 1 &&
+	    !vlist_bulk_build(tree, nodes, n_nodes))
+		return 0;
+
+	/* merge the sorted batch against the in-order node list */
+	i = 0;
+	node = avl_is_empty(avl) ? NULL :
+		avl_first_element(avl, node, avl);
+	while (node || i < n_nodes) {
+		next = NULL;
+		if (node && !avl_is_last(avl, &node->avl))
+			next = avl_next_element(node, avl);
+
+		if (!node)
+			ret = 1;
+		else if (i == n_nodes)
+			ret = -1;
+		else
+			ret = avl->comp(node->avl.key, nodes[i]->avl.key,
+					avl->cmp_ptr);
+
+		if (ret < 0) {
+			if (node->version != -1)
+				vlist_delete(tree, node);
+			node = next;
+		} else if (ret > 0) {
+			nodes[i]->version = tree->version;
+			avl_insert(avl, &nodes[i]->avl);
+			tree->update(tree, nodes[i], NULL);
+			nodes[i++] = NULL;
+		} else {
+			vlist_bulk_replace(tree, &nodes[i++], node);
+			node = next;
+		}
+	}
+
+	return 0;
+}
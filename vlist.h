@@ -26,10 +26,15 @@ typedef void (*vlist_update_cb)(struct vlist_tree *tree,
 				struct vlist_node *node_new,
 				struct vlist_node *node_old);
 
+typedef bool (*vlist_equal_cb)(struct vlist_tree *tree,
+			       struct vlist_node *node_new,
+			       struct vlist_node *node_old);
+
 struct vlist_tree {
 	struct avl_tree avl;
 
 	vlist_update_cb update;
+	vlist_equal_cb equal;
 	bool keep_old;
 	bool no_delete;
 
@@ -69,6 +74,24 @@ void vlist_delete(struct vlist_tree *tree, struct vlist_node *node);
 void vlist_flush(struct vlist_tree *tree);
 void vlist_flush_all(struct vlist_tree *tree);
 
+/*
+ * Replace the contents of the tree with a batch of nodes in one pass.
+ *
+ * The keys (nodes[i]->avl.key) must be set by the caller and sorted in
+ * ascending order of the tree comparator, without duplicates; otherwise
+ * -1 is returned and the tree is left untouched.
+ *
+ * Nodes missing from the batch are deleted, new ones are added and
+ * nodes with a matching key replace the old ones. If tree->equal is set
+ * and reports a new node as unchanged, the old node is kept and no
+ * update callback is issued for it.
+ *
+ * Batch entries passed to the update callback are set to NULL, like
+ * with vlist_add. Nodes skipped as unchanged still belong to the caller.
+ */
+int vlist_bulk_update(struct vlist_tree *tree, struct vlist_node **nodes,
+		      size_t n_nodes);
+
 #define vlist_for_each_element(tree, element, node_member) \
 	avl_for_each_element(&(tree)->avl, element, node_member.avl)
 